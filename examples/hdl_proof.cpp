@@ -42,6 +42,15 @@ int main() {
   builder.require(flattening[eq], hdl::BitString::from_bool(false));
   hdl::proof::Cnf cnf = builder.cnf();
   std::cout << "CNF: " << cnf.size() << std::endl;
+  
+  hdl::proof::Solver solver(cnf);
+  if (solver.solve() == hdl::proof::Solver::Result::Sat) {
+    std::cout << "Counterexample: a = " << builder.model(solver, flattening[a]);
+    std::cout << ", b = " << builder.model(solver, flattening[b]) << std::endl;
+  } else {
+    std::cout << "Proven" << std::endl;
+  }
+  
   hdl::proof::Cnf simplified = cnf.simplify();
   std::cout << "Simplified: " << simplified.size() << std::endl;
   simplified.save("proof.cnf");
@@ -22,6 +22,18 @@
 #include <set>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <memory>
+#include <iterator>
+#include <cstddef>
+#include <optional>
+#include <array>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/mman.h>
+  #define HDL_HAS_MMAP
+#endif
 
 #include "hdl_bitstring.hpp"
 
@@ -33,38 +45,108 @@
 
 namespace hdl {
   class Module;
+  class Arena;
+  template <class T> class NodeMap;
   
   struct Value {
+    // Tag identifying the concrete type of a value. Use hdl::isa, hdl::cast
+    // and hdl::dyn_cast instead of dynamic_cast to inspect values.
+    enum class Tag : uint8_t {
+      Input, Reg, Constant, Unknown, Op, Read
+    };
+    
+    const Tag tag;
+  private:
+    // Mark bit of Module::gc, only set while the collector runs
+    bool _marked = false;
+    uint32_t _id = NO_ID;
+    // Arena of the module which created the value. IDs are only unique
+    // within one arena, so NodeMap uses it to reject foreign values.
+    const Arena* _arena = nullptr;
+    friend class Module;
+    friend class Arena;
+    template <class T> friend class NodeMap;
+  public:
+    static constexpr const uint32_t NO_ID = ~uint32_t(0);
+    
     const size_t width = 0;
     
-    Value(size_t _width): width(_width) {}
+    Value(Tag _tag, size_t _width): tag(_tag), width(_width) {}
     virtual ~Value() {}
+    
+    // Dense index of the value within its module. It is assigned when the
+    // module creates the value and reused once the value is destroyed.
+    inline uint32_t id() const { return _id; }
+    
+    static bool classof(const Value* value) { return true; }
   };
   
+  template <class T>
+  inline bool isa(const Value* value) {
+    return value != nullptr && T::classof(value);
+  }
+  
+  // Casts value to T. The value must be an instance of T.
+  template <class T>
+  inline T* cast(Value* value) { return static_cast<T*>(value); }
+  
+  template <class T>
+  inline const T* cast(const Value* value) { return static_cast<const T*>(value); }
+  
+  // Casts value to T or returns nullptr if value is not an instance of T
+  template <class T>
+  inline T* dyn_cast(Value* value) {
+    return isa<T>(value) ? static_cast<T*>(value) : nullptr;
+  }
+  
+  template <class T>
+  inline const T* dyn_cast(const Value* value) {
+    return isa<T>(value) ? static_cast<const T*>(value) : nullptr;
+  }
+  
+  #define def_classof(name) \
+    static constexpr const Value::Tag TAG = Value::Tag::name; \
+    static bool classof(const Value* value) { return value->tag == TAG; }
+  
   struct Input final: public Value {
+    def_classof(Input)
+    
     std::string name;
     
     Input(const std::string& _name, size_t _width):
-      Value(_width), name(_name) {}
+      Value(TAG, _width), name(_name) {}
   };
   
   struct Reg final: public Value {
+    def_classof(Reg)
+    
     BitString initial;
     Value* clock = nullptr;
     Value* next = nullptr;
     std::string name;
     
     Reg(const BitString& _initial, Value* _clock):
-      Value(_initial.width()), initial(_initial), clock(_clock) {}
+      Value(TAG, _initial.width()), initial(_initial), clock(_clock) {}
   };
   
-  struct Comb: public Value { using Value::Value; };
+  struct Comb: public Value {
+    using Value::Value;
+    
+    static bool classof(const Value* value) {
+      return value->tag == Tag::Constant ||
+             value->tag == Tag::Unknown ||
+             value->tag == Tag::Op ||
+             value->tag == Tag::Read;
+    }
+  };
   
   struct Constant final: public Comb {
+    def_classof(Constant)
+    
     const BitString value;
     
     Constant(const BitString& _value):
-      Comb(_value.width()), value(_value) {}
+      Comb(TAG, _value.width()), value(_value) {}
     
     bool hashcons_equal(const Constant& other) const {
       return value == other.value;
@@ -72,10 +154,14 @@ namespace hdl {
   };
   
   struct Unknown final: public Comb {
-    Unknown(size_t _width): Comb(_width) {}
+    def_classof(Unknown)
+    
+    Unknown(size_t _width): Comb(TAG, _width) {}
   };
   
   struct Op final: public Comb {
+    def_classof(Op)
+    
     enum class Kind {
       #define def_op(name, ...) name,
       #include "ops.inc.h"
@@ -87,6 +173,15 @@ namespace hdl {
     
     static constexpr const size_t MAX_ARG_COUNT = 3;
     
+    static size_t arg_count(Kind kind) {
+      switch (kind) {
+      #define def_op(name, arg_count, ...) case Kind::name: return arg_count;
+      #include "ops.inc.h"
+      #undef def_op
+      }
+      return 0;
+    }
+    
     static bool is_commutative(Kind kind) {
       return kind == Kind::And ||
              kind == Kind::Or ||
@@ -103,19 +198,40 @@ namespace hdl {
              kind == Kind::Concat;
     }
     
-    const Kind kind;
-    const std::vector<Value*> args;
-    
-  private:
-    static size_t arg_count(Kind kind) {
-      switch (kind) {
-      #define def_op(name, arg_count, ...) case Kind::name: return arg_count;
-      #include "ops.inc.h"
-      #undef def_op
+    // Fixed size inline storage for the arguments of an operator
+    class Args {
+    private:
+      Value* _args[MAX_ARG_COUNT] = {nullptr};
+      size_t _size = 0;
+    public:
+      Args(const std::vector<Value*>& args): _size(args.size()) {
+        if (_size > MAX_ARG_COUNT) {
+          throw_error(Error, "Operators may have at most " << MAX_ARG_COUNT << " arguments, but got " << _size);
+        }
+        std::copy(args.begin(), args.end(), _args);
       }
-      return 0;
-    }
+      
+      inline size_t size() const { return _size; }
+      inline Value* operator[](size_t index) const { return _args[index]; }
+      
+      inline Value* const* begin() const { return _args; }
+      inline Value* const* end() const { return _args + _size; }
+      inline std::reverse_iterator<Value* const*> rbegin() const { return std::reverse_iterator<Value* const*>(end()); }
+      inline std::reverse_iterator<Value* const*> rend() const { return std::reverse_iterator<Value* const*>(begin()); }
+      
+      bool operator==(const Args& other) const {
+        return _size == other._size && std::equal(begin(), end(), other.begin());
+      }
+      
+      inline bool operator!=(const Args& other) const {
+        return !(*this == other);
+      }
+    };
     
+    const Kind kind;
+    const Args args;
+  
+  private:
     static void expect_arg_count(Kind& kind, const std::vector<Value*>& args) {
       size_t expected = arg_count(kind);
       if (args.size() != expected) {
@@ -138,7 +254,7 @@ namespace hdl {
     }
     
     static const BitString& expect_constant(Kind& kind, const std::vector<Value*>& args, size_t index) {
-      if (Constant* constant = dynamic_cast<Constant*>(args[index])) {
+      if (Constant* constant = dyn_cast<Constant>(args[index])) {
         return constant->value;
       } else {
         throw_error(Error,
@@ -200,7 +316,7 @@ namespace hdl {
   public:
     
     Op(Kind _kind, const std::vector<Value*>& _args):
-      Comb(infer_width(_kind, _args)), kind(_kind), args(_args) {}
+      Comb(TAG, infer_width(_kind, _args)), kind(_kind), args(_args) {}
     
     bool hashcons_equal(const Op& other) const {
       return kind == other.kind && args == other.args;
@@ -277,17 +393,270 @@ struct std::hash<hdl::Constant> {
 template <>
 struct std::hash<hdl::Op> {
   std::size_t operator()(const hdl::Op& op) const {
-    size_t hash = std::hash<size_t>()((size_t)op.kind);
-    size_t offset = 3;
+    uint64_t hash = hdl::hash_mix(uint64_t(op.kind));
     for (const hdl::Value* arg : op.args) {
-      hash ^= std::hash<const hdl::Value*>()(arg) << offset;
-      offset++;
+      hash = hdl::hash_combine(hash, uint64_t(uintptr_t(arg)));
     }
-    return hash;
+    return size_t(hash);
   }
 };
 
 namespace hdl {
+  // Allocator for the nodes of a module. Nodes are bump allocated from large
+  // slabs, freed nodes are kept in per size class free lists for reuse.
+  class Arena {
+  private:
+    static constexpr const size_t SLAB_SIZE = 64 * 1024;
+    static constexpr const size_t ALIGNMENT = alignof(std::max_align_t);
+    static constexpr const size_t SIZE_CLASS_COUNT = 16;
+    
+    struct FreeBlock {
+      FreeBlock* next = nullptr;
+    };
+    
+    std::vector<char*> _slabs;
+    char* _head = nullptr;
+    char* _end = nullptr;
+    FreeBlock* _free_lists[SIZE_CLASS_COUNT] = {nullptr};
+    
+    uint32_t _id_count = 0;
+    std::vector<uint32_t> _free_ids;
+    // Incremented whenever an id is freed, after which it may be reused
+    uint64_t _generation = 0;
+    
+    uint32_t alloc_id() {
+      if (!_free_ids.empty()) {
+        uint32_t id = _free_ids.back();
+        _free_ids.pop_back();
+        return id;
+      }
+      if (_id_count == Value::NO_ID) {
+        throw_error(Error, "Too many values in module");
+      }
+      return _id_count++;
+    }
+    
+    static size_t size_class(size_t size) {
+      return size == 0 ? 0 : (size + ALIGNMENT - 1) / ALIGNMENT - 1;
+    }
+  public:
+    Arena() {}
+    
+    Arena(const Arena& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+    
+    ~Arena() {
+      for (char* slab : _slabs) {
+        ::operator delete(slab);
+      }
+    }
+    
+    size_t slab_count() const { return _slabs.size(); }
+    // Upper bound on the ids of all values created by the arena
+    size_t id_count() const { return _id_count; }
+    uint64_t generation() const { return _generation; }
+    
+    void* alloc(size_t size) {
+      size_t size_class = Arena::size_class(size);
+      if (size_class >= SIZE_CLASS_COUNT) {
+        return ::operator new(size);
+      }
+      
+      if (FreeBlock* block = _free_lists[size_class]) {
+        _free_lists[size_class] = block->next;
+        return block;
+      }
+      
+      size_t bytes = (size_class + 1) * ALIGNMENT;
+      if (size_t(_end - _head) < bytes) {
+        _head = (char*) ::operator new(SLAB_SIZE);
+        _end = _head + SLAB_SIZE;
+        _slabs.push_back(_head);
+      }
+      
+      void* ptr = _head;
+      _head += bytes;
+      return ptr;
+    }
+    
+    void free(void* ptr, size_t size) {
+      size_t size_class = Arena::size_class(size);
+      if (size_class >= SIZE_CLASS_COUNT) {
+        ::operator delete(ptr);
+        return;
+      }
+      
+      FreeBlock* block = new (ptr) FreeBlock();
+      block->next = _free_lists[size_class];
+      _free_lists[size_class] = block;
+    }
+    
+    template <class T, class... Args>
+    T* create(Args&&... args) {
+      constexpr bool IS_VALUE = std::is_base_of<Value, T>::value;
+      uint32_t id = IS_VALUE ? alloc_id() : Value::NO_ID;
+      
+      void* ptr = alloc(sizeof(T));
+      T* node = nullptr;
+      try {
+        node = new (ptr) T(std::forward<Args>(args)...);
+      } catch (...) {
+        free(ptr, sizeof(T));
+        if (IS_VALUE) {
+          _free_ids.push_back(id);
+        }
+        throw;
+      }
+      if constexpr (IS_VALUE) {
+        node->_id = id;
+        node->_arena = this;
+      }
+      return node;
+    }
+    
+    // T must be the dynamic type of value
+    template <class T>
+    void destroy(T* value) {
+      if (value != nullptr) {
+        if constexpr (std::is_base_of<Value, T>::value) {
+          _free_ids.push_back(value->_id);
+          _generation++;
+        }
+        value->~T();
+        free(value, sizeof(T));
+      }
+    }
+  };
+  
+  struct Memory;
+  
+  // Index from each value to its users. It is owned by a Module and only
+  // maintained while enabled using Module::enable_fanouts.
+  class Fanouts {
+  public:
+    struct Use {
+      // Op, Memory::Read or Reg using the value or nullptr for write ports
+      Value* user = nullptr;
+      // Memory and index of the write port using the value
+      Memory* memory = nullptr;
+      size_t write = 0;
+      
+      Use(Value* _user): user(_user) {}
+      Use(Memory* _memory, size_t _write): memory(_memory), write(_write) {}
+      
+      bool operator==(const Use& other) const {
+        return user == other.user &&
+               memory == other.memory &&
+               write == other.write;
+      }
+      
+      bool operator!=(const Use& other) const { return !(*this == other); }
+    };
+  private:
+    // Operands of registers and write ports at the time they were attached.
+    // They are public fields, so they may have been changed since.
+    struct Operands {
+      std::array<Value*, 4> values = {nullptr, nullptr, nullptr, nullptr};
+      bool is_attached = false;
+    };
+    
+    std::vector<std::vector<Use>> _uses;
+    std::vector<Operands> _reg_operands;
+    std::unordered_map<const Memory*, std::vector<Operands>> _write_operands;
+    
+    void add(Value* value, const Use& use) {
+      if (value->id() >= _uses.size()) {
+        _uses.resize(value->id() + 1);
+      }
+      _uses[value->id()].push_back(use);
+    }
+    
+    void remove(Value* value, const Use& use) {
+      std::vector<Use>& uses = _uses[value->id()];
+      for (size_t it = 0; it < uses.size(); it++) {
+        if (uses[it] == use) {
+          uses[it] = uses.back();
+          uses.pop_back();
+          return;
+        }
+      }
+    }
+    
+    template <class F>
+    static void for_each_distinct(Value* const* operands, size_t count, const F& f) {
+      for (size_t it = 0; it < count; it++) {
+        bool is_distinct = true;
+        for (size_t prev = 0; prev < it; prev++) {
+          is_distinct = is_distinct && operands[prev] != operands[it];
+        }
+        if (is_distinct) {
+          f(operands[it]);
+        }
+      }
+    }
+    
+    Operands& reg_operands(const Value* reg) {
+      if (reg->id() >= _reg_operands.size()) {
+        _reg_operands.resize(reg->id() + 1);
+      }
+      return _reg_operands[reg->id()];
+    }
+    
+    Operands& write_operands(const Memory* memory, size_t write) {
+      std::vector<Operands>& operands = _write_operands[memory];
+      if (write >= operands.size()) {
+        operands.resize(write + 1);
+      }
+      return operands[write];
+    }
+    
+    static Operands current(const Reg* reg);
+    static Operands current(const Memory* memory, size_t write);
+    
+    // Calls f once for every distinct operand of user
+    template <class F>
+    static void for_each_operand(Value* user, const F& f);
+  public:
+    Fanouts() {}
+    
+    const std::vector<Use>& users(const Value* value) const {
+      static const std::vector<Use> EMPTY;
+      if (value->id() < _uses.size()) {
+        return _uses[value->id()];
+      }
+      return EMPTY;
+    }
+    
+    size_t user_count(const Value* value) const {
+      return users(value).size();
+    }
+    
+    // Adds or removes the uses of all operands of user. Registers and write
+    // ports are detached using the operands they were attached with.
+    void attach(Value* user);
+    void detach(Value* user);
+    void attach(Memory* memory, size_t write);
+    void detach(Memory* memory, size_t write);
+    
+    // Reattaches the registers and write ports of memory whose operands
+    // were changed without updating the index
+    void sync(Reg* reg) {
+      if (!reg_operands(reg).is_attached ||
+          reg_operands(reg).values != current(reg).values) {
+        detach(reg);
+        attach(reg);
+      }
+    }
+    
+    void sync(Memory* memory);
+    
+    void clear() {
+      _uses.clear();
+      _reg_operands.clear();
+      _write_operands.clear();
+    }
+  };
+  
   struct Memory {
     struct Write {
       Value* clock = nullptr;
@@ -300,13 +669,21 @@ namespace hdl {
     };
     
     struct Read final: public Comb {
+      def_classof(Read)
+      
       Memory* memory = nullptr;
       Value* address = nullptr;
       
       Read(Memory* _memory, Value* _address):
-        Comb(_memory->width), memory(_memory), address(_address) {}
+        Comb(TAG, _memory->width), memory(_memory), address(_address) {}
     };
-    
+  
+  private:
+    Arena& _arena;
+    bool _marked = false;
+    Fanouts* _fanouts = nullptr;
+    friend class Module;
+  public:
     const size_t width = 0;
     const size_t size = 0;
     std::unordered_map<uint64_t, BitString> initial;
@@ -314,15 +691,15 @@ namespace hdl {
     std::unordered_map<Value*, Read*> reads;
     std::string name;
     
-    Memory(size_t _width, size_t _size):
-      width(_width), size(_size) {}
+    Memory(Arena& arena, size_t _width, size_t _size):
+      _arena(arena), width(_width), size(_size) {}
     
     Memory(const Memory& other) = delete;
     Memory& operator=(const Memory& other) = delete;
     
     ~Memory() {
       for (const auto& [address, read] : reads) {
-        delete read;
+        _arena.destroy(read);
       }
     }
     
@@ -345,20 +722,26 @@ namespace hdl {
           " but got value of width " << enable->width
         );
       }
-      if (Constant* constant = dynamic_cast<Constant*>(enable)) {
+      if (Constant* constant = dyn_cast<Constant>(enable)) {
         if (constant->value.is_zero()) {
           return;
         }
       }
       writes.emplace_back(clock, address, enable, value);
+      if (_fanouts != nullptr) {
+        _fanouts->attach(this, writes.size() - 1);
+      }
     }
     
     Read* read(Value* address) {
       if (reads.find(address) != reads.end()) {
         return reads.at(address);
       }
-      Read* read = new Read(this, address);
+      Read* read = _arena.create<Read>(this, address);
       reads[address] = read;
+      if (_fanouts != nullptr) {
+        _fanouts->attach(read);
+      }
       return read;
     }
     
@@ -402,6 +785,89 @@ namespace hdl {
     }
   };
   
+  Fanouts::Operands Fanouts::current(const Reg* reg) {
+    Operands operands;
+    operands.values = {reg->clock, reg->next, nullptr, nullptr};
+    operands.is_attached = true;
+    return operands;
+  }
+  
+  Fanouts::Operands Fanouts::current(const Memory* memory, size_t write) {
+    const Memory::Write& port = memory->writes[write];
+    Operands operands;
+    operands.values = {port.clock, port.address, port.enable, port.value};
+    operands.is_attached = true;
+    return operands;
+  }
+  
+  template <class F>
+  void Fanouts::for_each_operand(Value* user, const F& f) {
+    if (Op* op = dyn_cast<Op>(user)) {
+      for_each_distinct(op->args.begin(), op->args.size(), f);
+    } else if (Memory::Read* read = dyn_cast<Memory::Read>(user)) {
+      f(read->address);
+    }
+  }
+  
+  void Fanouts::attach(Value* user) {
+    if (Reg* reg = dyn_cast<Reg>(user)) {
+      Operands& operands = reg_operands(reg);
+      operands = current(reg);
+      for_each_distinct(operands.values.data(), 2, [&](Value* operand){
+        add(operand, Use(user));
+      });
+    } else {
+      for_each_operand(user, [&](Value* operand){ add(operand, Use(user)); });
+    }
+  }
+  
+  void Fanouts::detach(Value* user) {
+    if (isa<Reg>(user)) {
+      Operands& operands = reg_operands(user);
+      if (operands.is_attached) {
+        for_each_distinct(operands.values.data(), 2, [&](Value* operand){
+          remove(operand, Use(user));
+        });
+        operands.is_attached = false;
+      }
+    } else {
+      for_each_operand(user, [&](Value* operand){ remove(operand, Use(user)); });
+    }
+  }
+  
+  void Fanouts::attach(Memory* memory, size_t write) {
+    Operands& operands = write_operands(memory, write);
+    operands = current(memory, write);
+    for_each_distinct(operands.values.data(), 4, [&](Value* operand){
+      add(operand, Use(memory, write));
+    });
+  }
+  
+  void Fanouts::detach(Memory* memory, size_t write) {
+    Operands& operands = write_operands(memory, write);
+    if (operands.is_attached) {
+      for_each_distinct(operands.values.data(), 4, [&](Value* operand){
+        remove(operand, Use(memory, write));
+      });
+      operands.is_attached = false;
+    }
+  }
+  
+  void Fanouts::sync(Memory* memory) {
+    std::vector<Operands>& operands = _write_operands[memory];
+    for (size_t it = memory->writes.size(); it < operands.size(); it++) {
+      detach(memory, it);
+    }
+    operands.resize(memory->writes.size());
+    for (size_t it = 0; it < memory->writes.size(); it++) {
+      if (!operands[it].is_attached ||
+          operands[it].values != current(memory, it).values) {
+        detach(memory, it);
+        attach(memory, it);
+      }
+    }
+  }
+  
   struct Output {
     std::string name;
     Value* value = nullptr;
@@ -410,91 +876,471 @@ namespace hdl {
       name(_name), value(_value) {}
   };
   
+  // Side table which maps the values of a single module to T. Entries are
+  // stored in a vector indexed by Value::id, so lookups do not hash.
+  // Ids of values removed by Module::gc are reused, so a NodeMap created
+  // for a module may not be used after values of the module were removed.
+  // Such lookups throw an error, as do lookups of values of other modules.
+  // A default constructed NodeMap is bound to the module of the first
+  // value inserted into it.
+  template <class T>
+  class NodeMap {
+  private:
+    std::vector<std::optional<T>> _entries;
+    size_t _size = 0;
+    const Arena* _arena = nullptr;
+    uint64_t _generation = 0;
+    
+    size_t index(const Value* value) const {
+      if (value->id() == Value::NO_ID) {
+        throw_error(Error, "Value does not belong to a module");
+      }
+      if (_arena != nullptr) {
+        if (value->_arena != _arena) {
+          throw_error(Error, "Value does not belong to the module of the NodeMap");
+        }
+        if (_arena->generation() != _generation) {
+          throw_error(Error, "NodeMap was invalidated by removing values from its module");
+        }
+      }
+      return value->id();
+    }
+    
+    // Unbound maps are empty, so they may be bound on the first insertion
+    size_t bind(const Value* value) {
+      if (_arena == nullptr && value->_arena != nullptr) {
+        _arena = value->_arena;
+        _generation = _arena->generation();
+      }
+      return index(value);
+    }
+  public:
+    NodeMap() {}
+    NodeMap(const Module& module);
+    
+    inline size_t size() const { return _size; }
+    inline bool empty() const { return _size == 0; }
+    
+    bool has(const Value* value) const {
+      size_t id = index(value);
+      return id < _entries.size() && _entries[id].has_value();
+    }
+    
+    T* find(const Value* value) {
+      size_t id = index(value);
+      if (id < _entries.size() && _entries[id].has_value()) {
+        return &*_entries[id];
+      }
+      return nullptr;
+    }
+    
+    const T* find(const Value* value) const {
+      return const_cast<NodeMap<T>*>(this)->find(value);
+    }
+    
+    T& at(const Value* value) {
+      if (T* entry = find(value)) {
+        return *entry;
+      }
+      throw_error(Error, "Value is not in NodeMap");
+    }
+    
+    const T& at(const Value* value) const {
+      return const_cast<NodeMap<T>*>(this)->at(value);
+    }
+    
+    // Inserts a default constructed entry if value has none
+    T& operator[](const Value* value) {
+      size_t id = bind(value);
+      if (id >= _entries.size()) {
+        _entries.resize(id + 1);
+      }
+      if (!_entries[id].has_value()) {
+        _entries[id].emplace();
+        _size++;
+      }
+      return *_entries[id];
+    }
+    
+    // Returns false if value already has an entry
+    bool insert(const Value* value, const T& entry) {
+      size_t id = bind(value);
+      if (id >= _entries.size()) {
+        _entries.resize(id + 1);
+      }
+      if (_entries[id].has_value()) {
+        return false;
+      }
+      _entries[id].emplace(entry);
+      _size++;
+      return true;
+    }
+    
+    void erase(const Value* value) {
+      size_t id = index(value);
+      if (id < _entries.size() && _entries[id].has_value()) {
+        _entries[id].reset();
+        _size--;
+      }
+    }
+    
+    void clear() {
+      _entries.clear();
+      _size = 0;
+      if (_arena != nullptr) {
+        _generation = _arena->generation();
+      }
+    }
+  };
+  
+  // Extension point for project specific simplifications. Module::op calls
+  // rewrite for every operator which is not yet part of the module, after
+  // the built-in simplifications were applied.
+  class Rewriter {
+  public:
+    virtual ~Rewriter() {}
+    
+    // Returns an equivalent value of the same width or nullptr to keep the
+    // operator. May create values using module.op, which are rewritten
+    // recursively, so rewrites must terminate.
+    virtual Value* rewrite(Module& module, Op::Kind kind, const std::vector<Value*>& args) const = 0;
+  };
+  
   class Module {
   private:
+    // Open addressing hash table with linear probing. The hash of each
+    // node is cached next to it, so probing rarely touches the nodes and
+    // growing the table never rehashes them.
     template <class T>
     class Hashcons {
     private:
-      struct Cell {
+      static constexpr const size_t MIN_CAPACITY = 64;
+      
+      struct Slot {
         T* node = nullptr;
-        
-        Cell(T* _node): node(_node) {}
-        
-        bool operator==(const Cell& other) const {
-          return node->hashcons_equal(*other.node);
-        }
+        size_t hash = 0;
       };
       
-      struct CellHasher {
-        size_t operator()(const Cell& cell) const {
-          return std::hash<T>()(*cell.node);
+      Arena* _arena = nullptr;
+      Slot* _slots = nullptr;
+      size_t _capacity = 0;
+      size_t _size = 0;
+      
+      static inline size_t hash(const T& node) {
+        return std::hash<T>()(node);
+      }
+      
+      // Returns the slot containing an equal node or the empty slot
+      // at which the node should be inserted
+      Slot* probe(const T& node, size_t hash) const {
+        size_t mask = _capacity - 1;
+        for (size_t index = hash & mask; ; index = (index + 1) & mask) {
+          Slot* slot = &_slots[index];
+          if (slot->node == nullptr ||
+              (slot->hash == hash && slot->node->hashcons_equal(node))) {
+            return slot;
+          }
         }
-      };
+      }
       
-      std::unordered_set<Cell, CellHasher> _nodes;
+      void insert(T* node, size_t hash) {
+        size_t mask = _capacity - 1;
+        size_t index = hash & mask;
+        while (_slots[index].node != nullptr) {
+          index = (index + 1) & mask;
+        }
+        _slots[index].node = node;
+        _slots[index].hash = hash;
+      }
+      
+      void rehash(size_t capacity) {
+        Slot* slots = _slots;
+        size_t old_capacity = _capacity;
+        _slots = new Slot[capacity]();
+        _capacity = capacity;
+        for (size_t it = 0; it < old_capacity; it++) {
+          if (slots[it].node != nullptr) {
+            insert(slots[it].node, slots[it].hash);
+          }
+        }
+        delete[] slots;
+      }
     public:
-      Hashcons() {}
+      Hashcons(Arena* arena): _arena(arena) {}
       
       Hashcons(const Hashcons<T>& other) = delete;
       Hashcons& operator=(const Hashcons<T>& other) = delete;
       
       Hashcons(Hashcons<T>&& other):
-        _nodes(std::move(other._nodes)) {}
+          _arena(other._arena),
+          _slots(other._slots),
+          _capacity(other._capacity),
+          _size(other._size) {
+        other._slots = nullptr;
+        other._capacity = 0;
+        other._size = 0;
+      }
       
       ~Hashcons() {
-        for (const Cell& cell : _nodes) {
-          delete cell.node;
+        for (size_t it = 0; it < _capacity; it++) {
+          if (_slots[it].node != nullptr) {
+            _arena->destroy(_slots[it].node);
+          }
+        }
+        delete[] _slots;
+      }
+      
+      inline size_t size() const { return _size; }
+      
+      // Returns the unique node equal to node and sets is_new if it was
+      // inserted by this call
+      T* get(const T& node, bool& is_new) {
+        // Keep the load factor below 3/4
+        if ((_size + 1) * 4 > _capacity * 3) {
+          rehash(std::max(_capacity * 2, MIN_CAPACITY));
         }
+        
+        size_t node_hash = hash(node);
+        Slot* slot = probe(node, node_hash);
+        is_new = slot->node == nullptr;
+        if (is_new) {
+          slot->node = _arena->create<T>(node);
+          slot->hash = node_hash;
+          _size++;
+        }
+        return slot->node;
       }
       
       T* operator[](const T& node) {
-        Cell cell((T*)&node);
-        if (_nodes.find(cell) == _nodes.end()) {
-          Cell cell(new T(node));
-          _nodes.insert(cell);
-          return cell.node;
-        } else {
-          return _nodes.find(cell)->node;
+        bool is_new = false;
+        return get(node, is_new);
+      }
+      
+      // Returns the unique node equal to node or nullptr if there is none
+      T* find(const T& node) const {
+        if (_capacity == 0) {
+          return nullptr;
         }
+        return probe(node, hash(node))->node;
       }
       
-      void gc(std::set<void*> reached) {
-        std::unordered_set<Cell, CellHasher> nodes;
-        for (const Cell& cell : _nodes) {
-          if (reached.find(cell.node) == reached.end()) {
-            delete cell.node;
-          } else {
-            nodes.insert(cell);
+      template <class F>
+      void for_each(const F& f) const {
+        for (size_t it = 0; it < _capacity; it++) {
+          if (_slots[it].node != nullptr) {
+            f(_slots[it].node);
           }
         }
-        _nodes = nodes;
       }
-    };
-    
-    std::string _name;
-    Hashcons<Constant> _constants;
-    Hashcons<Op> _ops;
-    std::vector<Reg*> _regs;
-    std::vector<Memory*> _memories;
-    std::vector<Input*> _inputs;
-    std::vector<Output> _outputs;
-    std::vector<Unknown*> _unknowns;
+      
+      // Removes the slot at index while keeping all probe sequences intact
+      // by moving later entries of the cluster backwards. Entries are only
+      // moved towards index.
+      void erase(size_t index) {
+        size_t mask = _capacity - 1;
+        size_t hole = index;
+        for (size_t it = (hole + 1) & mask; _slots[it].node != nullptr; it = (it + 1) & mask) {
+          size_t home = _slots[it].hash & mask;
+          bool is_in_place = hole <= it ? (hole < home && home <= it)
+                                        : (hole < home || home <= it);
+          if (!is_in_place) {
+            _slots[hole] = _slots[it];
+            hole = it;
+          }
+        }
+        _slots[hole] = Slot();
+      }
+      
+      // Destroys all unmarked nodes and clears the marks of all others
+      void sweep() {
+        if (_size == 0) {
+          return;
+        }
+        
+        // Start at an empty slot, so no cluster wraps around the start
+        // and erasing never moves entries into slots which were already
+        // visited.
+        size_t mask = _capacity - 1;
+        size_t start = 0;
+        while (_slots[start].node != nullptr) {
+          start++;
+        }
+        
+        for (size_t it = 0; it < _capacity; ) {
+          size_t index = (start + it) & mask;
+          T* node = _slots[index].node;
+          if (node != nullptr && !node->_marked) {
+            _arena->destroy(node);
+            erase(index);
+            _size--;
+          } else {
+            if (node != nullptr) {
+              node->_marked = false;
+            }
+            it++;
+          }
+        }
+      }
+    };
+    
+    std::string _name;
+    // Owns all nodes of the module, so it must be destroyed last
+    std::unique_ptr<Arena> _arena;
+    Hashcons<Constant> _constants;
+    Hashcons<Op> _ops;
+    std::vector<Reg*> _regs;
+    std::vector<Memory*> _memories;
+    std::vector<Input*> _inputs;
+    std::vector<Output> _outputs;
+    std::vector<Unknown*> _unknowns;
+    // Work list of gc, kept to avoid allocating on every collection
+    std::vector<Value*> _gc_stack;
+    // Heap allocated, so memories can keep pointers to it when moving
+    std::unique_ptr<Fanouts> _fanouts;
+    // Not owned by the module
+    const Rewriter* _rewriter = nullptr;
+    
+    // Cache of topo_order and levels. It is valid as long as the roots
+    // (outputs, registers and memory writes) stay the same.
+    bool _is_topo_valid = false;
+    std::vector<const void*> _topo_roots;
+    std::vector<Value*> _topo_order;
+    NodeMap<size_t> _levels;
+    
+    void collect_roots(std::vector<const void*>& roots) const {
+      for (const Output& output : _outputs) {
+        roots.push_back(output.value);
+      }
+      for (const Reg* reg : _regs) {
+        roots.push_back(reg);
+        roots.push_back(reg->clock);
+        roots.push_back(reg->next);
+      }
+      for (const Memory* memory : _memories) {
+        roots.push_back(memory);
+        for (const Memory::Write& write : memory->writes) {
+          roots.push_back(write.clock);
+          roots.push_back(write.address);
+          roots.push_back(write.enable);
+          roots.push_back(write.value);
+        }
+      }
+    }
+    
+    void build_topo_order() {
+      _topo_order.clear();
+      _levels.clear();
+      
+      // Values are pushed once unexpanded and once expanded after their
+      // arguments were pushed. Registers are sources, their next values
+      // are roots.
+      std::vector<std::pair<Value*, bool>> stack;
+      auto visit = [&](Value* root){
+        stack.emplace_back(root, false);
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          stack.pop_back();
+          
+          if (is_expanded) {
+            size_t level = 0;
+            if (Op* op = dyn_cast<Op>(value)) {
+              for (Value* arg : op->args) {
+                level = std::max(level, _levels.at(arg) + 1);
+              }
+            } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+              level = _levels.at(read->address) + 1;
+            }
+            _levels[value] = level;
+            _topo_order.push_back(value);
+          } else if (!_levels.has(value) && !value->_marked) {
+            value->_marked = true;
+            stack.emplace_back(value, true);
+            if (Op* op = dyn_cast<Op>(value)) {
+              for (size_t it = op->args.size(); it-- > 0; ) {
+                stack.emplace_back(op->args[it], false);
+              }
+            } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+              stack.emplace_back(read->address, false);
+            }
+          }
+        }
+      };
+      
+      for (const Output& output : _outputs) {
+        visit(output.value);
+      }
+      for (Reg* reg : _regs) {
+        visit(reg);
+        visit(reg->clock);
+        visit(reg->next);
+      }
+      for (Memory* memory : _memories) {
+        for (const Memory::Write& write : memory->writes) {
+          visit(write.clock);
+          visit(write.address);
+          visit(write.enable);
+          visit(write.value);
+        }
+      }
+      
+      for (Value* value : _topo_order) {
+        value->_marked = false;
+      }
+    }
+    
+    void build_fanouts() {
+      _fanouts->clear();
+      _ops.for_each([&](Op* op){ _fanouts->attach(op); });
+      for (Reg* reg : _regs) {
+        _fanouts->attach(reg);
+      }
+      for (Memory* memory : _memories) {
+        for (const auto& [address, read] : memory->reads) {
+          _fanouts->attach(read);
+        }
+        for (size_t it = 0; it < memory->writes.size(); it++) {
+          _fanouts->attach(memory, it);
+        }
+      }
+    }
   public:
-    Module(const std::string& name): _name(name) {}
+    Module(const std::string& name):
+      _name(name),
+      _arena(new Arena()),
+      _constants(_arena.get()),
+      _ops(_arena.get()) {}
     
     Module(const Module& other) = delete;
     Module& operator=(const Module& other) = delete;
     
     Module(Module&& other):
       _name(std::move(other._name)),
+      _arena(std::move(other._arena)),
       _constants(std::move(other._constants)),
       _ops(std::move(other._ops)),
       _regs(std::move(other._regs)),
       _memories(std::move(other._memories)),
       _inputs(std::move(other._inputs)),
-      _outputs(std::move(other._outputs)) {}
+      _outputs(std::move(other._outputs)),
+      _unknowns(std::move(other._unknowns)),
+      _fanouts(std::move(other._fanouts)),
+      _rewriter(other._rewriter),
+      _is_topo_valid(other._is_topo_valid),
+      _topo_roots(std::move(other._topo_roots)),
+      _topo_order(std::move(other._topo_order)),
+      _levels(std::move(other._levels)) {}
+    
+    ~Module() {
+      for (Memory* memory : _memories) { _arena->destroy(memory); }
+      for (Reg* reg : _regs) { _arena->destroy(reg); }
+      for (Input* input : _inputs) { _arena->destroy(input); }
+      for (Unknown* unknown : _unknowns) { _arena->destroy(unknown); }
+    }
     
     inline const std::string& name() const { return _name; }
+    inline const Arena& arena() const { return *_arena; }
+    // Upper bound on the ids of all values in the module
+    inline size_t id_count() const { return _arena->id_count(); }
     inline const std::vector<Reg*> regs() const { return _regs; }
     inline const std::vector<Memory*> memories() const { return _memories; }
     inline const std::vector<Input*> inputs() const { return _inputs; }
@@ -528,7 +1374,7 @@ namespace hdl {
         throw_error(Error, "Unable to find \"" << name << "\"");
       }
     }
-    
+  
   public:
     Reg* try_find_reg(const std::string& name) const { return try_find(_regs, name); }
     Input* try_find_input(const std::string& name) const { return try_find(_inputs, name); }
@@ -539,7 +1385,7 @@ namespace hdl {
     Memory* find_memory(const std::string& name) const { return find(_memories, name); }
     
     Input* input(const std::string& name, size_t width) {
-      Input* input = new Input(name, width);
+      Input* input = _arena->create<Input>(name, width);
       _inputs.push_back(input);
       return input;
     }
@@ -549,22 +1395,26 @@ namespace hdl {
     }
     
     Reg* reg(const BitString& initial, Value* clock) {
-      Reg* reg = new Reg(initial, clock);
+      Reg* reg = _arena->create<Reg>(initial, clock);
       reg->next = reg;
       _regs.push_back(reg);
+      if (_fanouts) {
+        _fanouts->attach(reg);
+      }
       return reg;
     }
     
     Memory* memory(size_t width, size_t size) {
-      Memory* memory = new Memory(width, size);
+      Memory* memory = _arena->create<Memory>(*_arena, width, size);
+      memory->_fanouts = _fanouts.get();
       _memories.push_back(memory);
       return memory;
     }
     
     Value* op(Op::Kind kind, std::vector<Value*> args) {
       if (Op::is_commutative(kind)) {
-        bool lhs_const = dynamic_cast<Constant*>(args[0]) != nullptr;
-        bool rhs_const = dynamic_cast<Constant*>(args[1]) != nullptr;
+        bool lhs_const = dyn_cast<Constant>(args[0]) != nullptr;
+        bool rhs_const = dyn_cast<Constant>(args[1]) != nullptr;
         if (lhs_const == rhs_const) {
           if (args[0] > args[1]) {
             std::swap(args[0], args[1]);
@@ -575,10 +1425,10 @@ namespace hdl {
       }
       
       if (Op::is_associative(kind) && args.size() == 2) {
-        Constant* lhs_const = dynamic_cast<Constant*>(args[0]);
-        Op* rhs_op = dynamic_cast<Op*>(args[1]);
+        Constant* lhs_const = dyn_cast<Constant>(args[0]);
+        Op* rhs_op = dyn_cast<Op>(args[1]);
         if (lhs_const && rhs_op && rhs_op->kind == kind) {
-          Constant* rhs_lhs_const = dynamic_cast<Constant*>(rhs_op->args[0]);
+          Constant* rhs_lhs_const = dyn_cast<Constant>(rhs_op->args[0]);
           
           if (rhs_lhs_const) {
             const BitString* arg_values[] = {
@@ -599,7 +1449,7 @@ namespace hdl {
       Op op(kind, args);
       bool is_constant = true;
       for (const Value* arg : args) {
-        if (!dynamic_cast<const Constant*>(arg)) {
+        if (!dyn_cast<Constant>(arg)) {
           is_constant = false;
           break;
         }
@@ -608,7 +1458,7 @@ namespace hdl {
       if (is_constant) {
         const BitString* arg_values[Op::MAX_ARG_COUNT] = {nullptr};
         for (size_t it = 0; it < args.size(); it++) {
-          arg_values[it] = &dynamic_cast<const Constant*>(args[it])->value;
+          arg_values[it] = &dyn_cast<Constant>(args[it])->value;
         }
         return constant(op.eval(arg_values));
       } else {
@@ -618,7 +1468,7 @@ namespace hdl {
           case Op::Kind::And:
             if (args[0] == args[1]) {
               return args[0];
-            } else if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            } else if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return constant;
               } else if (constant->value.is_all_ones()) {
@@ -629,7 +1479,7 @@ namespace hdl {
           case Op::Kind::Or:
             if (args[0] == args[1]) {
               return args[0];
-            } else if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            } else if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[1];
               } else if (constant->value.is_all_ones()) {
@@ -640,7 +1490,7 @@ namespace hdl {
           case Op::Kind::Xor:
             if (args[0] == args[1]) {
               return constant(BitString(args[0]->width));
-            } else if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            } else if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[1];
               } else if (constant->value.is_all_ones()) {
@@ -649,14 +1499,14 @@ namespace hdl {
             }
           break;
           case Op::Kind::Not:
-            if (const Op* arg = dynamic_cast<const Op*>(args[0])) {
+            if (const Op* arg = dyn_cast<Op>(args[0])) {
               if (arg->kind == Op::Kind::Not) {
                 return arg->args[0];
               }
             }
           break;
           case Op::Kind::Add:
-            if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[1];
               }
@@ -666,7 +1516,7 @@ namespace hdl {
             if (args[0] == args[1]) {
               return constant(BitString(args[0]->width));
             }
-            if (Constant* constant = dynamic_cast<Constant*>(args[1])) {
+            if (Constant* constant = dyn_cast<Constant>(args[1])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
@@ -678,7 +1528,7 @@ namespace hdl {
               return constant(BitString::from_bool(true));
             }
             if (args[1]->width == 1) {
-              if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+              if (Constant* constant = dyn_cast<Constant>(args[0])) {
                 if (constant->value.is_zero()) {
                   return this->op(Op::Kind::Not, { args[1] });
                 } else {
@@ -691,7 +1541,7 @@ namespace hdl {
             if (args[0] == args[1]) {
               return constant(BitString::from_bool(false));
             }
-            if (Constant* constant_b = dynamic_cast<Constant*>(args[1])) {
+            if (Constant* constant_b = dyn_cast<Constant>(args[1])) {
               if (constant_b->value.is_zero()) {
                 return constant(BitString::from_bool(false));
               }
@@ -703,8 +1553,8 @@ namespace hdl {
             }
           break;
           case Op::Kind::Concat: {
-            Op* op_high = dynamic_cast<Op*>(args[0]);
-            Op* op_low = dynamic_cast<Op*>(args[1]);
+            Op* op_high = dyn_cast<Op>(args[0]);
+            Op* op_low = dyn_cast<Op>(args[1]);
             
             if (op_low != nullptr &&
                 op_high != nullptr &&
@@ -712,11 +1562,11 @@ namespace hdl {
                 op_low->kind == Op::Kind::Slice &&
                 op_high->args[0] == op_low->args[0]) {
               
-              size_t low_offset = dynamic_cast<Constant*>(op_low->args[1])->value.as_uint64();
-              size_t low_width = dynamic_cast<Constant*>(op_low->args[2])->value.as_uint64();
+              size_t low_offset = dyn_cast<Constant>(op_low->args[1])->value.as_uint64();
+              size_t low_width = dyn_cast<Constant>(op_low->args[2])->value.as_uint64();
               
-              size_t high_offset = dynamic_cast<Constant*>(op_high->args[1])->value.as_uint64();
-              size_t high_width = dynamic_cast<Constant*>(op_high->args[2])->value.as_uint64();
+              size_t high_offset = dyn_cast<Constant>(op_high->args[1])->value.as_uint64();
+              size_t high_width = dyn_cast<Constant>(op_high->args[2])->value.as_uint64();
               
               if (low_offset + low_width == high_offset) {
                 return this->op(Op::Kind::Slice, {
@@ -729,10 +1579,10 @@ namespace hdl {
           }
           break;
           case Op::Kind::Slice: {
-            size_t offset = dynamic_cast<Constant*>(args[1])->value.as_uint64();
-            size_t width = dynamic_cast<Constant*>(args[2])->value.as_uint64();
+            size_t offset = dyn_cast<Constant>(args[1])->value.as_uint64();
+            size_t width = dyn_cast<Constant>(args[2])->value.as_uint64();
             
-            if (Op* op = dynamic_cast<Op*>(args[0])) {
+            if (Op* op = dyn_cast<Op>(args[0])) {
               switch (op->kind) {
                 case Op::Kind::Concat:
                   if (offset + width <= op->args[1]->width) {
@@ -750,7 +1600,7 @@ namespace hdl {
                   }
                 break;
                 case Op::Kind::Slice: {
-                  size_t inner_offset = dynamic_cast<Constant*>(op->args[1])->value.as_uint64();
+                  size_t inner_offset = dyn_cast<Constant>(op->args[1])->value.as_uint64();
                   return this->op(Op::Kind::Slice, {
                     op->args[0],
                     this->constant(BitString::from_uint(offset + inner_offset)),
@@ -764,40 +1614,40 @@ namespace hdl {
           }
           break;
           case Op::Kind::Shl:
-            if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
             }
-            if (Constant* constant = dynamic_cast<Constant*>(args[1])) {
+            if (Constant* constant = dyn_cast<Constant>(args[1])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
             }
           break;
           case Op::Kind::ShrU:
-            if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
             }
-            if (Constant* constant = dynamic_cast<Constant*>(args[1])) {
+            if (Constant* constant = dyn_cast<Constant>(args[1])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
             }
           break;
           case Op::Kind::ShrS:
-            if (Constant* constant = dynamic_cast<Constant*>(args[0])) {
+            if (Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value.is_zero()) {
                 return args[0];
               } else if (constant->value.is_all_ones()) {
                 return args[0];
               }
-            } else if (Op* op = dynamic_cast<Op*>(args[0])) {
+            } else if (Op* op = dyn_cast<Op>(args[0])) {
               // ShrS(Concat(n'b0, a), b) = Concat(n'b0, ShrU(a, b))
               if (op->kind == Op::Kind::Concat) {
-                if (Constant* constant = dynamic_cast<Constant*>(op->args[0])) {
+                if (Constant* constant = dyn_cast<Constant>(op->args[0])) {
                   if (constant->value.is_zero()) {
                     return this->op(Op::Kind::Concat, {
                       constant,
@@ -810,7 +1660,7 @@ namespace hdl {
                 }
               }
             }
-            if (Constant* constant = dynamic_cast<Constant*>(args[1])) {
+            if (Constant* constant = dyn_cast<Constant>(args[1])) {
               if (constant->value.is_zero()) {
                 return args[0];
               }
@@ -819,7 +1669,7 @@ namespace hdl {
           case Op::Kind::Select:
             if (args[1] == args[2]) {
               return args[1];
-            } else if (const Constant* constant = dynamic_cast<const Constant*>(args[0])) {
+            } else if (const Constant* constant = dyn_cast<Constant>(args[0])) {
               if (constant->value[0]) {
                 return args[1];
               } else {
@@ -834,92 +1684,389 @@ namespace hdl {
         }
       }
       
-      return _ops[op];
+      if (_rewriter != nullptr) {
+        if (Op* existing = _ops.find(op)) {
+          return existing;
+        }
+        if (Value* rewritten = _rewriter->rewrite(*this, kind, args)) {
+          if (rewritten->width != op.width) {
+            throw_error(Error,
+              "Rewriter replaced operator " << Op::KIND_NAMES[size_t(kind)] <<
+              " of width " << op.width << " by value of width " << rewritten->width
+            );
+          }
+          return rewritten;
+        }
+      }
+      
+      bool is_new = false;
+      Op* result = _ops.get(op, is_new);
+      if (is_new && _fanouts) {
+        _fanouts->attach(result);
+      }
+      return result;
     }
     
+    // Applies rewriter to all operators created from now on
+    void set_rewriter(const Rewriter* rewriter) { _rewriter = rewriter; }
+    inline const Rewriter* rewriter() const { return _rewriter; }
+    
     Constant* constant(const BitString& bit_string) {
       return _constants[Constant(bit_string)];
     }
     
     Unknown* unknown(size_t width) {
-      Unknown* unknown = new Unknown(width);
+      Unknown* unknown = _arena->create<Unknown>(width);
       _unknowns.push_back(unknown);
       return unknown;
     }
-    
+  
   private:
-    void trace(Memory* memory, std::set<void*>& reached) {
-      if (reached.find(memory) == reached.end()) {
-        reached.insert(memory);
-        
+    void mark(Value* value) {
+      if (!value->_marked) {
+        value->_marked = true;
+        _gc_stack.push_back(value);
+      }
+    }
+    
+    void mark(Memory* memory) {
+      if (!memory->_marked) {
+        memory->_marked = true;
         for (const Memory::Write& write : memory->writes) {
-          trace(write.clock, reached);
-          trace(write.address, reached);
-          trace(write.enable, reached);
-          trace(write.value, reached);
+          mark(write.clock);
+          mark(write.address);
+          mark(write.enable);
+          mark(write.value);
         }
       }
     }
     
-    void trace(Value* value, std::set<void*>& reached) {
-      if (reached.find(value) == reached.end()) {
-        reached.insert(value);
-        
-        if (Op* op = dynamic_cast<Op*>(value)) {
-          for (Value* arg : op->args) {
-            trace(arg, reached);
-          }
-        } else if (Reg* reg = dynamic_cast<Reg*>(value)) {
-          trace(reg->clock, reached);
-          trace(reg->next, reached);
-        } else if (Memory::Read* read = dynamic_cast<Memory::Read*>(value)) {
-          trace(read->memory, reached);
-          trace(read->address, reached);
+    template <class T>
+    void sweep(std::vector<T*>& nodes) {
+      size_t count = 0;
+      for (T* node : nodes) {
+        if (node->_marked) {
+          node->_marked = false;
+          nodes[count++] = node;
+        } else {
+          _arena->destroy(node);
         }
       }
+      nodes.resize(count);
     }
   public:
     void gc() {
-      std::set<void*> reached;
+      _gc_stack.clear();
       for (Output& output : _outputs) {
-        trace(output.value, reached);
+        mark(output.value);
       }
       
-      std::vector<Reg*> regs;
-      for (Reg* reg : _regs) {
-        if (reached.find(reg) == reached.end()) {
-          delete reg;
-        } else {
-          regs.push_back(reg);
+      while (!_gc_stack.empty()) {
+        Value* value = _gc_stack.back();
+        _gc_stack.pop_back();
+        
+        if (Op* op = dyn_cast<Op>(value)) {
+          for (Value* arg : op->args) {
+            mark(arg);
+          }
+        } else if (Reg* reg = dyn_cast<Reg>(value)) {
+          mark(reg->clock);
+          mark(reg->next);
+        } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+          mark(read->memory);
+          mark(read->address);
         }
       }
-      _regs = regs;
       
-      std::vector<Memory*> memories;
       for (Memory* memory : _memories) {
-        if (reached.find(memory) == reached.end()) {
-          delete memory;
-        } else {
-          memories.push_back(memory);
+        if (memory->_marked) {
+          for (auto it = memory->reads.begin(); it != memory->reads.end(); ) {
+            Memory::Read* read = it->second;
+            if (read->_marked) {
+              read->_marked = false;
+              it++;
+            } else {
+              it = memory->reads.erase(it);
+              _arena->destroy(read);
+            }
+          }
         }
       }
-      _memories = memories;
       
-      std::vector<Unknown*> unknowns;
-      for (Unknown* unknown : _unknowns) {
-        if (reached.find(unknown) == reached.end()) {
-          delete unknown;
-        } else {
-          unknowns.push_back(unknown);
+      sweep(_regs);
+      sweep(_memories);
+      sweep(_unknowns);
+      for (Input* input : _inputs) {
+        input->_marked = false;
+      }
+      _ops.sweep();
+      _constants.sweep();
+      
+      if (_fanouts) {
+        build_fanouts();
+      }
+      _is_topo_valid = false;
+    }
+    
+    // All values used by outputs, registers or memory writes, such that
+    // the arguments of each operator and memory read precede it.
+    // Registers act as sources. The order is computed once and cached
+    // until the outputs, registers or memory writes change.
+    const std::vector<Value*>& topo_order() {
+      std::vector<const void*> roots;
+      collect_roots(roots);
+      if (!_is_topo_valid || roots != _topo_roots) {
+        build_topo_order();
+        _topo_roots = std::move(roots);
+        _is_topo_valid = true;
+      }
+      return _topo_order;
+    }
+    
+    // Logic depth of each value in topo_order. Inputs, registers,
+    // constants and unknown values have level 0.
+    const NodeMap<size_t>& levels() {
+      topo_order();
+      return _levels;
+    }
+    
+    size_t depth() {
+      size_t depth = 0;
+      for (Value* value : topo_order()) {
+        depth = std::max(depth, _levels.at(value));
+      }
+      return depth;
+    }
+    
+    // The fanout index maps every value to the operators, memory reads,
+    // registers and memory write ports using it. It includes users which
+    // are no longer reachable from any output until the next gc.
+    // Registers and write ports which were changed by assigning their
+    // fields directly are reattached on the next lookup.
+    void enable_fanouts() {
+      if (!_fanouts) {
+        _fanouts.reset(new Fanouts());
+        for (Memory* memory : _memories) {
+          memory->_fanouts = _fanouts.get();
+        }
+        build_fanouts();
+      }
+    }
+    
+    void disable_fanouts() {
+      for (Memory* memory : _memories) {
+        memory->_fanouts = nullptr;
+      }
+      _fanouts.reset();
+    }
+    
+    inline bool has_fanouts() const { return bool(_fanouts); }
+  
+  private:
+    // Like the topological order cache, the index is revalidated against
+    // the registers and write ports, which are public fields
+    void sync_fanouts() const {
+      for (Reg* reg : _regs) {
+        _fanouts->sync(reg);
+      }
+      for (Memory* memory : _memories) {
+        _fanouts->sync(memory);
+      }
+    }
+  public:
+    const std::vector<Fanouts::Use>& users(const Value* value) const {
+      if (!_fanouts) {
+        throw_error(Error, "Fanout index is not enabled. Use Module::enable_fanouts to enable it.");
+      }
+      sync_fanouts();
+      return _fanouts->users(value);
+    }
+    
+    void set_next(Reg* reg, Value* next) {
+      if (next->width != reg->width) {
+        throw_error(Error,
+          "Unable to use value of width " << next->width <<
+          " as next value of register of width " << reg->width
+        );
+      }
+      if (_fanouts) {
+        _fanouts->detach(reg);
+      }
+      reg->next = next;
+      if (_fanouts) {
+        _fanouts->attach(reg);
+      }
+    }
+    
+    // Replaces all uses of from by to. Operators and memory reads using
+    // from are rebuilt, which may in turn replace their users.
+    // Registers, memory write ports and outputs are updated in place.
+    // Requires the fanout index. The value to must not depend on from,
+    // except for being a direct user of it.
+    void replace(Value* from, Value* to) {
+      if (!_fanouts) {
+        throw_error(Error, "Module::replace requires the fanout index. Use Module::enable_fanouts to enable it.");
+      }
+      if (from->width != to->width) {
+        throw_error(Error,
+          "Unable to replace value of width " << from->width <<
+          " by value of width " << to->width
+        );
+      }
+      if (from == to) {
+        return;
+      }
+      sync_fanouts();
+      
+      // Transitive users of from in reverse topological order. The users
+      // of to are not visited, since to itself is kept.
+      std::vector<Value*> order;
+      {
+        NodeMap<bool> visited(*this);
+        std::vector<std::pair<Value*, bool>> stack = {{from, false}};
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          stack.pop_back();
+          if (is_expanded) {
+            order.push_back(value);
+          } else if (value != to && visited.insert(value, true)) {
+            stack.emplace_back(value, true);
+            for (const Fanouts::Use& use : _fanouts->users(value)) {
+              if (use.user != nullptr && (isa<Op>(use.user) || isa<Memory::Read>(use.user))) {
+                stack.emplace_back(use.user, false);
+              }
+            }
+          }
+        }
+      }
+      
+      // Each user is rebuilt exactly once, after all of its arguments.
+      // The last entry of order is from itself.
+      NodeMap<Value*> mapped(*this);
+      mapped[from] = to;
+      for (size_t it = order.size() - 1; it-- > 0; ) {
+        mapped[order[it]] = rebuild(order[it], mapped);
+      }
+      remap_roots(mapped);
+    }
+    
+    // Rebuilds an operator or memory read using the entries of mapped for
+    // its arguments. Arguments without an entry are kept. Returns value
+    // itself if no argument changed.
+    Value* rebuild(Value* value, const NodeMap<Value*>& mapped) {
+      auto map = [&](Value* arg){
+        if (Value* const* result = mapped.find(arg)) {
+          return *result;
+        }
+        return arg;
+      };
+      
+      if (Op* op = dyn_cast<Op>(value)) {
+        std::vector<Value*> args;
+        bool changed = false;
+        for (Value* arg : op->args) {
+          args.push_back(map(arg));
+          changed = changed || args.back() != arg;
+        }
+        if (changed) {
+          return this->op(op->kind, args);
+        }
+      } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+        Value* address = map(read->address);
+        if (address != read->address) {
+          return read->memory->read(address);
+        }
+      }
+      return value;
+    }
+    
+    // Replaces the values used by outputs, registers (clock and next value)
+    // and memory write ports by their entries in mapped. Values without an
+    // entry are kept. The fanout index is updated if it is enabled.
+    void remap_roots(const NodeMap<Value*>& mapped) {
+      auto map = [&](Value* value){
+        if (value == nullptr) {
+          return value;
         }
+        Value* const* result = mapped.find(value);
+        if (result == nullptr) {
+          return value;
+        }
+        if ((*result)->width != value->width) {
+          throw_error(Error,
+            "Unable to replace value of width " << value->width <<
+            " by value of width " << (*result)->width
+          );
+        }
+        return *result;
+      };
+      
+      if (_fanouts) {
+        sync_fanouts();
       }
-      _unknowns = unknowns;
       
-      _ops.gc(reached);
-      _constants.gc(reached);
+      for (Output& output : _outputs) {
+        output.value = map(output.value);
+      }
+      for (Reg* reg : _regs) {
+        if (map(reg->clock) != reg->clock || map(reg->next) != reg->next) {
+          if (_fanouts) {
+            _fanouts->detach(reg);
+          }
+          reg->clock = map(reg->clock);
+          reg->next = map(reg->next);
+          if (_fanouts) {
+            _fanouts->attach(reg);
+          }
+        }
+      }
+      for (Memory* memory : _memories) {
+        for (size_t it = 0; it < memory->writes.size(); it++) {
+          Memory::Write& write = memory->writes[it];
+          if (map(write.clock) != write.clock ||
+              map(write.address) != write.address ||
+              map(write.enable) != write.enable ||
+              map(write.value) != write.value) {
+            if (_fanouts) {
+              _fanouts->detach(memory, it);
+            }
+            write.clock = map(write.clock);
+            write.address = map(write.address);
+            write.enable = map(write.enable);
+            write.value = map(write.value);
+            if (_fanouts) {
+              _fanouts->attach(memory, it);
+            }
+          }
+        }
+      }
+    }
+    
+    // Rebuilds all values in topological order, replacing the values in
+    // substitutes. Returns the value each value of the topological order
+    // is mapped to. Use remap_roots to apply the mapping to the outputs,
+    // registers and memory write ports. Replaced values are removed by the
+    // next Module::gc.
+    NodeMap<Value*> substitute(const NodeMap<Value*>& substitutes) {
+      NodeMap<Value*> mapped(*this);
+      std::vector<Value*> order = topo_order();
+      for (Value* value : order) {
+        if (Value* const* substitute = substitutes.find(value)) {
+          mapped[value] = *substitute;
+        } else {
+          mapped[value] = rebuild(value, mapped);
+        }
+      }
+      return mapped;
     }
   };
   
+  template <class T>
+  NodeMap<T>::NodeMap(const Module& module):
+      _arena(&module.arena()), _generation(module.arena().generation()) {
+    _entries.reserve(module.id_count());
+  }
+  
   namespace verilog {
     struct Width {
       size_t width = 0;
@@ -941,78 +2088,44 @@ namespace hdl {
       std::unordered_map<const Memory*, std::string> _memory_names;
       std::unordered_map<const Value*, size_t> _counts;
       
-      void count_usages(const Value* value) {
-        if (_counts.find(value) != _counts.end()) {
-          _counts[value] += 1;
-          return;
-        }
-        
-        _counts[value] = 1;
-        if (const Op* op = dynamic_cast<const Op*>(value)) {
-          if (op->kind == Op::Kind::Slice) {
-            // Slices can only be applied to wires, not expressions
-            count_usages(op->args[0]);
-          }
-          for (const Value* arg : op->args) {
-            count_usages(arg);
-          }
-          if (op->kind == Op::Kind::Slice) {
-            count_usages(op->args[1]);
+      void count_usages() {
+        for (const Value* value : _module.topo_order()) {
+          if (const Op* op = dyn_cast<Op>(value)) {
+            if (op->kind == Op::Kind::Slice) {
+              // Slices can only be applied to wires, not expressions
+              _counts[op->args[0]] += 1;
+              _counts[op->args[1]] += 1;
+            }
+            for (const Value* arg : op->args) {
+              _counts[arg] += 1;
+            }
+          } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+            _counts[read->address] += 1;
           }
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
-          count_usages(read->address);
         }
-      }
-      
-      void count_usages() {
+        
         for (const Reg* reg : _module.regs()) {
-          count_usages(reg->clock);
-          count_usages(reg->next);
+          _counts[reg->clock] += 1;
+          _counts[reg->next] += 1;
         }
         
         for (const Memory* memory : _module.memories()) {
-          if (memory->writes.size() > 0) {
-            for (const Memory::Write& write : memory->writes) {
-              count_usages(write.clock);
-              count_usages(write.address);
-              count_usages(write.value);
-              count_usages(write.enable);
-            }
+          for (const Memory::Write& write : memory->writes) {
+            _counts[write.clock] += 1;
+            _counts[write.address] += 1;
+            _counts[write.value] += 1;
+            _counts[write.enable] += 1;
           }
         }
         
         for (const Output& output : _module.outputs()) {
-          count_usages(output.value);
+          _counts[output.value] += 1;
         }
       }
       
-      std::string print(std::ostream& stream, const Value* value, std::unordered_set<const Value*>& closed) const {
-        if (closed.find(value) != closed.end()) {
-          if (_names.find(value) == _names.end()) {
-            throw Error("Unreachable");
-          }
-          return _names.at(value);
-        }
-        
-        if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
-          std::ostringstream expr;
-          expr << constant->value;
-          return expr.str();
-        } else if (const Unknown* unknown = dynamic_cast<const Unknown*>(value)) {
-          std::ostringstream expr;
-          expr << unknown->width << "'bx";
-          return expr.str();
-        }
-        
-        closed.insert(value);
-        
+      std::string print(const Value* value, const std::vector<std::string>& args) const {
         std::ostringstream expr;
-        if (const Op* op = dynamic_cast<const Op*>(value)) {
-          std::vector<std::string> args;
-          for (const Value* arg : op->args) {
-            args.emplace_back(print(stream, arg, closed));
-          }
-          
+        if (const Op* op = dyn_cast<Op>(value)) {
           expr << '(';
           switch (op->kind) {
             case Op::Kind::And: expr << args[0] << " & " << args[1]; break;
@@ -1028,7 +2141,7 @@ namespace hdl {
             case Op::Kind::Concat: expr << '{' << args[0] << ',' << args[1] << '}'; break;
             case Op::Kind::Slice:
               expr << args[0] << '[';
-              if (const Constant* const_offset = dynamic_cast<const Constant*>(op->args[1])) {
+              if (const Constant* const_offset = dyn_cast<Constant>(op->args[1])) {
                 size_t offset = const_offset->value.as_uint64();
                 expr << (offset + value->width - 1) << ':' << offset;
               } else {
@@ -1042,22 +2155,12 @@ namespace hdl {
             case Op::Kind::Select: expr << args[0] << " ? " << args[1] << " : " << args[2]; break;
           }
           expr << ')';
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
-          std::string address = print(stream, read->address, closed);
-          expr << '(' << _memory_names.at(read->memory) << '[' << address << "])";
+        } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+          expr << '(' << _memory_names.at(read->memory) << '[' << args[0] << "])";
         } else {
-          std::cout << value << std::endl;
           throw Error("Unreachable: Invalid value");
         }
-        
-        if (_names.find(value) == _names.end()) {
-          return expr.str();
-        } else {
-          const std::string& name = _names.at(value);
-          stream << "  wire " << Width(value->width) << name << ";\n";
-          stream << "  assign " << name << " = " << expr.str() << ";\n";
-          return name;
-        }
+        return expr.str();
       }
     public:
       Printer(Module& module): _module(module) {
@@ -1074,10 +2177,10 @@ namespace hdl {
         }
         
         count_usages();
-        for (const auto& [value, count] : _counts) {
-          if (count > 1 &&
+        for (const Value* value : _module.topo_order()) {
+          if (_counts[value] > 1 &&
               _names.find(value) == _names.end() &&
-              dynamic_cast<const Constant*>(value) == nullptr) {
+              dyn_cast<Constant>(value) == nullptr) {
             _names[value] = "value" + std::to_string(_names.size());
           }
         }
@@ -1098,15 +2201,8 @@ namespace hdl {
         }
         stream << ");\n";
         
-        std::unordered_set<const Value*> closed;
-        
-        for (const Input* input : _module.inputs()) {
-          closed.insert(input);
-        }
-        
         for (const Reg* reg : _module.regs()) {
           stream << "  reg " << Width(reg->width) << _names.at(reg) << " = " << reg->initial << ";\n";
-          closed.insert(reg);
         }
         
         for (const Memory* memory : _module.memories()) {
@@ -1121,14 +2217,59 @@ namespace hdl {
           }
         }
         
+        // Unnamed values are used exactly once, so their expression is
+        // moved into their user.
+        std::unordered_map<const Value*, std::string> exprs;
+        auto use = [&](const Value* value){
+          if (_names.find(value) != _names.end()) {
+            return _names.at(value);
+          } else if (const Constant* constant = dyn_cast<Constant>(value)) {
+            std::ostringstream expr;
+            expr << constant->value;
+            return expr.str();
+          } else if (const Unknown* unknown = dyn_cast<Unknown>(value)) {
+            std::ostringstream expr;
+            expr << unknown->width << "'bx";
+            return expr.str();
+          }
+          auto iter = exprs.find(value);
+          if (iter == exprs.end()) {
+            throw Error("Unreachable");
+          }
+          std::string expr = std::move(iter->second);
+          exprs.erase(iter);
+          return expr;
+        };
+        
+        for (const Value* value : _module.topo_order()) {
+          std::vector<std::string> args;
+          if (const Op* op = dyn_cast<Op>(value)) {
+            for (const Value* arg : op->args) {
+              args.emplace_back(use(arg));
+            }
+          } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+            args.emplace_back(use(read->address));
+          } else {
+            continue;
+          }
+          
+          std::string expr = print(value, args);
+          if (_names.find(value) == _names.end()) {
+            exprs[value] = std::move(expr);
+          } else {
+            const std::string& name = _names.at(value);
+            stream << "  wire " << Width(value->width) << name << ";\n";
+            stream << "  assign " << name << " = " << expr << ";\n";
+          }
+        }
+        
         for (const Output& output : _module.outputs()) {
-          std::string value = print(stream, output.value, closed);
-          stream << "  assign " << output.name << " = " << value << ";\n";
+          stream << "  assign " << output.name << " = " << use(output.value) << ";\n";
         }
         
         for (const Reg* reg : _module.regs()) {
-          std::string clock = print(stream, reg->clock, closed);
-          std::string next = print(stream, reg->next, closed);
+          std::string clock = use(reg->clock);
+          std::string next = use(reg->next);
           const std::string& name = _names.at(reg);
           
           stream << "  always @(posedge " << clock << ")\n";
@@ -1139,10 +2280,10 @@ namespace hdl {
           const std::string& name = _memory_names.at(memory);
           
           for (const Memory::Write& write : memory->writes) {
-            std::string clock = print(stream, write.clock, closed);
-            std::string enable = print(stream, write.enable, closed);
-            std::string address = print(stream, write.address, closed);
-            std::string value = print(stream, write.value, closed);
+            std::string clock = use(write.clock);
+            std::string enable = use(write.enable);
+            std::string address = use(write.address);
+            std::string value = use(write.value);
             
             stream << "  always @(posedge " << clock << ")\n";
             stream << "    if (" << enable << ")\n";
@@ -1172,7 +2313,7 @@ namespace hdl {
       
       struct Context {
         std::ostream& stream;
-        std::unordered_map<const Value*, size_t> ids;
+        NodeMap<size_t> ids;
         std::unordered_map<const Memory*, size_t> memory_ids;
         size_t id_count = 0;
         
@@ -1216,13 +2357,13 @@ namespace hdl {
       }
       
       size_t print(const Value* value, Context& ctx) const {
-        if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
+        if (const Constant* constant = dyn_cast<Constant>(value)) {
           size_t id = ctx.alloc();
           ctx.stream << "  n" << id << " [shape=none, label=\"";
           constant->value.write_short(ctx.stream);
           ctx.stream << "\"];\n";
           return id;
-        } else if (const Unknown* unknown = dynamic_cast<const Unknown*>(value)) {
+        } else if (const Unknown* unknown = dyn_cast<Unknown>(value)) {
           size_t id = ctx.alloc();
           ctx.stream << "  n" << id << " [shape=none, label=\"";
           ctx.stream << unknown->width << "'bx";
@@ -1230,23 +2371,23 @@ namespace hdl {
           return id;
         }
         
-        if (ctx.ids.find(value) != ctx.ids.end()) {
+        if (ctx.ids.has(value)) {
           return ctx[value];
         }
         
         size_t id = ctx.alloc(value);
         
-        if (const Op* op = dynamic_cast<const Op*>(value)) {
+        if (const Op* op = dyn_cast<Op>(value)) {
           ctx.stream << "  n" << id << " [label=" << Op::KIND_NAMES[(size_t)op->kind] << "];\n";
-        } else if (const Input* op = dynamic_cast<const Input*>(value)) {
+        } else if (const Input* op = dyn_cast<Input>(value)) {
           ctx.stream << "  n" << id << " [shape=box, label=\"" << op->name << "\"];\n";
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
+        } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
           ctx.stream << "  n" << id << " [label=Read];\n";
         } else {
           ctx.stream << "  n" << id << ";\n";
         }
         
-        if (const Op* op = dynamic_cast<const Op*>(value)) {
+        if (const Op* op = dyn_cast<Op>(value)) {
           const char** names = arg_names(op->kind);
           size_t it = 0;
           for (const Value* arg : op->args) {
@@ -1258,7 +2399,7 @@ namespace hdl {
             ctx.stream << ";\n";
             it++;
           }
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
+        } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
           size_t address_id = print(read->address, ctx);
           ctx.stream << "  n" << address_id << " -> n" << id << ";\n";
           ctx.stream << "  n" << ctx[read->memory] << " -> n" << id << ";\n";
@@ -1298,7 +2439,7 @@ namespace hdl {
           ctx.stream << "  }\n";
         }
       }
-      
+    
     public:
       Printer(Module& module): _module(module) {}
       
@@ -1372,44 +2513,269 @@ namespace hdl {
   namespace sim {
     class Simulation {
     public:
-      using Values = std::unordered_map<const Value*, BitString>;
+      // Values of the module in the last update. Since this is a NodeMap
+      // instead of an unordered_map, use has or find, which returns a
+      // pointer. It may not be used after Module::gc removed values.
+      using Values = NodeMap<BitString>;
       
-      struct MemoryData {
-        const Memory* memory = nullptr;
-        std::unordered_map<uint64_t, BitString> data;
-        
-        MemoryData() {}
-        MemoryData(const Memory* _memory):
-          memory(_memory), data(_memory->initial) {}
-        
-        BitString& operator[](uint64_t address) {
-          if (address >= memory->size) {
-            //throw_error(Error,
-            //  "Memory access out of bounds: Attempt to access address " << address <<
-            //  " in memory of size " << memory->size
-            //);
-            address %= memory->size;
+      // Contents of a simulated memory. Memories are stored in a single
+      // contiguous word buffer unless they are too large and cannot be
+      // mapped lazily, in which case only the touched addresses are stored
+      // in a hash map.
+      class MemoryData {
+      public:
+        enum class Storage {
+          Auto, Dense, Sparse
+        };
+        
+        // Dense memories larger than this are allocated using mmap, so that
+        // untouched pages do not occupy physical memory.
+        static constexpr const size_t MMAP_BYTES = size_t(16) << 20;
+        // Storage::Auto only uses dense storage for larger memories if they
+        // can be allocated using mmap and switches to sparse storage otherwise
+        static constexpr const size_t MAX_DENSE_BYTES = size_t(1) << 30;
+        static constexpr const size_t MAX_MAPPED_BYTES = size_t(1) << 36;
+      private:
+        using Word = BitString::Word;
+        
+        class Buffer {
+        private:
+          Word* _data = nullptr;
+          size_t _size = 0;
+          bool _is_mapped = false;
+          
+          void alloc(size_t size, bool mapped_only) {
+            _size = size;
+            if (_size == 0) {
+              return;
+            }
+            #ifdef HDL_HAS_MMAP
+              if (_size * sizeof(Word) >= MMAP_BYTES) {
+                void* data = mmap(
+                  nullptr, _size * sizeof(Word),
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                  -1, 0
+                );
+                if (data != MAP_FAILED) {
+                  _data = (Word*) data;
+                  _is_mapped = true;
+                  return;
+                }
+              }
+            #endif
+            if (mapped_only) {
+              _size = 0;
+              return;
+            }
+            _data = new Word[_size]();
           }
-          if (data.find(address) == data.end()) {
-            data[address] = BitString(memory->width);
+          
+          void free() {
+            #ifdef HDL_HAS_MMAP
+              if (_is_mapped) {
+                munmap(_data, _size * sizeof(Word));
+                _data = nullptr;
+              }
+            #endif
+            delete[] _data;
+            _data = nullptr;
+            _size = 0;
+            _is_mapped = false;
           }
-          return data[address];
-        }
-      };
-    private:
-      Module& _module;
-      std::unordered_map<const Value*, bool> _prev_clocks;
-      std::vector<BitString> _regs;
-      std::unordered_map<const Memory*, MemoryData> _memories;
-      std::vector<BitString> _outputs;
+        public:
+          Buffer() {}
+          // If mapped_only is set and the buffer cannot be allocated using
+          // mmap, the buffer is left empty
+          Buffer(size_t size, bool mapped_only = false) { alloc(size, mapped_only); }
+          
+          Buffer(const Buffer& other) {
+            alloc(other._size, false);
+            if (_size > 0) {
+              memcpy(_data, other._data, _size * sizeof(Word));
+            }
+          }
+          
+          Buffer(Buffer&& other):
+              _data(other._data), _size(other._size), _is_mapped(other._is_mapped) {
+            other._data = nullptr;
+            other._size = 0;
+            other._is_mapped = false;
+          }
+          
+          Buffer& operator=(const Buffer& other) {
+            if (&other != this) {
+              free();
+              new (this) Buffer(other);
+            }
+            return *this;
+          }
+          
+          Buffer& operator=(Buffer&& other) {
+            if (&other != this) {
+              free();
+              new (this) Buffer(std::move(other));
+            }
+            return *this;
+          }
+          
+          ~Buffer() { free(); }
+          
+          bool is_mapped() const { return _is_mapped; }
+          Word* data() { return _data; }
+          const Word* data() const { return _data; }
+        };
+        
+        const Memory* _memory = nullptr;
+        Storage _storage = Storage::Dense;
+        size_t _stride = 0;
+        Buffer _dense;
+        std::unordered_map<uint64_t, BitString> _sparse;
+        
+        uint64_t wrap(uint64_t address) const {
+          if (address >= _memory->size) {
+            //throw_error(Error,
+            //  "Memory access out of bounds: Attempt to access address " << address <<
+            //  " in memory of size " << _memory->size
+            //);
+            address %= _memory->size;
+          }
+          return address;
+        }
+      public:
+        MemoryData() {}
+        MemoryData(const Memory* memory, Storage storage = Storage::Auto):
+            _memory(memory),
+            _storage(storage),
+            _stride(BitString::word_count(memory->width)) {
+          
+          if (_storage == Storage::Auto) {
+            size_t max_words = MAX_DENSE_BYTES / sizeof(Word);
+            size_t max_mapped_words = MAX_MAPPED_BYTES / sizeof(Word);
+            if (_stride == 0 || _memory->size <= max_words / _stride) {
+              _storage = Storage::Dense;
+            } else if (_memory->size <= max_mapped_words / _stride) {
+              _dense = Buffer(_memory->size * _stride, true);
+              _storage = _dense.is_mapped() ? Storage::Dense : Storage::Sparse;
+            } else {
+              _storage = Storage::Sparse;
+            }
+          }
+          
+          if (_storage == Storage::Dense && !_dense.is_mapped()) {
+            _dense = Buffer(_memory->size * _stride);
+          }
+          
+          for (const auto& [address, value] : _memory->initial) {
+            write(address, value);
+          }
+        }
+        
+        const Memory* memory() const { return _memory; }
+        bool is_dense() const { return _storage == Storage::Dense; }
+        bool is_mapped() const { return _dense.is_mapped(); }
+        
+        // Stores the value at address into into, reusing its buffer
+        void read_into(BitString& into, uint64_t address) const {
+          address = wrap(address);
+          if (_storage == Storage::Dense) {
+            BitString::load_words_into(into, _memory->width, _dense.data() + address * _stride);
+          } else {
+            auto it = _sparse.find(address);
+            if (it == _sparse.end()) {
+              if (into.width() == _memory->width) {
+                into.set_zero();
+              } else {
+                into = BitString(_memory->width);
+              }
+            } else {
+              into = it->second;
+            }
+          }
+        }
+        
+        BitString read(uint64_t address) const {
+          BitString value(_memory->width);
+          read_into(value, address);
+          return value;
+        }
+        
+        // Returns true if the stored value changed
+        bool write(uint64_t address, const BitString& value) {
+          if (value.width() != _memory->width) {
+            throw_error(Error,
+              "Unable to write value of width " << value.width() <<
+              " to memory of width " << _memory->width
+            );
+          }
+          address = wrap(address);
+          if (_storage == Storage::Dense) {
+            Word* words = _dense.data() + address * _stride;
+            if (value.equals_words(words)) {
+              return false;
+            }
+            value.store_words(words);
+            return true;
+          } else {
+            auto it = _sparse.find(address);
+            if (it == _sparse.end()) {
+              if (value.is_zero()) {
+                return false;
+              }
+              _sparse.emplace(address, value);
+              return true;
+            } else if (it->second == value) {
+              return false;
+            }
+            it->second = value;
+            return true;
+          }
+        }
+        
+        // Words are not stored as BitStrings, so writes through operator[]
+        // use a proxy instead of returning BitString&
+        class Reference {
+        private:
+          MemoryData& _data;
+          uint64_t _address = 0;
+        public:
+          Reference(MemoryData& data, uint64_t address):
+            _data(data), _address(address) {}
+          
+          operator BitString() const { return _data.read(_address); }
+          
+          Reference& operator=(const BitString& value) {
+            _data.write(_address, value);
+            return *this;
+          }
+          
+          Reference& operator=(const Reference& other) {
+            return *this = BitString(other);
+          }
+        };
+        
+        Reference operator[](uint64_t address) {
+          return Reference(*this, address);
+        }
+        
+        BitString operator[](uint64_t address) const {
+          return read(address);
+        }
+      };
+    private:
+      Module& _module;
+      std::unordered_map<const Value*, bool> _prev_clocks;
+      std::vector<BitString> _regs;
+      std::unordered_map<const Memory*, MemoryData> _memories;
+      std::vector<BitString> _outputs;
       std::vector<const hdl::Value*> _probes;
-      
+    
     public:
       Simulation(Module& module):
           _module(module),
           _regs(module.regs().size()),
           _outputs(module.outputs().size()) {
-
+        
         size_t it = 0;
         for (const Reg* reg : _module.regs()) {
           _prev_clocks[reg->clock] = false;
@@ -1465,62 +2831,102 @@ namespace hdl {
           _memories[memory] = MemoryData(memory);
         }
       }
-      
-      BitString eval(const Value* value, Values& values) {
-        if (values.find(value) != values.end()) {
-          return values.at(value);
-        }
-        
+    
+    private:
+      // Computes value assuming that all of its required arguments are
+      // already stored in values
+      BitString compute(const Value* value, const Values& values) const {
         BitString result;
-        if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
+        if (const Constant* constant = dyn_cast<Constant>(value)) {
           result = constant->value;
-        } else if (const Unknown* unknown = dynamic_cast<const Unknown*>(value)) {
+        } else if (dyn_cast<Unknown>(value)) {
           throw_error(Error, "Unable to simulate with unknown values");
-        } else if (const Op* op = dynamic_cast<const Op*>(value)) {
+        } else if (const Op* op = dyn_cast<Op>(value)) {
           if (op->kind == Op::Kind::Select) {
-            if (eval(op->args[0], values).at(0)) {
-              result = eval(op->args[1], values);
+            if (values.at(op->args[0]).at(0)) {
+              result = values.at(op->args[1]);
             } else {
-              result = eval(op->args[2], values);
+              result = values.at(op->args[2]);
             }
           } else {
-            for (size_t it = 0; it < op->args.size(); it++) {
-              eval(op->args[it], values);
-            }
-            
             const BitString* args[Op::MAX_ARG_COUNT] = {nullptr};
             for (size_t it = 0; it < op->args.size(); it++) {
               args[it] = &values.at(op->args[it]);
             }
             result = op->eval(args);
           }
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
-          BitString address = eval(read->address, values);
-          result = _memories.at(read->memory)[address.as_uint64()];
+        } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+          result = _memories.at(read->memory).read(values.at(read->address).as_uint64());
         } else {
           throw Error("");
         }
         
         if (result.width() != value->width) {
           std::string name = "value";
-          if (const Op* op = dynamic_cast<const Op*>(value)) {
+          if (const Op* op = dyn_cast<Op>(value)) {
             name = Op::KIND_NAMES[size_t(op->kind)];
-          } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
+          } else if (dyn_cast<Memory::Read>(value)) {
             name = "read";
           }
           throw_error(Error, "Width mismatch: " << name << " returned BitString of width " << result.width() << ", but expected width " << value->width);
         }
         
-        values[value] = result;
         return result;
       }
+    public:
+      // Evaluates value and all values it depends on. Uses an explicit stack,
+      // so that deep combinational paths do not overflow the call stack.
+      // Only the selected branch of a Select is evaluated.
+      BitString eval(const Value* root, Values& values) {
+        if (const BitString* cached = values.find(root)) {
+          return *cached;
+        }
+        
+        std::vector<std::pair<const Value*, bool>> stack;
+        stack.emplace_back(root, false);
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          if (values.has(value)) {
+            stack.pop_back();
+            continue;
+          }
+          
+          const Op* op = dyn_cast<Op>(value);
+          if (!is_expanded) {
+            stack.back().second = true;
+            if (op && op->kind == Op::Kind::Select) {
+              stack.emplace_back(op->args[0], false);
+            } else if (op) {
+              for (const Value* arg : op->args) {
+                stack.emplace_back(arg, false);
+              }
+            } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+              stack.emplace_back(read->address, false);
+            }
+            continue;
+          }
+          
+          if (op && op->kind == Op::Kind::Select) {
+            const Value* branch = op->args[values.at(op->args[0]).at(0) ? 1 : 2];
+            if (!values.has(branch)) {
+              stack.emplace_back(branch, false);
+              continue;
+            }
+          }
+          
+          stack.pop_back();
+          values[value] = compute(value, values);
+        }
+        
+        return values.at(root);
+      }
       
       Values update(const std::vector<BitString>& inputs) {
         if (inputs.size() != _module.inputs().size()) {
           throw_error(Error, "Module has " << _module.inputs().size() << " inputs, but simulation only got " << inputs.size() << " values.");
         }
         
-        Values values;
+        Values values(_module);
         for (size_t it = 0; it < inputs.size(); it++) {
           values[_module.inputs()[it]] = inputs[it];
         }
@@ -1533,7 +2939,7 @@ namespace hdl {
           throw_error(Error, "Module has " << _module.inputs().size() << " inputs, but simulation only got " << inputs.size() << " values.");
         }
         
-        Values values;
+        Values values(_module);
         for (hdl::Input* input : _module.inputs()) {
           values[input] = inputs.at(input->name);
         }
@@ -1605,7 +3011,7 @@ namespace hdl {
               if (enable) {
                 uint64_t address = eval(write.address, values).as_uint64();
                 BitString value = eval(write.value, values);
-                _memories[memory][address] = value;
+                _memories[memory].write(address, value);
                 changed = true;
               }
             }
@@ -1620,6 +3026,532 @@ namespace hdl {
       }
     };
     
+    // Simulation which compiles the module into a flat, levelized program once
+    // and then evaluates each step as a linear sweep over a preallocated buffer
+    // of value slots.
+    // In event driven mode, only instructions whose arguments changed since
+    // the previous evaluation are re-evaluated.
+    // Unlike Simulation, both arms of every Select are always evaluated, so
+    // modules containing unknown values are rejected when they are compiled,
+    // even if the unknown values are never selected.
+    class CompiledSimulation {
+    public:
+      using MemoryData = Simulation::MemoryData;
+    private:
+      // Everything required for evaluating an instruction is resolved at
+      // compile time, so that eval does not need to inspect the IR
+      struct Instr {
+        Op::Kind kind = Op::Kind::And;
+        bool is_read = false;
+        size_t memory = 0;
+        size_t arg_count = 0;
+        size_t result = 0;
+        size_t args[Op::MAX_ARG_COUNT] = {0};
+        size_t level = 0;
+        size_t scratch = 0;
+      };
+      
+      struct Write {
+        size_t memory = 0;
+        size_t clock = 0;
+        size_t address = 0;
+        size_t enable = 0;
+        size_t value = 0;
+      };
+      
+      Module& _module;
+      
+      NodeMap<size_t> _slots;
+      std::vector<BitString> _values;
+      std::vector<Instr> _program;
+      // One buffer per result width, used by propagate for comparing the new
+      // value of an instruction against the old one
+      std::vector<BitString> _scratch;
+      
+      std::vector<size_t> _input_slots;
+      std::vector<size_t> _reg_slots;
+      std::vector<size_t> _next_slots;
+      std::vector<size_t> _reg_clocks;
+      std::vector<size_t> _output_slots;
+      
+      std::vector<size_t> _clock_slots;
+      std::vector<bool> _prev_clocks;
+      std::vector<bool> _clock_edges;
+      
+      std::unordered_map<const Memory*, size_t> _memory_indices;
+      std::vector<MemoryData> _memories;
+      std::vector<Write> _writes;
+      
+      std::vector<BitString> _staged_regs;
+      std::vector<BitString> _outputs;
+      
+      bool _event_driven = false;
+      bool _is_dirty = true;
+      size_t _eval_count = 0;
+      std::vector<size_t> _fanout_offsets;
+      std::vector<size_t> _fanouts;
+      std::vector<std::vector<size_t>> _memory_readers;
+      std::vector<std::vector<size_t>> _queues;
+      std::vector<bool> _queued;
+      
+      size_t alloc(const Value* value) {
+        size_t slot = _values.size();
+        _slots[value] = slot;
+        _values.emplace_back(value->width);
+        return slot;
+      }
+      
+      size_t clock_index(const Value* clock) {
+        size_t slot = _slots.at(clock);
+        for (size_t it = 0; it < _clock_slots.size(); it++) {
+          if (_clock_slots[it] == slot) {
+            return it;
+          }
+        }
+        _clock_slots.push_back(slot);
+        return _clock_slots.size() - 1;
+      }
+      
+      // Appends the instructions required for computing value to the program
+      // in topological order. Uses an explicit stack, so that deep
+      // combinational paths do not overflow the call stack.
+      void compile(const Value* root, std::vector<Instr>& program) {
+        if (_slots.has(root)) {
+          return;
+        }
+        
+        std::vector<std::pair<const Value*, bool>> stack;
+        stack.emplace_back(root, false);
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          stack.pop_back();
+          
+          if (_slots.has(value)) {
+            continue;
+          }
+          
+          if (const Constant* constant = dyn_cast<Constant>(value)) {
+            _values[alloc(value)] = constant->value;
+          } else if (dyn_cast<Unknown>(value)) {
+            throw_error(Error, "Unable to simulate with unknown values");
+          } else if (const Op* op = dyn_cast<Op>(value)) {
+            if (is_expanded) {
+              Instr instr;
+              instr.kind = op->kind;
+              instr.arg_count = op->args.size();
+              for (size_t it = 0; it < op->args.size(); it++) {
+                instr.args[it] = _slots.at(op->args[it]);
+              }
+              instr.result = alloc(value);
+              program.push_back(instr);
+            } else {
+              stack.emplace_back(value, true);
+              for (const Value* arg : op->args) {
+                stack.emplace_back(arg, false);
+              }
+            }
+          } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+            if (is_expanded) {
+              Instr instr;
+              instr.is_read = true;
+              instr.memory = _memory_indices.at(read->memory);
+              instr.arg_count = 1;
+              instr.args[0] = _slots.at(read->address);
+              instr.result = alloc(value);
+              program.push_back(instr);
+            } else {
+              stack.emplace_back(value, true);
+              stack.emplace_back(read->address, false);
+            }
+          } else {
+            throw_error(Error, "Unable to compile value");
+          }
+        }
+      }
+      
+      // Sorts the program by logic level. Instructions of the same level do
+      // not depend on each other.
+      void levelize(std::vector<Instr>& program) {
+        std::vector<size_t> levels(_values.size(), 0);
+        size_t max_level = 0;
+        for (Instr& instr : program) {
+          size_t level = 0;
+          for (size_t it = 0; it < instr.arg_count; it++) {
+            level = std::max(level, levels[instr.args[it]] + 1);
+          }
+          levels[instr.result] = level;
+          instr.level = level;
+          max_level = std::max(max_level, level);
+        }
+        
+        std::vector<size_t> offsets(max_level + 2, 0);
+        for (const Instr& instr : program) {
+          offsets[instr.level + 1]++;
+        }
+        for (size_t it = 1; it < offsets.size(); it++) {
+          offsets[it] += offsets[it - 1];
+        }
+        
+        _program.resize(program.size());
+        for (const Instr& instr : program) {
+          _program[offsets[instr.level]++] = instr;
+        }
+        
+        _queues.resize(max_level + 1);
+      }
+      
+      void alloc_scratch() {
+        std::unordered_map<size_t, size_t> indices;
+        for (Instr& instr : _program) {
+          size_t width = _values[instr.result].width();
+          auto it = indices.find(width);
+          if (it == indices.end()) {
+            it = indices.emplace(width, _scratch.size()).first;
+            _scratch.emplace_back(width);
+          }
+          instr.scratch = it->second;
+        }
+      }
+      
+      // Builds the fanout lists used by the event driven mode. The fanout of
+      // a slot is stored in _fanouts[_fanout_offsets[slot]..._fanout_offsets[slot + 1]].
+      void build_fanouts() {
+        _fanout_offsets.resize(_values.size() + 1, 0);
+        for (const Instr& instr : _program) {
+          for (size_t it = 0; it < instr.arg_count; it++) {
+            _fanout_offsets[instr.args[it] + 1]++;
+          }
+        }
+        for (size_t it = 1; it < _fanout_offsets.size(); it++) {
+          _fanout_offsets[it] += _fanout_offsets[it - 1];
+        }
+        
+        std::vector<size_t> offsets = _fanout_offsets;
+        _fanouts.resize(_fanout_offsets.back());
+        _memory_readers.resize(_memories.size());
+        for (size_t index = 0; index < _program.size(); index++) {
+          const Instr& instr = _program[index];
+          for (size_t it = 0; it < instr.arg_count; it++) {
+            _fanouts[offsets[instr.args[it]]++] = index;
+          }
+          if (instr.is_read) {
+            _memory_readers[instr.memory].push_back(index);
+          }
+        }
+        
+        _queued.resize(_program.size(), false);
+      }
+      
+      void schedule(size_t index) {
+        if (!_queued[index]) {
+          _queued[index] = true;
+          _queues[_program[index].level].push_back(index);
+        }
+      }
+      
+      void schedule_fanouts(size_t slot) {
+        for (size_t it = _fanout_offsets[slot]; it < _fanout_offsets[slot + 1]; it++) {
+          schedule(_fanouts[it]);
+        }
+      }
+      
+      void clear_queues() {
+        for (std::vector<size_t>& queue : _queues) {
+          for (size_t index : queue) {
+            _queued[index] = false;
+          }
+          queue.clear();
+        }
+      }
+      
+      // Evaluates instr into into, which must already have the width of the
+      // result. Wide values are computed in place without allocating.
+      void eval(const Instr& instr, BitString& into) {
+        _eval_count++;
+        
+        #define arg(index) (_values[instr.args[(index)]])
+        
+        if (instr.is_read) {
+          _memories[instr.memory].read_into(into, arg(0).as_uint64());
+          return;
+        }
+        
+        switch (instr.kind) {
+          case Op::Kind::And: arg(0).and_into(into, arg(1)); break;
+          case Op::Kind::Or: arg(0).or_into(into, arg(1)); break;
+          case Op::Kind::Xor: arg(0).xor_into(into, arg(1)); break;
+          case Op::Kind::Not: arg(0).not_into(into); break;
+          case Op::Kind::Add: arg(0).add_into(into, arg(1)); break;
+          case Op::Kind::Sub: arg(0).sub_into(into, arg(1)); break;
+          case Op::Kind::Mul: arg(0).mul_u_into(into, arg(1)); break;
+          case Op::Kind::Eq: into.set(0, arg(0).eq(arg(1))); break;
+          case Op::Kind::LtU: into.set(0, arg(0).lt_u(arg(1))); break;
+          case Op::Kind::LtS: into.set(0, arg(0).lt_s(arg(1))); break;
+          case Op::Kind::Concat: arg(0).concat_into(into, arg(1)); break;
+          case Op::Kind::Slice: arg(0).slice_width_into(into, arg(1).as_uint64(), arg(2).as_uint64()); break;
+          case Op::Kind::Shl: arg(0).shl_into(into, arg(1).as_uint64()); break;
+          case Op::Kind::ShrU: arg(0).shr_u_into(into, arg(1).as_uint64()); break;
+          case Op::Kind::ShrS: arg(0).shr_s_into(into, arg(1).as_uint64()); break;
+          case Op::Kind::Select: into = arg(0)[0] ? arg(1) : arg(2); break;
+        }
+        
+        #undef arg
+      }
+      
+      void sweep() {
+        for (const Instr& instr : _program) {
+          eval(instr, _values[instr.result]);
+        }
+        
+        if (_event_driven) {
+          clear_queues();
+        }
+        _is_dirty = false;
+      }
+      
+      // Evaluates all scheduled instructions level by level. Instructions
+      // only schedule instructions of higher levels, so each queue is
+      // complete once it is reached.
+      void propagate() {
+        for (std::vector<size_t>& queue : _queues) {
+          for (size_t index : queue) {
+            const Instr& instr = _program[index];
+            _queued[index] = false;
+            BitString& result = _scratch[instr.scratch];
+            eval(instr, result);
+            if (result != _values[instr.result]) {
+              std::swap(_values[instr.result], result);
+              schedule_fanouts(instr.result);
+            }
+          }
+          queue.clear();
+        }
+      }
+      
+      void assign(size_t slot, const BitString& value) {
+        if (_event_driven && !_is_dirty) {
+          if (_values[slot] != value) {
+            _values[slot] = value;
+            schedule_fanouts(slot);
+          }
+        } else {
+          _values[slot] = value;
+        }
+      }
+      
+      bool step() {
+        if (_event_driven && !_is_dirty) {
+          propagate();
+        } else {
+          sweep();
+        }
+        
+        for (size_t it = 0; it < _clock_slots.size(); it++) {
+          bool clock = _values[_clock_slots[it]][0];
+          _clock_edges[it] = clock && !_prev_clocks[it];
+          _prev_clocks[it] = clock;
+        }
+        
+        bool changed = false;
+        for (size_t it = 0; it < _reg_slots.size(); it++) {
+          if (_clock_edges[_reg_clocks[it]]) {
+            _staged_regs[it] = _values[_next_slots[it]];
+            changed = true;
+          }
+        }
+        
+        for (const Write& write : _writes) {
+          if (_clock_edges[write.clock] && _values[write.enable][0]) {
+            uint64_t address = _values[write.address].as_uint64();
+            if (_memories[write.memory].write(address, _values[write.value]) && _event_driven) {
+              for (size_t index : _memory_readers[write.memory]) {
+                schedule(index);
+              }
+            }
+            changed = true;
+          }
+        }
+        
+        for (size_t it = 0; it < _reg_slots.size(); it++) {
+          if (_clock_edges[_reg_clocks[it]]) {
+            assign(_reg_slots[it], _staged_regs[it]);
+          }
+        }
+        
+        return changed;
+      }
+    
+    public:
+      CompiledSimulation(Module& module, const std::vector<const Value*>& probes = {}):
+          _module(module),
+          _outputs(module.outputs().size()) {
+        
+        for (const Input* input : _module.inputs()) {
+          _input_slots.push_back(alloc(input));
+        }
+        
+        for (const Reg* reg : _module.regs()) {
+          _reg_slots.push_back(alloc(reg));
+        }
+        
+        for (const Memory* memory : _module.memories()) {
+          _memory_indices[memory] = _memories.size();
+          _memories.emplace_back(memory);
+        }
+        
+        std::vector<Instr> program;
+        for (const Reg* reg : _module.regs()) {
+          compile(reg->clock, program);
+          compile(reg->next, program);
+        }
+        
+        for (const Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            compile(write.clock, program);
+            compile(write.address, program);
+            compile(write.enable, program);
+            compile(write.value, program);
+          }
+        }
+        
+        for (const Output& output : _module.outputs()) {
+          compile(output.value, program);
+          _output_slots.push_back(_slots.at(output.value));
+        }
+        
+        for (const Value* probe : probes) {
+          compile(probe, program);
+        }
+        
+        levelize(program);
+        alloc_scratch();
+        build_fanouts();
+        
+        for (const Reg* reg : _module.regs()) {
+          _next_slots.push_back(_slots.at(reg->next));
+          _reg_clocks.push_back(clock_index(reg->clock));
+          _staged_regs.emplace_back(reg->width);
+        }
+        
+        for (const Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            Write instr;
+            instr.memory = _memory_indices.at(memory);
+            instr.clock = clock_index(write.clock);
+            instr.address = _slots.at(write.address);
+            instr.enable = _slots.at(write.enable);
+            instr.value = _slots.at(write.value);
+            _writes.push_back(instr);
+          }
+        }
+        
+        _prev_clocks.resize(_clock_slots.size(), false);
+        _clock_edges.resize(_clock_slots.size(), false);
+        
+        reset();
+      }
+      
+      size_t slot_count() const { return _values.size(); }
+      size_t instr_count() const { return _program.size(); }
+      
+      // Number of instructions evaluated since construction
+      size_t eval_count() const { return _eval_count; }
+      
+      bool is_event_driven() const { return _event_driven; }
+      
+      // Enables or disables event driven evaluation. Designs with low
+      // activity factors benefit from only re-evaluating changed cones.
+      void set_event_driven(bool event_driven) {
+        _event_driven = event_driven;
+        _is_dirty = true;
+      }
+      
+      std::vector<BitString> regs() const {
+        std::vector<BitString> regs;
+        regs.reserve(_reg_slots.size());
+        for (size_t slot : _reg_slots) {
+          regs.push_back(_values[slot]);
+        }
+        return regs;
+      }
+      
+      const std::vector<MemoryData>& memories() const { return _memories; }
+      const std::vector<BitString>& outputs() const { return _outputs; }
+      
+      const BitString& operator[](const Value* value) const {
+        if (!_slots.has(value)) {
+          throw_error(Error, "Value is not part of the compiled simulation. Use a probe to include it.");
+        }
+        return _values[_slots.at(value)];
+      }
+      
+      const BitString& find_output(const std::string& name) const {
+        for (size_t it = 0; it < _outputs.size(); it++) {
+          if (_module.outputs()[it].name == name) {
+            return _outputs[it];
+          }
+        }
+        
+        throw_error(Error, "Output " << name << " not found");
+      }
+      
+      const BitString& find_reg(const std::string& name) const {
+        for (size_t it = 0; it < _reg_slots.size(); it++) {
+          if (_module.regs()[it]->name == name) {
+            return _values[_reg_slots[it]];
+          }
+        }
+        
+        throw_error(Error, "Reg " << name << " not found");
+      }
+      
+      void reset() {
+        size_t it = 0;
+        for (const Reg* reg : _module.regs()) {
+          _values[_reg_slots[it++]] = reg->initial;
+        }
+        
+        it = 0;
+        for (const Memory* memory : _module.memories()) {
+          _memories[it++] = MemoryData(memory);
+        }
+        
+        _is_dirty = true;
+      }
+      
+      void update(const std::vector<BitString>& inputs) {
+        if (inputs.size() != _input_slots.size()) {
+          throw_error(Error, "Module has " << _input_slots.size() << " inputs, but simulation only got " << inputs.size() << " values.");
+        }
+        
+        for (size_t it = 0; it < inputs.size(); it++) {
+          if (inputs[it].width() != _values[_input_slots[it]].width()) {
+            throw_error(Error, "Input " << _module.inputs()[it]->name << " has width " << _values[_input_slots[it]].width() << ", but got value of width " << inputs[it].width());
+          }
+          assign(_input_slots[it], inputs[it]);
+        }
+        
+        while (step()) {}
+        
+        for (size_t it = 0; it < _output_slots.size(); it++) {
+          _outputs[it] = _values[_output_slots[it]];
+        }
+      }
+      
+      void update(const std::unordered_map<std::string, BitString>& inputs) {
+        if (inputs.size() != _module.inputs().size()) {
+          throw_error(Error, "Module has " << _module.inputs().size() << " inputs, but simulation only got " << inputs.size() << " values.");
+        }
+        
+        std::vector<BitString> values;
+        values.reserve(inputs.size());
+        for (const Input* input : _module.inputs()) {
+          values.push_back(inputs.at(input->name));
+        }
+        update(values);
+      }
+    };
+    
     class VCDWriter {
     private:
       std::ostream& _stream;
@@ -1730,7 +3662,7 @@ namespace hdl {
         _stream << "$timescale " << _timescale << " $end" << std::endl;
         _stream << "$scope module " << _module.name() << " $end" << std::endl;
         for (const Probe& probe : _probes) {
-          const Reg* reg = dynamic_cast<const Reg*>(probe.value);
+          const Reg* reg = dyn_cast<Reg>(probe.value);
           
           _stream << "$var " << (reg ? "reg" : "wire") << " " << probe.value->width << " ";
           print_id(_ids.at(probe.value));
@@ -1741,7 +3673,7 @@ namespace hdl {
         _stream << "$dumpvars" << std::endl;
         
         for (const auto& [value, id] : _ids) {
-          if (const Reg* reg = dynamic_cast<const Reg*>(value)) {
+          if (const Reg* reg = dyn_cast<Reg>(value)) {
             _prev[value] = reg->initial;
           } else {
             _prev[value] = BitString(value->width);
@@ -1754,7 +3686,7 @@ namespace hdl {
         _header_written = true;
       }
       
-      void write(const std::unordered_map<const Value*, BitString>& values) {
+      void write(const Simulation::Values& values) {
         if (!_header_written) {
           write_header();
         }
@@ -1771,11 +3703,12 @@ namespace hdl {
         
         _timestamp++;
       }
-      
+    
     };
   }
 }
 
+#undef def_classof
 #undef throw_error
 
 #endif
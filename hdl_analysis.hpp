@@ -16,6 +16,7 @@
 #define HDL_ANALYSIS_HPP
 
 #include <map>
+#include <optional>
 #include <unordered_set>
 
 #include "hdl.hpp"
@@ -47,16 +48,16 @@ namespace hdl {
         }
         
         AffineValue affine_value(value, BitString::one(value->width));
-        if (Constant* constant = dynamic_cast<Constant*>(value)) {
+        if (Constant* constant = dyn_cast<Constant>(value)) {
           affine_value = AffineValue(constant->value);
-        } else if (Op* op = dynamic_cast<Op*>(value)) {
+        } else if (Op* op = dyn_cast<Op>(value)) {
           #define arg(index) build(op->args[index], affine)
           
           switch (op->kind) {
             case Op::Kind::Add: affine_value = arg(0) + arg(1); break;
             case Op::Kind::Sub: affine_value = arg(0) - arg(1); break;
             case Op::Kind::Shl:
-              if (Constant* constant = dynamic_cast<Constant*>(op->args[1])) {
+              if (Constant* constant = dyn_cast<Constant>(op->args[1])) {
                 BitString factor = BitString::one(op->args[0]->width);
                 factor = factor << constant->value.as_uint64();
                 affine_value = arg(0) * factor;
@@ -220,17 +221,17 @@ namespace hdl {
           
           _values.insert(value);
           
-          if (Reg* reg = dynamic_cast<Reg*>(value)) {
+          if (Reg* reg = dyn_cast<Reg>(value)) {
             _regs.insert(reg);
             if (_indirect) {
               push(reg->clock);
               push(reg->next);
             }
-          } else if (Op* op = dynamic_cast<Op*>(value)) {
+          } else if (Op* op = dyn_cast<Op>(value)) {
             for (Value* arg : op->args) {
               push(arg);
             }
-          } else if (Memory::Read* read = dynamic_cast<Memory::Read*>(value)) {
+          } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
             push(read->address);
             if (_memories.find(read->memory) == _memories.end()) {
               _memories.insert(read->memory);
@@ -0,0 +1,231 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_BALANCE_HPP
+#define HDL_BALANCE_HPP
+
+#include <inttypes.h>
+#include <vector>
+#include <queue>
+#include <tuple>
+
+#include "hdl.hpp"
+
+namespace hdl {
+  namespace balance {
+    // Tree height reduction. Trees of associative operators of the same kind
+    // (e.g. And chains produced by the DSL or Concat chains produced by the
+    // yosys frontend) are rebuilt as balanced trees. Operators which are
+    // used more than once are kept as leaves, so no logic is duplicated.
+    class Balancing {
+    public:
+      struct Stats {
+        size_t trees = 0;
+        size_t depth_before = 0;
+        size_t depth_after = 0;
+      };
+    private:
+      Module& _module;
+      NodeMap<size_t> _uses;
+      NodeMap<bool> _is_interior;
+      NodeMap<size_t> _levels;
+      
+      // Levels start out as Module::levels. Values created while balancing
+      // get their level from the known levels of their arguments, so that
+      // existing operators returned by hashconsing are not traversed.
+      size_t level(Value* value) {
+        if (const size_t* level = _levels.find(value)) {
+          return *level;
+        }
+        auto known = [&](Value* arg){
+          const size_t* level = _levels.find(arg);
+          return level == nullptr ? 0 : *level;
+        };
+        size_t level = 0;
+        if (Op* op = dyn_cast<Op>(value)) {
+          for (Value* arg : op->args) {
+            level = std::max(level, known(arg) + 1);
+          }
+        } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+          level = known(read->address) + 1;
+        }
+        _levels[value] = level;
+        return level;
+      }
+      
+      void count_uses() {
+        auto use = [&](Value* value){
+          _uses[value]++;
+        };
+        
+        for (Value* value : _module.topo_order()) {
+          if (Op* op = dyn_cast<Op>(value)) {
+            for (Value* arg : op->args) {
+              use(arg);
+              if (Op* arg_op = dyn_cast<Op>(arg)) {
+                if (arg_op->kind == op->kind && Op::is_associative(op->kind)) {
+                  _is_interior[arg] = true;
+                }
+              }
+            }
+          } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+            use(read->address);
+          }
+        }
+        
+        for (const Output& output : _module.outputs()) {
+          use(output.value);
+        }
+        for (Reg* reg : _module.regs()) {
+          use(reg->clock);
+          if (reg->next != nullptr) {
+            use(reg->next);
+          }
+        }
+        for (Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            use(write.clock);
+            use(write.address);
+            use(write.enable);
+            use(write.value);
+          }
+        }
+      }
+      
+      bool is_interior(Value* value) const {
+        const bool* is_interior = _is_interior.find(value);
+        return is_interior && *is_interior && _uses.at(value) == 1;
+      }
+      
+      // Collects the leaves of the tree rooted at op from left to right.
+      // Returns the height of the tree.
+      size_t collect(Op* root, std::vector<Value*>& leaves) const {
+        size_t height = 0;
+        std::vector<std::pair<Value*, size_t>> stack = {{root, 1}};
+        while (!stack.empty()) {
+          auto [value, depth] = stack.back();
+          stack.pop_back();
+          if (value != root && !is_interior(value)) {
+            leaves.push_back(value);
+            continue;
+          }
+          height = std::max(height, depth);
+          Op* op = cast<Op>(value);
+          for (size_t it = op->args.size(); it-- > 0; ) {
+            stack.emplace_back(op->args[it], depth + 1);
+          }
+        }
+        return height;
+      }
+      
+      Value* op(Op::Kind kind, Value* a, Value* b) {
+        Value* value = _module.op(kind, {a, b});
+        if (!_levels.has(value)) {
+          _levels[value] = std::max(level(a), level(b)) + 1;
+        }
+        return value;
+      }
+      
+      // Concat is not commutative, so the order of the leaves is kept
+      Value* build_ordered(Op::Kind kind, const std::vector<Value*>& leaves, size_t begin, size_t end) {
+        if (end - begin == 1) {
+          return leaves[begin];
+        }
+        size_t mid = begin + (end - begin) / 2;
+        return op(kind,
+          build_ordered(kind, leaves, begin, mid),
+          build_ordered(kind, leaves, mid, end)
+        );
+      }
+      
+      // Combines the two shallowest subtrees first, so that late arriving
+      // leaves are placed close to the root
+      Value* build_commutative(Op::Kind kind, const std::vector<Value*>& leaves) {
+        using Entry = std::tuple<size_t, size_t, Value*>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        size_t order = 0;
+        for (Value* leaf : leaves) {
+          queue.emplace(level(leaf), order++, leaf);
+        }
+        while (queue.size() > 1) {
+          Value* a = std::get<2>(queue.top());
+          queue.pop();
+          Value* b = std::get<2>(queue.top());
+          queue.pop();
+          Value* value = op(kind, a, b);
+          queue.emplace(level(value), order++, value);
+        }
+        return std::get<2>(queue.top());
+      }
+      
+      static size_t log2_ceil(size_t count) {
+        size_t log2 = 0;
+        while ((size_t(1) << log2) < count) {
+          log2++;
+        }
+        return log2;
+      }
+    public:
+      Balancing(Module& module): _module(module), _uses(module), _is_interior(module), _levels(module) {}
+      
+      // Rewrites the outputs, register clocks and next values and memory writes.
+      // Replaced values are removed by the next Module::gc.
+      Stats run() {
+        Stats stats;
+        stats.depth_before = _module.depth();
+        
+        count_uses();
+        _levels = _module.levels();
+        
+        NodeMap<Value*> mapped(_module);
+        std::vector<Value*> order = _module.topo_order();
+        for (Value* value : order) {
+          Value* result = value;
+          if (Op* op = dyn_cast<Op>(value)) {
+            std::vector<Value*> leaves;
+            size_t height = 0;
+            if (Op::is_associative(op->kind) && !is_interior(op)) {
+              height = collect(op, leaves);
+            }
+            
+            if (leaves.size() >= 3 && height > log2_ceil(leaves.size())) {
+              for (Value*& leaf : leaves) {
+                leaf = mapped.at(leaf);
+              }
+              if (Op::is_commutative(op->kind)) {
+                result = build_commutative(op->kind, leaves);
+              } else {
+                result = build_ordered(op->kind, leaves, 0, leaves.size());
+              }
+              stats.trees++;
+            } else {
+              result = _module.rebuild(value, mapped);
+            }
+          } else {
+            result = _module.rebuild(value, mapped);
+          }
+          mapped[value] = result;
+          level(result);
+        }
+        
+        _module.remap_roots(mapped);
+        
+        stats.depth_after = _module.depth();
+        return stats;
+      }
+    };
+  }
+}
+
+#endif
@@ -18,9 +18,17 @@
 #include <inttypes.h>
 #include <string.h>
 #include <vector>
+#include <utility>
+#include <algorithm>
 #include <string>
 #include <sstream>
 
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
 #define throw_error(Error, msg) { \
   std::ostringstream error_message; \
   error_message << msg; \
@@ -31,11 +39,26 @@ namespace hdl {
   class Error: public std::runtime_error {
     using std::runtime_error::runtime_error;
   };
+  
+  // Finalizer of splitmix64. Every input bit affects every output bit.
+  inline uint64_t hash_mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    value ^= value >> 31;
+    return value;
+  }
+  
+  // Order dependent combination of two hashes
+  inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+    return hash_mix(seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+  }
 
   class BitString {
   public:
-    using Word = uint32_t;
-    using DoubleWord = uint64_t;
+    using Word = uint64_t;
+    __extension__ typedef unsigned __int128 DoubleWord;
     static constexpr const size_t WORD_WIDTH = sizeof(Word) * 8;
     
     class WordArray {
@@ -70,13 +93,38 @@ namespace hdl {
         }
       }
       
+      WordArray(WordArray&& other) noexcept: _size(other._size) {
+        if (is_small()) {
+          memcpy(_small, other._small, sizeof(_small));
+        } else {
+          _data = other._data;
+          other._data = nullptr;
+        }
+        // The moved from array is empty, so it can be reused
+        other._size = 0;
+        memset(other._small, 0, sizeof(other._small));
+      }
+      
       WordArray& operator=(const WordArray& other) {
+        if (&other != this) {
+          if (_size == other._size && (is_small() || _data != nullptr)) {
+            // Reuse the existing buffer
+            memcpy(begin(), other.begin(), sizeof(Word) * _size);
+          } else {
+            this->~WordArray();
+            new (this) WordArray(other);
+          }
+        }
+        return *this;
+      }
+      
+      WordArray& operator=(WordArray&& other) noexcept {
         if (&other != this) {
           this->~WordArray();
-          new (this) WordArray(other);
+          new (this) WordArray(std::move(other));
         }
         return *this;
-      } 
+      }
       
       ~WordArray() {
         if (!is_small() && _data != nullptr) {
@@ -114,10 +162,12 @@ namespace hdl {
     size_t _width = 0;
     WordArray _data;
     
+  public:
     static size_t word_count(size_t width) {
       return width / WORD_WIDTH + (width % WORD_WIDTH == 0 ? 0 : 1);
     }
     
+  private:
     static Word mask_lower(size_t bits) {
       return bits == WORD_WIDTH ? ~Word(0) : (Word(1) << bits) - 1;
     }
@@ -125,10 +175,136 @@ namespace hdl {
     inline Word high_word_mask() const {
       return _width % WORD_WIDTH == 0 ? ~Word(0) : mask_lower(_width % WORD_WIDTH);
     }
+    
+    inline Word masked_word(size_t index) const {
+      return index + 1 == _data.size() ? _data[index] & high_word_mask() : _data[index];
+    }
+    
+    // Bulk kernels operate on VECTOR_WORDS words at a time using SSE2 or
+    // AVX2 if available.
+    
+    #if defined(__AVX2__)
+      using Vector = __m256i;
+      static constexpr const size_t VECTOR_WORDS = 4;
+      
+      static inline Vector vector_load(const Word* words) { return _mm256_loadu_si256((const __m256i*) words); }
+      static inline void vector_store(Word* words, Vector vector) { _mm256_storeu_si256((__m256i*) words, vector); }
+      static inline Vector vector_and(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+      static inline Vector vector_or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+      static inline Vector vector_xor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+      static inline Vector vector_not(Vector a) { return _mm256_xor_si256(a, _mm256_set1_epi64x(-1)); }
+      static inline bool vector_is_zero(Vector a) { return _mm256_testz_si256(a, a); }
+      static inline Vector vector_shl(Vector a, size_t shift) { return _mm256_sll_epi64(a, _mm_cvtsi64_si128(shift)); }
+      static inline Vector vector_shr(Vector a, size_t shift) { return _mm256_srl_epi64(a, _mm_cvtsi64_si128(shift)); }
+    #elif defined(__SSE2__)
+      using Vector = __m128i;
+      static constexpr const size_t VECTOR_WORDS = 2;
+      
+      static inline Vector vector_load(const Word* words) { return _mm_loadu_si128((const __m128i*) words); }
+      static inline void vector_store(Word* words, Vector vector) { _mm_storeu_si128((__m128i*) words, vector); }
+      static inline Vector vector_and(Vector a, Vector b) { return _mm_and_si128(a, b); }
+      static inline Vector vector_or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+      static inline Vector vector_xor(Vector a, Vector b) { return _mm_xor_si128(a, b); }
+      static inline Vector vector_not(Vector a) { return _mm_xor_si128(a, _mm_set1_epi64x(-1)); }
+      static inline bool vector_is_zero(Vector a) { return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) == 0xffff; }
+      static inline Vector vector_shl(Vector a, size_t shift) { return _mm_sll_epi64(a, _mm_cvtsi64_si128(shift)); }
+      static inline Vector vector_shr(Vector a, size_t shift) { return _mm_srl_epi64(a, _mm_cvtsi64_si128(shift)); }
+    #else
+      using Vector = Word;
+      static constexpr const size_t VECTOR_WORDS = 1;
+      
+      static inline Vector vector_load(const Word* words) { return *words; }
+      static inline void vector_store(Word* words, Vector vector) { *words = vector; }
+      static inline Vector vector_and(Vector a, Vector b) { return a & b; }
+      static inline Vector vector_or(Vector a, Vector b) { return a | b; }
+      static inline Vector vector_xor(Vector a, Vector b) { return a ^ b; }
+      static inline Vector vector_not(Vector a) { return ~a; }
+      static inline bool vector_is_zero(Vector a) { return a == 0; }
+      static inline Vector vector_shl(Vector a, size_t shift) { return a << shift; }
+      static inline Vector vector_shr(Vector a, size_t shift) { return a >> shift; }
+    #endif
+    
+    #define WORD_KERNEL(name, op) \
+      static inline void name##_words(Word* result, const Word* a, const Word* b, size_t count) { \
+        size_t it = 0; \
+        for (; it + VECTOR_WORDS <= count; it += VECTOR_WORDS) { \
+          vector_store(result + it, vector_##name(vector_load(a + it), vector_load(b + it))); \
+        } \
+        for (; it < count; it++) { \
+          result[it] = a[it] op b[it]; \
+        } \
+      }
+    
+    WORD_KERNEL(and, &)
+    WORD_KERNEL(or, |)
+    WORD_KERNEL(xor, ^)
+    
+    #undef WORD_KERNEL
+    
+    static inline void not_words(Word* result, const Word* a, size_t count) {
+      size_t it = 0;
+      for (; it + VECTOR_WORDS <= count; it += VECTOR_WORDS) {
+        vector_store(result + it, vector_not(vector_load(a + it)));
+      }
+      for (; it < count; it++) {
+        result[it] = ~a[it];
+      }
+    }
+    
+    static inline bool equal_words(const Word* a, const Word* b, size_t count) {
+      size_t it = 0;
+      for (; it + VECTOR_WORDS <= count; it += VECTOR_WORDS) {
+        if (!vector_is_zero(vector_xor(vector_load(a + it), vector_load(b + it)))) {
+          return false;
+        }
+      }
+      for (; it < count; it++) {
+        if (a[it] != b[it]) {
+          return false;
+        }
+      }
+      return true;
+    }
+    
+    // Checks whether all words are zero, or all ones if invert is set
+    template <bool invert>
+    static inline bool is_zero_words(const Word* a, size_t count) {
+      size_t it = 0;
+      for (; it + VECTOR_WORDS <= count; it += VECTOR_WORDS) {
+        Vector vector = vector_load(a + it);
+        if (!vector_is_zero(invert ? vector_not(vector) : vector)) {
+          return false;
+        }
+      }
+      for (; it < count; it++) {
+        if ((invert ? ~a[it] : a[it]) != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
   public:
     BitString() {}
     explicit BitString(size_t width): _width(width), _data(word_count(width)) {}
     
+    BitString(const BitString& other) = default;
+    BitString& operator=(const BitString& other) = default;
+    
+    // Leaves other as an empty BitString of width 0
+    BitString(BitString&& other) noexcept:
+        _width(other._width), _data(std::move(other._data)) {
+      other._width = 0;
+    }
+    
+    BitString& operator=(BitString&& other) noexcept {
+      if (&other != this) {
+        _width = other._width;
+        _data = std::move(other._data);
+        other._width = 0;
+      }
+      return *this;
+    }
+    
     BitString(const std::string& string):
         _width(string.size()), _data(word_count(string.size())) {
       for (size_t it = 0; it < string.size(); it++) {
@@ -152,7 +328,7 @@ namespace hdl {
     template <class T>
     static BitString from_uint(T value) {
       BitString bit_string(sizeof(T) * 8);
-      if (sizeof(T) > sizeof(Word)) {
+      if constexpr (sizeof(T) > sizeof(Word)) {
         for (size_t it = 0; it * WORD_WIDTH < sizeof(T) * 8; it++) {
           bit_string._data[it] = Word(value & T(~Word(0)));
           value >>= WORD_WIDTH;
@@ -229,7 +405,7 @@ namespace hdl {
       if (index >= _width) {
         throw_error(Error, "Index " << index << " out of bounds for BitString of width " << _width);
       }
-      return (_data[index / WORD_WIDTH] & (1 << index % WORD_WIDTH)) != 0;
+      return (_data[index / WORD_WIDTH] & (Word(1) << index % WORD_WIDTH)) != 0;
     }
     
     inline bool operator[](size_t index) const { return at(index); }
@@ -239,11 +415,16 @@ namespace hdl {
         throw_error(Error, "Index " << index << " out of bounds for BitString of width " << _width);
       }
       if (value) {
-        _data[index / WORD_WIDTH] |= 1 << index % WORD_WIDTH;
+        _data[index / WORD_WIDTH] |= Word(1) << index % WORD_WIDTH;
       } else {
-        _data[index / WORD_WIDTH] &= ~(1 << index % WORD_WIDTH);
+        _data[index / WORD_WIDTH] &= ~(Word(1) << index % WORD_WIDTH);
       }
     }
+    
+    // Sets all bits to zero without changing the width
+    void set_zero() {
+      std::fill(_data.begin(), _data.end(), 0);
+    }
   
   private:
     void ensure_same_width(const BitString& other) const {
@@ -253,55 +434,99 @@ namespace hdl {
     }
   public:
   
-    #define BINOP(op) \
-      BitString operator op(const BitString& other) const { \
+    // The *_into variants store their result in into, which is resized to the
+    // width of the result if necessary. into may alias the arguments.
+    // Reusing into avoids allocating a new buffer for wide values.
+    
+    #define BINOP(op, name) \
+      void name##_into(BitString& into, const BitString& other) const { \
         ensure_same_width(other); \
+        into.prepare(_width); \
+        name##_words(into._data.begin(), _data.begin(), other._data.begin(), _data.size()); \
+      } \
+      \
+      BitString operator op(const BitString& other) const { \
         BitString result(_width); \
-        for (size_t it = 0; it < _data.size(); it++) { \
-          result._data[it] = _data[it] op other._data[it]; \
-        } \
+        name##_into(result, other); \
         return result; \
+      } \
+      \
+      BitString& operator op##=(const BitString& other) { \
+        name##_into(*this, other); \
+        return *this; \
       }
     
-    BINOP(&);
-    BINOP(|);
-    BINOP(^);
+    BINOP(&, and);
+    BINOP(|, or);
+    BINOP(^, xor);
     
     #undef BINOP
     
+    void not_into(BitString& into) const {
+      into.prepare(_width);
+      not_words(into._data.begin(), _data.begin(), _data.size());
+    }
+    
     BitString operator~() const {
       BitString result(_width);
-      for (size_t it = 0; it < _data.size(); it++) {
-        result._data[it] = ~_data[it];
-      }
+      not_into(result);
       return result;
     }
   
   private:
+    // Ensures that the BitString has the given width. The contents are
+    // unspecified afterwards unless the width is unchanged.
+    inline void prepare(size_t width) {
+      if (_width != width) {
+        *this = BitString(width);
+      }
+    }
+    
     template <bool initial_carry, bool invert> 
-    BitString add_carry(const BitString& other) const {
+    void add_carry_into(BitString& into, const BitString& other) const {
       ensure_same_width(other);
       
-      BitString sum(_width);
+      into.prepare(_width);
       DoubleWord carry = initial_carry ? 1 : 0;
       for (size_t it = 0; it < _data.size(); it++) {
         DoubleWord word_sum = DoubleWord(_data[it]) + DoubleWord(invert ? ~other._data[it] : other._data[it]) + carry;
-        sum._data[it] = Word(word_sum) & ~Word(0);
+        into._data[it] = Word(word_sum) & ~Word(0);
         carry = word_sum >> WORD_WIDTH;
       }
-      return sum;
     }
   public:
+    void add_into(BitString& into, const BitString& other) const {
+      add_carry_into<false, false>(into, other);
+    }
+    
+    void sub_into(BitString& into, const BitString& other) const {
+      add_carry_into<true, true>(into, other);
+    }
+    
     BitString operator+(const BitString& other) const {
-      return add_carry<false, false>(other);
+      BitString sum(_width);
+      add_into(sum, other);
+      return sum;
     }
     
     BitString operator-(const BitString& other) const {
-      return add_carry<true, true>(other);
+      BitString difference(_width);
+      sub_into(difference, other);
+      return difference;
+    }
+    
+    BitString& operator+=(const BitString& other) {
+      add_into(*this, other);
+      return *this;
+    }
+    
+    BitString& operator-=(const BitString& other) {
+      sub_into(*this, other);
+      return *this;
     }
     
   private:
-    inline void shl_into(BitString& into, size_t shift) const {
+    inline void or_shl_into(BitString& into, size_t shift) const {
       size_t inner_shift = shift % WORD_WIDTH;
       size_t outer_shift = shift / WORD_WIDTH;
       
@@ -313,7 +538,7 @@ namespace hdl {
       }
     }
     
-    inline void shr_u_into(BitString& into, size_t shift) const {
+    inline void or_shr_u_into(BitString& into, size_t shift) const {
       size_t inner_shift = shift % WORD_WIDTH;
       size_t outer_shift = shift / WORD_WIDTH;
       
@@ -330,6 +555,81 @@ namespace hdl {
     }
     
   public:
+    void shl_into(BitString& into, size_t shift) const {
+      into.prepare(_width);
+      size_t inner_shift = shift % WORD_WIDTH;
+      size_t outer_shift = shift / WORD_WIDTH;
+      
+      const Word* words = _data.begin();
+      Word* into_words = into._data.begin();
+      size_t it = _data.size();
+      if (inner_shift == 0) {
+        for (; it > outer_shift; it--) {
+          into_words[it - 1] = words[it - 1 - outer_shift];
+        }
+      } else {
+        // Words are written from high to low, so that into may alias this
+        for (; it >= outer_shift + 1 + VECTOR_WORDS; it -= VECTOR_WORDS) {
+          size_t offset = it - VECTOR_WORDS;
+          Vector high = vector_load(words + offset - outer_shift);
+          Vector low = vector_load(words + offset - outer_shift - 1);
+          vector_store(into_words + offset, vector_or(
+            vector_shl(high, inner_shift),
+            vector_shr(low, WORD_WIDTH - inner_shift)
+          ));
+        }
+      }
+      
+      for (; it-- > 0; ) {
+        Word word = 0;
+        if (it >= outer_shift) {
+          word = _data[it - outer_shift] << inner_shift;
+          if (it > outer_shift && inner_shift > 0) {
+            word |= _data[it - outer_shift - 1] >> (WORD_WIDTH - inner_shift);
+          }
+        }
+        into._data[it] = word;
+      }
+    }
+    
+    void shr_u_into(BitString& into, size_t shift) const {
+      into.prepare(_width);
+      size_t inner_shift = shift % WORD_WIDTH;
+      size_t outer_shift = shift / WORD_WIDTH;
+      
+      const Word* words = _data.begin();
+      Word* into_words = into._data.begin();
+      size_t it = 0;
+      // Words are written from low to high, so that into may alias this.
+      // The vectorized loop does not touch the highest word, which may
+      // contain bits above the width.
+      if (inner_shift == 0) {
+        for (; it + outer_shift + 1 < _data.size(); it++) {
+          into_words[it] = words[it + outer_shift];
+        }
+      } else {
+        for (; it + outer_shift + VECTOR_WORDS + 2 <= _data.size(); it += VECTOR_WORDS) {
+          Vector low = vector_load(words + it + outer_shift);
+          Vector high = vector_load(words + it + outer_shift + 1);
+          vector_store(into_words + it, vector_or(
+            vector_shr(low, inner_shift),
+            vector_shl(high, WORD_WIDTH - inner_shift)
+          ));
+        }
+      }
+      
+      for (; it < _data.size(); it++) {
+        Word word = 0;
+        if (it + outer_shift < _data.size()) {
+          word = masked_word(it + outer_shift) >> inner_shift;
+          if (it + outer_shift + 1 < _data.size() && inner_shift > 0) {
+            word |= masked_word(it + outer_shift + 1) << (WORD_WIDTH - inner_shift);
+          }
+        }
+        into._data[it] = word;
+      }
+    }
+    
     BitString operator<<(size_t shift) const {
       BitString result(_width);
       shl_into(result, shift);
@@ -341,9 +641,22 @@ namespace hdl {
       shr_u_into(result, shift);
       return result;
     }
+    
+    BitString& operator<<=(size_t shift) {
+      shl_into(*this, shift);
+      return *this;
+    }
+    
+    BitString& operator>>=(size_t shift) {
+      shr_u_into(*this, shift);
+      return *this;
+    }
   
   private:
     void fill_upper(size_t from_bit) {
+      if (from_bit >= _width) {
+        return;
+      }
       size_t from_word = from_bit / WORD_WIDTH;
       size_t from_inner = from_bit % WORD_WIDTH;
       
@@ -353,13 +666,17 @@ namespace hdl {
       }
     }
   public:
-    BitString shr_s(size_t shift) const {
-      BitString result = shr_u(shift);
-      
-      if (at(_width - 1)) {
-        result.fill_upper(shift >= _width ? 0 : _width - shift);
+    void shr_s_into(BitString& into, size_t shift) const {
+      bool sign = at(_width - 1);
+      shr_u_into(into, shift);
+      if (sign) {
+        into.fill_upper(shift >= _width ? 0 : _width - shift);
       }
-      
+    }
+    
+    BitString shr_s(size_t shift) const {
+      BitString result(_width);
+      shr_s_into(result, shift);
       return result;
     }
     
@@ -413,40 +730,193 @@ namespace hdl {
       }
     }
     
-    BitString mul_u(const BitString& other) const {
-      BitString result(_width + other._width);
-      for (size_t it = 0; it < _width; it++) {
-        if (at(it)) {
-          result = result + (other.zero_extend(_width + other._width) << it);
+  private:
+    // Operands with at least this many words are multiplied using Karatsuba
+    static constexpr const size_t KARATSUBA_WORDS = 32;
+    
+    // Returns *this or a copy of it in storage with the bits above the width cleared
+    const BitString& normalized(BitString& storage) const {
+      if (_data.size() == 0 || (_data.back() & ~high_word_mask()) == 0) {
+        return *this;
+      }
+      storage = *this;
+      storage._data[_data.size() - 1] &= high_word_mask();
+      return storage;
+    }
+    
+    // result[0..result_count) += a * b, discarding words beyond result_count
+    static void mul_add_schoolbook(Word* result, size_t result_count,
+                                   const Word* a, size_t a_count,
+                                   const Word* b, size_t b_count) {
+      for (size_t it = 0; it < a_count && it < result_count; it++) {
+        if (a[it] == 0) {
+          continue;
+        }
+        DoubleWord carry = 0;
+        size_t it2 = 0;
+        for (; it2 < b_count && it + it2 < result_count; it2++) {
+          DoubleWord product = DoubleWord(a[it]) * DoubleWord(b[it2]) + result[it + it2] + carry;
+          result[it + it2] = Word(product);
+          carry = product >> WORD_WIDTH;
+        }
+        for (size_t index = it + it2; carry != 0 && index < result_count; index++) {
+          DoubleWord sum = DoubleWord(result[index]) + carry;
+          result[index] = Word(sum);
+          carry = sum >> WORD_WIDTH;
+        }
+      }
+    }
+    
+    // result[0..result_count) += a, returns the carry out
+    static Word add_words(Word* result, size_t result_count, const Word* a, size_t a_count) {
+      DoubleWord carry = 0;
+      for (size_t it = 0; it < result_count && (it < a_count || carry != 0); it++) {
+        DoubleWord sum = DoubleWord(result[it]) + (it < a_count ? a[it] : 0) + carry;
+        result[it] = Word(sum);
+        carry = sum >> WORD_WIDTH;
+      }
+      return Word(carry);
+    }
+    
+    // result[0..result_count) -= a, where result >= a
+    static void sub_words(Word* result, size_t result_count, const Word* a, size_t a_count) {
+      Word borrow = 0;
+      for (size_t it = 0; it < result_count && (it < a_count || borrow != 0); it++) {
+        Word sub = it < a_count ? a[it] : 0;
+        Word diff = result[it] - sub - borrow;
+        borrow = (result[it] < sub || (result[it] == sub && borrow)) ? 1 : 0;
+        result[it] = diff;
+      }
+    }
+    
+    // result[0..a_count + b_count) = a * b, result must be zeroed
+    static void mul_words(Word* result, const Word* a, size_t a_count, const Word* b, size_t b_count) {
+      if (a_count < b_count) {
+        std::swap(a, b);
+        std::swap(a_count, b_count);
+      }
+      
+      if (b_count < KARATSUBA_WORDS) {
+        mul_add_schoolbook(result, a_count + b_count, a, a_count, b, b_count);
+        return;
+      }
+      
+      size_t split = (a_count + 1) / 2;
+      if (b_count <= split) {
+        // Unbalanced operands: Multiply b with chunks of a
+        std::vector<Word> partial(2 * b_count);
+        for (size_t offset = 0; offset < a_count; offset += b_count) {
+          size_t count = std::min(b_count, a_count - offset);
+          std::fill(partial.begin(), partial.end(), 0);
+          mul_words(partial.data(), a + offset, count, b, b_count);
+          add_words(result + offset, a_count + b_count - offset, partial.data(), count + b_count);
+        }
+        return;
+      }
+      
+      // a = a1 * B^split + a0, b = b1 * B^split + b0
+      const Word* a0 = a;
+      const Word* a1 = a + split;
+      const Word* b0 = b;
+      const Word* b1 = b + split;
+      size_t a1_count = a_count - split;
+      size_t b1_count = b_count - split;
+      
+      std::vector<Word> a_sum(split + 1, 0);
+      std::vector<Word> b_sum(split + 1, 0);
+      std::copy(a0, a0 + split, a_sum.begin());
+      std::copy(b0, b0 + split, b_sum.begin());
+      add_words(a_sum.data(), a_sum.size(), a1, a1_count);
+      add_words(b_sum.data(), b_sum.size(), b1, b1_count);
+      
+      std::vector<Word> z0(2 * split, 0);
+      std::vector<Word> z1(2 * split + 2, 0);
+      std::vector<Word> z2(a1_count + b1_count, 0);
+      mul_words(z0.data(), a0, split, b0, split);
+      mul_words(z1.data(), a_sum.data(), a_sum.size(), b_sum.data(), b_sum.size());
+      mul_words(z2.data(), a1, a1_count, b1, b1_count);
+      
+      // z1 = (a0 + a1) * (b0 + b1) - z0 - z2 = a0 * b1 + a1 * b0
+      sub_words(z1.data(), z1.size(), z0.data(), z0.size());
+      sub_words(z1.data(), z1.size(), z2.data(), z2.size());
+      
+      size_t count = a_count + b_count;
+      std::copy(z0.begin(), z0.end(), result);
+      std::copy(z2.begin(), z2.end(), result + 2 * split);
+      add_words(result + split, count - split, z1.data(), std::min(z1.size(), count - split));
+    }
+    
+    // Stores the lower into.width() bits of the product into into
+    void mul_into(BitString& into, const BitString& other) const {
+      BitString a_storage, b_storage;
+      const BitString& a = normalized(a_storage);
+      const BitString& b = other.normalized(b_storage);
+      
+      if (a._data.size() <= 1 && b._data.size() <= 1) {
+        // Fast path for operands which fit into a single word
+        DoubleWord product = DoubleWord(a._data.size() > 0 ? a._data[0] : 0) *
+                             DoubleWord(b._data.size() > 0 ? b._data[0] : 0);
+        for (size_t it = 0; it < into._data.size(); it++) {
+          into._data[it] = Word(product);
+          product >>= WORD_WIDTH;
         }
+      } else if (std::min(a._data.size(), b._data.size()) < KARATSUBA_WORDS) {
+        std::fill(into._data.begin(), into._data.end(), 0);
+        mul_add_schoolbook(
+          into._data.begin(), into._data.size(),
+          a._data.begin(), a._data.size(),
+          b._data.begin(), b._data.size()
+        );
+      } else {
+        std::vector<Word> product(a._data.size() + b._data.size(), 0);
+        mul_words(
+          product.data(),
+          a._data.begin(), a._data.size(),
+          b._data.begin(), b._data.size()
+        );
+        std::copy(product.begin(), product.begin() + into._data.size(), into._data.begin());
       }
+    }
+  public:
+    // into must not alias the arguments
+    void mul_u_into(BitString& into, const BitString& other) const {
+      into.prepare(_width + other._width);
+      mul_into(into, other);
+    }
+    
+    BitString mul_u(const BitString& other) const {
+      BitString result(_width + other._width);
+      mul_into(result, other);
       return result;
     }
     
     BitString operator*(const BitString& other) const {
       ensure_same_width(other);
-      return mul_u(other).truncate(_width);
+      BitString result(_width);
+      mul_into(result, other);
+      return result;
     }
     
-    void write(std::ostream& stream) const {
-      stream << _width << "'b";
-      for (size_t it = _width; it-- > 0;) {
-        stream << ((*this)[it] ? '1' : '0');
+  private:
+    std::string digits(size_t count) const {
+      std::string result(count, '0');
+      for (size_t it = 0; it < count; it++) {
+        if ((_data[it / WORD_WIDTH] >> (it % WORD_WIDTH)) & 1) {
+          result[count - it - 1] = '1';
+        }
       }
+      return result;
+    }
+  public:
+    void write(std::ostream& stream) const {
+      stream << _width << "'b" << digits(_width);
     }
     
     void write_short(std::ostream& stream) const {
       if (_width == 0) {
         stream << "0'b0";
       } else {
-        stream << _width << "'b";
-        size_t highest_significant_digit = _width - 1;
-        while (highest_significant_digit > 0 && !(*this)[highest_significant_digit]) {
-          highest_significant_digit--;
-        }
-        for (size_t it = highest_significant_digit + 1; it-- > 0; ) {
-          stream << ((*this)[it] ? '1' : '0');
-        }
+        stream << _width << "'b" << digits(floor_log2() + 1);
       }
     }
     
@@ -459,12 +929,12 @@ namespace hdl {
     bool operator==(const BitString& other) const {
       if (_width != other._width) {
         return false;
+      } else if (_data.size() == 0) {
+        return true;
       }
       
-      for (size_t it = 0; it + 1 < _data.size(); it++) {
-        if (_data[it] != other._data[it]) {
-          return false;
-        }
+      if (!equal_words(_data.begin(), other._data.begin(), _data.size() - 1)) {
+        return false;
       }
       
       Word mask = high_word_mask();
@@ -476,10 +946,12 @@ namespace hdl {
     }
     
     bool is_zero() const {
-      for (size_t it = 0; it + 1 < _data.size(); it++) {
-        if (_data[it] != 0) {
-          return false;
-        }
+      if (_data.size() == 0) {
+        return true;
+      }
+      
+      if (!is_zero_words<false>(_data.begin(), _data.size() - 1)) {
+        return false;
       }
       
       Word mask = high_word_mask();
@@ -487,10 +959,12 @@ namespace hdl {
     }
     
     bool is_all_ones() const {
-      for (size_t it = 0; it + 1 < _data.size(); it++) {
-        if (_data[it] != ~Word(0)) {
-          return false;
-        }
+      if (_data.size() == 0) {
+        return true;
+      }
+      
+      if (!is_zero_words<true>(_data.begin(), _data.size() - 1)) {
+        return false;
       }
       
       Word mask = high_word_mask();
@@ -498,11 +972,15 @@ namespace hdl {
     }
     
     bool is_uint(uint64_t value) const {
+      if (_data.size() == 0) {
+        return value == 0;
+      }
+      
       for (size_t it = 0; it + 1 < _data.size(); it++) {
         if (_data[it] != Word(value)) {
           return false;
         }
-        value = value >> WORD_WIDTH;
+        value = 0;
       }
       
       Word mask = high_word_mask();
@@ -510,12 +988,11 @@ namespace hdl {
     }
     
     size_t hash() const {
-      size_t value = std::hash<size_t>()(_width);
-      for (size_t it = 0; it + 1 < _data.size(); it++) {
-        value ^= std::hash<Word>()(_data[it]);
+      uint64_t value = hash_mix(_width);
+      for (size_t it = 0; it < _data.size(); it++) {
+        value = hash_combine(value, masked_word(it));
       }
-      value ^= std::hash<Word>()(_data.back() & high_word_mask());
-      return value;
+      return size_t(value);
     }
     
     bool eq(const BitString& other) const {
@@ -579,15 +1056,25 @@ namespace hdl {
       }
     }
     
+    // into must not alias the arguments
+    void concat_into(BitString& into, const BitString& other) const {
+      into.prepare(_width + other._width);
+      std::fill(into._data.begin(), into._data.end(), 0);
+      std::copy(other._data.begin(), other._data.end(), into._data.begin());
+      if (other._data.size() > 0) {
+        into._data[other._data.size() - 1] &= other.high_word_mask();
+      }
+      or_shl_into(into, other._width);
+    }
+    
     BitString concat(const BitString& other) const {
       BitString result(_width + other._width);
-      std::copy(other._data.begin(), other._data.end(), result._data.begin());
-      result._data[other._data.size() - 1] &= other.high_word_mask();
-      shl_into(result, other._width);
+      concat_into(result, other);
       return result;
     }
     
-    BitString slice_width(size_t offset, size_t width) const {
+    // into must not alias this
+    void slice_width_into(BitString& into, size_t offset, size_t width) const {
       if (offset + width > _width) {
         throw_error(Error,
           "Slice [" << (offset + width - 1) << ":" << offset << "] " <<
@@ -595,8 +1082,14 @@ namespace hdl {
         );
       }
       
+      into.prepare(width);
+      std::fill(into._data.begin(), into._data.end(), 0);
+      or_shr_u_into(into, offset);
+    }
+    
+    BitString slice_width(size_t offset, size_t width) const {
       BitString result(width);
-      shr_u_into(result, offset);
+      slice_width_into(result, offset, width);
       return result;
     }
     
@@ -619,6 +1112,63 @@ namespace hdl {
       return at(0);
     }
     
+    // Stores the value into word_count(width()) words, clearing unused upper bits
+    void store_words(Word* words) const {
+      for (size_t it = 0; it < _data.size(); it++) {
+        words[it] = _data[it];
+      }
+      if (_data.size() > 0) {
+        words[_data.size() - 1] &= high_word_mask();
+      }
+    }
+    
+    // Checks whether words stored by store_words hold the same value
+    bool equals_words(const Word* words) const {
+      if (_data.size() == 0) {
+        return true;
+      }
+      if (!equal_words(_data.begin(), words, _data.size() - 1)) {
+        return false;
+      }
+      return (_data.back() & high_word_mask()) == words[_data.size() - 1];
+    }
+    
+    static void load_words_into(BitString& into, size_t width, const Word* words) {
+      into.prepare(width);
+      for (size_t it = 0; it < into._data.size(); it++) {
+        into._data[it] = words[it];
+      }
+    }
+    
+    static BitString load_words(size_t width, const Word* words) {
+      BitString result(width);
+      load_words_into(result, width, words);
+      return result;
+    }
+    
+  private:
+    // Reads count <= WORD_WIDTH bits starting at offset
+    inline Word extract_bits(size_t offset, size_t count) const {
+      size_t index = offset / WORD_WIDTH;
+      size_t inner = offset % WORD_WIDTH;
+      Word word = _data[index] >> inner;
+      if (inner > 0 && inner + count > WORD_WIDTH) {
+        word |= _data[index + 1] << (WORD_WIDTH - inner);
+      }
+      return word & mask_lower(count);
+    }
+    
+    // Writes count <= WORD_WIDTH bits starting at offset into zeroed bits
+    inline void deposit_bits(size_t offset, size_t count, Word bits) {
+      size_t index = offset / WORD_WIDTH;
+      size_t inner = offset % WORD_WIDTH;
+      bits &= mask_lower(count);
+      _data[index] |= bits << inner;
+      if (inner > 0 && inner + count > WORD_WIDTH) {
+        _data[index + 1] |= bits >> (WORD_WIDTH - inner);
+      }
+    }
+  public:
     BitString reverse_words(size_t word_size) const {
       if (_width % word_size != 0) {
         throw_error(Error, "Width must be a multiple of word_size");
@@ -626,8 +1176,10 @@ namespace hdl {
       
       BitString result(_width);
       for (size_t word_it = 0; word_it < _width; word_it += word_size) {
-        for (size_t bit_it = 0; bit_it < word_size; bit_it++) {
-          result.set(_width - word_size - word_it + bit_it, at(word_it + bit_it));
+        size_t target = _width - word_size - word_it;
+        for (size_t bit_it = 0; bit_it < word_size; bit_it += WORD_WIDTH) {
+          size_t count = std::min(WORD_WIDTH, word_size - bit_it);
+          result.deposit_bits(target + bit_it, count, extract_bits(word_it + bit_it, count));
         }
       }
       return result;
@@ -635,35 +1187,19 @@ namespace hdl {
     
     size_t popcount() const {
       size_t count = 0;
-      for (size_t it = 0; it < _width; it++) {
-        if (at(it)) {
-          count++;
-        }
+      for (size_t it = 0; it < _data.size(); it++) {
+        count += __builtin_popcountll(masked_word(it));
       }
       return count;
     }
     
     bool is_one_hot() const {
-      bool found = false;
-      for (size_t it = 0; it < _width; it++) {
-        if (at(it)) {
-          if (found) {
-            return false;
-          } else {
-            found = true;
-          }
-        }
-      }
-      return found;
+      return popcount() == 1;
     }
     
     size_t floor_log2() const {
-      for (size_t it = _width; it-- > 0; ) {
-        if (at(it)) {
-          return it;
-        }
-      }
-      return 0;
+      size_t index = rfind_bit(true);
+      return index == _width ? 0 : index;
     }
     
     size_t ceil_log2() const {
@@ -689,18 +1225,26 @@ namespace hdl {
     inline size_t clog2() const { return ceil_log2(); }
     
     size_t find_bit(bool bit) const {
-      for (size_t it = 0; it < _width; it++) {
-        if (at(it) == bit) {
-          return it;
+      for (size_t it = 0; it < _data.size(); it++) {
+        Word word = bit ? _data[it] : ~_data[it];
+        if (it + 1 == _data.size()) {
+          word &= high_word_mask();
+        }
+        if (word != 0) {
+          return it * WORD_WIDTH + __builtin_ctzll(word);
         }
       }
       return _width;
     }
     
     size_t rfind_bit(bool bit) const {
-      for (size_t it = _width; it-- > 0; ) {
-        if (at(it) == bit) {
-          return it;
+      for (size_t it = _data.size(); it-- > 0; ) {
+        Word word = bit ? _data[it] : ~_data[it];
+        if (it + 1 == _data.size()) {
+          word &= high_word_mask();
+        }
+        if (word != 0) {
+          return it * WORD_WIDTH + WORD_WIDTH - 1 - __builtin_clzll(word);
         }
       }
       return _width;
@@ -843,6 +1387,9 @@ namespace hdl {
     }
     
     PartialBitString operator<<(size_t shift) const {
+      if (shift >= width()) {
+        return PartialBitString(BitString(width()));
+      }
       return PartialBitString(
         _known << shift | (shift > 0 ? (~BitString(shift)).zero_extend(width()) : BitString(width())),
         _value << shift
@@ -0,0 +1,621 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_CPP_HPP
+#define HDL_CPP_HPP
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "hdl.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace cpp {
+    // Runtime library included in every generated file.
+    // Values are stored in hdl_rt::Bits<W>, a fixed size array of uint64_t words.
+    // Bits above W are always zero.
+    static const char* RUNTIME = R"(#ifndef HDL_CPP_RUNTIME
+#define HDL_CPP_RUNTIME
+
+namespace hdl_rt {
+  template <size_t W>
+  struct Bits {
+    static constexpr size_t WORDS = W == 0 ? 1 : (W + 63) / 64;
+    static constexpr uint64_t HIGH_MASK = W % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << (W % 64)) - 1;
+
+    uint64_t words[WORDS] = {0};
+
+    static Bits<W> from_uint(uint64_t value) {
+      Bits<W> bits;
+      bits.words[0] = value;
+      bits.normalize();
+      return bits;
+    }
+
+    inline void normalize() { words[WORDS - 1] &= HIGH_MASK; }
+    inline uint64_t as_uint64() const { return words[0]; }
+    inline bool as_bool() const { return words[0] & 1; }
+    inline bool at(size_t index) const { return (words[index / 64] >> (index % 64)) & 1; }
+
+    bool operator==(const Bits<W>& other) const {
+      for (size_t it = 0; it < WORDS; it++) {
+        if (words[it] != other.words[it]) { return false; }
+      }
+      return true;
+    }
+
+    bool operator!=(const Bits<W>& other) const { return !(*this == other); }
+  };
+
+  inline Bits<1> from_bool(bool value) {
+    Bits<1> bits;
+    bits.words[0] = value ? 1 : 0;
+    return bits;
+  }
+
+  template <size_t R, size_t W>
+  inline Bits<R> resize(const Bits<W>& a) {
+    Bits<R> result;
+    for (size_t it = 0; it < Bits<R>::WORDS && it < Bits<W>::WORDS; it++) {
+      result.words[it] = a.words[it];
+    }
+    result.normalize();
+    return result;
+  }
+
+  template <size_t S>
+  inline uint64_t shift_amount(const Bits<S>& shift) {
+    for (size_t it = 1; it < Bits<S>::WORDS; it++) {
+      if (shift.words[it] != 0) { return ~uint64_t(0); }
+    }
+    return shift.words[0];
+  }
+
+  #define hdl_rt_bitwise(name, op) \
+    template <size_t W> \
+    inline Bits<W> name(const Bits<W>& a, const Bits<W>& b) { \
+      Bits<W> result; \
+      for (size_t it = 0; it < Bits<W>::WORDS; it++) { \
+        result.words[it] = a.words[it] op b.words[it]; \
+      } \
+      return result; \
+    }
+
+  hdl_rt_bitwise(and_, &)
+  hdl_rt_bitwise(or_, |)
+  hdl_rt_bitwise(xor_, ^)
+
+  #undef hdl_rt_bitwise
+
+  template <size_t W>
+  inline Bits<W> not_(const Bits<W>& a) {
+    Bits<W> result;
+    for (size_t it = 0; it < Bits<W>::WORDS; it++) {
+      result.words[it] = ~a.words[it];
+    }
+    result.normalize();
+    return result;
+  }
+
+  template <size_t W, bool invert>
+  inline Bits<W> add_carry(const Bits<W>& a, const Bits<W>& b, uint64_t carry) {
+    Bits<W> result;
+    if constexpr (Bits<W>::WORDS == 1) {
+      result.words[0] = a.words[0] + (invert ? ~b.words[0] : b.words[0]) + carry;
+    } else {
+      for (size_t it = 0; it < Bits<W>::WORDS; it++) {
+        uint64_t word = invert ? ~b.words[it] : b.words[it];
+        uint64_t sum = a.words[it] + word;
+        uint64_t carry_out = sum < word ? 1 : 0;
+        result.words[it] = sum + carry;
+        carry = carry_out | (result.words[it] < sum ? 1 : 0);
+      }
+    }
+    result.normalize();
+    return result;
+  }
+
+  template <size_t W>
+  inline Bits<W> add(const Bits<W>& a, const Bits<W>& b) { return add_carry<W, false>(a, b, 0); }
+
+  template <size_t W>
+  inline Bits<W> sub(const Bits<W>& a, const Bits<W>& b) { return add_carry<W, true>(a, b, 1); }
+
+  template <size_t A, size_t B>
+  inline Bits<A + B> mul(const Bits<A>& a, const Bits<B>& b) {
+    Bits<A + B> result;
+    if constexpr (A + B <= 64) {
+      result.words[0] = a.words[0] * b.words[0];
+    } else {
+      for (size_t it = 0; it < Bits<A>::WORDS; it++) {
+        unsigned __int128 carry = 0;
+        for (size_t it2 = 0; it2 < Bits<B>::WORDS && it + it2 < Bits<A + B>::WORDS; it2++) {
+          unsigned __int128 product = (unsigned __int128)a.words[it] * b.words[it2] + result.words[it + it2] + carry;
+          result.words[it + it2] = uint64_t(product);
+          carry = product >> 64;
+        }
+        if (it + Bits<B>::WORDS < Bits<A + B>::WORDS) {
+          result.words[it + Bits<B>::WORDS] = uint64_t(carry);
+        }
+      }
+    }
+    result.normalize();
+    return result;
+  }
+
+  template <size_t W>
+  inline Bits<1> eq(const Bits<W>& a, const Bits<W>& b) {
+    return from_bool(a == b);
+  }
+
+  template <size_t W>
+  inline bool lt_u_bool(const Bits<W>& a, const Bits<W>& b) {
+    for (size_t it = Bits<W>::WORDS; it-- > 0; ) {
+      if (a.words[it] != b.words[it]) {
+        return a.words[it] < b.words[it];
+      }
+    }
+    return false;
+  }
+
+  template <size_t W>
+  inline Bits<1> lt_u(const Bits<W>& a, const Bits<W>& b) {
+    return from_bool(lt_u_bool(a, b));
+  }
+
+  template <size_t W>
+  inline Bits<1> lt_s(const Bits<W>& a, const Bits<W>& b) {
+    bool sign_a = a.at(W - 1);
+    bool sign_b = b.at(W - 1);
+    if (sign_a != sign_b) {
+      return from_bool(sign_a);
+    }
+    return from_bool(lt_u_bool(a, b));
+  }
+
+  template <size_t W>
+  inline Bits<W> shl(const Bits<W>& a, uint64_t shift) {
+    Bits<W> result;
+    if (shift >= W) {
+      return result;
+    }
+    size_t outer = shift / 64;
+    size_t inner = shift % 64;
+    for (size_t it = Bits<W>::WORDS; it-- > outer; ) {
+      uint64_t word = a.words[it - outer] << inner;
+      if (inner > 0 && it > outer) {
+        word |= a.words[it - outer - 1] >> (64 - inner);
+      }
+      result.words[it] = word;
+    }
+    result.normalize();
+    return result;
+  }
+
+  template <size_t W>
+  inline Bits<W> shr_u(const Bits<W>& a, uint64_t shift) {
+    Bits<W> result;
+    if (shift >= W) {
+      return result;
+    }
+    size_t outer = shift / 64;
+    size_t inner = shift % 64;
+    for (size_t it = 0; it + outer < Bits<W>::WORDS; it++) {
+      uint64_t word = a.words[it + outer] >> inner;
+      if (inner > 0 && it + outer + 1 < Bits<W>::WORDS) {
+        word |= a.words[it + outer + 1] << (64 - inner);
+      }
+      result.words[it] = word;
+    }
+    return result;
+  }
+
+  template <size_t W>
+  inline Bits<W> shr_s(const Bits<W>& a, uint64_t shift) {
+    if (!a.at(W - 1)) {
+      return shr_u(a, shift);
+    }
+    Bits<W> ones = not_(Bits<W>());
+    return or_(shr_u(a, shift), not_(shr_u(ones, shift)));
+  }
+
+  template <size_t W, size_t S>
+  inline Bits<W> shl(const Bits<W>& a, const Bits<S>& shift) { return shl(a, shift_amount(shift)); }
+
+  template <size_t W, size_t S>
+  inline Bits<W> shr_u(const Bits<W>& a, const Bits<S>& shift) { return shr_u(a, shift_amount(shift)); }
+
+  template <size_t W, size_t S>
+  inline Bits<W> shr_s(const Bits<W>& a, const Bits<S>& shift) { return shr_s(a, shift_amount(shift)); }
+
+  template <size_t A, size_t B>
+  inline Bits<A + B> concat(const Bits<A>& high, const Bits<B>& low) {
+    return or_(resize<A + B>(low), shl(resize<A + B>(high), B));
+  }
+
+  template <size_t Offset, size_t R, size_t W>
+  inline Bits<R> slice(const Bits<W>& a) {
+    return resize<R>(shr_u(a, Offset));
+  }
+
+  template <size_t W>
+  inline const Bits<W>& select(const Bits<1>& cond, const Bits<W>& a, const Bits<W>& b) {
+    return cond.words[0] ? a : b;
+  }
+}
+
+#endif
+)";
+
+    class Printer {
+    private:
+      Module& _module;
+      std::string _class_name;
+
+      NodeMap<std::string> _names;
+      std::unordered_map<const Memory*, std::string> _memory_names;
+      std::vector<std::string> _output_names;
+      std::unordered_set<std::string> _used_names;
+
+      static bool is_keyword(const std::string& name) {
+        static const std::unordered_set<std::string> KEYWORDS = {
+          "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand",
+          "bitor", "bool", "break", "case", "catch", "char", "class",
+          "compl", "const", "constexpr", "const_cast", "continue",
+          "decltype", "default", "delete", "do", "double", "dynamic_cast",
+          "else", "enum", "explicit", "export", "extern", "false", "float",
+          "for", "friend", "goto", "if", "inline", "int", "long", "mutable",
+          "namespace", "new", "noexcept", "not", "not_eq", "nullptr",
+          "operator", "or", "or_eq", "private", "protected", "public",
+          "register", "reinterpret_cast", "return", "short", "signed",
+          "sizeof", "static", "static_assert", "static_cast", "struct",
+          "switch", "template", "this", "throw", "true", "try", "typedef",
+          "typeid", "typename", "union", "unsigned", "using", "virtual",
+          "void", "volatile", "wchar_t", "while", "xor", "xor_eq",
+          "eval", "step", "update", "reset", "hdl_rt"
+        };
+        return KEYWORDS.find(name) != KEYWORDS.end();
+      }
+
+      std::string unique_name(const std::string& name, const std::string& fallback) {
+        std::string sanitized;
+        for (char chr : name) {
+          if ((chr >= 'a' && chr <= 'z') ||
+              (chr >= 'A' && chr <= 'Z') ||
+              (chr >= '0' && chr <= '9') ||
+              chr == '_') {
+            sanitized.push_back(chr);
+          } else if (sanitized.size() > 0 && sanitized.back() != '_') {
+            sanitized.push_back('_');
+          }
+        }
+
+        // Names starting with an underscore are reserved for locals
+        if (sanitized.size() == 0) {
+          sanitized = fallback;
+        } else if (sanitized[0] == '_' || (sanitized[0] >= '0' && sanitized[0] <= '9')) {
+          sanitized = "m" + sanitized;
+        }
+
+        std::string unique = sanitized;
+        for (size_t it = 0; is_keyword(unique) || _used_names.find(unique) != _used_names.end(); it++) {
+          unique = sanitized + "_" + std::to_string(it);
+        }
+        _used_names.insert(unique);
+        return unique;
+      }
+
+      static std::string type(size_t width) {
+        return "hdl_rt::Bits<" + std::to_string(width) + ">";
+      }
+
+      static std::string literal(const BitString& bit_string) {
+        std::ostringstream stream;
+        stream << type(bit_string.width()) << "{{";
+        for (size_t offset = 0; offset < bit_string.width() || offset == 0; offset += 64) {
+          if (offset != 0) {
+            stream << ", ";
+          }
+          size_t width = std::min(bit_string.width() - offset, size_t(64));
+          uint64_t word = width == 0 ? 0 : bit_string.slice_width(offset, width).as_uint64();
+          stream << "0x" << std::hex << word << std::dec << "ull";
+        }
+        stream << "}}";
+        return stream.str();
+      }
+
+      // Emits a local variable for every value required to compute roots.
+      // Values are emitted in topological order using an explicit stack.
+      void print_values(std::ostream& stream,
+                        const std::vector<const Value*>& roots,
+                        std::unordered_map<const Value*, std::string>& locals) const {
+        std::vector<std::pair<const Value*, bool>> stack;
+        for (auto root = roots.rbegin(); root != roots.rend(); root++) {
+          stack.emplace_back(*root, false);
+        }
+
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          stack.pop_back();
+
+          if (_names.has(value) || locals.find(value) != locals.end()) {
+            continue;
+          }
+
+          const Op* op = dyn_cast<Op>(value);
+          const Memory::Read* read = dyn_cast<Memory::Read>(value);
+
+          if (!is_expanded && (op != nullptr || read != nullptr)) {
+            stack.emplace_back(value, true);
+            if (op != nullptr && op->kind == Op::Kind::Slice) {
+              // Offset and width are template arguments
+              stack.emplace_back(op->args[0], false);
+            } else if (op != nullptr) {
+              for (auto arg = op->args.rbegin(); arg != op->args.rend(); arg++) {
+                stack.emplace_back(*arg, false);
+              }
+            } else {
+              stack.emplace_back(read->address, false);
+            }
+            continue;
+          }
+
+          #define arg(index) name(op->args[index], locals)
+
+          std::ostringstream expr;
+          if (const Constant* constant = dyn_cast<Constant>(value)) {
+            expr << literal(constant->value);
+          } else if (dyn_cast<Unknown>(value)) {
+            throw_error(Error, "Unable to generate C++ code for unknown values");
+          } else if (op != nullptr) {
+            switch (op->kind) {
+              case Op::Kind::And: expr << "hdl_rt::and_(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Or: expr << "hdl_rt::or_(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Xor: expr << "hdl_rt::xor_(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Not: expr << "hdl_rt::not_(" << arg(0) << ")"; break;
+              case Op::Kind::Add: expr << "hdl_rt::add(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Sub: expr << "hdl_rt::sub(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Mul: expr << "hdl_rt::mul(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Eq: expr << "hdl_rt::eq(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::LtU: expr << "hdl_rt::lt_u(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::LtS: expr << "hdl_rt::lt_s(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Concat: expr << "hdl_rt::concat(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Slice: {
+                uint64_t offset = dyn_cast<Constant>(op->args[1])->value.as_uint64();
+                expr << "hdl_rt::slice<" << offset << ", " << op->width << ">(" << arg(0) << ")";
+              }
+              break;
+              case Op::Kind::Shl: expr << "hdl_rt::shl(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::ShrU: expr << "hdl_rt::shr_u(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::ShrS: expr << "hdl_rt::shr_s(" << arg(0) << ", " << arg(1) << ")"; break;
+              case Op::Kind::Select: expr << "hdl_rt::select(" << arg(0) << ", " << arg(1) << ", " << arg(2) << ")"; break;
+            }
+          } else if (read != nullptr) {
+            expr << _memory_names.at(read->memory) << "[";
+            expr << name(read->address, locals) << ".as_uint64() % " << read->memory->size << "ull]";
+          } else {
+            throw_error(Error, "Unable to generate C++ code for value");
+          }
+
+          #undef arg
+
+          std::string local = "_v" + std::to_string(locals.size());
+          stream << "    const " << type(value->width) << " " << local << " = " << expr.str() << ";\n";
+          locals[value] = local;
+        }
+      }
+
+      std::string name(const Value* value, const std::unordered_map<const Value*, std::string>& locals) const {
+        if (const std::string* global = _names.find(value)) {
+          return *global;
+        }
+        return locals.at(value);
+      }
+
+    public:
+      Printer(Module& module): Printer(module, module.name()) {}
+
+      Printer(Module& module, const std::string& class_name): _module(module), _names(module) {
+        _class_name = unique_name(class_name, "Model");
+
+        for (const Input* input : _module.inputs()) {
+          _names[input] = unique_name(input->name, "input");
+        }
+
+        for (const Output& output : _module.outputs()) {
+          _output_names.push_back(unique_name(output.name, "output"));
+        }
+
+        for (const Reg* reg : _module.regs()) {
+          _names[reg] = unique_name(reg->name, "reg");
+        }
+
+        for (const Memory* memory : _module.memories()) {
+          _memory_names[memory] = unique_name(memory->name, "memory");
+        }
+      }
+
+      const std::string& class_name() const { return _class_name; }
+
+      void print(std::ostream& stream) const {
+        stream << "#include <cstdint>\n";
+        stream << "#include <cstddef>\n";
+        stream << "#include <vector>\n\n";
+        stream << RUNTIME << "\n";
+
+        stream << "class " << _class_name << " {\n";
+        stream << "public:\n";
+
+        stream << "  // Inputs\n";
+        for (const Input* input : _module.inputs()) {
+          stream << "  " << type(input->width) << " " << _names.at(input) << ";\n";
+        }
+
+        stream << "  // Outputs\n";
+        for (size_t it = 0; it < _output_names.size(); it++) {
+          stream << "  " << type(_module.outputs()[it].value->width) << " " << _output_names[it] << ";\n";
+        }
+
+        stream << "  // Registers\n";
+        for (const Reg* reg : _module.regs()) {
+          stream << "  " << type(reg->width) << " " << _names.at(reg) << ";\n";
+        }
+
+        stream << "  // Memories\n";
+        for (const Memory* memory : _module.memories()) {
+          stream << "  std::vector<" << type(memory->width) << "> " << _memory_names.at(memory) << ";\n";
+        }
+
+        std::vector<const Value*> clocks;
+        for (const Reg* reg : _module.regs()) {
+          if (std::find(clocks.begin(), clocks.end(), reg->clock) == clocks.end()) {
+            clocks.push_back(reg->clock);
+          }
+        }
+        for (const Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            if (std::find(clocks.begin(), clocks.end(), write.clock) == clocks.end()) {
+              clocks.push_back(write.clock);
+            }
+          }
+        }
+
+        stream << "private:\n";
+        for (size_t it = 0; it < clocks.size(); it++) {
+          stream << "  bool _prev_clock" << it << " = false;\n";
+        }
+
+        stream << "public:\n";
+        stream << "  " << _class_name << "() { reset(); }\n\n";
+
+        stream << "  void reset() {\n";
+        for (const Reg* reg : _module.regs()) {
+          stream << "    " << _names.at(reg) << " = " << literal(reg->initial) << ";\n";
+        }
+        for (const Memory* memory : _module.memories()) {
+          const std::string& name = _memory_names.at(memory);
+          stream << "    " << name << ".assign(" << memory->size << "ull, " << type(memory->width) << "());\n";
+          for (const auto& [address, value] : memory->initial) {
+            stream << "    " << name << "[" << address << "ull] = " << literal(value) << ";\n";
+          }
+        }
+        for (size_t it = 0; it < clocks.size(); it++) {
+          stream << "    _prev_clock" << it << " = false;\n";
+        }
+        stream << "  }\n\n";
+
+        // eval
+        {
+          stream << "  // Computes the outputs from the current inputs and state\n";
+          stream << "  void eval() {\n";
+          std::vector<const Value*> roots;
+          for (const Output& output : _module.outputs()) {
+            roots.push_back(output.value);
+          }
+          std::unordered_map<const Value*, std::string> locals;
+          print_values(stream, roots, locals);
+          for (size_t it = 0; it < _output_names.size(); it++) {
+            stream << "    " << _output_names[it] << " = " << name(_module.outputs()[it].value, locals) << ";\n";
+          }
+          stream << "  }\n\n";
+        }
+
+        // step
+        {
+          stream << "  // Applies all clock edges. Returns true if the state changed.\n";
+          stream << "  bool step() {\n";
+          std::vector<const Value*> roots = clocks;
+          for (const Reg* reg : _module.regs()) {
+            roots.push_back(reg->next);
+          }
+          for (const Memory* memory : _module.memories()) {
+            for (const Memory::Write& write : memory->writes) {
+              roots.push_back(write.enable);
+              roots.push_back(write.address);
+              roots.push_back(write.value);
+            }
+          }
+          std::unordered_map<const Value*, std::string> locals;
+          print_values(stream, roots, locals);
+
+          stream << "    bool _changed = false;\n";
+          for (size_t it = 0; it < clocks.size(); it++) {
+            std::string clock = name(clocks[it], locals);
+            stream << "    const bool _edge" << it << " = " << clock << ".as_bool() && !_prev_clock" << it << ";\n";
+            stream << "    _prev_clock" << it << " = " << clock << ".as_bool();\n";
+          }
+
+          auto clock_index = [&](const Value* clock) {
+            return std::find(clocks.begin(), clocks.end(), clock) - clocks.begin();
+          };
+
+          // Registers may depend on each other, so next values are copied before committing.
+          size_t reg_index = 0;
+          for (const Reg* reg : _module.regs()) {
+            stream << "    const " << type(reg->width) << " _next" << reg_index << " = " << name(reg->next, locals) << ";\n";
+            reg_index++;
+          }
+
+          for (const Memory* memory : _module.memories()) {
+            for (const Memory::Write& write : memory->writes) {
+              stream << "    if (_edge" << clock_index(write.clock) << " && " << name(write.enable, locals) << ".as_bool()) {\n";
+              stream << "      " << _memory_names.at(memory) << "[" << name(write.address, locals) << ".as_uint64() % " << memory->size << "ull] = " << name(write.value, locals) << ";\n";
+              stream << "      _changed = true;\n";
+              stream << "    }\n";
+            }
+          }
+
+          reg_index = 0;
+          for (const Reg* reg : _module.regs()) {
+            stream << "    if (_edge" << clock_index(reg->clock) << ") {\n";
+            stream << "      " << _names.at(reg) << " = _next" << reg_index << ";\n";
+            stream << "      _changed = true;\n";
+            stream << "    }\n";
+            reg_index++;
+          }
+
+          stream << "    return _changed;\n";
+          stream << "  }\n\n";
+        }
+
+        stream << "  // Equivalent to hdl::sim::Simulation::update\n";
+        stream << "  void update() {\n";
+        stream << "    while (step()) {}\n";
+        stream << "    eval();\n";
+        stream << "  }\n";
+
+        stream << "};\n";
+      }
+
+      void save(const char* path) const {
+        std::ofstream file;
+        file.open(path);
+        print(file);
+      }
+    };
+  }
+}
+
+#undef throw_error
+
+#endif
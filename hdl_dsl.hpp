@@ -111,7 +111,7 @@ namespace hdl {
     class Reg: public T {
     private:
       static hdl::Value* create_register(const T& initial) {
-        hdl::Constant* const_initial = dynamic_cast<hdl::Constant*>(initial.value());
+        hdl::Constant* const_initial = hdl::dyn_cast<hdl::Constant>(initial.value());
         if (const_initial == nullptr) {
           throw Error("Register initializer must be constant");
         }
@@ -127,12 +127,12 @@ namespace hdl {
       Reg(const T& initial): T(initial.module(), create_register(initial)) {}
       
       void set_name(const std::string& name) {
-        hdl::Reg* reg = dynamic_cast<hdl::Reg*>(this->value());
+        hdl::Reg* reg = hdl::dyn_cast<hdl::Reg>(this->value());
         reg->name = name;
       }
       
       Reg<T>& operator=(const T& val) {
-        hdl::Reg* reg = dynamic_cast<hdl::Reg*>(this->value());
+        hdl::Reg* reg = hdl::dyn_cast<hdl::Reg>(this->value());
         reg->clock = global_context.clock();
         reg->next = global_context.module().op(Op::Kind::Select, {
           global_context.condition(),
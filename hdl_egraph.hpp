@@ -0,0 +1,816 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_EGRAPH_HPP
+#define HDL_EGRAPH_HPP
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <functional>
+#include <optional>
+#include <chrono>
+#include <limits>
+
+#include "hdl.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace egraph {
+    using ClassId = uint32_t;
+    
+    // Operator whose arguments are equivalence classes. Values which are not
+    // operators (inputs, registers, constants, unknowns and memory reads)
+    // are represented as leaves.
+    struct ENode {
+      Op::Kind kind = Op::Kind::And;
+      Value* leaf = nullptr;
+      uint8_t arg_count = 0;
+      ClassId args[Op::MAX_ARG_COUNT] = {0};
+      
+      ENode() {}
+      ENode(Value* _leaf): leaf(_leaf) {}
+      ENode(Op::Kind _kind, const std::vector<ClassId>& _args): kind(_kind) {
+        if (_args.size() > Op::MAX_ARG_COUNT) {
+          throw_error(Error, "ENode can have at most " << Op::MAX_ARG_COUNT << " arguments");
+        }
+        arg_count = uint8_t(_args.size());
+        for (size_t it = 0; it < _args.size(); it++) {
+          args[it] = _args[it];
+        }
+      }
+      
+      inline bool is_leaf() const { return leaf != nullptr; }
+      
+      bool operator==(const ENode& other) const {
+        if (leaf != nullptr || other.leaf != nullptr) {
+          return leaf == other.leaf;
+        }
+        if (kind != other.kind || arg_count != other.arg_count) {
+          return false;
+        }
+        for (size_t it = 0; it < arg_count; it++) {
+          if (args[it] != other.args[it]) {
+            return false;
+          }
+        }
+        return true;
+      }
+      
+      bool operator!=(const ENode& other) const { return !(*this == other); }
+      
+      size_t hash() const {
+        if (leaf != nullptr) {
+          return size_t(hash_mix(uint64_t(uintptr_t(leaf))));
+        }
+        uint64_t hash = hash_mix(uint64_t(kind) + 1);
+        for (size_t it = 0; it < arg_count; it++) {
+          hash = hash_combine(hash, args[it]);
+        }
+        return size_t(hash);
+      }
+      
+      struct Hasher {
+        size_t operator()(const ENode& node) const { return node.hash(); }
+      };
+    };
+    
+    // Term with variables which is matched against or instantiated in the
+    // e-graph. Constants of width 0 take the width of the matched class.
+    struct Pattern {
+      enum class Type {
+        Var, Op, Constant
+      };
+      
+      static constexpr const size_t MAX_VAR_COUNT = 8;
+      
+      Type type = Type::Var;
+      size_t var = 0;
+      Op::Kind kind = Op::Kind::And;
+      std::vector<Pattern> args;
+      uint64_t value = 0;
+      size_t width = 0;
+      
+      static Pattern variable(size_t var) {
+        if (var >= MAX_VAR_COUNT) {
+          throw_error(Error, "Patterns can have at most " << MAX_VAR_COUNT << " variables");
+        }
+        Pattern pattern;
+        pattern.type = Type::Var;
+        pattern.var = var;
+        return pattern;
+      }
+      
+      static Pattern op(Op::Kind kind, const std::vector<Pattern>& args) {
+        Pattern pattern;
+        pattern.type = Type::Op;
+        pattern.kind = kind;
+        pattern.args = args;
+        return pattern;
+      }
+      
+      static Pattern constant(uint64_t value, size_t width = 0) {
+        Pattern pattern;
+        pattern.type = Type::Constant;
+        pattern.value = value;
+        pattern.width = width;
+        return pattern;
+      }
+    };
+    
+    // Classes assigned to the variables of a pattern
+    using Subst = std::array<ClassId, Pattern::MAX_VAR_COUNT>;
+    
+    struct Rule {
+      std::string name;
+      Pattern lhs;
+      Pattern rhs;
+      
+      Rule(const std::string& _name, const Pattern& _lhs, const Pattern& _rhs):
+        name(_name), lhs(_lhs), rhs(_rhs) {}
+    };
+    
+    // Reassociation, commutativity, distributivity and other identities
+    // of the bitwise and additive operators
+    std::vector<Rule> default_rules() {
+      using Kind = Op::Kind;
+      
+      Pattern a = Pattern::variable(0);
+      Pattern b = Pattern::variable(1);
+      Pattern c = Pattern::variable(2);
+      auto op = [](Kind kind, const std::vector<Pattern>& args){
+        return Pattern::op(kind, args);
+      };
+      
+      std::vector<Rule> rules;
+      for (Kind kind : {Kind::And, Kind::Or, Kind::Xor, Kind::Add}) {
+        std::string name = Op::KIND_NAMES[size_t(kind)];
+        rules.emplace_back(name + "/commute", op(kind, {a, b}), op(kind, {b, a}));
+        rules.emplace_back(name + "/assoc_right",
+          op(kind, {op(kind, {a, b}), c}),
+          op(kind, {a, op(kind, {b, c})})
+        );
+        rules.emplace_back(name + "/assoc_left",
+          op(kind, {a, op(kind, {b, c})}),
+          op(kind, {op(kind, {a, b}), c})
+        );
+      }
+      
+      for (Kind outer : {Kind::Or, Kind::Xor}) {
+        std::string name = std::string("And/") + Op::KIND_NAMES[size_t(outer)];
+        rules.emplace_back(name + "/factor",
+          op(outer, {op(Kind::And, {a, b}), op(Kind::And, {a, c})}),
+          op(Kind::And, {a, op(outer, {b, c})})
+        );
+        rules.emplace_back(name + "/distribute",
+          op(Kind::And, {a, op(outer, {b, c})}),
+          op(outer, {op(Kind::And, {a, b}), op(Kind::And, {a, c})})
+        );
+      }
+      rules.emplace_back("Or/And/factor",
+        op(Kind::And, {op(Kind::Or, {a, b}), op(Kind::Or, {a, c})}),
+        op(Kind::Or, {a, op(Kind::And, {b, c})})
+      );
+      
+      rules.emplace_back("Not/And/demorgan",
+        op(Kind::Not, {op(Kind::And, {a, b})}),
+        op(Kind::Or, {op(Kind::Not, {a}), op(Kind::Not, {b})})
+      );
+      rules.emplace_back("Not/Or/demorgan",
+        op(Kind::Not, {op(Kind::Or, {a, b})}),
+        op(Kind::And, {op(Kind::Not, {a}), op(Kind::Not, {b})})
+      );
+      rules.emplace_back("Or/Not/demorgan",
+        op(Kind::Or, {op(Kind::Not, {a}), op(Kind::Not, {b})}),
+        op(Kind::Not, {op(Kind::And, {a, b})})
+      );
+      rules.emplace_back("And/Not/demorgan",
+        op(Kind::And, {op(Kind::Not, {a}), op(Kind::Not, {b})}),
+        op(Kind::Not, {op(Kind::Or, {a, b})})
+      );
+      rules.emplace_back("Not/Not", op(Kind::Not, {op(Kind::Not, {a})}), a);
+      
+      rules.emplace_back("And/idempotent", op(Kind::And, {a, a}), a);
+      rules.emplace_back("Or/idempotent", op(Kind::Or, {a, a}), a);
+      rules.emplace_back("Xor/self", op(Kind::Xor, {a, a}), Pattern::constant(0));
+      rules.emplace_back("Sub/self", op(Kind::Sub, {a, a}), Pattern::constant(0));
+      rules.emplace_back("Add/Sub/cancel", op(Kind::Sub, {op(Kind::Add, {a, b}), b}), a);
+      rules.emplace_back("Sub/Add/cancel", op(Kind::Add, {op(Kind::Sub, {a, b}), b}), a);
+      
+      // Multiplication by powers of two is expressed using shifts, since
+      // Mul widens its result
+      rules.emplace_back("Add/double", op(Kind::Add, {a, a}), op(Kind::Shl, {a, Pattern::constant(1)}));
+      rules.emplace_back("Shl/double", op(Kind::Shl, {a, Pattern::constant(1)}), op(Kind::Add, {a, a}));
+      
+      rules.emplace_back("Select/same", op(Kind::Select, {c, a, a}), a);
+      rules.emplace_back("Select/Not",
+        op(Kind::Select, {op(Kind::Not, {c}), a, b}),
+        op(Kind::Select, {c, b, a})
+      );
+      
+      return rules;
+    }
+    
+    struct Limits {
+      size_t max_iterations = 16;
+      size_t max_nodes = 100000;
+      double max_seconds = 1.0;
+    };
+    
+    struct Stats {
+      size_t iterations = 0;
+      size_t matches = 0;
+      bool is_saturated = false;
+    };
+    
+    // Cost of a single e-node of the given width, excluding its arguments.
+    // All operators must have positive costs.
+    using CostFunction = std::function<double(const ENode& node, size_t width)>;
+    
+    double default_cost(const ENode& node, size_t width) {
+      if (node.is_leaf()) {
+        return 0;
+      }
+      switch (node.kind) {
+        case Op::Kind::Concat:
+        case Op::Kind::Slice:
+          return 1;
+        case Op::Kind::Mul:
+          return 8.0 * width;
+        case Op::Kind::Add:
+        case Op::Kind::Sub:
+        case Op::Kind::Eq:
+        case Op::Kind::LtU:
+        case Op::Kind::LtS:
+          return 2.0 * width;
+        default:
+          return 1.0 * width;
+      }
+    }
+    
+    class EGraph {
+    private:
+      struct EClass {
+        size_t width = 0;
+        std::vector<ENode> nodes;
+        std::vector<std::pair<ENode, ClassId>> parents;
+        Constant* constant = nullptr;
+      };
+      
+      using Bound = std::array<bool, Pattern::MAX_VAR_COUNT>;
+      
+      Module& _module;
+      std::vector<ClassId> _union_find;
+      std::vector<EClass> _classes;
+      std::unordered_map<ENode, ClassId, ENode::Hasher> _memo;
+      std::vector<ClassId> _pending;
+      
+      ENode canonicalize(ENode node) {
+        for (size_t it = 0; it < node.arg_count; it++) {
+          node.args[it] = find(node.args[it]);
+        }
+        return node;
+      }
+      
+      // Returns false if the widths of the arguments do not match
+      bool infer_width(const ENode& node, size_t& width) const {
+        if (node.is_leaf()) {
+          width = node.leaf->width;
+          return true;
+        }
+        
+        #define arg_width(index) _classes[node.args[index]].width
+        
+        if (node.arg_count != Op::arg_count(node.kind)) {
+          return false;
+        }
+        
+        switch (node.kind) {
+          case Op::Kind::Not:
+          case Op::Kind::Shl:
+          case Op::Kind::ShrU:
+          case Op::Kind::ShrS:
+            width = arg_width(0);
+            return true;
+          case Op::Kind::And:
+          case Op::Kind::Or:
+          case Op::Kind::Xor:
+          case Op::Kind::Add:
+          case Op::Kind::Sub:
+            width = arg_width(0);
+            return arg_width(0) == arg_width(1);
+          case Op::Kind::Eq:
+          case Op::Kind::LtU:
+          case Op::Kind::LtS:
+            width = 1;
+            return arg_width(0) == arg_width(1);
+          case Op::Kind::Mul:
+          case Op::Kind::Concat:
+            width = arg_width(0) + arg_width(1);
+            return true;
+          case Op::Kind::Slice: {
+            Constant* offset = _classes[node.args[1]].constant;
+            Constant* slice_width = _classes[node.args[2]].constant;
+            if (offset == nullptr || slice_width == nullptr) {
+              return false;
+            }
+            width = size_t(slice_width->value.as_uint64());
+            return offset->value.as_uint64() + width <= arg_width(0);
+          }
+          case Op::Kind::Select:
+            width = arg_width(1);
+            return arg_width(0) == 1 && arg_width(1) == arg_width(2);
+        }
+        
+        #undef arg_width
+        
+        return false;
+      }
+      
+      // Folds node into a constant if all of its arguments are constant
+      Constant* fold(const ENode& node) {
+        if (node.is_leaf()) {
+          return dyn_cast<Constant>(node.leaf);
+        }
+        std::vector<Value*> args;
+        for (size_t it = 0; it < node.arg_count; it++) {
+          Constant* constant = _classes[find(node.args[it])].constant;
+          if (constant == nullptr) {
+            return nullptr;
+          }
+          args.push_back(constant);
+        }
+        return dyn_cast<Constant>(_module.op(node.kind, args));
+      }
+      
+      ClassId add_class(const ENode& node, size_t width) {
+        ClassId id = ClassId(_classes.size());
+        _union_find.push_back(id);
+        _classes.emplace_back();
+        _classes[id].width = width;
+        _classes[id].nodes.push_back(node);
+        for (size_t it = 0; it < node.arg_count; it++) {
+          _classes[node.args[it]].parents.emplace_back(node, id);
+        }
+        _memo[node] = id;
+        return id;
+      }
+      
+      // Adds a leaf for the constant value of id if it was not known before
+      void set_constant(ClassId id, Constant* constant) {
+        id = find(id);
+        if (_classes[id].constant == nullptr) {
+          _classes[id].constant = constant;
+          merge(id, add(ENode(constant)));
+        }
+      }
+      
+      void repair(ClassId id) {
+        std::vector<std::pair<ENode, ClassId>> parents = std::move(_classes[id].parents);
+        _classes[id].parents.clear();
+        
+        for (const auto& [node, parent] : parents) {
+          _memo.erase(node);
+        }
+        
+        std::unordered_map<ENode, ClassId, ENode::Hasher> unique;
+        for (const auto& [node, parent] : parents) {
+          ENode canonical = canonicalize(node);
+          auto it = unique.find(canonical);
+          if (it != unique.end()) {
+            merge(it->second, parent);
+          }
+          unique[canonical] = find(parent);
+          _memo[canonical] = find(parent);
+        }
+        
+        for (const auto& [node, parent] : unique) {
+          _classes[find(id)].parents.emplace_back(node, find(parent));
+        }
+        
+        // Folding may add classes, so it must not hold references into _classes
+        for (const auto& [node, parent] : unique) {
+          if (_classes[find(parent)].constant == nullptr) {
+            if (Constant* constant = fold(node)) {
+              set_constant(parent, constant);
+            }
+          }
+        }
+      }
+      
+      // Bindings are made in place and undone when backtracking, found is
+      // called once for every way of matching the rest of the pattern
+      void match(const Pattern& pattern,
+                 ClassId id,
+                 Subst& subst,
+                 Bound& bound,
+                 const std::function<void()>& found) const {
+        id = find(id);
+        switch (pattern.type) {
+          case Pattern::Type::Var:
+            if (bound[pattern.var]) {
+              if (subst[pattern.var] == id) {
+                found();
+              }
+            } else {
+              bound[pattern.var] = true;
+              subst[pattern.var] = id;
+              found();
+              bound[pattern.var] = false;
+            }
+          break;
+          case Pattern::Type::Constant: {
+            Constant* constant = _classes[id].constant;
+            if (constant != nullptr && constant->value.width() <= 64 &&
+                constant->value.as_uint64() == pattern.value &&
+                (pattern.width == 0 || pattern.width == constant->width)) {
+              found();
+            }
+          }
+          break;
+          case Pattern::Type::Op:
+            for (const ENode& node : _classes[id].nodes) {
+              if (!node.is_leaf() &&
+                  node.kind == pattern.kind &&
+                  node.arg_count == pattern.args.size()) {
+                match_args(pattern, node, 0, subst, bound, found);
+              }
+            }
+          break;
+        }
+      }
+      
+      void match_args(const Pattern& pattern,
+                      const ENode& node,
+                      size_t index,
+                      Subst& subst,
+                      Bound& bound,
+                      const std::function<void()>& found) const {
+        if (index >= node.arg_count) {
+          found();
+          return;
+        }
+        match(pattern.args[index], node.args[index], subst, bound, [&](){
+          match_args(pattern, node, index + 1, subst, bound, found);
+        });
+      }
+      
+      // Returns nothing if the instantiated term is not well typed
+      std::optional<ClassId> instantiate(const Pattern& pattern,
+                                         const Subst& subst,
+                                         size_t width) {
+        switch (pattern.type) {
+          case Pattern::Type::Var:
+            return find(subst[pattern.var]);
+          case Pattern::Type::Constant: {
+            size_t constant_width = pattern.width == 0 ? width : pattern.width;
+            BitString value = BitString::from_uint(pattern.value).resize_u(constant_width);
+            return add(ENode(_module.constant(value)));
+          }
+          case Pattern::Type::Op: {
+            std::vector<ClassId> args;
+            for (const Pattern& arg : pattern.args) {
+              std::optional<ClassId> id = instantiate(arg, subst, width);
+              if (!id.has_value()) {
+                return {};
+              }
+              args.push_back(id.value());
+            }
+            ENode node(pattern.kind, args);
+            size_t node_width = 0;
+            if (!infer_width(canonicalize(node), node_width)) {
+              return {};
+            }
+            return add(node);
+          }
+        }
+        return {};
+      }
+    public:
+      EGraph(Module& module): _module(module) {}
+      
+      inline Module& module() const { return _module; }
+      inline size_t node_count() const { return _memo.size(); }
+      inline size_t width(ClassId id) const { return _classes[find(id)].width; }
+      inline Constant* constant(ClassId id) const { return _classes[find(id)].constant; }
+      
+      ClassId find(ClassId id) const {
+        std::vector<ClassId>& union_find = const_cast<std::vector<ClassId>&>(_union_find);
+        while (union_find[id] != id) {
+          union_find[id] = union_find[union_find[id]];
+          id = union_find[id];
+        }
+        return id;
+      }
+      
+      const std::vector<ENode>& nodes(ClassId id) const {
+        return _classes[find(id)].nodes;
+      }
+      
+      size_t class_count() const {
+        size_t count = 0;
+        for (ClassId id = 0; id < _classes.size(); id++) {
+          if (find(id) == id) {
+            count++;
+          }
+        }
+        return count;
+      }
+      
+      ClassId add(const ENode& node) {
+        ENode canonical = canonicalize(node);
+        auto it = _memo.find(canonical);
+        if (it != _memo.end()) {
+          return find(it->second);
+        }
+        
+        size_t width = 0;
+        if (!infer_width(canonical, width)) {
+          throw_error(Error, "ENode is not well typed");
+        }
+        
+        ClassId id = add_class(canonical, width);
+        if (Constant* constant = fold(canonical)) {
+          if (canonical.is_leaf()) {
+            _classes[id].constant = constant;
+          } else {
+            set_constant(id, constant);
+          }
+        }
+        return find(id);
+      }
+      
+      // Adds all values used by the outputs, registers and memory writes
+      // of the module. Returns the class of each value.
+      NodeMap<ClassId> add(Module& module) {
+        NodeMap<ClassId> classes(module);
+        for (Value* value : module.topo_order()) {
+          if (Op* op = dyn_cast<Op>(value)) {
+            std::vector<ClassId> args;
+            for (Value* arg : op->args) {
+              args.push_back(classes.at(arg));
+            }
+            classes[value] = add(ENode(op->kind, args));
+          } else {
+            classes[value] = add(ENode(value));
+          }
+        }
+        return classes;
+      }
+      
+      bool merge(ClassId a, ClassId b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+          return false;
+        }
+        
+        if (_classes[a].nodes.size() + _classes[a].parents.size() <
+            _classes[b].nodes.size() + _classes[b].parents.size()) {
+          std::swap(a, b);
+        }
+        
+        if (_classes[a].width != _classes[b].width) {
+          throw_error(Error, "Unable to merge classes of different widths");
+        }
+        
+        _union_find[b] = a;
+        EClass& into = _classes[a];
+        EClass& from = _classes[b];
+        into.nodes.insert(into.nodes.end(), from.nodes.begin(), from.nodes.end());
+        into.parents.insert(into.parents.end(), from.parents.begin(), from.parents.end());
+        if (into.constant == nullptr) {
+          into.constant = from.constant;
+        }
+        from = EClass();
+        
+        _pending.push_back(a);
+        return true;
+      }
+      
+      // Restores the congruence closure after merging classes
+      void rebuild() {
+        while (!_pending.empty()) {
+          std::vector<ClassId> pending = std::move(_pending);
+          _pending.clear();
+          for (ClassId id : pending) {
+            if (find(id) == id) {
+              repair(id);
+            }
+          }
+        }
+        
+        for (ClassId id = 0; id < _classes.size(); id++) {
+          if (find(id) == id) {
+            std::vector<ENode>& nodes = _classes[id].nodes;
+            for (ENode& node : nodes) {
+              node = canonicalize(node);
+            }
+            std::unordered_map<ENode, bool, ENode::Hasher> seen;
+            size_t count = 0;
+            for (const ENode& node : nodes) {
+              if (seen.insert({node, true}).second) {
+                nodes[count++] = node;
+              }
+            }
+            nodes.resize(count);
+          }
+        }
+      }
+      
+      // Calls found once for every substitution under which pattern
+      // matches a node of class id
+      void match(const Pattern& pattern,
+                 ClassId id,
+                 const std::function<void(const Subst&)>& found) const {
+        Subst subst = {0};
+        Bound bound = {false};
+        match(pattern, id, subst, bound, [&](){ found(subst); });
+      }
+      
+      // Applies rules until no rule adds new equalities or a limit is reached
+      Stats saturate(const std::vector<Rule>& rules, const Limits& limits = Limits()) {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        
+        rebuild();
+        
+        Stats stats;
+        while (stats.iterations < limits.max_iterations) {
+          stats.iterations++;
+          
+          struct Match {
+            const Rule* rule = nullptr;
+            ClassId id = 0;
+            Subst subst;
+          };
+          
+          std::vector<Match> matches;
+          for (const Rule& rule : rules) {
+            for (ClassId id = 0; id < _classes.size(); id++) {
+              if (find(id) == id) {
+                match(rule.lhs, id, [&](const Subst& subst){
+                  matches.push_back(Match { &rule, id, subst });
+                });
+              }
+            }
+          }
+          stats.matches += matches.size();
+          
+          bool changed = false;
+          bool is_limited = false;
+          for (const Match& match : matches) {
+            if (_memo.size() >= limits.max_nodes) {
+              is_limited = true;
+              break;
+            }
+            std::optional<ClassId> id = instantiate(match.rule->rhs, match.subst, width(match.id));
+            if (id.has_value()) {
+              changed = merge(match.id, id.value()) || changed;
+            }
+          }
+          rebuild();
+          
+          if (!changed && !is_limited) {
+            stats.is_saturated = true;
+            break;
+          }
+          
+          std::chrono::duration<double> elapsed = Clock::now() - start;
+          if (is_limited || elapsed.count() >= limits.max_seconds) {
+            break;
+          }
+        }
+        
+        return stats;
+      }
+      
+      // Selects the cheapest node of every class and rebuilds it in the module
+      class Extractor {
+      private:
+        EGraph& _egraph;
+        std::vector<double> _costs;
+        std::vector<ENode> _best;
+        std::unordered_map<ClassId, Value*> _values;
+      public:
+        Extractor(EGraph& egraph, const CostFunction& cost = default_cost):
+            _egraph(egraph) {
+          const double INFINITE = std::numeric_limits<double>::infinity();
+          size_t count = egraph._classes.size();
+          _costs.resize(count, INFINITE);
+          _best.resize(count);
+          
+          // Costs only decrease, so this terminates once every class
+          // has reached its minimum
+          bool changed = true;
+          while (changed) {
+            changed = false;
+            for (ClassId id = 0; id < count; id++) {
+              if (egraph.find(id) != id) {
+                continue;
+              }
+              for (const ENode& node : egraph._classes[id].nodes) {
+                double node_cost = cost(node, egraph._classes[id].width);
+                for (size_t it = 0; it < node.arg_count; it++) {
+                  node_cost += _costs[egraph.find(node.args[it])];
+                }
+                if (node_cost < _costs[id]) {
+                  _costs[id] = node_cost;
+                  _best[id] = node;
+                  changed = true;
+                }
+              }
+            }
+          }
+        }
+        
+        double cost(ClassId id) const { return _costs[_egraph.find(id)]; }
+        
+        Value* operator[](ClassId root) {
+          std::vector<std::pair<ClassId, bool>> stack;
+          stack.emplace_back(_egraph.find(root), false);
+          while (!stack.empty()) {
+            auto [id, is_expanded] = stack.back();
+            stack.pop_back();
+            if (_values.find(id) != _values.end()) {
+              continue;
+            }
+            
+            const ENode& node = _best[id];
+            if (node.is_leaf()) {
+              _values[id] = node.leaf;
+            } else if (is_expanded) {
+              std::vector<Value*> args;
+              for (size_t it = 0; it < node.arg_count; it++) {
+                args.push_back(_values.at(_egraph.find(node.args[it])));
+              }
+              _values[id] = _egraph._module.op(node.kind, args);
+            } else {
+              stack.emplace_back(id, true);
+              for (size_t it = node.arg_count; it-- > 0; ) {
+                stack.emplace_back(_egraph.find(node.args[it]), false);
+              }
+            }
+          }
+          return _values.at(_egraph.find(root));
+        }
+      };
+    };
+    
+    // Optimizes the outputs, clocks and next values of registers and memory
+    // writes of module using equality saturation. Memory read addresses are
+    // not rewritten. Replaced values are removed by the next Module::gc.
+    Stats optimize(Module& module,
+                   const std::vector<Rule>& rules = default_rules(),
+                   const Limits& limits = Limits(),
+                   const CostFunction& cost = default_cost) {
+      EGraph egraph(module);
+      NodeMap<ClassId> classes = egraph.add(module);
+      Stats stats = egraph.saturate(rules, limits);
+      
+      EGraph::Extractor extractor(egraph, cost);
+      
+      NodeMap<Value*> mapped(module);
+      for (const Output& output : module.outputs()) {
+        mapped[output.value] = extractor[classes.at(output.value)];
+      }
+      for (Reg* reg : module.regs()) {
+        mapped[reg->clock] = extractor[classes.at(reg->clock)];
+        if (reg->next != nullptr) {
+          mapped[reg->next] = extractor[classes.at(reg->next)];
+        }
+      }
+      for (Memory* memory : module.memories()) {
+        for (const Memory::Write& write : memory->writes) {
+          mapped[write.clock] = extractor[classes.at(write.clock)];
+          mapped[write.address] = extractor[classes.at(write.address)];
+          mapped[write.enable] = extractor[classes.at(write.enable)];
+          mapped[write.value] = extractor[classes.at(write.value)];
+        }
+      }
+      module.remap_roots(mapped);
+      
+      return stats;
+    }
+  }
+}
+
+#undef throw_error
+
+#endif
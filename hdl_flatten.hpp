@@ -28,7 +28,7 @@ namespace hdl {
       using Bits = std::vector<Value*>;
       
       Module& _module;
-      std::unordered_map<Value*, Bits> _values;
+      NodeMap<Bits> _values;
       
       Value* select(Value* cond, Value* a, Value* b) {
         return _module.op(Op::Kind::Or, {
@@ -212,22 +212,22 @@ namespace hdl {
       
       // Flattens value to only use single bit wide And, Or, Xor and Not operators
       void flatten(Value* value) {
-        if (_values.find(value) != _values.end()) {
+        if (_values.has(value)) {
           return;
         }
         
         Bits bits;
         bits.reserve(value->width);
-        if (Constant* constant = dynamic_cast<Constant*>(value)) {
+        if (Constant* constant = dyn_cast<Constant>(value)) {
           for (size_t it = 0; it < value->width; it++) {
             bool bit = constant->value.at(it);
             bits.push_back(_module.constant(BitString::from_bool(bit)));
           }
-        } else if (Unknown* unknown = dynamic_cast<Unknown*>(value)) {
+        } else if (Unknown* unknown = dyn_cast<Unknown>(value)) {
           for (size_t it = 0; it < value->width; it++) {
             bits.push_back(_module.unknown(1));
           }
-        } else if (Op* op = dynamic_cast<Op*>(value)) {
+        } else if (Op* op = dyn_cast<Op>(value)) {
           for (Value* arg : op->args) {
             flatten(arg);
           }
@@ -287,7 +287,7 @@ namespace hdl {
           throw Error("");
         }
         
-        _values.insert({value, bits});
+        _values.insert(value, bits);
       }
       
     };
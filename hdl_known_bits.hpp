@@ -45,7 +45,7 @@ namespace hdl {
     private:
       Module& _module;
       
-      std::unordered_map<Value*, PartialValue> _values;
+      NodeMap<PartialValue> _values;
       std::unordered_map<Memory*, PartialMemory> _memories;
       
       PartialValue merge(PartialValue a, PartialValue b) {
@@ -116,18 +116,18 @@ namespace hdl {
       }
       
       PartialValue lower(Value* value) {
-        if (_values.find(value) != _values.end()) {
-          return _values.at(value);
+        if (const PartialValue* partial = _values.find(value)) {
+          return *partial;
         }
         
         PartialValue partial;
-        if (Constant* constant = dynamic_cast<Constant*>(value)) {
+        if (Constant* constant = dyn_cast<Constant>(value)) {
           partial.value = _module.constant(constant->value);
           partial.known = _module.constant(~BitString(constant->width));
-        } else if (dynamic_cast<Unknown*>(value)) {
+        } else if (dyn_cast<Unknown>(value)) {
           partial.value = _module.constant(BitString(value->width));
           partial.known = _module.constant(BitString(value->width));
-        } else if (Op* op = dynamic_cast<Op*>(value)) {
+        } else if (Op* op = dyn_cast<Op>(value)) {
           std::vector<PartialValue> args;
           for (Value* arg : op->args) {
             args.push_back(lower(arg));
@@ -192,7 +192,7 @@ namespace hdl {
             }
             break;
           }
-        } else if (Memory::Read* read = dynamic_cast<Memory::Read*>(value)) {
+        } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
           PartialMemory memory = lower(read->memory);
           PartialValue address = lower(read->address);
           partial = PartialValue(
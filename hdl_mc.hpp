@@ -0,0 +1,876 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_MC_HPP
+#define HDL_MC_HPP
+
+#include <inttypes.h>
+#include <vector>
+#include <string>
+#include <optional>
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+
+#include "hdl.hpp"
+#include "hdl_flatten.hpp"
+#include "hdl_proof.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace mc {
+    // Counterexample to a safety property
+    struct Trace {
+      // Values of all inputs of the module (in the order of Module::inputs)
+      // in each cycle
+      std::vector<std::vector<BitString>> inputs;
+      // Cycle and index of the violated property
+      size_t cycle = 0;
+      size_t property = 0;
+    };
+    
+    // Unrolls the transition relation of a module into a combinational
+    // circuit with one copy of the module per time frame. All registers and
+    // memory write ports must be driven by the same clock, so each frame
+    // corresponds to one clock cycle. Frames are added incrementally and
+    // bit-blasted into a single incremental CnfBuilder.
+    class Unrolling {
+    private:
+      struct Write {
+        Value* index = nullptr;
+        Value* enable = nullptr;
+        Value* value = nullptr;
+      };
+      
+      Module& _module;
+      bool _is_initialized = true;
+      std::vector<Value*> _order;
+      
+      Module _circuit;
+      flatten::Flattening _flattening;
+      proof::CnfBuilder _builder;
+      
+      std::vector<NodeMap<Value*>> _values;
+      std::vector<std::vector<Value*>> _inputs;
+      std::unordered_map<const Memory*, std::vector<Write>> _writes;
+      
+      Value* leaf(size_t width) {
+        Value* value = _circuit.input("", width);
+        std::vector<Value*> bits = _flattening.split(value);
+        _flattening.define(value, bits);
+        _builder.free(bits);
+        return value;
+      }
+      
+      Value* slice(Value* value, size_t offset, size_t width) {
+        return _circuit.op(Op::Kind::Slice, {
+          value,
+          _circuit.constant(BitString::from_uint(offset)),
+          _circuit.constant(BitString::from_uint(width))
+        });
+      }
+      
+      static size_t index_width(const Memory* memory) {
+        size_t width = 1;
+        while (width < 64 && (uint64_t(1) << width) < memory->size) {
+          width++;
+        }
+        return width;
+      }
+      
+      // Address modulo the size of memory, as used by hdl::sim::Simulation.
+      // All indices of a memory have the same width.
+      Value* index(Memory* memory, Value* address) {
+        size_t width = index_width(memory);
+        if (memory->size <= 1) {
+          return _circuit.constant(BitString(width));
+        }
+        if (address->width > 64) {
+          address = slice(address, 0, 64);
+        }
+        
+        if (address->width < 64 && (uint64_t(1) << address->width) <= memory->size) {
+          if (address->width < width) {
+            address = _circuit.op(Op::Kind::Concat, {
+              _circuit.constant(BitString(width - address->width)),
+              address
+            });
+          }
+          return address;
+        } else if ((memory->size & (memory->size - 1)) == 0) {
+          return slice(address, 0, width);
+        }
+        
+        // Restoring division by the size, keeping only the remainder
+        Value* size = _circuit.constant(BitString::from_uint(memory->size).resize_u(width + 1));
+        Value* remainder = _circuit.constant(BitString(width + 1));
+        for (size_t it = address->width; it-- > 0; ) {
+          Value* shifted = _circuit.op(Op::Kind::Concat, {
+            slice(remainder, 0, width),
+            slice(address, it, 1)
+          });
+          remainder = _circuit.op(Op::Kind::Select, {
+            _circuit.op(Op::Kind::LtU, {shifted, size}),
+            shifted,
+            _circuit.op(Op::Kind::Sub, {shifted, size})
+          });
+        }
+        return slice(remainder, 0, width);
+      }
+      
+      // Reads the value written by the last enabled write port with a
+      // matching index or the initial value
+      Value* read(Memory* memory, Value* index) {
+        Value* value = _circuit.constant(BitString(memory->width));
+        for (const auto& [init_address, init_value] : memory->initial) {
+          value = _circuit.op(Op::Kind::Select, {
+            _circuit.op(Op::Kind::Eq, {
+              index,
+              _circuit.constant(BitString::from_uint(init_address % memory->size).resize_u(index->width))
+            }),
+            _circuit.constant(init_value),
+            value
+          });
+        }
+        
+        for (const Write& write : _writes[memory]) {
+          value = _circuit.op(Op::Kind::Select, {
+            _circuit.op(Op::Kind::And, {
+              write.enable,
+              _circuit.op(Op::Kind::Eq, {write.index, index})
+            }),
+            write.value,
+            value
+          });
+        }
+        return value;
+      }
+    public:
+      // If is_initialized is false, the registers start in an arbitrary
+      // state instead of their initial values.
+      Unrolling(Module& module, bool is_initialized = true):
+          _module(module),
+          _is_initialized(is_initialized),
+          _order(module.topo_order()),
+          _circuit(module.name() + "_unrolled"),
+          _flattening(_circuit) {
+        if (!_is_initialized && _module.memories().size() > 0) {
+          throw_error(Error, "Uninitialized unrollings do not support memories");
+        }
+        
+        Value* clock = nullptr;
+        auto check_clock = [&](Value* other){
+          if (clock == nullptr) {
+            clock = other;
+          } else if (clock != other) {
+            throw_error(Error, "Unrolling requires all registers and memory write ports to use the same clock");
+          }
+        };
+        for (Reg* reg : _module.regs()) {
+          check_clock(reg->clock);
+        }
+        for (Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            check_clock(write.clock);
+          }
+        }
+      }
+      
+      Unrolling(const Unrolling& other) = delete;
+      Unrolling& operator=(const Unrolling& other) = delete;
+      
+      size_t frames() const { return _values.size(); }
+      proof::CnfBuilder& builder() { return _builder; }
+      
+      // Adds the next frame
+      void unroll() {
+        size_t frame = _values.size();
+        NodeMap<Value*> values(_module);
+        
+        std::vector<Value*> inputs;
+        for (Input* input : _module.inputs()) {
+          values[input] = leaf(input->width);
+          inputs.push_back(values[input]);
+        }
+        _inputs.push_back(inputs);
+        
+        for (Reg* reg : _module.regs()) {
+          if (frame == 0) {
+            values[reg] = _is_initialized ? _circuit.constant(reg->initial) : leaf(reg->width);
+          } else if (reg->next == nullptr) {
+            values[reg] = _values[frame - 1].at(reg);
+          } else {
+            values[reg] = _values[frame - 1].at(reg->next);
+          }
+        }
+        
+        for (Value* value : _order) {
+          if (values.has(value)) {
+            continue;
+          }
+          Value* result = nullptr;
+          if (Constant* constant = dyn_cast<Constant>(value)) {
+            result = _circuit.constant(constant->value);
+          } else if (isa<Unknown>(value)) {
+            result = leaf(value->width);
+          } else if (Op* op = dyn_cast<Op>(value)) {
+            std::vector<Value*> args;
+            for (Value* arg : op->args) {
+              args.push_back(values.at(arg));
+            }
+            result = _circuit.op(op->kind, args);
+          } else if (Memory::Read* mem_read = dyn_cast<Memory::Read>(value)) {
+            result = read(mem_read->memory, index(mem_read->memory, values.at(mem_read->address)));
+          } else {
+            throw_error(Error, "Unable to unroll value");
+          }
+          values[value] = result;
+        }
+        
+        // Writes of this frame are visible from the next frame on. Later
+        // write ports take precedence, so they are added last.
+        for (Memory* memory : _module.memories()) {
+          for (const Memory::Write& write : memory->writes) {
+            _writes[memory].push_back(Write {
+              index(memory, values.at(write.address)),
+              values.at(write.enable),
+              values.at(write.value)
+            });
+          }
+        }
+        
+        // Bit-blasting the state of each frame bounds the recursion depth
+        // of Flattening and CnfBuilder to a single frame
+        for (Reg* reg : _module.regs()) {
+          bits(reg->next == nullptr ? values.at(reg) : values.at(reg->next));
+        }
+        
+        _values.push_back(std::move(values));
+      }
+      
+      // Value of a value of the module in the given frame
+      Value* at(size_t frame, Value* value) const {
+        return _values[frame].at(value);
+      }
+      
+      // Bits of a value of the unrolled circuit. They are added to builder.
+      std::vector<Value*> bits(Value* value) {
+        _flattening.flatten(value);
+        std::vector<Value*> bits = _flattening[value];
+        for (Value* bit : bits) {
+          _builder.build(bit);
+        }
+        return bits;
+      }
+      
+      // Literal of a single bit value of the unrolled circuit
+      proof::Cnf::Literal literal(Value* value) {
+        if (value->width != 1) {
+          throw_error(Error, "Expected value of width 1, but got " << value->width);
+        }
+        return _builder[bits(value)[0]];
+      }
+      
+      // Bits of all registers at the start of the given frame
+      std::vector<Value*> state(size_t frame) {
+        std::vector<Value*> state;
+        for (Reg* reg : _module.regs()) {
+          std::vector<Value*> reg_bits = bits(_values[frame].at(reg));
+          state.insert(state.end(), reg_bits.begin(), reg_bits.end());
+        }
+        return state;
+      }
+      
+      // Bits of all registers at the end of the given frame
+      std::vector<Value*> next_state(size_t frame) {
+        std::vector<Value*> state;
+        for (Reg* reg : _module.regs()) {
+          Value* next = reg->next == nullptr ? reg : reg->next;
+          std::vector<Value*> reg_bits = bits(_values[frame].at(next));
+          state.insert(state.end(), reg_bits.begin(), reg_bits.end());
+        }
+        return state;
+      }
+      
+      // Value of value in the given frame in the model found by the last
+      // call to builder().solve()
+      BitString model(size_t frame, Value* value) {
+        return _builder.model(bits(at(frame, value)));
+      }
+      
+      // Input values of the first length frames in the model found by the
+      // last call to builder().solve()
+      Trace trace(size_t length) {
+        Trace trace;
+        for (size_t frame = 0; frame < length; frame++) {
+          std::vector<BitString> inputs;
+          for (Value* input : _inputs[frame]) {
+            inputs.push_back(_builder.model(bits(input)));
+          }
+          trace.inputs.push_back(inputs);
+        }
+        return trace;
+      }
+    };
+    
+    // Looks up the outputs which are used as properties
+    std::vector<Value*> find_properties(Module& module, const std::vector<std::string>& names) {
+      std::vector<Value*> properties;
+      for (const std::string& name : names) {
+        Value* value = nullptr;
+        for (const Output& output : module.outputs()) {
+          if (output.name == name) {
+            value = output.value;
+          }
+        }
+        if (value == nullptr) {
+          throw_error(Error, "Module has no output " << name);
+        } else if (value->width != 1) {
+          throw_error(Error, "Property " << name << " must have width 1, but got " << value->width);
+        }
+        properties.push_back(value);
+      }
+      return properties;
+    }
+    
+    // Bounded model checking of safety properties. Properties are outputs
+    // of width 1 which must be true in every cycle.
+    class Bmc {
+    private:
+      std::vector<Value*> _properties;
+      Unrolling _unrolling;
+      size_t _checked = 0;
+    public:
+      Bmc(Module& module, const std::vector<std::string>& properties):
+        _properties(find_properties(module, properties)), _unrolling(module) {}
+      
+      size_t checked_depth() const { return _checked; }
+      
+      // Checks the properties in the first depth cycles. Cycles which were
+      // checked by previous calls are not checked again.
+      std::optional<Trace> check(size_t depth) {
+        proof::CnfBuilder& builder = _unrolling.builder();
+        while (_checked < depth) {
+          size_t frame = _checked;
+          while (_unrolling.frames() <= frame) {
+            _unrolling.unroll();
+          }
+          
+          std::vector<proof::Cnf::Literal> holds;
+          for (Value* property : _properties) {
+            holds.push_back(_unrolling.literal(_unrolling.at(frame, property)));
+          }
+          proof::Cnf::Literal is_violated = builder.cnf().var();
+          std::vector<proof::Cnf::Literal> clause = {!is_violated};
+          for (proof::Cnf::Literal lit : holds) {
+            clause.push_back(!lit);
+          }
+          builder.cnf().add_clause(clause);
+          
+          if (builder.solve({is_violated}) == proof::Solver::Result::Sat) {
+            Trace trace = _unrolling.trace(frame + 1);
+            trace.cycle = frame;
+            for (size_t it = 0; it < _properties.size(); it++) {
+              if (!_unrolling.model(frame, _properties[it])[0]) {
+                trace.property = it;
+                break;
+              }
+            }
+            return trace;
+          }
+          
+          // The properties hold in this frame, which constrains later queries
+          for (proof::Cnf::Literal lit : holds) {
+            builder.cnf().add_clause({lit});
+          }
+          _checked++;
+        }
+        return std::nullopt;
+      }
+    };
+    
+    enum class Status {
+      Proven, Violated, Unknown
+    };
+    
+    // Unbounded safety checking using k-induction. The base case is checked
+    // using Bmc. The induction step checks whether k consecutive cycles in
+    // which the properties hold are always followed by a cycle in which they
+    // hold, where the k + 1 states must be pairwise distinct (simple path
+    // constraint). Memories are not supported.
+    class KInduction {
+    private:
+      std::vector<Value*> _properties;
+      Bmc _base;
+      Unrolling _step;
+      size_t _depth = 0;
+      std::optional<Trace> _trace;
+      
+      // Requires the state of the newest frame of the step unrolling to
+      // differ from all previous states
+      void add_simple_path() {
+        proof::CnfBuilder& builder = _step.builder();
+        size_t frame = _step.frames() - 1;
+        std::vector<Value*> state = _step.state(frame);
+        for (size_t other = 0; other < frame; other++) {
+          std::vector<Value*> other_state = _step.state(other);
+          std::vector<proof::Cnf::Literal> clause;
+          for (size_t it = 0; it < state.size(); it++) {
+            clause.push_back(builder.cnf().f_xor(builder[state[it]], builder[other_state[it]]));
+          }
+          builder.cnf().add_clause(clause);
+        }
+      }
+    public:
+      KInduction(Module& module, const std::vector<std::string>& properties):
+        _properties(find_properties(module, properties)),
+        _base(module, properties),
+        _step(module, false) {}
+      
+      // The properties are k-inductive for k = depth() if they were proven
+      size_t depth() const { return _depth; }
+      const Trace& trace() const { return _trace.value(); }
+      
+      Status check(size_t max_depth) {
+        proof::CnfBuilder& builder = _step.builder();
+        for (size_t depth = _depth + 1; depth <= max_depth; depth++) {
+          _trace = _base.check(depth);
+          if (_trace.has_value()) {
+            return Status::Violated;
+          }
+          
+          // The properties hold in the first depth frames
+          while (_step.frames() <= depth) {
+            _step.unroll();
+            add_simple_path();
+          }
+          for (Value* property : _properties) {
+            builder.cnf().add_clause({_step.literal(_step.at(depth - 1, property))});
+          }
+          
+          proof::Cnf::Literal is_violated = builder.cnf().var();
+          std::vector<proof::Cnf::Literal> clause = {!is_violated};
+          for (Value* property : _properties) {
+            clause.push_back(!_step.literal(_step.at(depth, property)));
+          }
+          builder.cnf().add_clause(clause);
+          
+          _depth = depth;
+          if (builder.solve({is_violated}) == proof::Solver::Result::Unsat) {
+            return Status::Proven;
+          }
+        }
+        return Status::Unknown;
+      }
+    };
+    
+    // Inductive invariant over the registers of a module in conjunctive
+    // normal form
+    struct Invariant {
+      struct Literal {
+        Reg* reg = nullptr;
+        size_t bit = 0;
+        bool value = false;
+      };
+      
+      // Each clause requires one of its register bits to have the given value
+      std::vector<std::vector<Literal>> clauses;
+      
+      // Builds a value of width 1 which is true iff the registers of module
+      // satisfy the invariant
+      Value* build(Module& module) const {
+        Value* result = module.constant(BitString::from_bool(true));
+        for (const std::vector<Literal>& clause : clauses) {
+          Value* is_sat = module.constant(BitString::from_bool(false));
+          for (const Literal& lit : clause) {
+            Value* bit = module.op(Op::Kind::Slice, {
+              lit.reg,
+              module.constant(BitString::from_uint(lit.bit)),
+              module.constant(BitString::from_uint(1))
+            });
+            if (!lit.value) {
+              bit = module.op(Op::Kind::Not, {bit});
+            }
+            is_sat = module.op(Op::Kind::Or, {is_sat, bit});
+          }
+          result = module.op(Op::Kind::And, {result, is_sat});
+        }
+        return result;
+      }
+    };
+    
+    // Unbounded safety checking using IC3 / property directed reachability.
+    // The transition relation is bit-blasted once, all queries are solved
+    // incrementally using one activation literal per frame. Memories are
+    // not supported.
+    class Ic3 {
+    private:
+      using Literal = proof::Cnf::Literal;
+      // Number of retired strengthening clauses after which they are
+      // deleted from the solver
+      static constexpr const size_t SIMPLIFY_INTERVAL = 256;
+      // Indices of register bits and their values
+      using Cube = std::vector<std::pair<size_t, bool>>;
+      
+      struct Obligation {
+        size_t level = 0;
+        Cube cube;
+        // Inputs which lead to the successor or violate a property
+        std::vector<BitString> inputs;
+        size_t successor = 0;
+        bool has_successor = false;
+      };
+      
+      Module& _module;
+      std::vector<Value*> _properties;
+      Unrolling _unrolling;
+      
+      std::vector<std::pair<Reg*, size_t>> _bits;
+      std::vector<Value*> _state;
+      std::vector<Value*> _next_state;
+      std::vector<bool> _initial;
+      Literal _is_bad;
+      
+      // Cubes blocked at each level. Frame k contains the negation of all
+      // cubes at levels >= k.
+      std::vector<std::vector<Cube>> _frames;
+      std::vector<Literal> _activations;
+      size_t _retired = 0;
+      
+      std::optional<Trace> _trace;
+      Invariant _invariant;
+      
+      proof::CnfBuilder& builder() { return _unrolling.builder(); }
+      
+      size_t frontier() const { return _frames.size() - 1; }
+      
+      Literal literal(const std::vector<Value*>& state, const std::pair<size_t, bool>& lit) {
+        Literal literal = builder()[state[lit.first]];
+        return lit.second ? literal : !literal;
+      }
+      
+      bool is_initial(const Cube& cube) const {
+        for (const auto& [index, value] : cube) {
+          if (_initial[index] != value) {
+            return false;
+          }
+        }
+        return true;
+      }
+      
+      // Assumptions which restrict the current state to frame k
+      std::vector<Literal> frame_assumptions(size_t level) {
+        std::vector<Literal> assumptions;
+        if (level == 0) {
+          for (size_t it = 0; it < _state.size(); it++) {
+            assumptions.push_back(literal(_state, {it, _initial[it]}));
+          }
+        } else {
+          for (size_t it = level; it < _activations.size(); it++) {
+            assumptions.push_back(_activations[it]);
+          }
+        }
+        return assumptions;
+      }
+      
+      Cube model_cube() {
+        BitString values = builder().model(_state);
+        Cube cube;
+        for (size_t it = 0; it < _state.size(); it++) {
+          cube.emplace_back(it, values[it]);
+        }
+        return cube;
+      }
+      
+      std::vector<BitString> model_inputs() {
+        return _unrolling.trace(1).inputs[0];
+      }
+      
+      // Checks whether frame level together with the negation of cube (if
+      // is_strengthened is set) can reach cube in one step. If not, core is
+      // set to a subset of cube which is not reachable either.
+      // The negation of a cube with more than one literal is a temporary
+      // clause with a fresh activation literal. It is retired by a unit
+      // afterwards and periodically deleted from the solver.
+      bool is_reachable(size_t level, const Cube& cube, bool is_strengthened, Cube* core = nullptr) {
+        std::vector<Literal> assumptions = frame_assumptions(level);
+        Literal strengthening;
+        if (is_strengthened && cube.size() == 1) {
+          assumptions.push_back(!literal(_state, cube[0]));
+          is_strengthened = false;
+        } else if (is_strengthened) {
+          strengthening = builder().cnf().var();
+          std::vector<Literal> clause = {!strengthening};
+          for (const auto& lit : cube) {
+            clause.push_back(!literal(_state, lit));
+          }
+          builder().cnf().add_clause(clause);
+          assumptions.push_back(strengthening);
+        }
+        size_t cube_offset = assumptions.size();
+        for (const auto& lit : cube) {
+          assumptions.push_back(literal(_next_state, lit));
+        }
+        
+        bool is_sat = builder().solve(assumptions) == proof::Solver::Result::Sat;
+        if (!is_sat && core != nullptr) {
+          std::unordered_map<int64_t, size_t> indices;
+          for (size_t it = 0; it < cube.size(); it++) {
+            indices[assumptions[cube_offset + it].id] = it;
+          }
+          std::vector<bool> is_core(cube.size());
+          for (Literal lit : builder().failed_assumptions()) {
+            auto it = indices.find(lit.id);
+            if (it != indices.end()) {
+              is_core[it->second] = true;
+            }
+          }
+          core->clear();
+          for (size_t it = 0; it < cube.size(); it++) {
+            if (is_core[it]) {
+              core->push_back(cube[it]);
+            }
+          }
+          // The lemma must hold in the initial state
+          if (is_initial(*core)) {
+            for (const auto& lit : cube) {
+              if (_initial[lit.first] != lit.second) {
+                core->push_back(lit);
+                std::sort(core->begin(), core->end());
+                break;
+              }
+            }
+          }
+        }
+        
+        if (is_strengthened) {
+          builder().cnf().add_clause({!strengthening});
+          if (++_retired >= SIMPLIFY_INTERVAL) {
+            builder().simplify();
+            _retired = 0;
+          }
+        }
+        return is_sat;
+      }
+      
+      // Drops literals from cube while it stays unreachable from frame level
+      Cube generalize(size_t level, Cube cube) {
+        for (size_t it = 0; it < cube.size() && cube.size() > 1; ) {
+          Cube candidate = cube;
+          candidate.erase(candidate.begin() + it);
+          Cube core;
+          if (!is_initial(candidate) && !is_reachable(level, candidate, true, &core)) {
+            cube = core;
+            it = 0;
+          } else {
+            it++;
+          }
+        }
+        return cube;
+      }
+      
+      void add_lemma(size_t level, const Cube& cube) {
+        _frames[level].push_back(cube);
+        std::vector<Literal> clause = {!_activations[level]};
+        for (const auto& lit : cube) {
+          clause.push_back(!literal(_state, lit));
+        }
+        builder().cnf().add_clause(clause);
+      }
+      
+      static bool subsumes(const Cube& a, const Cube& b) {
+        return std::includes(b.begin(), b.end(), a.begin(), a.end());
+      }
+      
+      bool is_blocked(size_t level, const Cube& cube) const {
+        for (size_t it = level; it < _frames.size(); it++) {
+          for (const Cube& lemma : _frames[it]) {
+            if (subsumes(lemma, cube)) {
+              return true;
+            }
+          }
+        }
+        return false;
+      }
+      
+      void new_frame() {
+        _frames.emplace_back();
+        _activations.push_back(builder().cnf().var());
+      }
+      
+      Trace build_trace(std::vector<Obligation>& obligations, size_t index, size_t property) {
+        Trace trace;
+        while (true) {
+          trace.inputs.push_back(obligations[index].inputs);
+          if (!obligations[index].has_successor) {
+            break;
+          }
+          index = obligations[index].successor;
+        }
+        trace.cycle = trace.inputs.size() - 1;
+        trace.property = property;
+        return trace;
+      }
+      
+      size_t violated_property() {
+        for (size_t it = 0; it < _properties.size(); it++) {
+          if (!_unrolling.model(0, _properties[it])[0]) {
+            return it;
+          }
+        }
+        return 0;
+      }
+      
+      // Blocks all bad states in the frontier. Returns false if a
+      // counterexample was found.
+      bool block_bad() {
+        while (true) {
+          std::vector<Literal> assumptions = frame_assumptions(frontier());
+          assumptions.push_back(_is_bad);
+          if (builder().solve(assumptions) != proof::Solver::Result::Sat) {
+            return true;
+          }
+          
+          size_t property = violated_property();
+          std::vector<Obligation> obligations;
+          obligations.push_back(Obligation {frontier(), model_cube(), model_inputs()});
+          if (is_initial(obligations[0].cube)) {
+            _trace = build_trace(obligations, 0, property);
+            return false;
+          }
+          
+          using Entry = std::pair<size_t, size_t>;
+          std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+          queue.emplace(frontier(), 0);
+          while (!queue.empty()) {
+            auto [level, index] = queue.top();
+            Cube cube = obligations[index].cube;
+            if (is_blocked(level, cube)) {
+              queue.pop();
+              continue;
+            }
+            
+            Cube core;
+            if (is_reachable(level - 1, cube, true, &core)) {
+              Obligation predecessor {level - 1, model_cube(), model_inputs()};
+              predecessor.successor = index;
+              predecessor.has_successor = true;
+              obligations.push_back(predecessor);
+              if (is_initial(predecessor.cube)) {
+                _trace = build_trace(obligations, obligations.size() - 1, property);
+                return false;
+              }
+              queue.emplace(level - 1, obligations.size() - 1);
+            } else {
+              queue.pop();
+              Cube lemma = generalize(level - 1, core);
+              size_t lemma_level = level;
+              while (lemma_level < frontier() && !is_reachable(lemma_level, lemma, true)) {
+                lemma_level++;
+              }
+              add_lemma(lemma_level, lemma);
+            }
+          }
+        }
+      }
+      
+      // Pushes lemmas to higher frames. Returns true if two frames are equal,
+      // in which case they are an inductive invariant.
+      bool propagate() {
+        for (size_t level = 1; level < frontier(); level++) {
+          std::vector<Cube> cubes = _frames[level];
+          _frames[level].clear();
+          for (const Cube& cube : cubes) {
+            if (is_reachable(level, cube, false)) {
+              _frames[level].push_back(cube);
+            } else {
+              add_lemma(level + 1, cube);
+            }
+          }
+          
+          if (_frames[level].empty()) {
+            for (size_t it = level + 1; it < _frames.size(); it++) {
+              for (const Cube& cube : _frames[it]) {
+                std::vector<Invariant::Literal> clause;
+                for (const auto& [index, value] : cube) {
+                  clause.push_back(Invariant::Literal {_bits[index].first, _bits[index].second, !value});
+                }
+                _invariant.clauses.push_back(clause);
+              }
+            }
+            return true;
+          }
+        }
+        return false;
+      }
+    public:
+      Ic3(Module& module, const std::vector<std::string>& properties):
+          _module(module),
+          _properties(find_properties(module, properties)),
+          _unrolling(module, false) {
+        _unrolling.unroll();
+        _state = _unrolling.state(0);
+        _next_state = _unrolling.next_state(0);
+        for (Reg* reg : _module.regs()) {
+          for (size_t bit = 0; bit < reg->width; bit++) {
+            _bits.emplace_back(reg, bit);
+            _initial.push_back(reg->initial[bit]);
+          }
+        }
+        
+        _is_bad = builder().cnf().var();
+        std::vector<Literal> clause = {!_is_bad};
+        for (Value* property : _properties) {
+          clause.push_back(!_unrolling.literal(_unrolling.at(0, property)));
+        }
+        builder().cnf().add_clause(clause);
+      }
+      
+      const Trace& trace() const { return _trace.value(); }
+      const Invariant& invariant() const { return _invariant; }
+      size_t frames() const { return _frames.size(); }
+      
+      // Returns Unknown if no invariant was found using max_frames frames
+      Status check(size_t max_frames) {
+        if (_frames.empty()) {
+          new_frame();
+          if (!block_bad()) {
+            return Status::Violated;
+          }
+          new_frame();
+        }
+        
+        while (_frames.size() <= max_frames) {
+          if (!block_bad()) {
+            return Status::Violated;
+          }
+          if (propagate()) {
+            return Status::Proven;
+          }
+          new_frame();
+        }
+        return Status::Unknown;
+      }
+    };
+  }
+}
+
+#undef throw_error
+
+#endif
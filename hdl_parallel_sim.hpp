@@ -0,0 +1,327 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_PARALLEL_SIM_HPP
+#define HDL_PARALLEL_SIM_HPP
+
+#include <inttypes.h>
+#include <vector>
+#include <unordered_map>
+#include <random>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+  #include <immintrin.h>
+#endif
+
+#include "hdl.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace sim {
+    // Simulates LANES independent instances of a bit level circuit in lockstep.
+    // Every single bit value is stored as a mask with one bit per lane.
+    // Circuits should be flattened using hdl::flatten::Flattening first.
+    // And, Or, Xor and Not gates of width 1 are evaluated, all other values
+    // of width 1 (e.g. inputs or slices of inputs) are treated as free
+    // variables which are set using ParallelSimulation::set.
+    // Registers of width 1 are updated once per call to step.
+    template <size_t WORDS = 1>
+    class ParallelSimulation {
+    public:
+      static constexpr const size_t LANES = WORDS * 64;
+      // Only as strict as the widest vector kernel which is used for WORDS,
+      // so that small lane counts are not padded
+      static constexpr const size_t ALIGNMENT =
+        WORDS % 8 == 0 ? 64 : (WORDS % 4 == 0 ? 32 : alignof(uint64_t));
+
+      struct alignas(ALIGNMENT) Lanes {
+        uint64_t words[WORDS] = {0};
+
+        bool at(size_t lane) const {
+          return (words[lane / 64] >> (lane % 64)) & 1;
+        }
+
+        void set(size_t lane, bool value) {
+          if (value) {
+            words[lane / 64] |= uint64_t(1) << (lane % 64);
+          } else {
+            words[lane / 64] &= ~(uint64_t(1) << (lane % 64));
+          }
+        }
+
+        bool operator==(const Lanes& other) const {
+          for (size_t it = 0; it < WORDS; it++) {
+            if (words[it] != other.words[it]) {
+              return false;
+            }
+          }
+          return true;
+        }
+
+        bool operator!=(const Lanes& other) const {
+          return !(*this == other);
+        }
+      };
+    private:
+      struct Gate {
+        Op::Kind kind;
+        size_t result = 0;
+        size_t a = 0;
+        size_t b = 0;
+      };
+
+      struct State {
+        const Reg* reg = nullptr;
+        size_t slot = 0;
+        size_t next = 0;
+      };
+
+      Module& _module;
+      NodeMap<size_t> _slots;
+      std::vector<Lanes> _values;
+      std::vector<Gate> _gates;
+      std::vector<const Value*> _free;
+      std::vector<State> _states;
+      std::vector<Lanes> _staged;
+
+      static bool is_gate(const Value* value) {
+        if (const Op* op = dyn_cast<Op>(value)) {
+          return op->width == 1 && (
+            op->kind == Op::Kind::And ||
+            op->kind == Op::Kind::Or ||
+            op->kind == Op::Kind::Xor ||
+            op->kind == Op::Kind::Not
+          );
+        }
+        return false;
+      }
+
+      size_t alloc(const Value* value) {
+        size_t slot = _values.size();
+        _slots[value] = slot;
+        _values.emplace_back();
+        return slot;
+      }
+
+      void compile(const Value* root, std::vector<const Reg*>& regs) {
+        std::vector<std::pair<const Value*, bool>> stack;
+        stack.emplace_back(root, false);
+        while (!stack.empty()) {
+          auto [value, is_expanded] = stack.back();
+          stack.pop_back();
+
+          if (_slots.has(value)) {
+            continue;
+          }
+
+          if (value->width != 1) {
+            throw_error(Error,
+              "ParallelSimulation expects values of width 1, but got value of width " << value->width << ". " <<
+              "Use hdl::flatten::Flattening to flatten the circuit."
+            );
+          }
+
+          if (const Constant* constant = dyn_cast<Constant>(value)) {
+            Lanes& lanes = _values[alloc(value)];
+            for (size_t it = 0; it < WORDS; it++) {
+              lanes.words[it] = constant->value[0] ? ~uint64_t(0) : 0;
+            }
+          } else if (const Reg* reg = dyn_cast<Reg>(value)) {
+            alloc(reg);
+            regs.push_back(reg);
+          } else if (is_gate(value)) {
+            const Op* op = dyn_cast<Op>(value);
+            if (is_expanded) {
+              Gate gate;
+              gate.kind = op->kind;
+              gate.a = _slots.at(op->args[0]);
+              gate.b = op->args.size() > 1 ? _slots.at(op->args[1]) : gate.a;
+              gate.result = alloc(value);
+              _gates.push_back(gate);
+            } else {
+              stack.emplace_back(value, true);
+              for (const Value* arg : op->args) {
+                stack.emplace_back(arg, false);
+              }
+            }
+          } else {
+            alloc(value);
+            _free.push_back(value);
+          }
+        }
+      }
+
+      #if defined(__AVX512F__)
+        #define simd512(intrinsic) \
+          if constexpr (WORDS % 8 == 0) { \
+            for (size_t it = 0; it < WORDS; it += 8) { \
+              __m512i a_vec = _mm512_load_si512((const void*)(a + it)); \
+              __m512i b_vec = _mm512_load_si512((const void*)(b + it)); \
+              _mm512_store_si512((void*)(result + it), intrinsic(a_vec, b_vec)); \
+            } \
+            return; \
+          }
+      #else
+        #define simd512(intrinsic)
+      #endif
+
+      #if defined(__AVX2__)
+        #define simd256(intrinsic) \
+          if constexpr (WORDS % 4 == 0) { \
+            for (size_t it = 0; it < WORDS; it += 4) { \
+              __m256i a_vec = _mm256_load_si256((const __m256i*)(a + it)); \
+              __m256i b_vec = _mm256_load_si256((const __m256i*)(b + it)); \
+              _mm256_store_si256((__m256i*)(result + it), intrinsic(a_vec, b_vec)); \
+            } \
+            return; \
+          }
+      #else
+        #define simd256(intrinsic)
+      #endif
+
+      #define kernel(name, op, intrinsic512, intrinsic256) \
+        static inline void name(uint64_t* result, const uint64_t* a, const uint64_t* b) { \
+          simd512(intrinsic512) \
+          simd256(intrinsic256) \
+          for (size_t it = 0; it < WORDS; it++) { \
+            result[it] = a[it] op b[it]; \
+          } \
+        }
+
+      kernel(kernel_and, &, _mm512_and_si512, _mm256_and_si256)
+      kernel(kernel_or, |, _mm512_or_si512, _mm256_or_si256)
+      kernel(kernel_xor, ^, _mm512_xor_si512, _mm256_xor_si256)
+
+      #undef kernel
+      #undef simd256
+      #undef simd512
+
+      static inline void kernel_not(uint64_t* result, const uint64_t* a) {
+        for (size_t it = 0; it < WORDS; it++) {
+          result[it] = ~a[it];
+        }
+      }
+    public:
+      ParallelSimulation(Module& module, const std::vector<Value*>& bits):
+          _module(module) {
+        std::vector<const Reg*> regs;
+        for (const Value* bit : bits) {
+          compile(bit, regs);
+        }
+
+        for (size_t it = 0; it < regs.size(); it++) {
+          compile(regs[it]->next, regs);
+        }
+
+        for (const Reg* reg : regs) {
+          State state;
+          state.reg = reg;
+          state.slot = _slots.at(reg);
+          state.next = _slots.at(reg->next);
+          _states.push_back(state);
+        }
+        _staged.resize(_states.size());
+
+        reset();
+      }
+
+      const std::vector<const Value*>& free() const { return _free; }
+      size_t gate_count() const { return _gates.size(); }
+
+      bool has(const Value* bit) const {
+        return _slots.has(bit);
+      }
+
+      const Lanes& operator[](const Value* bit) const {
+        if (!has(bit)) {
+          throw_error(Error, "Value is not part of the simulation");
+        }
+        return _values[_slots.at(bit)];
+      }
+
+      bool at(const Value* bit, size_t lane) const {
+        return (*this)[bit].at(lane);
+      }
+
+      void set(const Value* bit, const Lanes& lanes) {
+        if (!has(bit)) {
+          throw_error(Error, "Value is not part of the simulation");
+        }
+        _values[_slots.at(bit)] = lanes;
+      }
+
+      void set(const Value* bit, size_t lane, bool value) {
+        if (!has(bit)) {
+          throw_error(Error, "Value is not part of the simulation");
+        }
+        _values[_slots.at(bit)].set(lane, value);
+      }
+
+      // Assigns independent uniformly distributed values to all free variables
+      template <class Rng>
+      void randomize(Rng& rng) {
+        for (const Value* value : _free) {
+          Lanes& lanes = _values[_slots.at(value)];
+          for (size_t it = 0; it < WORDS; it++) {
+            lanes.words[it] = uint64_t(rng());
+          }
+        }
+      }
+
+      void reset() {
+        for (const State& state : _states) {
+          Lanes& lanes = _values[state.slot];
+          for (size_t it = 0; it < WORDS; it++) {
+            lanes.words[it] = state.reg->initial[0] ? ~uint64_t(0) : 0;
+          }
+        }
+      }
+
+      void eval() {
+        for (const Gate& gate : _gates) {
+          uint64_t* result = _values[gate.result].words;
+          const uint64_t* a = _values[gate.a].words;
+          const uint64_t* b = _values[gate.b].words;
+          switch (gate.kind) {
+            case Op::Kind::And: kernel_and(result, a, b); break;
+            case Op::Kind::Or: kernel_or(result, a, b); break;
+            case Op::Kind::Xor: kernel_xor(result, a, b); break;
+            case Op::Kind::Not: kernel_not(result, a); break;
+            default: break;
+          }
+        }
+      }
+
+      // Evaluates the circuit and advances all registers by one clock cycle
+      void step() {
+        eval();
+        for (size_t it = 0; it < _states.size(); it++) {
+          _staged[it] = _values[_states[it].next];
+        }
+        for (size_t it = 0; it < _states.size(); it++) {
+          _values[_states[it].slot] = _staged[it];
+        }
+      }
+    };
+  }
+}
+
+#undef throw_error
+
+#endif
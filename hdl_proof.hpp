@@ -17,8 +17,7 @@
 
 #include <inttypes.h>
 #include <vector>
-#include <set>
-#include <map>
+#include <algorithm>
 #include <fstream>
 
 #include "hdl.hpp"
@@ -49,6 +48,16 @@ namespace hdl {
       std::vector<Literal> _literals;
       std::vector<size_t> _clause_indices;
       int64_t _var_count = 0;
+      
+      // Bounds for simplify. Variables are only eliminated if they occur in
+      // at most MAX_OCCURRENCES clauses per polarity and if this does not
+      // increase the number of clauses.
+      static constexpr const int8_t UNASSIGNED = -1;
+      static constexpr const size_t MAX_ROUNDS = 8;
+      static constexpr const size_t MAX_OCCURRENCES = 16;
+      static constexpr const size_t MAX_RESOLVENT_SIZE = 24;
+      
+      friend class Solver;
     public:
       Cnf() { }
       
@@ -177,165 +186,397 @@ namespace hdl {
         return _clause_indices[clause_id];
       }
       
-      Cnf simplify() const {
-        struct Simplification {
-          struct Uses {
-            std::set<size_t> positive;
-            std::set<size_t> negative;
-            
-            std::set<size_t>& operator[](bool polarity) {
-              if (polarity) {
-                return positive;
-              } else {
-                return negative;
-              }
+      // Maps models of a simplified Cnf back to the variables of the
+      // original Cnf
+      struct Reconstruction {
+        struct Elimination {
+          size_t var = 0;
+          std::vector<std::vector<Literal>> clauses;
+        };
+        
+        // Literal of each original variable in the simplified Cnf
+        std::vector<Literal> literals;
+        // Values of variables which were fixed by unit propagation or pure
+        // literal elimination (-1 if the variable is not fixed)
+        std::vector<int8_t> values;
+        // Clauses removed by variable elimination in the order of elimination
+        std::vector<Elimination> eliminations;
+        
+        std::vector<bool> model(const std::vector<bool>& simplified) const {
+          std::vector<bool> result(literals.size());
+          for (size_t var = 0; var < literals.size(); var++) {
+            if (literals[var].is_valid()) {
+              result[var] = simplified[literals[var].var()] == literals[var].is_positive();
+            } else if (values[var] >= 0) {
+              result[var] = values[var] == 1;
             }
-            
-            bool is_pure() const {
-              return positive.size() == 0 || negative.size() == 0;
+          }
+          
+          // The eliminated variable is only set if one of its clauses is
+          // not satisfied otherwise
+          for (auto it = eliminations.rbegin(); it != eliminations.rend(); it++) {
+            result[it->var] = false;
+            for (const std::vector<Literal>& clause : it->clauses) {
+              bool is_sat = false;
+              for (Literal lit : clause) {
+                is_sat = is_sat || result[lit.var()] == lit.is_positive();
+              }
+              if (!is_sat) {
+                result[it->var] = true;
+                break;
+              }
             }
+          }
+          return result;
+        }
+      };
+      
+      // Unit propagation, pure literal elimination, subsumption,
+      // self-subsuming resolution and bounded variable elimination
+      Cnf simplify(Reconstruction& reconstruction) const {
+        struct Simplification {
+          struct Clause {
+            std::vector<Literal> literals;
+            bool is_active = true;
           };
           
           const Cnf& cnf;
-          std::vector<Uses> uses;
-          std::vector<size_t> clause_sizes;
-          std::map<int64_t, bool> assignments;
-          std::set<size_t> inactive_clauses;
-          std::vector<size_t> unit_clauses;
+          Reconstruction& reconstruction;
+          std::vector<Clause> clauses;
+          std::vector<std::vector<size_t>> occurrences;
+          std::vector<int8_t> values;
+          std::vector<bool> is_eliminated;
+          std::vector<bool> marks;
+          std::vector<Literal> units;
           bool is_unsat = false;
           
-          Simplification(const Cnf& _cnf): cnf(_cnf), uses(_cnf._var_count), clause_sizes(_cnf._clause_indices.size()) {
-            for (size_t clause_start = 0, clause_id = 0; clause_id < cnf._clause_indices.size(); clause_id++) {
-              size_t clause_end = cnf._clause_indices[clause_id];
-              for (size_t it = clause_start; it < clause_end; it++) {
-                Literal lit = cnf._literals[it];
-                uses[lit.var()][lit.is_positive()].insert(clause_id);
-              }
-              size_t clause_size = clause_end - clause_start;
-              clause_sizes[clause_id] = clause_size;
-              if (clause_size == 1) {
-                unit_clauses.push_back(clause_id);
-              } else if (clause_size == 0) {
-                is_unsat = true;
+          static inline size_t index(Literal lit) {
+            return size_t(lit.var()) * 2 + (lit.is_negative() ? 1 : 0);
+          }
+          
+          Simplification(const Cnf& _cnf, Reconstruction& _reconstruction):
+              cnf(_cnf),
+              reconstruction(_reconstruction),
+              occurrences(size_t(_cnf._var_count) * 2),
+              values(_cnf._var_count, UNASSIGNED),
+              is_eliminated(_cnf._var_count),
+              marks(size_t(_cnf._var_count) * 2) {
+            for (size_t clause_id = 0; clause_id < cnf.clause_count(); clause_id++) {
+              add_clause(std::vector<Literal>(
+                cnf._literals.begin() + cnf.clause_start_index(clause_id),
+                cnf._literals.begin() + cnf.clause_end_index(clause_id)
+              ));
+            }
+          }
+          
+          int8_t eval(Literal lit) const {
+            int8_t value = values[lit.var()];
+            if (value == UNASSIGNED) {
+              return UNASSIGNED;
+            }
+            return lit.is_positive() ? value : 1 - value;
+          }
+          
+          void add_clause(std::vector<Literal> literals) {
+            size_t count = 0;
+            bool is_tautology = false;
+            for (Literal lit : literals) {
+              if (marks[index(!lit)]) {
+                is_tautology = true;
+                break;
+              } else if (!marks[index(lit)]) {
+                marks[index(lit)] = true;
+                literals[count++] = lit;
               }
-              clause_start = clause_end;
             }
+            literals.resize(count);
+            for (Literal lit : literals) {
+              marks[index(lit)] = false;
+            }
+            
+            if (is_tautology) {
+              return;
+            } else if (literals.size() == 0) {
+              is_unsat = true;
+              return;
+            } else if (literals.size() == 1) {
+              units.push_back(literals[0]);
+            }
+            
+            for (Literal lit : literals) {
+              occurrences[index(lit)].push_back(clauses.size());
+            }
+            clauses.push_back(Clause {std::move(literals)});
           }
-        
-          bool is_active(size_t clause_id) const {
-            return inactive_clauses.find(clause_id) == inactive_clauses.end();
+          
+          // Active clauses containing lit. Inactive clauses are removed
+          // from the occurrence lists lazily.
+          const std::vector<size_t>& occurs(Literal lit) {
+            std::vector<size_t>& list = occurrences[index(lit)];
+            size_t count = 0;
+            for (size_t clause_id : list) {
+              if (clauses[clause_id].is_active) {
+                list[count++] = clause_id;
+              }
+            }
+            list.resize(count);
+            return list;
           }
           
-          bool is_assigned(int64_t var_id) const {
-            return assignments.find(var_id) != assignments.end();
+          void remove_literal(size_t clause_id, Literal lit) {
+            std::vector<Literal>& literals = clauses[clause_id].literals;
+            for (size_t it = 0; it < literals.size(); it++) {
+              if (literals[it].id == lit.id) {
+                literals.erase(literals.begin() + it);
+                break;
+              }
+            }
+            std::vector<size_t>& list = occurrences[index(lit)];
+            list.erase(std::find(list.begin(), list.end(), clause_id));
+            
+            if (literals.size() == 1) {
+              units.push_back(literals[0]);
+            } else if (literals.size() == 0) {
+              is_unsat = true;
+            }
           }
-        
-        private:
-          void deactivate_clause(size_t clause_id) {
-            inactive_clauses.insert(clause_id);
-            for (size_t it = cnf.clause_start_index(clause_id); it < cnf.clause_end_index(clause_id); it++) {
-              Literal lit = cnf._literals[it];
-              uses[lit.var()][lit.is_positive()].erase(clause_id);
+          
+          void assign(Literal lit) {
+            values[lit.var()] = lit.is_positive() ? 1 : 0;
+            for (size_t clause_id : occurs(lit)) {
+              clauses[clause_id].is_active = false;
+            }
+            std::vector<size_t> falsified = occurs(!lit);
+            for (size_t clause_id : falsified) {
+              remove_literal(clause_id, !lit);
             }
           }
-        
-        public:
-          void assign(int64_t var_id, bool value) {
-            if (is_unsat) { return; }
-            if (is_assigned(var_id)) {
-              if (assignments.at(var_id) != value) {
+          
+          bool propagate() {
+            bool changed = false;
+            while (!units.empty() && !is_unsat) {
+              Literal lit = units.back();
+              units.pop_back();
+              int8_t value = eval(lit);
+              if (value == 0) {
                 is_unsat = true;
+              } else if (value == UNASSIGNED) {
+                assign(lit);
+                changed = true;
               }
-              return;
             }
-            
-            assignments[var_id] = value;
-            Uses var_uses = uses[var_id];
-            for (size_t clause_id : var_uses[value]) {
-              deactivate_clause(clause_id);
-            }
-            for (size_t clause_id : var_uses[!value]) {
-              for (size_t it = cnf.clause_start_index(clause_id); it < cnf.clause_end_index(clause_id); it++) {
-                if (cnf._literals[it].var() == var_id) {
-                  clause_sizes[clause_id] -= 1;
+            return changed;
+          }
+          
+          bool assign_pure() {
+            bool changed = false;
+            for (size_t var = 0; var < values.size(); var++) {
+              if (values[var] != UNASSIGNED || is_eliminated[var]) {
+                continue;
+              }
+              Literal lit(int64_t(var) + 1);
+              bool has_positive = occurs(lit).size() > 0;
+              bool has_negative = occurs(!lit).size() > 0;
+              if (has_positive != has_negative) {
+                assign(has_positive ? lit : !lit);
+                changed = true;
+              }
+            }
+            return changed;
+          }
+          
+          // Removes clauses which are subsumed by another clause and
+          // strengthens clauses using self-subsuming resolution
+          bool subsume() {
+            bool changed = false;
+            for (size_t clause_id = 0; clause_id < clauses.size() && !is_unsat; clause_id++) {
+              if (!clauses[clause_id].is_active) {
+                continue;
+              }
+              const std::vector<Literal>& literals = clauses[clause_id].literals;
+              
+              // Every candidate contains the literal with the fewest
+              // occurrences or its negation
+              Literal best = literals[0];
+              size_t best_count = 0;
+              for (Literal lit : literals) {
+                size_t count = occurs(lit).size() + occurs(!lit).size();
+                if (lit.id == literals[0].id || count < best_count) {
+                  best = lit;
+                  best_count = count;
                 }
-                if (clause_sizes[clause_id] == 1) {
-                  unit_clauses.push_back(clause_id);
-                } else if (clause_sizes[clause_id] == 0) {
-                  is_unsat = true;
-                  return;
+              }
+              std::vector<size_t> candidates = occurs(best);
+              const std::vector<size_t>& negated = occurs(!best);
+              candidates.insert(candidates.end(), negated.begin(), negated.end());
+              
+              for (Literal lit : literals) {
+                marks[index(lit)] = true;
+              }
+              for (size_t other_id : candidates) {
+                const Clause& other = clauses[other_id];
+                if (other_id == clause_id || !other.is_active || other.literals.size() < literals.size()) {
+                  continue;
+                }
+                size_t matches = 0;
+                Literal flipped;
+                for (Literal lit : other.literals) {
+                  if (marks[index(lit)]) {
+                    matches++;
+                  } else if (marks[index(!lit)] && !flipped.is_valid()) {
+                    flipped = lit;
+                    matches++;
+                  }
+                }
+                if (matches == literals.size()) {
+                  if (flipped.is_valid()) {
+                    remove_literal(other_id, flipped);
+                  } else {
+                    clauses[other_id].is_active = false;
+                  }
+                  changed = true;
                 }
               }
+              for (Literal lit : clauses[clause_id].literals) {
+                marks[index(lit)] = false;
+              }
             }
+            return changed;
           }
           
-          void unit_prop() {
-            while (unit_clauses.size() > 0 && !is_unsat) {
-              size_t clause_id = unit_clauses.back();
-              unit_clauses.pop_back();
-              
-              if (!is_active(clause_id) || clause_sizes[clause_id] != 1) {
+          // Returns false if the resolvent is a tautology
+          bool resolve(const std::vector<Literal>& a, const std::vector<Literal>& b, size_t var, std::vector<Literal>& resolvent) {
+            resolvent.clear();
+            for (Literal lit : a) {
+              if (size_t(lit.var()) != var) {
+                marks[index(lit)] = true;
+                resolvent.push_back(lit);
+              }
+            }
+            bool is_tautology = false;
+            for (Literal lit : b) {
+              if (size_t(lit.var()) == var || marks[index(lit)]) {
+                continue;
+              } else if (marks[index(!lit)]) {
+                is_tautology = true;
+                break;
+              }
+              resolvent.push_back(lit);
+            }
+            for (Literal lit : a) {
+              marks[index(lit)] = false;
+            }
+            return !is_tautology;
+          }
+          
+          bool eliminate() {
+            bool changed = false;
+            std::vector<Literal> resolvent;
+            for (size_t var = 0; var < values.size() && !is_unsat; var++) {
+              if (values[var] != UNASSIGNED || is_eliminated[var]) {
+                continue;
+              }
+              Literal lit(int64_t(var) + 1);
+              std::vector<size_t> positive = occurs(lit);
+              std::vector<size_t> negative = occurs(!lit);
+              if (positive.size() + negative.size() == 0 ||
+                  positive.size() > MAX_OCCURRENCES ||
+                  negative.size() > MAX_OCCURRENCES) {
                 continue;
               }
               
-              for (size_t it = cnf.clause_start_index(clause_id); it < cnf.clause_end_index(clause_id); it++) {
-                Literal lit = cnf._literals[it];
-                if (!is_assigned(lit.var())) {
-                  assign(lit.var(), lit.is_positive());
+              std::vector<std::vector<Literal>> resolvents;
+              bool is_bounded = true;
+              for (size_t positive_id : positive) {
+                for (size_t negative_id : negative) {
+                  if (resolve(clauses[positive_id].literals, clauses[negative_id].literals, var, resolvent)) {
+                    if (resolvent.size() > MAX_RESOLVENT_SIZE ||
+                        resolvents.size() >= positive.size() + negative.size()) {
+                      is_bounded = false;
+                      break;
+                    }
+                    resolvents.push_back(resolvent);
+                  }
+                }
+                if (!is_bounded) {
                   break;
                 }
               }
+              if (!is_bounded) {
+                continue;
+              }
+              
+              Reconstruction::Elimination elimination;
+              elimination.var = var;
+              for (const std::vector<size_t>* clause_ids : {&positive, &negative}) {
+                for (size_t clause_id : *clause_ids) {
+                  elimination.clauses.push_back(clauses[clause_id].literals);
+                  clauses[clause_id].is_active = false;
+                }
+              }
+              reconstruction.eliminations.push_back(std::move(elimination));
+              is_eliminated[var] = true;
+              
+              for (std::vector<Literal>& clause : resolvents) {
+                add_clause(std::move(clause));
+              }
+              propagate();
+              changed = true;
             }
+            return changed;
           }
           
-          void assign_pure() {
-            for (size_t var_id = 0; var_id < uses.size(); var_id++) {
-              if (!is_assigned(var_id) && uses[var_id].is_pure()) {
-                assign(var_id, uses[var_id].positive.size() > 0);
+          void run() {
+            propagate();
+            for (size_t round = 0; round < MAX_ROUNDS && !is_unsat; round++) {
+              bool changed = subsume();
+              changed = propagate() || changed;
+              changed = assign_pure() || changed;
+              changed = eliminate() || changed;
+              changed = propagate() || changed;
+              if (!changed) {
+                break;
               }
             }
           }
           
           Cnf to_cnf() {
             Cnf result;
+            reconstruction.literals.assign(values.size(), Literal());
+            reconstruction.values = values;
             if (is_unsat) {
               result.add_clause({});
               return result;
             }
-            std::vector<Literal> vars(cnf._var_count);
-            for (size_t clause_start = 0, clause_id = 0; clause_id < cnf._clause_indices.size(); clause_id++) {
-              size_t clause_end = cnf._clause_indices[clause_id];
-              
-              if (inactive_clauses.find(clause_id) == inactive_clauses.end()) {
-                std::vector<Literal> clause;
-                for (size_t it = clause_start; it < clause_end; it++) {
-                  if (assignments.find(cnf._literals[it].var()) != assignments.end()) {
-                    continue;
-                  }
-                  if (!vars[cnf._literals[it].var()].is_valid()) {
-                    vars[cnf._literals[it].var()] = result.var();
-                  }
-                  Literal lit = vars[cnf._literals[it].var()];
-                  if (cnf._literals[it].is_negative()) {
-                    lit = !lit;
-                  }
-                  clause.push_back(lit);
+            std::vector<Literal>& vars = reconstruction.literals;
+            for (const Clause& clause : clauses) {
+              if (!clause.is_active) {
+                continue;
+              }
+              std::vector<Literal> literals;
+              for (Literal lit : clause.literals) {
+                if (!vars[lit.var()].is_valid()) {
+                  vars[lit.var()] = result.var();
                 }
-                result.add_clause(clause);
+                literals.push_back(lit.is_negative() ? !vars[lit.var()] : vars[lit.var()]);
               }
-              
-              clause_start = clause_end;
+              result.add_clause(literals);
             }
             return result;
           }
         };
         
-        Simplification simplification(*this);
-        simplification.unit_prop();
-        simplification.assign_pure();
+        reconstruction = Reconstruction();
+        Simplification simplification(*this, reconstruction);
+        simplification.run();
         return simplification.to_cnf();
       }
       
+      Cnf simplify() const {
+        Reconstruction reconstruction;
+        return simplify(reconstruction);
+      }
+      
       // I/O
       
       void write(std::ostream& stream) const {
@@ -358,10 +599,617 @@ namespace hdl {
       }
     };
     
+    // CDCL solver with two watched literals, VSIDS, first UIP clause learning,
+    // phase saving and Luby restarts. The clauses of the Cnf are copied once,
+    // learnt clauses are appended to the same flat literal array. Inactive
+    // learnt clauses are periodically deleted at decision level 0.
+    class Solver {
+    public:
+      enum class Result {
+        Sat, Unsat, Unknown
+      };
+    private:
+      using Literal = Cnf::Literal;
+      
+      static constexpr const int8_t UNASSIGNED = -1;
+      static constexpr const size_t NONE = ~size_t(0);
+      static constexpr const size_t RESTART_INTERVAL = 100;
+      static constexpr const double ACTIVITY_DECAY = 0.95;
+      static constexpr const double CLAUSE_ACTIVITY_DECAY = 0.999;
+      // Number of learnt clauses which are kept before the first reduction.
+      // The limit grows by a tenth after each reduction.
+      static constexpr const size_t MIN_MAX_LEARNTS = 2000;
+      
+      struct Clause {
+        size_t start = 0;
+        size_t size = 0;
+        bool is_learnt = false;
+        double activity = 0.0;
+      };
+      
+      struct Var {
+        int8_t value = UNASSIGNED;
+        bool phase = false;
+        size_t level = 0;
+        size_t reason = NONE;
+        double activity = 0.0;
+        size_t heap_index = NONE;
+      };
+      
+      std::vector<Literal> _literals;
+      std::vector<Clause> _clauses;
+      std::vector<std::vector<size_t>> _watches;
+      std::vector<Var> _vars;
+      std::vector<Literal> _trail;
+      std::vector<size_t> _trail_lims;
+      size_t _propagated = 0;
+      std::vector<size_t> _heap;
+      double _activity_inc = 1.0;
+      std::vector<bool> _seen;
+      double _clause_activity_inc = 1.0;
+      size_t _learnt_count = 0;
+      size_t _max_learnts = MIN_MAX_LEARNTS;
+      bool _is_unsat = false;
+      size_t _synced_clauses = 0;
+      std::vector<Literal> _failed_assumptions;
+      
+      static inline size_t index(Literal lit) {
+        return size_t(lit.var()) * 2 + (lit.is_negative() ? 1 : 0);
+      }
+      
+      // Returns 1 if lit is true, 0 if it is false and UNASSIGNED otherwise
+      inline int8_t eval(Literal lit) const {
+        int8_t value = _vars[lit.var()].value;
+        if (value == UNASSIGNED) {
+          return UNASSIGNED;
+        }
+        return lit.is_positive() ? value : 1 - value;
+      }
+      
+      inline size_t level() const {
+        return _trail_lims.size();
+      }
+      
+      // VSIDS
+      
+      bool heap_less(size_t a, size_t b) const {
+        return _vars[_heap[a]].activity > _vars[_heap[b]].activity;
+      }
+      
+      void heap_swap(size_t a, size_t b) {
+        std::swap(_heap[a], _heap[b]);
+        _vars[_heap[a]].heap_index = a;
+        _vars[_heap[b]].heap_index = b;
+      }
+      
+      void heap_up(size_t it) {
+        while (it > 0 && heap_less(it, (it - 1) / 2)) {
+          heap_swap(it, (it - 1) / 2);
+          it = (it - 1) / 2;
+        }
+      }
+      
+      void heap_down(size_t it) {
+        while (true) {
+          size_t best = it;
+          for (size_t child = it * 2 + 1; child <= it * 2 + 2 && child < _heap.size(); child++) {
+            if (heap_less(child, best)) {
+              best = child;
+            }
+          }
+          if (best == it) {
+            break;
+          }
+          heap_swap(it, best);
+          it = best;
+        }
+      }
+      
+      void heap_insert(size_t var) {
+        if (_vars[var].heap_index == NONE) {
+          _vars[var].heap_index = _heap.size();
+          _heap.push_back(var);
+          heap_up(_heap.size() - 1);
+        }
+      }
+      
+      size_t heap_pop() {
+        size_t var = _heap[0];
+        heap_swap(0, _heap.size() - 1);
+        _heap.pop_back();
+        _vars[var].heap_index = NONE;
+        if (!_heap.empty()) {
+          heap_down(0);
+        }
+        return var;
+      }
+      
+      void bump(size_t var) {
+        Var& data = _vars[var];
+        data.activity += _activity_inc;
+        if (data.activity > 1e100) {
+          for (Var& other : _vars) {
+            other.activity *= 1e-100;
+          }
+          _activity_inc *= 1e-100;
+        }
+        if (data.heap_index != NONE) {
+          heap_up(data.heap_index);
+        }
+      }
+      
+      void bump_clause(size_t clause) {
+        Clause& data = _clauses[clause];
+        data.activity += _clause_activity_inc;
+        if (data.activity > 1e20) {
+          for (Clause& other : _clauses) {
+            other.activity *= 1e-20;
+          }
+          _clause_activity_inc *= 1e-20;
+        }
+      }
+      
+      // Search
+      
+      void assign(Literal lit, size_t reason) {
+        Var& var = _vars[lit.var()];
+        var.value = lit.is_positive() ? 1 : 0;
+        var.level = level();
+        var.reason = reason;
+        _trail.push_back(lit);
+      }
+      
+      void watch(size_t clause) {
+        const Clause& data = _clauses[clause];
+        _watches[index(_literals[data.start])].push_back(clause);
+        _watches[index(_literals[data.start + 1])].push_back(clause);
+      }
+      
+      // Returns the conflicting clause or NONE
+      size_t propagate() {
+        while (_propagated < _trail.size()) {
+          Literal lit = !_trail[_propagated++];
+          std::vector<size_t>& watches = _watches[index(lit)];
+          size_t count = 0;
+          for (size_t it = 0; it < watches.size(); it++) {
+            size_t clause = watches[it];
+            Literal* lits = &_literals[_clauses[clause].start];
+            size_t size = _clauses[clause].size;
+            
+            // The false literal is moved to position 1
+            if (lits[0].id == lit.id) {
+              std::swap(lits[0], lits[1]);
+            }
+            if (eval(lits[0]) == 1) {
+              watches[count++] = clause;
+              continue;
+            }
+            
+            bool found = false;
+            for (size_t other = 2; other < size; other++) {
+              if (eval(lits[other]) != 0) {
+                std::swap(lits[1], lits[other]);
+                _watches[index(lits[1])].push_back(clause);
+                found = true;
+                break;
+              }
+            }
+            if (found) {
+              continue;
+            }
+            
+            watches[count++] = clause;
+            if (eval(lits[0]) == 0) {
+              for (it++; it < watches.size(); it++) {
+                watches[count++] = watches[it];
+              }
+              watches.resize(count);
+              return clause;
+            } else if (eval(lits[0]) == UNASSIGNED) {
+              assign(lits[0], clause);
+            }
+          }
+          watches.resize(count);
+        }
+        return NONE;
+      }
+      
+      // Derives the first UIP clause from the conflict. The asserting
+      // literal is placed at position 0 and the literal with the highest
+      // remaining level at position 1.
+      std::vector<Literal> analyze(size_t conflict) {
+        std::vector<Literal> learnt = {Literal()};
+        size_t pending = 0;
+        size_t trail_index = _trail.size();
+        Literal lit;
+        size_t clause = conflict;
+        do {
+          if (_clauses[clause].is_learnt) {
+            bump_clause(clause);
+          }
+          const Clause& data = _clauses[clause];
+          for (size_t it = lit.is_valid() ? 1 : 0; it < data.size; it++) {
+            Literal other = _literals[data.start + it];
+            size_t var = other.var();
+            if (!_seen[var] && _vars[var].level > 0) {
+              _seen[var] = true;
+              bump(var);
+              if (_vars[var].level == level()) {
+                pending++;
+              } else {
+                learnt.push_back(other);
+              }
+            }
+          }
+          
+          do {
+            lit = _trail[--trail_index];
+          } while (!_seen[lit.var()]);
+          clause = _vars[lit.var()].reason;
+          _seen[lit.var()] = false;
+          pending--;
+        } while (pending > 0);
+        learnt[0] = !lit;
+        
+        for (size_t it = 1; it < learnt.size(); it++) {
+          _seen[learnt[it].var()] = false;
+          if (_vars[learnt[it].var()].level > _vars[learnt[1].var()].level) {
+            std::swap(learnt[1], learnt[it]);
+          }
+        }
+        
+        _activity_inc /= ACTIVITY_DECAY;
+        _clause_activity_inc /= CLAUSE_ACTIVITY_DECAY;
+        return learnt;
+      }
+      
+      void backtrack(size_t target_level) {
+        if (level() <= target_level) {
+          return;
+        }
+        size_t trail_size = _trail_lims[target_level];
+        while (_trail.size() > trail_size) {
+          size_t var = _trail.back().var();
+          _vars[var].phase = _vars[var].value == 1;
+          _vars[var].value = UNASSIGNED;
+          _vars[var].reason = NONE;
+          heap_insert(var);
+          _trail.pop_back();
+        }
+        _trail_lims.resize(target_level);
+        _propagated = trail_size;
+      }
+      
+      // Adds a clause at decision level 0
+      void add_clause(std::vector<Literal> clause) {
+        if (_is_unsat) {
+          return;
+        }
+        
+        size_t count = 0;
+        for (size_t it = 0; it < clause.size(); it++) {
+          Literal lit = clause[it];
+          int8_t value = eval(lit);
+          if (value == 1) {
+            return;
+          } else if (value == 0) {
+            continue;
+          }
+          bool is_duplicate = false;
+          for (size_t other = 0; other < count; other++) {
+            if (clause[other].id == -lit.id) {
+              return;
+            }
+            is_duplicate = is_duplicate || clause[other].id == lit.id;
+          }
+          if (!is_duplicate) {
+            clause[count++] = lit;
+          }
+        }
+        clause.resize(count);
+        
+        if (clause.empty()) {
+          _is_unsat = true;
+        } else if (clause.size() == 1) {
+          assign(clause[0], NONE);
+          _is_unsat = propagate() != NONE;
+        } else {
+          add_clause(clause, false);
+        }
+      }
+      
+      size_t add_clause(const std::vector<Literal>& clause, bool is_learnt) {
+        Clause data;
+        data.start = _literals.size();
+        data.size = clause.size();
+        data.is_learnt = is_learnt;
+        data.activity = is_learnt ? _clause_activity_inc : 0.0;
+        _literals.insert(_literals.end(), clause.begin(), clause.end());
+        _clauses.push_back(data);
+        _learnt_count += is_learnt ? 1 : 0;
+        watch(_clauses.size() - 1);
+        return _clauses.size() - 1;
+      }
+      
+      bool is_satisfied(const Clause& clause) const {
+        for (size_t it = 0; it < clause.size; it++) {
+          if (eval(_literals[clause.start + it]) == 1) {
+            return true;
+          }
+        }
+        return false;
+      }
+      
+      // Compacts the remaining clauses and rebuilds their watches. Must be
+      // called at decision level 0 after propagation. The reasons of level 0
+      // assignments are never inspected by analyze or analyze_final, so they
+      // are cleared instead of keeping their clauses alive.
+      void remove_clauses(const std::vector<bool>& is_deleted) {
+        std::vector<Literal> literals;
+        std::vector<Clause> clauses;
+        _learnt_count = 0;
+        for (size_t clause = 0; clause < _clauses.size(); clause++) {
+          if (!is_deleted[clause]) {
+            Clause data = _clauses[clause];
+            data.start = literals.size();
+            literals.insert(literals.end(),
+              _literals.begin() + _clauses[clause].start,
+              _literals.begin() + _clauses[clause].start + data.size
+            );
+            clauses.push_back(data);
+            _learnt_count += data.is_learnt ? 1 : 0;
+          }
+        }
+        _literals = std::move(literals);
+        _clauses = std::move(clauses);
+        
+        for (Literal lit : _trail) {
+          _vars[lit.var()].reason = NONE;
+        }
+        for (std::vector<size_t>& watches : _watches) {
+          watches.clear();
+        }
+        for (size_t clause = 0; clause < _clauses.size(); clause++) {
+          watch(clause);
+        }
+      }
+      
+      // Deletes all clauses which are satisfied at decision level 0 and the
+      // less active half of the learnt clauses with more than two literals
+      void reduce() {
+        std::vector<bool> is_deleted(_clauses.size(), false);
+        std::vector<size_t> learnts;
+        for (size_t clause = 0; clause < _clauses.size(); clause++) {
+          if (is_satisfied(_clauses[clause])) {
+            is_deleted[clause] = true;
+          } else if (_clauses[clause].is_learnt && _clauses[clause].size > 2) {
+            learnts.push_back(clause);
+          }
+        }
+        
+        std::sort(learnts.begin(), learnts.end(), [&](size_t a, size_t b){
+          return _clauses[a].activity < _clauses[b].activity;
+        });
+        for (size_t it = 0; it < learnts.size() / 2; it++) {
+          is_deleted[learnts[it]] = true;
+        }
+        
+        remove_clauses(is_deleted);
+      }
+      
+      void reduce_if_full() {
+        if (_learnt_count >= _max_learnts) {
+          reduce();
+          _max_learnts = std::max(_max_learnts, _learnt_count) + _max_learnts / 10;
+        }
+      }
+      
+      static size_t luby(size_t index) {
+        size_t size = 1;
+        size_t seq = 0;
+        while (size < index + 1) {
+          seq++;
+          size = 2 * size + 1;
+        }
+        while (size - 1 != index) {
+          size = (size - 1) / 2;
+          seq--;
+          index = index % size;
+        }
+        return size_t(1) << seq;
+      }
+      // Collects the assumptions which imply that the assumption lit is false
+      void analyze_final(Literal lit) {
+        _failed_assumptions = {lit};
+        if (level() == 0) {
+          return;
+        }
+        _seen[lit.var()] = true;
+        for (size_t it = _trail.size(); it-- > _trail_lims[0]; ) {
+          size_t var = _trail[it].var();
+          if (!_seen[var]) {
+            continue;
+          }
+          if (_vars[var].reason == NONE) {
+            _failed_assumptions.push_back(_trail[it]);
+          } else {
+            const Clause& data = _clauses[_vars[var].reason];
+            for (size_t other = 1; other < data.size; other++) {
+              size_t other_var = _literals[data.start + other].var();
+              if (_vars[other_var].level > 0) {
+                _seen[other_var] = true;
+              }
+            }
+          }
+          _seen[var] = false;
+        }
+        _seen[lit.var()] = false;
+      }
+    public:
+      Solver() {}
+      Solver(const Cnf& cnf) { sync(cnf); }
+      
+      // Adds all variables and clauses which were added to cnf since the
+      // last call. Learnt clauses are kept, so the solver can be reused for
+      // related queries on a growing Cnf.
+      void sync(const Cnf& cnf) {
+        backtrack(0);
+        size_t var_count = cnf.var_count();
+        if (var_count > _vars.size()) {
+          size_t prev_var_count = _vars.size();
+          _vars.resize(var_count);
+          _watches.resize(var_count * 2);
+          _seen.resize(var_count);
+          for (size_t var = prev_var_count; var < var_count; var++) {
+            heap_insert(var);
+          }
+        }
+        for (size_t clause = _synced_clauses; clause < cnf.clause_count(); clause++) {
+          add_clause(std::vector<Literal>(
+            cnf._literals.begin() + cnf.clause_start_index(clause),
+            cnf._literals.begin() + cnf.clause_end_index(clause)
+          ));
+        }
+        _synced_clauses = cnf.clause_count();
+      }
+      
+      // Returns Unknown if more than max_conflicts conflicts occur.
+      // A limit of 0 disables it.
+      Result solve(size_t max_conflicts = 0) {
+        return solve({}, max_conflicts);
+      }
+      
+      // Solves under the assumption that all given literals are true.
+      // If the result is Unsat, failed_assumptions contains a subset of
+      // the assumptions which is already unsatisfiable.
+      Result solve(const std::vector<Literal>& assumptions, size_t max_conflicts = 0) {
+        backtrack(0);
+        _failed_assumptions.clear();
+        if (_is_unsat) {
+          return Result::Unsat;
+        }
+        reduce_if_full();
+        
+        size_t conflicts = 0;
+        size_t restarts = 0;
+        size_t restart_limit = RESTART_INTERVAL * luby(restarts);
+        size_t restart_conflicts = 0;
+        while (true) {
+          size_t conflict = propagate();
+          if (conflict != NONE) {
+            conflicts++;
+            restart_conflicts++;
+            if (level() == 0) {
+              _is_unsat = true;
+              return Result::Unsat;
+            }
+            
+            std::vector<Literal> learnt = analyze(conflict);
+            backtrack(learnt.size() > 1 ? _vars[learnt[1].var()].level : 0);
+            if (learnt.size() == 1) {
+              assign(learnt[0], NONE);
+            } else {
+              assign(learnt[0], add_clause(learnt, true));
+            }
+            
+            if (max_conflicts != 0 && conflicts >= max_conflicts) {
+              backtrack(0);
+              return Result::Unknown;
+            }
+            continue;
+          }
+          
+          if (restart_conflicts >= restart_limit) {
+            backtrack(0);
+            restarts++;
+            restart_limit = RESTART_INTERVAL * luby(restarts);
+            restart_conflicts = 0;
+            reduce_if_full();
+          }
+          
+          // The first decision levels are reserved for the assumptions
+          Literal decision;
+          while (level() < assumptions.size()) {
+            Literal assumption = assumptions[level()];
+            int8_t value = eval(assumption);
+            if (value == 1) {
+              _trail_lims.push_back(_trail.size());
+            } else if (value == 0) {
+              analyze_final(assumption);
+              backtrack(0);
+              return Result::Unsat;
+            } else {
+              decision = assumption;
+              break;
+            }
+          }
+          
+          if (!decision.is_valid()) {
+            size_t var = NONE;
+            while (!_heap.empty()) {
+              size_t candidate = heap_pop();
+              if (_vars[candidate].value == UNASSIGNED) {
+                var = candidate;
+                break;
+              }
+            }
+            if (var == NONE) {
+              return Result::Sat;
+            }
+            decision = Literal(int64_t(var) + 1);
+            if (!_vars[var].phase) {
+              decision = !decision;
+            }
+          }
+          
+          _trail_lims.push_back(_trail.size());
+          assign(decision, NONE);
+        }
+      }
+      
+      const std::vector<Literal>& failed_assumptions() const {
+        return _failed_assumptions;
+      }
+      
+      // Deletes all clauses which are satisfied by the units known so far.
+      // Incremental users which retire clauses by asserting the negation of
+      // their activation literal use this to stop propagating through them.
+      void simplify() {
+        backtrack(0);
+        if (_is_unsat) {
+          return;
+        }
+        std::vector<bool> is_deleted(_clauses.size(), false);
+        for (size_t clause = 0; clause < _clauses.size(); clause++) {
+          is_deleted[clause] = is_satisfied(_clauses[clause]);
+        }
+        remove_clauses(is_deleted);
+      }
+      
+      size_t clause_count() const { return _clauses.size(); }
+      size_t learnt_count() const { return _learnt_count; }
+      
+      // Value of lit in the model found by the last call to solve
+      bool value(Literal lit) const {
+        return eval(lit) == 1;
+      }      
+      // Values of all variables in the model found by the last call to solve
+      std::vector<bool> model() const {
+        std::vector<bool> values(_vars.size());
+        for (size_t var = 0; var < _vars.size(); var++) {
+          values[var] = _vars[var].value == 1;
+        }
+        return values;
+      }
+    };
+    
     class CnfBuilder {
     private:
       Cnf _cnf;
+      // Keyed by pointer, since a builder may be shared by several modules
+      // whose value IDs overlap
       std::unordered_map<const Value*, Cnf::Literal> _values;
+      Solver _solver;
       
       void expect_bit(const Value* value) {
         if (value->width != 1) {
@@ -375,6 +1223,10 @@ namespace hdl {
       CnfBuilder() {}
       
       const Cnf& cnf() const { return _cnf; }
+      Cnf& cnf() { return _cnf; }
+      
+      bool has(const Value* bit) const { return _values.find(bit) != _values.end(); }
+      Cnf::Literal operator[](const Value* bit) const { return _values.at(bit); }
       
       void free(const Value* bit) {
         expect_bit(bit);
@@ -396,9 +1248,9 @@ namespace hdl {
         
         Cnf::Literal result;
         
-        if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
+        if (const Constant* constant = dyn_cast<Constant>(value)) {
           result = _cnf.f_const(constant->value[0]);
-        } else if (const Op* op = dynamic_cast<const Op*>(value)) {
+        } else if (const Op* op = dyn_cast<Op>(value)) {
           for (const Value* arg : op->args) {
             build(arg);
           }
@@ -439,6 +1291,59 @@ namespace hdl {
         }
       }
       
+      // Values of bits in the model found by the last call to Solver::solve.
+      // The solver must have been constructed from cnf().
+      BitString model(const Solver& solver, const std::vector<Value*>& bits) const {
+        BitString string(bits.size());
+        for (size_t it = 0; it < bits.size(); it++) {
+          string.set(it, solver.value(_values.at(bits[it])));
+        }
+        return string;
+      }
+      
+      // Literals which are true iff bits are equal to string. They can be
+      // passed as assumptions to solve.
+      std::vector<Cnf::Literal> assumptions(const std::vector<Value*>& bits, const BitString& string) {
+        if (bits.size() != string.width()) {
+          throw_error(Error,
+            "assumptions expected BitString to be of the same width as value, but got " <<
+            string.width() << " and " << bits.size()
+          );
+        }
+        
+        std::vector<Cnf::Literal> literals;
+        for (size_t it = 0; it < bits.size(); it++) {
+          build(bits[it]);
+          literals.push_back(string[it] ? _values.at(bits[it]) : !_values.at(bits[it]));
+        }
+        return literals;
+      }
+      
+      // Incremental solving. Clauses which were added since the last call
+      // are passed to a solver which is kept alive (including its learnt
+      // clauses) across calls.
+      Solver::Result solve(const std::vector<Cnf::Literal>& assumptions = {}, size_t max_conflicts = 0) {
+        _solver.sync(_cnf);
+        return _solver.solve(assumptions, max_conflicts);
+      }
+      
+      const std::vector<Cnf::Literal>& failed_assumptions() const {
+        return _solver.failed_assumptions();
+      }
+      
+      // Passes new clauses to the incremental solver and deletes the clauses
+      // which are satisfied at decision level 0 from it
+      void simplify() {
+        _solver.sync(_cnf);
+        _solver.simplify();
+      }
+      
+      const Solver& solver() const { return _solver; }
+      
+      // Values of bits in the model found by the last call to solve
+      BitString model(const std::vector<Value*>& bits) const {
+        return model(_solver, bits);
+      }
     };
   }
 }
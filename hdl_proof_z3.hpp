@@ -41,6 +41,11 @@ namespace hdl {
             build(BitString::from_bool(false))
           );
         }
+        
+        // expr::bit2bool is not available in older z3 releases
+        static ::z3::expr bit2bool(::z3::expr expr, unsigned index) {
+          return expr.extract(index, index) == expr.ctx().bv_val(1, 1);
+        }
       public:
         Builder(::z3::context& context): _context(context) {}
         
@@ -114,12 +119,12 @@ namespace hdl {
           }
           
           std::optional<::z3::expr> expr;
-          if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
+          if (const Constant* constant = dyn_cast<Constant>(value)) {
             expr = build(constant->value);
-          } else if (const Unknown* unknown = dynamic_cast<const Unknown*>(value)) {
+          } else if (const Unknown* unknown = dyn_cast<Unknown>(value)) {
             free(value);
             return _values.at(value);
-          } else if (const Op* op = dynamic_cast<const Op*>(value)) {
+          } else if (const Op* op = dyn_cast<Op>(value)) {
             for (const Value* arg : op->args) {
               build(arg);
             }
@@ -139,21 +144,21 @@ namespace hdl {
               case Op::Kind::LtS: expr = bool2bv(::z3::slt(arg(0), arg(1))); break;
               case Op::Kind::Concat: expr = ::z3::concat(arg(0), arg(1)); break;
               case Op::Kind::Slice: {
-                size_t offset = dynamic_cast<const Constant*>(op->args[1])->value.as_uint64();
-                size_t width = dynamic_cast<const Constant*>(op->args[2])->value.as_uint64();
+                size_t offset = dyn_cast<Constant>(op->args[1])->value.as_uint64();
+                size_t width = dyn_cast<Constant>(op->args[2])->value.as_uint64();
                 expr = arg(0).extract(offset + width - 1, offset);
               }
               break;
               case Op::Kind::Shl: expr = ::z3::shl(arg(0), resize_u(arg(1), op->args[0]->width)); break;
               case Op::Kind::ShrU: expr = ::z3::lshr(arg(0), resize_u(arg(1), op->args[0]->width)); break;
               case Op::Kind::ShrS: expr = ::z3::ashr(arg(0), resize_u(arg(1), op->args[0]->width)); break;
-              case Op::Kind::Select: expr = ::z3::ite(arg(0).bit2bool(0), arg(1), arg(2)); break;
+              case Op::Kind::Select: expr = ::z3::ite(bit2bool(arg(0), 0), arg(1), arg(2)); break;
               default:
                 throw Error("Operator not implemented");
             }
             
             #undef arg
-          } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
+          } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
             // TODO: Check bounds
             ::z3::expr address = ::z3::bv2int(build(read->address), false);
             expr = _memories.at(read->memory)[address];
@@ -174,7 +179,7 @@ namespace hdl {
           auto numeral = model.eval(_values.at(value), true);
           BitString bit_string(numeral.get_sort().bv_size());
           for (size_t it = 0; it < bit_string.width(); it++) {
-            switch (model.eval(numeral.bit2bool(it), true).bool_value()) {
+            switch (model.eval(bit2bool(numeral, it), true).bool_value()) {
               case Z3_L_TRUE: bit_string.set(it, true); break;
               case Z3_L_FALSE: bit_string.set(it, false); break;
               default: throw Error("");
@@ -0,0 +1,503 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_REWRITE_HPP
+#define HDL_REWRITE_HPP
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <array>
+#include <optional>
+#include <variant>
+
+#include "hdl.hpp"
+#include "hdl_s_expr.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace rewrite {
+    // Rewrite rules written in the s_expr syntax, e.g.
+    //   (And (Not a) (Not b)) => (Not (Or a b))
+    // Names are variables, repeated names must match the same value and _
+    // matches any value. Constants may contain unknown (x) bits in the left
+    // hand side, (Match <constant> name) binds name to a matching constant.
+    // Rules only match if the widths of their right hand side fit the
+    // captured values, e.g. (Or a (Not a)) => 1'b1 only rewrites operators
+    // of width 1. All rules are compiled into a single discrimination tree
+    // which is walked once per operator. If multiple rules match, the first
+    // one wins.
+    class RuleSet final: public Rewriter {
+    private:
+      using Token = s_expr::Token;
+      using TokenStream = s_expr::TokenStream;
+      
+      struct Pattern {
+        enum class Type {
+          Var, Constant, Op
+        };
+        
+        Type type = Type::Var;
+        size_t var = 0;
+        PartialBitString constant;
+        Op::Kind kind = Op::Kind::And;
+        std::vector<Pattern> args;
+      };
+      
+      static constexpr const size_t NO_VAR = ~size_t(0);
+      static constexpr const uint32_t NONE = ~uint32_t(0);
+      
+      // Symbols of the discrimination tree. Operators are identified by
+      // their kind, followed by the symbols of their arguments.
+      static constexpr const size_t SYMBOL_CONSTANT = Op::KIND_COUNT;
+      static constexpr const size_t SYMBOL_ANY = Op::KIND_COUNT + 1;
+      static constexpr const size_t SYMBOL_COUNT = Op::KIND_COUNT + 2;
+      
+      // Rule with the order of operator arguments fixed. Captures are the
+      // values matched by SYMBOL_CONSTANT and SYMBOL_ANY in preorder.
+      struct Variant {
+        size_t rule = 0;
+        std::vector<size_t> vars;
+        std::vector<std::pair<size_t, size_t>> equal;
+        std::vector<std::pair<size_t, PartialBitString>> constants;
+      };
+      
+      struct Node {
+        std::array<uint32_t, SYMBOL_COUNT> children;
+        std::vector<Variant> variants;
+        
+        Node() { children.fill(NONE); }
+      };
+      
+      // Right hand sides of all rules
+      std::vector<Pattern> _rules;
+      std::vector<Node> _nodes = {Node()};
+      
+      static std::optional<Op::Kind> find_kind(const std::string& name) {
+        for (size_t it = 0; it < Op::KIND_COUNT; it++) {
+          if (name == Op::KIND_NAMES[it]) {
+            return Op::Kind(it);
+          }
+        }
+        return {};
+      }
+      
+      Pattern read_pattern(TokenStream& stream,
+                           std::unordered_map<std::string, size_t>& vars,
+                           bool is_lhs) {
+        Pattern pattern;
+        if (stream.take(Token::Kind::Name)) {
+          const std::string& name = std::get<std::string>(stream.value());
+          pattern.type = Pattern::Type::Var;
+          if (name == "_" && is_lhs) {
+            pattern.var = NO_VAR;
+          } else if (vars.find(name) != vars.end()) {
+            pattern.var = vars.at(name);
+          } else if (is_lhs) {
+            pattern.var = vars.size();
+            vars[name] = pattern.var;
+          } else {
+            throw_error(Error, "Undefined variable " << name);
+          }
+        } else if (stream.take(Token::Kind::Constant)) {
+          pattern.type = Pattern::Type::Constant;
+          pattern.constant = std::get<PartialBitString>(stream.value());
+          pattern.var = NO_VAR;
+          if (!is_lhs && !pattern.constant.is_fully_known()) {
+            throw_error(Error, "Constants on the right hand side may not include unknown (x) bits");
+          }
+        } else if (stream.take(Token::Kind::ParOpen)) {
+          stream.expect(Token::Kind::Name);
+          std::string op_name = std::get<std::string>(stream.value());
+          
+          if (op_name == "Match") {
+            if (!is_lhs) {
+              throw_error(Error, "Match may only be used on the left hand side");
+            }
+            stream.expect(Token::Kind::Constant);
+            pattern.type = Pattern::Type::Constant;
+            pattern.constant = std::get<PartialBitString>(stream.value());
+            Pattern var = read_pattern(stream, vars, is_lhs);
+            if (var.type != Pattern::Type::Var) {
+              throw_error(Error, "Match expects a variable");
+            }
+            pattern.var = var.var;
+            stream.expect(Token::Kind::ParClose);
+            return pattern;
+          }
+          
+          std::optional<Op::Kind> kind = find_kind(op_name);
+          if (!kind.has_value()) {
+            throw_error(Error, "Unknown operator " << op_name);
+          }
+          
+          pattern.type = Pattern::Type::Op;
+          pattern.kind = kind.value();
+          while (!stream.take(Token::Kind::ParClose)) {
+            if (stream.next(Token::Kind::Eof)) {
+              throw_error(Error, "Unbalanced parentheses");
+            }
+            pattern.args.push_back(read_pattern(stream, vars, is_lhs));
+          }
+          
+          if (pattern.args.size() != Op::arg_count(pattern.kind)) {
+            throw_error(Error,
+              "Operator " << op_name << " expects " << Op::arg_count(pattern.kind) <<
+              " arguments, but got " << pattern.args.size()
+            );
+          }
+        } else {
+          throw_error(Error, "Unexpected token");
+        }
+        return pattern;
+      }
+      
+      // Operators are canonicalized by Module::op, so arguments of
+      // commutative operators are matched in both orders
+      static std::vector<Pattern> expand_commutative(const Pattern& pattern) {
+        if (pattern.type != Pattern::Type::Op) {
+          return {pattern};
+        }
+        
+        std::vector<Pattern> variants = {pattern};
+        for (size_t it = 0; it < pattern.args.size(); it++) {
+          std::vector<Pattern> next;
+          for (const Pattern& arg : expand_commutative(pattern.args[it])) {
+            for (Pattern variant : variants) {
+              variant.args[it] = arg;
+              next.push_back(variant);
+            }
+          }
+          variants = std::move(next);
+        }
+        
+        if (Op::is_commutative(pattern.kind)) {
+          size_t count = variants.size();
+          for (size_t it = 0; it < count; it++) {
+            Pattern swapped = variants[it];
+            std::swap(swapped.args[0], swapped.args[1]);
+            variants.push_back(swapped);
+          }
+        }
+        return variants;
+      }
+      
+      void insert(const Pattern& pattern, uint32_t& node, Variant& variant, size_t& capture) {
+        size_t symbol = SYMBOL_ANY;
+        switch (pattern.type) {
+          case Pattern::Type::Var: symbol = SYMBOL_ANY; break;
+          case Pattern::Type::Constant: symbol = SYMBOL_CONSTANT; break;
+          case Pattern::Type::Op: symbol = size_t(pattern.kind); break;
+        }
+        
+        if (_nodes[node].children[symbol] == NONE) {
+          _nodes[node].children[symbol] = uint32_t(_nodes.size());
+          _nodes.emplace_back();
+        }
+        node = _nodes[node].children[symbol];
+        
+        if (pattern.type == Pattern::Type::Op) {
+          for (const Pattern& arg : pattern.args) {
+            insert(arg, node, variant, capture);
+          }
+          return;
+        }
+        
+        if (pattern.type == Pattern::Type::Constant) {
+          variant.constants.emplace_back(capture, pattern.constant);
+        }
+        if (pattern.var != NO_VAR) {
+          if (variant.vars[pattern.var] == NO_VAR) {
+            variant.vars[pattern.var] = capture;
+          } else {
+            variant.equal.emplace_back(variant.vars[pattern.var], capture);
+          }
+        }
+        capture++;
+      }
+      
+      bool check(const Variant& variant, const std::vector<Value*>& captures) const {
+        for (const auto& [a, b] : variant.equal) {
+          if (captures[a] != captures[b]) {
+            return false;
+          }
+        }
+        for (const auto& [index, pattern] : variant.constants) {
+          const Constant* constant = dyn_cast<Constant>(captures[index]);
+          if (constant == nullptr || constant->width != pattern.width()) {
+            return false;
+          }
+          if ((constant->value & pattern.known()) != (pattern.value() & pattern.known())) {
+            return false;
+          }
+        }
+        return true;
+      }
+      
+      struct Match {
+        const Variant* variant = nullptr;
+        std::vector<Value*> captures;
+      };
+      
+      // Width and constant value (if known) of an instantiated pattern
+      struct Shape {
+        size_t width = 0;
+        const BitString* constant = nullptr;
+      };
+      
+      // Width of an operator with arguments of the given shapes or nothing if
+      // they do not fit, mirroring the checks performed by Module::op
+      static std::optional<size_t> op_width(Op::Kind kind, const Shape* args) {
+        switch (kind) {
+          case Op::Kind::Not:
+          case Op::Kind::Shl:
+          case Op::Kind::ShrU:
+          case Op::Kind::ShrS:
+            return args[0].width;
+          case Op::Kind::And:
+          case Op::Kind::Or:
+          case Op::Kind::Xor:
+          case Op::Kind::Add:
+          case Op::Kind::Sub:
+            if (args[0].width != args[1].width) {
+              return {};
+            }
+            return args[0].width;
+          case Op::Kind::Mul:
+          case Op::Kind::Concat:
+            return args[0].width + args[1].width;
+          case Op::Kind::Eq:
+          case Op::Kind::LtU:
+          case Op::Kind::LtS:
+            if (args[0].width != args[1].width) {
+              return {};
+            }
+            return 1;
+          case Op::Kind::Slice: {
+            if (args[1].constant == nullptr || args[2].constant == nullptr) {
+              return {};
+            }
+            uint64_t offset = args[1].constant->as_uint64();
+            uint64_t width = args[2].constant->as_uint64();
+            if (offset > args[0].width || width > args[0].width - offset) {
+              return {};
+            }
+            return width;
+          }
+          case Op::Kind::Select:
+            if (args[0].width != 1 || args[1].width != args[2].width) {
+              return {};
+            }
+            return args[1].width;
+        }
+        return {};
+      }
+      
+      static Shape shape(const Value* value) {
+        Shape shape;
+        shape.width = value->width;
+        if (const Constant* constant = dyn_cast<Constant>(value)) {
+          shape.constant = &constant->value;
+        }
+        return shape;
+      }
+      
+      // Shape of the value instantiate would build for pattern or nothing if
+      // the widths of the captured values do not fit the pattern
+      std::optional<Shape> infer(const Pattern& pattern,
+                                 const Variant& variant,
+                                 const std::vector<Value*>& captures) const {
+        switch (pattern.type) {
+          case Pattern::Type::Var:
+            return shape(captures[variant.vars[pattern.var]]);
+          case Pattern::Type::Constant:
+            return Shape {pattern.constant.width(), &pattern.constant.value()};
+          case Pattern::Type::Op: {
+            Shape args[Op::MAX_ARG_COUNT];
+            for (size_t it = 0; it < pattern.args.size(); it++) {
+              std::optional<Shape> arg = infer(pattern.args[it], variant, captures);
+              if (!arg.has_value()) {
+                return {};
+              }
+              args[it] = arg.value();
+            }
+            std::optional<size_t> width = op_width(pattern.kind, args);
+            if (!width.has_value()) {
+              return {};
+            }
+            return Shape {width.value(), nullptr};
+          }
+        }
+        return {};
+      }
+      
+      bool fits(const Variant& variant, const std::vector<Value*>& captures, size_t width) const {
+        std::optional<Shape> rhs = infer(_rules[variant.rule], variant, captures);
+        return rhs.has_value() && rhs->width == width;
+      }
+      
+      // Values which still need to be matched are kept on the pending stack
+      // Rules whose right hand side does not fit the widths of the captured
+      // values or differs in width from the rewritten operator do not match
+      void walk(uint32_t node,
+                std::vector<Value*>& pending,
+                std::vector<Value*>& captures,
+                size_t width,
+                Match& match) const {
+        if (pending.empty()) {
+          for (const Variant& variant : _nodes[node].variants) {
+            if ((match.variant == nullptr || variant.rule < match.variant->rule) &&
+                check(variant, captures) &&
+                fits(variant, captures, width)) {
+              match.variant = &variant;
+              match.captures = captures;
+            }
+          }
+          return;
+        }
+        
+        Value* value = pending.back();
+        pending.pop_back();
+        
+        const std::array<uint32_t, SYMBOL_COUNT>& children = _nodes[node].children;
+        if (children[SYMBOL_ANY] != NONE) {
+          captures.push_back(value);
+          walk(children[SYMBOL_ANY], pending, captures, width, match);
+          captures.pop_back();
+        }
+        
+        if (children[SYMBOL_CONSTANT] != NONE && isa<Constant>(value)) {
+          captures.push_back(value);
+          walk(children[SYMBOL_CONSTANT], pending, captures, width, match);
+          captures.pop_back();
+        }
+        
+        if (Op* op = dyn_cast<Op>(value)) {
+          if (children[size_t(op->kind)] != NONE) {
+            for (size_t it = op->args.size(); it-- > 0; ) {
+              pending.push_back(op->args[it]);
+            }
+            walk(children[size_t(op->kind)], pending, captures, width, match);
+            pending.resize(pending.size() - op->args.size());
+          }
+        }
+        
+        pending.push_back(value);
+      }
+      
+      Value* instantiate(Module& module, const Pattern& pattern, const Match& match) const {
+        switch (pattern.type) {
+          case Pattern::Type::Var:
+            return match.captures[match.variant->vars[pattern.var]];
+          case Pattern::Type::Constant:
+            return module.constant(pattern.constant.value());
+          case Pattern::Type::Op: {
+            std::vector<Value*> args;
+            for (const Pattern& arg : pattern.args) {
+              args.push_back(instantiate(module, arg, match));
+            }
+            return module.op(pattern.kind, args);
+          }
+        }
+        return nullptr;
+      }
+    public:
+      RuleSet() {}
+      
+      inline size_t size() const { return _rules.size(); }
+      inline size_t node_count() const { return _nodes.size(); }
+      
+      // Reads rules of the form lhs => rhs until the end of the stream
+      void read(std::istream& stream) {
+        TokenStream token_stream(stream);
+        while (!token_stream.next(Token::Kind::Eof)) {
+          std::unordered_map<std::string, size_t> vars;
+          Pattern lhs = read_pattern(token_stream, vars, true);
+          if (!token_stream.take(Token::Kind::Name) ||
+              std::get<std::string>(token_stream.value()) != "=>") {
+            throw_error(Error, "Expected => after left hand side of rule " << _rules.size());
+          }
+          Pattern rhs = read_pattern(token_stream, vars, false);
+          
+          if (lhs.type != Pattern::Type::Op) {
+            throw_error(Error, "Left hand side of rule " << _rules.size() << " must be an operator");
+          }
+          
+          for (const Pattern& variant_pattern : expand_commutative(lhs)) {
+            Variant variant;
+            variant.rule = _rules.size();
+            variant.vars.resize(vars.size(), NO_VAR);
+            uint32_t node = 0;
+            size_t capture = 0;
+            insert(variant_pattern, node, variant, capture);
+            _nodes[node].variants.push_back(variant);
+          }
+          
+          _rules.push_back(rhs);
+        }
+      }
+      
+      void read(const std::string& source) {
+        std::istringstream stream(source);
+        read(stream);
+      }
+      
+      void load(const char* path) {
+        std::ifstream file;
+        file.open(path);
+        if (!file) {
+          throw_error(Error, "Failed to open \"" << path << "\"");
+        }
+        read(file);
+      }
+      
+      Value* rewrite(Module& module, Op::Kind kind, const std::vector<Value*>& args) const override {
+        uint32_t root = _nodes[0].children[size_t(kind)];
+        if (root == NONE) {
+          return nullptr;
+        }
+        
+        Shape arg_shapes[Op::MAX_ARG_COUNT];
+        for (size_t it = 0; it < args.size(); it++) {
+          arg_shapes[it] = shape(args[it]);
+        }
+        std::optional<size_t> width = op_width(kind, arg_shapes);
+        if (!width.has_value()) {
+          return nullptr;
+        }
+        
+        std::vector<Value*> pending(args.rbegin(), args.rend());
+        std::vector<Value*> captures;
+        Match match;
+        walk(root, pending, captures, width.value(), match);
+        
+        if (match.variant == nullptr) {
+          return nullptr;
+        }
+        return instantiate(module, _rules[match.variant->rule], match);
+      }
+    };
+  }
+}
+
+#undef throw_error
+
+#endif
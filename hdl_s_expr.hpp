@@ -32,174 +32,174 @@
 
 namespace hdl {
   namespace s_expr {
-    class Reader {
-    public:
-      using Value = std::variant<hdl::Value*, hdl::Memory*>;
-    private:
-      struct Token {
-        enum class Kind {
-          Eof,
-          Name, Constant,
-          ParOpen, ParClose
-        };
-        
-        using Value = std::variant<std::string, PartialBitString>;
-        
-        Kind kind = Kind::Eof;
-        Value value;
-        
-        Token() {}
-        Token(const Kind& _kind): kind(_kind) {}
-        Token(const Kind& _kind, const Value& _value): kind(_kind), value(_value) {}
+    struct Token {
+      enum class Kind {
+        Eof,
+        Name, Constant,
+        ParOpen, ParClose
       };
       
-      class TokenStream {
-      private:
-        std::istream& _stream;
-        Token _prev;
-        Token _token;
-        
-        bool is_whitespace(char chr) const {
-          return chr == ' ' || 
-                 chr == '\n' ||
-                 chr == '\t' ||
-                 chr == '\r';
+      using Value = std::variant<std::string, PartialBitString>;
+      
+      Kind kind = Kind::Eof;
+      Value value;
+      
+      Token() {}
+      Token(const Kind& _kind): kind(_kind) {}
+      Token(const Kind& _kind, const Value& _value): kind(_kind), value(_value) {}
+    };
+    
+    class TokenStream {
+    private:
+      std::istream& _stream;
+      Token _prev;
+      Token _token;
+      
+      bool is_whitespace(char chr) const {
+        return chr == ' ' || 
+               chr == '\n' ||
+               chr == '\t' ||
+               chr == '\r';
+      }
+      
+      bool is_stop_char(char chr) const {
+        return is_whitespace(chr) || chr == '(' || chr == ')';
+      }
+      
+      bool is_digit(char chr) const {
+        return chr >= '0' && chr <= '9';
+      }
+      
+      std::optional<PartialBitString> parse_constant(const std::string& source) const {
+        const char* cur = source.c_str();
+        size_t width = 0;
+        while (is_digit(*cur)) { 
+          width *= 10;
+          width += *cur - '0';
+          cur++;
         }
-        
-        bool is_stop_char(char chr) const {
-          return is_whitespace(chr) || chr == '(' || chr == ')';
+        if (*cur != '\'') {
+          return {};
         }
-        
-        bool is_digit(char chr) const {
-          return chr >= '0' && chr <= '9';
+        cur++;
+        size_t base_log2 = 0;
+        switch (*cur) {
+          case 'b': base_log2 = 1; break;
+          case 'o': base_log2 = 3; break;
+          case 'h': base_log2 = 4; break;
+          default: return {};
         }
-        
-        std::optional<PartialBitString> parse_constant(const std::string& source) const {
-          const char* cur = source.c_str();
-          size_t width = 0;
-          while (is_digit(*cur)) { 
-            width *= 10;
-            width += *cur - '0';
-            cur++;
-          }
-          if (*cur != '\'') {
-            return {};
-          }
-          cur++;
-          size_t base_log2 = 0;
-          switch (*cur) {
-            case 'b': base_log2 = 1; break;
-            case 'o': base_log2 = 3; break;
-            case 'h': base_log2 = 4; break;
-            default: return {};
-          }
-          cur++;
-          BitString known = ~BitString(width);
-          BitString value(width);
-          size_t digits = source.size() - (cur - source.c_str());
-          size_t bits = digits * base_log2;
-          if (bits > width) {
-            return {};
-          }
-          while (*cur >= '0' && *cur <= '9' ||
-                 *cur >= 'a' && *cur <= 'f' ||
-                 *cur >= 'A' && *cur <= 'F' ||
-                 *cur == 'X' ||
-                 *cur == 'x') {
-            if (*cur == 'x' || *cur == 'X') {
-              for (size_t it = base_log2; it-- > 0; ) {
-                known.set(--bits, false);
-              }
+        cur++;
+        BitString known = ~BitString(width);
+        BitString value(width);
+        size_t digits = source.size() - (cur - source.c_str());
+        size_t bits = digits * base_log2;
+        if (bits > width) {
+          return {};
+        }
+        while (*cur >= '0' && *cur <= '9' ||
+               *cur >= 'a' && *cur <= 'f' ||
+               *cur >= 'A' && *cur <= 'F' ||
+               *cur == 'X' ||
+               *cur == 'x') {
+          if (*cur == 'x' || *cur == 'X') {
+            for (size_t it = base_log2; it-- > 0; ) {
+              known.set(--bits, false);
+            }
+          } else {
+            size_t digit = 0;
+            
+            if (*cur >= '0' && *cur <= '9') {
+              digit = *cur - '0';
+            } else if (*cur >= 'a' && *cur <= 'f') {
+              digit = (*cur - 'a') + 10;
+            } else if (*cur >= 'A' && *cur <= 'F') {
+              digit = (*cur - 'A') + 10;
             } else {
-              size_t digit = 0;
-              
-              if (*cur >= '0' && *cur <= '9') {
-                digit = *cur - '0';
-              } else if (*cur >= 'a' && *cur <= 'f') {
-                digit = (*cur - 'a') + 10;
-              } else if (*cur >= 'A' && *cur <= 'F') {
-                digit = (*cur - 'A') + 10;
-              } else {
-                throw_error(Error, "Unreachable");
-              }
-              
-              if (digit >= (1 << base_log2)) {
-                return {};
-              }
-              
-              for (size_t it = base_log2; it-- > 0; ) {
-                --bits;
-                known.set(bits, true);
-                value.set(bits, (digit >> it) & 1);
-              }
+              throw_error(Error, "Unreachable");
             }
-            cur++;
-          }
-          if (*cur != '\0') {
-            return {};
-          }
-          if (bits != 0) {
-            throw_error(Error, "Unreachable");
-          }
-          return PartialBitString(known, value);
-        }
-        
-        Token next_token() {
-          while (is_whitespace(_stream.peek())) {
-            _stream.get();
-          }
-          
-          if (_stream.eof() || _stream.peek() == EOF) {
-            return Token(Token::Kind::Eof);
-          }
-          
-          char chr = _stream.get();
-          switch (chr) {
-            case '(': return Token(Token::Kind::ParOpen);
-            case ')': return Token(Token::Kind::ParClose);
-            default: {
-              std::string value;
-              value.push_back(chr);
-              while (!_stream.eof() && _stream.peek() != EOF && !is_stop_char(_stream.peek())) {
-                value.push_back(_stream.get());
-              }
-              std::optional<PartialBitString> constant = parse_constant(value);
-              if (constant.has_value()) {
-                return Token(Token::Kind::Constant, constant.value());
-              }
-              return Token(Token::Kind::Name, value);
+            
+            if (digit >= (1 << base_log2)) {
+              return {};
+            }
+            
+            for (size_t it = base_log2; it-- > 0; ) {
+              --bits;
+              known.set(bits, true);
+              value.set(bits, (digit >> it) & 1);
             }
           }
+          cur++;
         }
-      public:
-        TokenStream(std::istream& stream): _stream(stream) {
-          _token = next_token();
+        if (*cur != '\0') {
+          return {};
         }
-        
-        const Token& prev() const { return _prev; }
-        const Token::Value& value() const { return _prev.value; }
-        
-        bool next(Token::Kind kind) const {
-          return _token.kind == kind;
+        if (bits != 0) {
+          throw_error(Error, "Unreachable");
+        }
+        return PartialBitString(known, value);
+      }
+      
+      Token next_token() {
+        while (is_whitespace(_stream.peek())) {
+          _stream.get();
         }
         
-        bool take(Token::Kind kind) {
-          if (next(kind)) {
-            _prev = _token;
-            _token = next_token();
-            return true;
-          }
-          return false;
+        if (_stream.eof() || _stream.peek() == EOF) {
+          return Token(Token::Kind::Eof);
         }
         
-        void expect(Token::Kind kind) {
-          if (!take(kind)) {
-            throw_error(Error, "Expected token");
+        char chr = _stream.get();
+        switch (chr) {
+          case '(': return Token(Token::Kind::ParOpen);
+          case ')': return Token(Token::Kind::ParClose);
+          default: {
+            std::string value;
+            value.push_back(chr);
+            while (!_stream.eof() && _stream.peek() != EOF && !is_stop_char(_stream.peek())) {
+              value.push_back(_stream.get());
+            }
+            std::optional<PartialBitString> constant = parse_constant(value);
+            if (constant.has_value()) {
+              return Token(Token::Kind::Constant, constant.value());
+            }
+            return Token(Token::Kind::Name, value);
           }
         }
-        
-      };
+      }
+    public:
+      TokenStream(std::istream& stream): _stream(stream) {
+        _token = next_token();
+      }
+      
+      const Token& prev() const { return _prev; }
+      const Token::Value& value() const { return _prev.value; }
+      
+      bool next(Token::Kind kind) const {
+        return _token.kind == kind;
+      }
+      
+      bool take(Token::Kind kind) {
+        if (next(kind)) {
+          _prev = _token;
+          _token = next_token();
+          return true;
+        }
+        return false;
+      }
+      
+      void expect(Token::Kind kind) {
+        if (!take(kind)) {
+          throw_error(Error, "Expected token");
+        }
+      }
+      
+    };
     
+    class Reader {
+    public:
+      using Value = std::variant<hdl::Value*, hdl::Memory*>;
+    private:
       Module& _module;
       std::unordered_map<std::string, Value> _bindings;
       
@@ -260,7 +260,7 @@ namespace hdl {
               throw_error(Error, "Delay operator expects 3 arguments, but got " << args.size());
             }
             hdl::Value* clock = std::get<hdl::Value*>(args[0]);
-            hdl::Constant* initial = dynamic_cast<Constant*>(std::get<hdl::Value*>(args[1]));
+            hdl::Constant* initial = dyn_cast<Constant>(std::get<hdl::Value*>(args[1]));
             hdl::Value* value = std::get<hdl::Value*>(args[2]);
             if (initial == nullptr) {
               throw_error(Error, "Initial value must be constant");
@@ -0,0 +1,496 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HDL_SWEEP_HPP
+#define HDL_SWEEP_HPP
+
+#include <inttypes.h>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <tuple>
+#include <array>
+#include <random>
+
+#include "hdl.hpp"
+#include "hdl_proof.hpp"
+#include "hdl_parallel_sim.hpp"
+
+#define throw_error(Error, msg) { \
+  std::ostringstream error_message; \
+  error_message << msg; \
+  throw Error(error_message.str()); \
+}
+
+namespace hdl {
+  namespace sweep {
+    // Sequential optimizations on the registers and memories of a module.
+    // Registers and memories which provably never change are replaced by
+    // constants, registers which always hold equal values are merged and
+    // registers which feed nothing observable are removed.
+    class RegisterSweep {
+    public:
+      struct Stats {
+        size_t iterations = 0;
+        size_t constant_regs = 0;
+        size_t constant_reads = 0;
+        size_t removed_writes = 0;
+        size_t merged_regs = 0;
+        size_t removed_regs = 0;
+      };
+    private:
+      Module& _module;
+      NodeMap<PartialBitString> _states;
+      std::unordered_map<const Memory*, bool> _is_written;
+      
+      PartialBitString eval_read(const Memory::Read* read, const PartialBitString& address) const {
+        const Memory* memory = read->memory;
+        if (_is_written.at(memory) || !address.is_fully_known() || memory->size == 0) {
+          return PartialBitString(read->width);
+        }
+        uint64_t index = address.value().as_uint64() % memory->size;
+        auto it = memory->initial.find(index);
+        if (it == memory->initial.end()) {
+          return PartialBitString(BitString(memory->width));
+        }
+        return PartialBitString(it->second);
+      }
+      
+      // Evaluates all values in topological order using three valued logic,
+      // assuming that each register holds a value described by its state.
+      void eval(NodeMap<PartialBitString>& values) {
+        for (Value* value : _module.topo_order()) {
+          PartialBitString result;
+          if (Constant* constant = dyn_cast<Constant>(value)) {
+            result = PartialBitString(constant->value);
+          } else if (isa<Reg>(value)) {
+            result = _states.at(value);
+          } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
+            result = eval_read(read, values.at(read->address));
+          } else if (Op* op = dyn_cast<Op>(value)) {
+            #define arg(index) values.at(op->args[index])
+            
+            switch (op->kind) {
+              case Op::Kind::And: result = arg(0) & arg(1); break;
+              case Op::Kind::Or: result = arg(0) | arg(1); break;
+              case Op::Kind::Xor: result = arg(0) ^ arg(1); break;
+              case Op::Kind::Not: result = ~arg(0); break;
+              case Op::Kind::Add: result = arg(0) + arg(1); break;
+              case Op::Kind::Sub: result = arg(0) - arg(1); break;
+              case Op::Kind::Mul: result = arg(0).mul_u(arg(1)); break;
+              case Op::Kind::Eq: result = PartialBitString::from_bool(arg(0).eq(arg(1))); break;
+              case Op::Kind::LtU: result = PartialBitString::from_bool(arg(0).lt_u(arg(1))); break;
+              case Op::Kind::LtS: result = PartialBitString::from_bool(arg(0).lt_s(arg(1))); break;
+              case Op::Kind::Concat: result = arg(0).concat(arg(1)); break;
+              case Op::Kind::Slice:
+                result = arg(0).slice_width(
+                  cast<Constant>(op->args[1])->value.as_uint64(),
+                  cast<Constant>(op->args[2])->value.as_uint64()
+                );
+              break;
+              case Op::Kind::Shl: result = arg(0) << arg(1); break;
+              case Op::Kind::ShrU: result = arg(0).shr_u(arg(1)); break;
+              case Op::Kind::ShrS: result = arg(0).shr_s(arg(1)); break;
+              case Op::Kind::Select: result = arg(0).select(arg(1), arg(2)); break;
+            }
+            
+            #undef arg
+          } else {
+            result = PartialBitString(value->width);
+          }
+          values[value] = result;
+        }
+      }
+      
+      static bool is_never(const PartialBitString& enable) {
+        return enable.is_fully_known() && enable.value().is_zero();
+      }
+      
+      // Over-approximates the reachable states. Every register starts at its
+      // initial value and its state is merged with its next value until no
+      // known bit changes. Bits only ever become unknown, so this terminates.
+      size_t propagate_constants() {
+        for (Reg* reg : _module.regs()) {
+          _states[reg] = PartialBitString(reg->initial);
+        }
+        for (Memory* memory : _module.memories()) {
+          _is_written[memory] = false;
+        }
+        
+        size_t iterations = 0;
+        bool changed = true;
+        while (changed) {
+          changed = false;
+          iterations++;
+          
+          NodeMap<PartialBitString> values(_module);
+          eval(values);
+          
+          for (Reg* reg : _module.regs()) {
+            if (reg->next != nullptr && _states[reg].merge_inplace(values.at(reg->next))) {
+              changed = true;
+            }
+          }
+          
+          for (Memory* memory : _module.memories()) {
+            if (!_is_written.at(memory)) {
+              for (const Memory::Write& write : memory->writes) {
+                if (!is_never(values.at(write.enable))) {
+                  _is_written[memory] = true;
+                  changed = true;
+                }
+              }
+            }
+          }
+        }
+        return iterations;
+      }
+      
+      // Registers and memory reads which provably hold a constant value
+      void find_constants(NodeMap<Value*>& substitutes, Stats& stats) {
+        for (Reg* reg : _module.regs()) {
+          const PartialBitString& state = _states.at(reg);
+          if (state.is_fully_known()) {
+            substitutes[reg] = _module.constant(state.value());
+            stats.constant_regs++;
+          }
+        }
+        
+        // Uses the final states, so reads whose address only depends on
+        // constant registers are found as well
+        NodeMap<PartialBitString> values(_module);
+        eval(values);
+        for (Memory* memory : _module.memories()) {
+          for (const auto& [address, read] : memory->reads) {
+            const PartialBitString* value = values.find(read);
+            if (value != nullptr && value->is_fully_known()) {
+              substitutes[read] = _module.constant(value->value());
+              stats.constant_reads++;
+            }
+          }
+        }
+      }
+      
+      void remove_writes(Stats& stats) {
+        for (Memory* memory : _module.memories()) {
+          std::vector<Memory::Write>& writes = memory->writes;
+          size_t count = 0;
+          for (const Memory::Write& write : writes) {
+            if (_is_written.at(memory)) {
+              writes[count++] = write;
+            }
+          }
+          stats.removed_writes += writes.size() - count;
+          writes.erase(writes.begin() + count, writes.end());
+        }
+      }
+      
+      // Partitions the registers into classes which provably hold equal
+      // values in every cycle. Classes start out grouped by clock and
+      // initial value and are split until the next values of all registers
+      // in a class are structurally equal when every register is
+      // substituted by the representative of its class.
+      void merge_equivalent(NodeMap<Value*>& substitutes, Stats& stats) {
+        using Key = std::tuple<const Value*, std::string, size_t>;
+        
+        std::vector<Reg*> regs;
+        for (Reg* reg : _module.regs()) {
+          if (reg->next != nullptr && !_states.at(reg).is_fully_known()) {
+            regs.push_back(reg);
+          }
+        }
+        
+        NodeMap<size_t> classes(_module);
+        std::vector<Reg*> reprs;
+        {
+          std::map<Key, size_t> ids;
+          for (Reg* reg : regs) {
+            std::ostringstream initial;
+            initial << reg->initial;
+            Key key(reg->clock, initial.str(), reg->width);
+            if (ids.find(key) == ids.end()) {
+              ids[key] = reprs.size();
+              reprs.push_back(reg);
+            }
+            classes[reg] = ids.at(key);
+          }
+        }
+        
+        while (true) {
+          stats.iterations++;
+          
+          NodeMap<Value*> class_substitutes = substitutes;
+          for (Reg* reg : regs) {
+            class_substitutes[reg] = reprs[classes.at(reg)];
+          }
+          NodeMap<Value*> substituted = _module.substitute(class_substitutes);
+          
+          std::map<std::pair<size_t, const Value*>, size_t> ids;
+          std::vector<Reg*> next_reprs;
+          for (Reg* reg : regs) {
+            std::pair<size_t, const Value*> key(classes.at(reg), substituted.at(reg->next));
+            if (ids.find(key) == ids.end()) {
+              ids[key] = next_reprs.size();
+              next_reprs.push_back(reg);
+            }
+            classes[reg] = ids.at(key);
+          }
+          
+          bool is_stable = next_reprs.size() == reprs.size();
+          reprs = std::move(next_reprs);
+          if (is_stable) {
+            break;
+          }
+        }
+        
+        for (Reg* reg : regs) {
+          Reg* repr = reprs[classes.at(reg)];
+          if (repr != reg) {
+            substitutes[reg] = repr;
+            stats.merged_regs++;
+          }
+        }
+      }
+    public:
+      RegisterSweep(Module& module): _module(module), _states(module) {}
+      
+      // Runs all optimizations and removes unobservable values using
+      // Module::gc. Values held by the caller may be invalidated.
+      Stats run() {
+        Stats stats;
+        stats.iterations = propagate_constants();
+        
+        // All substitutions are applied in a single rebuild of the module
+        NodeMap<Value*> substitutes(_module);
+        find_constants(substitutes, stats);
+        merge_equivalent(substitutes, stats);
+        
+        _module.remap_roots(_module.substitute(substitutes));
+        remove_writes(stats);
+        
+        size_t reg_count = _module.regs().size();
+        _module.gc();
+        stats.removed_regs = reg_count - _module.regs().size();
+        return stats;
+      }
+    };
+    
+    // SAT sweeping (fraiging) of bit level circuits. Candidate equivalences
+    // between gates of width 1 are found using bit parallel random
+    // simulation and proven using SAT. Gates are visited in topological
+    // order, so later queries already operate on the merged circuit.
+    // Circuits should be flattened using hdl::flatten::Flattening first.
+    class Fraig {
+    public:
+      struct Stats {
+        size_t rounds = 0;
+        size_t queries = 0;
+        size_t merged = 0;
+        size_t disproven = 0;
+        size_t unknown = 0;
+      };
+      
+      size_t max_rounds = 8;
+      // Queries exceeding this limit are treated as not equivalent
+      size_t max_conflicts = 1000;
+    private:
+      static constexpr const size_t WORDS = 4;
+      
+      using Simulation = sim::ParallelSimulation<WORDS>;
+      using Signature = std::array<uint64_t, WORDS>;
+      using Counterexample = std::vector<std::pair<Value*, bool>>;
+      
+      Module& _module;
+      std::mt19937_64 _rng;
+      // Counterexamples of disproven candidates are simulated in the next
+      // round, so that the candidates are split
+      std::vector<Counterexample> _counterexamples;
+      std::set<std::pair<const Value*, const Value*>> _unknown;
+      // Values visited by the current query are stamped with its epoch, so
+      // the map is not cleared between queries
+      NodeMap<uint64_t> _visited;
+      uint64_t _epoch = 0;
+      
+      static bool is_gate(const Value* value) {
+        if (const Op* op = dyn_cast<Op>(value)) {
+          return op->width == 1 && (
+            op->kind == Op::Kind::And ||
+            op->kind == Op::Kind::Or ||
+            op->kind == Op::Kind::Xor ||
+            op->kind == Op::Kind::Not
+          );
+        }
+        return false;
+      }
+      
+      // Checks whether a == b (or a == !b if complement is set) holds for all
+      // values of the leaves of their cones. All queries of a round share
+      // the same incremental builder, so its learnt clauses are reused.
+      proof::Solver::Result prove(proof::CnfBuilder& builder, Value* a, Value* b, bool complement, Counterexample& counterexample) {
+        std::vector<Value*> leaves;
+        std::vector<Value*> stack = {a, b};
+        _epoch++;
+        while (!stack.empty()) {
+          Value* value = stack.back();
+          stack.pop_back();
+          uint64_t& epoch = _visited[value];
+          if (epoch == _epoch) {
+            continue;
+          }
+          epoch = _epoch;
+          if (is_gate(value)) {
+            for (Value* arg : cast<Op>(value)->args) {
+              stack.push_back(arg);
+            }
+          } else if (!isa<Constant>(value)) {
+            if (!builder.has(value)) {
+              builder.free(value);
+            }
+            leaves.push_back(value);
+          }
+        }
+        
+        builder.build(a);
+        builder.build(b);
+        proof::Cnf& cnf = builder.cnf();
+        proof::Cnf::Literal diff = cnf.f_xor(builder[a], builder[b]);
+        
+        proof::Solver::Result result = builder.solve({complement ? !diff : diff}, max_conflicts);
+        if (result == proof::Solver::Result::Sat) {
+          BitString values = builder.model(leaves);
+          for (size_t it = 0; it < leaves.size(); it++) {
+            counterexample.emplace_back(leaves[it], values[it]);
+          }
+        }
+        return result;
+      }
+      
+      void simulate(Simulation& sim) {
+        sim.randomize(_rng);
+        for (Reg* reg : _module.regs()) {
+          if (sim.has(reg)) {
+            typename Simulation::Lanes lanes;
+            for (size_t it = 0; it < WORDS; it++) {
+              lanes.words[it] = uint64_t(_rng());
+            }
+            sim.set(reg, lanes);
+          }
+        }
+        
+        for (size_t lane = 0; lane < _counterexamples.size() && lane < Simulation::LANES; lane++) {
+          for (const auto& [leaf, value] : _counterexamples[lane]) {
+            if (sim.has(leaf)) {
+              sim.set(leaf, lane, value);
+            }
+          }
+        }
+        _counterexamples.clear();
+        
+        sim.eval();
+      }
+      
+    public:
+      Fraig(Module& module, uint64_t seed = 0): _module(module), _rng(seed) {}
+      
+      // Merges all proven equivalences into the outputs, registers and
+      // memory writes. Replaced values are removed by the next Module::gc.
+      Stats run() {
+        Stats stats;
+        Value* zero = _module.constant(BitString::from_bool(false));
+        _visited = NodeMap<uint64_t>(_module);
+        
+        while (stats.rounds < max_rounds) {
+          stats.rounds++;
+          
+          std::vector<Value*> order = _module.topo_order();
+          std::vector<Value*> bits = {zero};
+          for (Value* value : order) {
+            if (is_gate(value)) {
+              bits.push_back(value);
+            }
+          }
+          
+          Simulation sim(_module, bits);
+          simulate(sim);
+          
+          // The first gate with a given signature (up to complement) is the
+          // representative of its class. Constant gates join the class of zero.
+          std::map<Signature, std::pair<Value*, bool>> reprs;
+          NodeMap<std::pair<Value*, bool>> candidates(_module);
+          for (Value* bit : bits) {
+            const typename Simulation::Lanes& lanes = sim[bit];
+            bool complement = lanes.at(0);
+            Signature signature;
+            for (size_t it = 0; it < WORDS; it++) {
+              signature[it] = complement ? ~lanes.words[it] : lanes.words[it];
+            }
+            auto it = reprs.find(signature);
+            if (it == reprs.end()) {
+              reprs[signature] = {bit, complement};
+            } else {
+              candidates[bit] = {it->second.first, it->second.second != complement};
+            }
+          }
+          
+          bool is_refuted = false;
+          proof::CnfBuilder builder;
+          NodeMap<Value*> mapped(_module);
+          mapped[zero] = zero;
+          for (Value* value : order) {
+            Value* result = _module.rebuild(value, mapped);
+            if (const std::pair<Value*, bool>* candidate = candidates.find(value)) {
+              auto [repr, complement] = *candidate;
+              Value* target = mapped.at(repr);
+              Value* expected = complement ? _module.op(Op::Kind::Not, {target}) : target;
+              if (result != expected && _unknown.find({result, target}) == _unknown.end()) {
+                stats.queries++;
+                Counterexample counterexample;
+                switch (prove(builder, result, target, complement, counterexample)) {
+                  case proof::Solver::Result::Unsat:
+                    result = expected;
+                    stats.merged++;
+                  break;
+                  case proof::Solver::Result::Sat:
+                    _counterexamples.push_back(counterexample);
+                    stats.disproven++;
+                    is_refuted = true;
+                  break;
+                  case proof::Solver::Result::Unknown:
+                    _unknown.insert({result, target});
+                    stats.unknown++;
+                  break;
+                }
+              }
+            }
+            
+            mapped[value] = result;
+          }
+          
+          _module.remap_roots(mapped);
+          
+          if (!is_refuted) {
+            break;
+          }
+        }
+        
+        return stats;
+      }
+    };
+  }
+}
+
+#undef throw_error
+
+#endif
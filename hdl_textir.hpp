@@ -206,7 +206,7 @@ namespace hdl {
             if (!has_id) { throw_error(Error, "Does not have id"); }
             memories[id] = memory;
           } else if (cmd == "next") {
-            Reg* reg = dynamic_cast<Reg*>(values.at(read_size(stream)));
+            Reg* reg = dyn_cast<Reg>(values.at(read_size(stream)));
             reg->clock = values.at(read_id(stream));
             reg->next = values.at(read_id(stream));
           } else if (cmd == "read") {
@@ -318,7 +318,7 @@ namespace hdl {
       struct Context {
         std::ostream& stream;
         size_t id_count = 0;
-        std::unordered_map<const Value*, size_t> values;
+        NodeMap<size_t> values;
         std::unordered_map<const Memory*, size_t> memories;
         
         Context(std::ostream& _stream): stream(_stream) {}
@@ -338,32 +338,27 @@ namespace hdl {
         size_t operator[](const Value* value) const { return values.at(value); }
         size_t operator[](const Memory* memory) const { return memories.at(memory); }
         
-        bool has(const Value* value) const { return values.find(value) != values.end(); }
+        bool has(const Value* value) const { return values.has(value); }
       };
       
+      // Arguments must be printed first
       void print(Value* value, Context& context) const {
         if (context.has(value)) {
           return;
         }
         
-        if (Constant* constant = dynamic_cast<Constant*>(value)) {
+        if (Constant* constant = dyn_cast<Constant>(value)) {
           context.stream << context.alloc(value) << " = constant ";
           print(context.stream, constant->value);
-        } else if (Unknown* unknown = dynamic_cast<Unknown*>(value)) {
+        } else if (Unknown* unknown = dyn_cast<Unknown>(value)) {
           context.stream << context.alloc(value) << " = unknown ";
           context.stream << unknown->width;
-        } else if (Op* op = dynamic_cast<Op*>(value)) {
-          for (Value* arg : op->args) {
-            print(arg, context);
-          }
-          
+        } else if (Op* op = dyn_cast<Op>(value)) {
           context.stream << context.alloc(value) << " = " << op->kind;
           for (Value* arg : op->args) {
             context.stream << ' ' << context[arg];
           }
-        } else if (Memory::Read* read = dynamic_cast<Memory::Read*>(value)) {
-          print(read->address, context);
-          
+        } else if (Memory::Read* read = dyn_cast<Memory::Read>(value)) {
           context.stream << context.alloc(value) << " = read ";
           context.stream << context[read->memory] << ' ';
           context.stream << context[read->address];
@@ -410,9 +405,11 @@ namespace hdl {
           }
         }
         
+        for (Value* value : _module.topo_order()) {
+          print(value, context);
+        }
+        
         for (Reg* reg : _module.regs()) {
-          print(reg->clock, context);
-          print(reg->next, context);
           stream << "next " << context[reg] << ' ';
           stream << context[reg->clock] << ' ';
           stream << context[reg->next] << '\n';
@@ -420,11 +417,6 @@ namespace hdl {
         
         for (Memory* memory : _module.memories()) {
           for (const Memory::Write& write : memory->writes) {
-            print(write.clock, context);
-            print(write.address, context);
-            print(write.enable, context);
-            print(write.value, context);
-            
             stream << "write " << context[memory] << ' ';
             stream << context[write.clock] << ' ';
             stream << context[write.address] << ' ';
@@ -434,7 +426,6 @@ namespace hdl {
         }
         
         for (const Output& output : _module.outputs()) {
-          print(output.value, context);
           stream << "output ";
           print(stream, output.name);
           stream << ' ' << context[output.value] << '\n';
@@ -737,12 +737,12 @@ namespace hdl {
           Value* value = lower(bit, context);
           
           bool concat = false;
-          if (Constant* constant = dynamic_cast<Constant*>(value)) {
-            if (dynamic_cast<Constant*>(chunk)) {
+          if (Constant* constant = dyn_cast<Constant>(value)) {
+            if (dyn_cast<Constant>(chunk)) {
               concat = true;
             }
-          } else if (Op* op = dynamic_cast<Op*>(value)) {
-            if (Op* chunk_op = dynamic_cast<Op*>(chunk)) {
+          } else if (Op* op = dyn_cast<Op>(value)) {
+            if (Op* chunk_op = dyn_cast<Op>(chunk)) {
               if (op->kind == Op::Kind::Slice &&
                   chunk_op->kind == Op::Kind::Slice &&
                   op->args[0] == chunk_op->args[0]) {
@@ -927,16 +927,16 @@ namespace hdl {
         }
         
         RTLIL::SigSpec spec;
-        if (const Constant* constant = dynamic_cast<const Constant*>(value)) {
+        if (const Constant* constant = dyn_cast<Constant>(value)) {
           spec = build(constant->value);
-        } else if (const Input* input = dynamic_cast<const Input*>(value)) {
+        } else if (const Input* input = dyn_cast<Input>(value)) {
           RTLIL::Wire* wire = _ys_module->addWire(
             RTLIL::escape_id(input->name.c_str()),
             input->width
           );
           wire->port_input = true;
           spec = wire;
-        } else if (const Op* op = dynamic_cast<const Op*>(value)) {
+        } else if (const Op* op = dyn_cast<Op>(value)) {
           #define arg(index) build(op->args[index])
           
           RTLIL::Wire* wire = _ys_module->addWire(NEW_ID, value->width);
@@ -975,7 +975,7 @@ namespace hdl {
           spec = wire;
           
           #undef arg
-        } else if (const Memory::Read* read = dynamic_cast<const Memory::Read*>(value)) {
+        } else if (const Memory::Read* read = dyn_cast<Memory::Read>(value)) {
           RTLIL::Cell* cell = _ys_module->addCell(NEW_ID, ID($memrd_v2));
           
           std::string memory_name = RTLIL::id2cstr(_memories.at(read->memory)->name);
@@ -0,0 +1,178 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_balance.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+using Balancing = hdl::balance::Balancing;
+
+// Checks that both modules compute the same outputs for random inputs
+void check_equivalent(hdl::Module& a, hdl::Module& b) {
+  hdl::sim::Simulation sim_a(a);
+  hdl::sim::Simulation sim_b(b);
+  for (size_t iter = 0; iter < 64; iter++) {
+    std::vector<hdl::BitString> inputs;
+    for (const hdl::Input* input : a.inputs()) {
+      inputs.push_back(hdl::BitString::random(input->width));
+    }
+    sim_a.update(inputs);
+    sim_b.update(inputs);
+    assert(sim_a.outputs() == sim_b.outputs());
+  }
+}
+
+void build_chain(hdl::Module& module, hdl::Op::Kind kind, size_t count, size_t width) {
+  hdl::Value* value = module.input("x0", width);
+  for (size_t it = 1; it < count; it++) {
+    value = module.op(kind, {value, module.input("x" + std::to_string(it), width)});
+  }
+  module.output("y", value);
+}
+
+int main() {
+  Test("And").run([](){
+    hdl::Module module("top");
+    hdl::Module balanced("top");
+    build_chain(module, hdl::Op::Kind::And, 16, 1);
+    build_chain(balanced, hdl::Op::Kind::And, 16, 1);
+    
+    Balancing::Stats stats = Balancing(balanced).run();
+    assert(stats.trees == 1);
+    assert(stats.depth_before == 15);
+    assert(stats.depth_after == 4);
+    
+    check_equivalent(module, balanced);
+  });
+  
+  Test("Concat").run([](){
+    hdl::Module module("top");
+    hdl::Module balanced("top");
+    build_chain(module, hdl::Op::Kind::Concat, 9, 3);
+    build_chain(balanced, hdl::Op::Kind::Concat, 9, 3);
+    
+    Balancing::Stats stats = Balancing(balanced).run();
+    assert(stats.depth_after == 4);
+    
+    check_equivalent(module, balanced);
+  });
+  
+  Test("Shared").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    build_chain(module, Kind::Xor, 8, 4);
+    
+    // The inner chain is used twice and must not be duplicated
+    hdl::Value* shared = module.outputs()[0].value;
+    hdl::Value* a = module.input("a", 4);
+    hdl::Value* b = module.input("b", 4);
+    module.output("a", module.op(Kind::Xor, {a, shared}));
+    module.output("b", module.op(Kind::Xor, {b, shared}));
+    
+    Balancing::Stats stats = Balancing(module).run();
+    assert(stats.trees == 1);
+    assert(stats.depth_after == 4);
+    
+    hdl::Value* balanced = module.outputs()[0].value;
+    assert(module.outputs()[1].value == module.op(Kind::Xor, {a, balanced}));
+    assert(module.outputs()[2].value == module.op(Kind::Xor, {b, balanced}));
+  });
+  
+  Test("Clock").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Module balanced("top");
+    for (hdl::Module* mod : {&module, &balanced}) {
+      build_chain(*mod, Kind::And, 8, 1);
+      
+      // The inner chain is also used as a clock
+      hdl::Value* clock = mod->outputs()[0].value;
+      for (size_t it = 0; it < 4; it++) {
+        clock = hdl::cast<hdl::Op>(clock)->args[0];
+      }
+      hdl::Reg* reg = mod->reg(hdl::BitString("0"), clock);
+      reg->next = mod->op(Kind::Not, {reg});
+      mod->output("reg", reg);
+    }
+    
+    Balancing::Stats stats = Balancing(balanced).run();
+    assert(stats.trees == 2);
+    
+    hdl::Value* clock = balanced.regs()[0]->clock;
+    hdl::Op* root = hdl::cast<hdl::Op>(balanced.outputs()[0].value);
+    assert(root->args[0] == clock || root->args[1] == clock);
+    
+    check_equivalent(module, balanced);
+  });
+  
+  Test("Levels").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Module balanced("top");
+    for (hdl::Module* mod : {&module, &balanced}) {
+      hdl::Value* late = mod->input("late", 8);
+      for (size_t it = 0; it < 3; it++) {
+        late = mod->op(Kind::Mul, {late, late});
+        late = mod->op(Kind::Slice, {
+          late,
+          mod->constant(hdl::BitString::from_uint(0)),
+          mod->constant(hdl::BitString::from_uint(8))
+        });
+      }
+      hdl::Value* value = late;
+      for (size_t it = 0; it < 4; it++) {
+        value = mod->op(Kind::Add, {mod->input("x" + std::to_string(it), 8), value});
+      }
+      mod->output("y", value);
+    }
+    
+    // The late arriving value is added last
+    Balancing::Stats stats = Balancing(balanced).run();
+    assert(stats.trees == 1);
+    assert(stats.depth_before == 10);
+    assert(stats.depth_after == 7);
+    
+    check_equivalent(module, balanced);
+  });
+  
+  Test("Deep").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* deep = module.input("deep", 1);
+    hdl::Value* other = module.input("other", 1);
+    for (size_t it = 0; it < 100000; it++) {
+      deep = module.op(Kind::Eq, {deep, other});
+    }
+    hdl::Value* value = deep;
+    for (size_t it = 0; it < 7; it++) {
+      value = module.op(Kind::And, {value, module.input("x" + std::to_string(it), 1)});
+    }
+    module.output("y", value);
+    
+    // Already existing operators are found by hashconsing
+    module.op(Kind::And, {module.find_input("x0"), module.find_input("x1")});
+    
+    Balancing::Stats stats = Balancing(module).run();
+    assert(stats.trees == 1);
+    assert(stats.depth_before == 100007);
+    assert(stats.depth_after == 100001);
+  });
+  
+  return 0;
+}
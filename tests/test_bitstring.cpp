@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <inttypes.h>
+#include <unordered_set>
 
 #include "../../unittest.cpp/unittest.hpp"
 #include "../hdl_bitstring.hpp"
@@ -142,6 +143,134 @@ int main() {
     assert(BitString("010000000000000000000000000000000").shr_s(33) == BitString("000000000000000000000000000000000"));
     assert(BitString("100000000000000000000000000000000").shr_s(31) == BitString("111111111111111111111111111111110"));
     assert(BitString("100000000000000000000000000000000").shr_s(32) == BitString("111111111111111111111111111111111"));
+    for (size_t width : {64, 128}) {
+      BitString ones = ~BitString(width);
+      assert(ones.shr_s(0) == ones);
+      BitString value = BitString::random(width);
+      value.set(width - 1, true);
+      assert(value.shr_s(0) == value);
+    }
+  });
+  
+  Test("BitString::compound").run([](){
+    BitString a = BitString::from_hex("0123456789abcdef0123456789abcdef0123");
+    BitString b = BitString::from_hex("fedcba9876543210fedcba9876543210fedc");
+    
+    BitString value = a;
+    value += b;
+    assert(value == a + b);
+    value -= b;
+    assert(value == a);
+    value &= b;
+    assert(value == (a & b));
+    value = a;
+    value |= b;
+    assert(value == (a | b));
+    value ^= b;
+    assert(value == ((a | b) ^ b));
+    
+    for (size_t shift : {0, 1, 31, 32, 33, 100, 144, 200}) {
+      value = a;
+      value <<= shift;
+      assert(value == a << shift);
+      value = a;
+      value >>= shift;
+      assert(value == a.shr_u(shift));
+    }
+  });
+  
+  Test("BitString::*_into").run([](){
+    BitString a = BitString::from_hex("0123456789abcdef0123456789abcdef");
+    BitString b = BitString::from_hex("fedcba9876543210fedcba9876543210");
+    
+    BitString into(3);
+    a.add_into(into, b);
+    assert(into == a + b);
+    a.sub_into(into, b);
+    assert(into == a - b);
+    a.xor_into(into, b);
+    assert(into == (a ^ b));
+    a.not_into(into);
+    assert(into == ~a);
+    a.shl_into(into, 40);
+    assert(into == a << 40);
+    a.shr_u_into(into, 40);
+    assert(into == a.shr_u(40));
+    b.shr_s_into(into, 70);
+    assert(into == b.shr_s(70));
+    a.mul_u_into(into, b);
+    assert(into == a.mul_u(b));
+    a.concat_into(into, b.slice_width(3, 70));
+    assert(into == a.concat(b.slice_width(3, 70)));
+    b.slice_width_into(into, 3, 70);
+    assert(into == b.slice_width(3, 70));
+    into.set_zero();
+    assert(into == BitString(70));
+    
+    BitString moved = std::move(into);
+    assert(moved == BitString(70));
+  });
+  
+  Test("BitString::move").run([](){
+    BitString a = BitString::random(300);
+    BitString b = BitString::random(300);
+    BitString c = std::move(a);
+    assert(a.width() == 0);
+    assert(a == BitString());
+    a = b;
+    assert(a == b);
+    
+    BitString d = BitString::random(300);
+    BitString e(300);
+    e = std::move(d);
+    assert(d.width() == 0);
+    d = e;
+    assert(d == e);
+  });
+  
+  Test("BitString::hash").run([](){
+    assert(BitString("0101").hash() == BitString("0101").hash());
+    assert(BitString("0101").hash() != BitString("00101").hash());
+    assert(BitString().hash() != BitString("0").hash());
+    
+    // Bits above the width do not affect the hash
+    assert((~BitString(3)).hash() == BitString("111").hash());
+    
+    // Sequential values do not collide in the low bits used by hash tables
+    std::unordered_set<size_t> buckets;
+    for (uint64_t it = 0; it < 1024; it++) {
+      buckets.insert(BitString::from_uint(it).hash() & 0xffff);
+    }
+    assert(buckets.size() > 1000);
+  });
+  
+  Test("BitString::mul_u").run([](){
+    assert(BitString::from_uint(uint8_t(200)).mul_u(BitString::from_uint(uint8_t(100))) == BitString::from_uint(uint16_t(20000)));
+    assert(BitString::from_uint(~uint64_t(0)).mul_u(BitString::from_uint(~uint64_t(0))) == BitString::from_hex("fffffffffffffffe0000000000000001"));
+    assert(BitString("111") * BitString("011") == BitString("101"));
+    
+    for (size_t width : {1, 7, 64, 65, 100, 500, 2100, 4100}) {
+      for (size_t other_width : {1, 33, 64, 128, 2050, 5000}) {
+        BitString a = BitString::random(width);
+        BitString b = BitString::random(other_width);
+        
+        BitString expected(width + other_width);
+        BitString shifted = b.zero_extend(width + other_width);
+        for (size_t it = 0; it < width; it++) {
+          if (a.at(it)) {
+            expected += shifted;
+          }
+          shifted <<= 1;
+        }
+        
+        assert(a.mul_u(b) == expected);
+        assert(b.mul_u(a) == expected);
+      }
+      
+      BitString a = BitString::random(width);
+      BitString b = BitString::random(width);
+      assert(a * b == a.mul_u(b).truncate(width));
+    }
   });
   
   Test("BitString::zero_extend").run([](){
@@ -269,6 +398,23 @@ int main() {
     assert(BitString::from_hex("0123456789abcdef").popcount() == 0 + 1 + 1 + 2 + 1 + 2 + 2 + 3 + 1 + 2 + 2 + 3 + 2 + 3 + 3 + 4);
   });
   
+  Test("BitString::find_bit").run([](){
+    assert(BitString("0100").find_bit(true) == 2);
+    assert(BitString("0111").find_bit(false) == 3);
+    assert(BitString("1111").find_bit(false) == 4);
+    assert((BitString::one(200) << 150).find_bit(true) == 150);
+    assert((BitString::one(200) << 150).rfind_bit(true) == 150);
+    assert(BitString(200).rfind_bit(true) == 200);
+    assert((~BitString(130)).rfind_bit(false) == 130);
+  });
+  
+  Test("BitString::floor_log2").run([](){
+    assert(BitString("0001").floor_log2() == 0);
+    assert(BitString("0110").floor_log2() == 2);
+    assert((BitString::one(300) << 299).floor_log2() == 299);
+    assert(BitString::from_hex("0123456789abcdef0123456789abcdef").floor_log2() == 120);
+  });
+  
   Test("PartialBitString::from_bool").run([](){
     assert(PartialBitString::from_bool(PartialBitString::Bool::False) == PartialBitString("0"));
     assert(PartialBitString::from_bool(PartialBitString::Bool::True) == PartialBitString("1"));
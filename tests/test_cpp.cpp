@@ -0,0 +1,187 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_cpp.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+// Words of a value, formatted like the harness prints them
+std::string format_words(const hdl::BitString& value) {
+  std::ostringstream stream;
+  for (size_t offset = 0; offset < value.width() || offset == 0; offset += 64) {
+    size_t width = std::min(value.width() - offset, size_t(64));
+    uint64_t word = width == 0 ? 0 : value.slice_width(offset, width).as_uint64();
+    stream << std::hex << word << std::dec << " ";
+  }
+  return stream.str();
+}
+
+// Generates the model of module together with a harness which applies the
+// given inputs and prints the outputs after every update. The harness is
+// compiled and run, its output is returned line by line.
+std::vector<std::string> run_generated(hdl::Module& module,
+                                       const std::vector<std::vector<hdl::BitString>>& inputs) {
+  char dir_template[] = "/tmp/hdl_cpp_XXXXXX";
+  const char* dir = mkdtemp(dir_template);
+  if (dir == nullptr) {
+    throw hdl::Error("Unable to create temporary directory");
+  }
+  std::string source = std::string(dir) + "/model.cpp";
+  std::string binary = std::string(dir) + "/model";
+
+  hdl::cpp::Printer printer(module);
+  {
+    std::ofstream file(source);
+    printer.print(file);
+
+    file << "#include <stdio.h>\n\n";
+    file << "int main() {\n";
+    file << "  " << printer.class_name() << " model;\n";
+    for (const std::vector<hdl::BitString>& values : inputs) {
+      for (size_t it = 0; it < values.size(); it++) {
+        const hdl::Input* input = module.inputs()[it];
+        for (size_t offset = 0; offset < input->width; offset += 64) {
+          size_t width = std::min(input->width - offset, size_t(64));
+          file << "  model." << input->name << ".words[" << offset / 64 << "] = 0x";
+          file << std::hex << values[it].slice_width(offset, width).as_uint64() << std::dec << "ull;\n";
+        }
+      }
+      file << "  model.update();\n";
+      for (const hdl::Output& output : module.outputs()) {
+        file << "  for (uint64_t word : model." << output.name << ".words) { printf(\"%llx \", (unsigned long long) word); }\n";
+      }
+      file << "  printf(\"\\n\");\n";
+    }
+    file << "  return 0;\n";
+    file << "}\n";
+  }
+
+  const char* cxx = getenv("CXX");
+  std::string command = std::string(cxx == nullptr ? "c++" : cxx) + " -std=c++17 -O1 " + source + " -o " + binary;
+  if (system(command.c_str()) != 0) {
+    throw hdl::Error("Unable to compile generated model");
+  }
+
+  std::vector<std::string> lines;
+  FILE* pipe = popen(binary.c_str(), "r");
+  std::string line;
+  for (int chr = fgetc(pipe); chr != EOF; chr = fgetc(pipe)) {
+    if (chr == '\n') {
+      lines.push_back(line);
+      line.clear();
+    } else {
+      line.push_back(char(chr));
+    }
+  }
+  pclose(pipe);
+
+  unlink(source.c_str());
+  unlink(binary.c_str());
+  rmdir(dir);
+  return lines;
+}
+
+int main() {
+  Test("Generated Model").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 100);
+    hdl::Value* b = module.input("b", 100);
+    hdl::Value* shift = module.input("shift", 8);
+    hdl::Value* address = module.input("address", 3);
+    hdl::Value* enable = module.input("enable", 1);
+
+    auto slice = [&](hdl::Value* value, size_t offset, size_t width){
+      return module.op(Kind::Slice, {
+        value,
+        module.constant(hdl::BitString::from_uint(offset)),
+        module.constant(hdl::BitString::from_uint(width))
+      });
+    };
+
+    hdl::Reg* acc = module.reg(hdl::BitString(100), clock);
+    acc->name = "acc";
+    acc->next = module.op(Kind::Add, {acc, module.op(Kind::Xor, {a, b})});
+
+    hdl::Reg* product = module.reg(hdl::BitString(200), clock);
+    product->name = "product";
+    product->next = module.op(Kind::Mul, {a, acc});
+
+    hdl::Reg* diff = module.reg(hdl::BitString::from_uint(uint64_t(7)).zero_extend(70), clock);
+    diff->name = "diff";
+    diff->next = module.op(Kind::Sub, {slice(product, 130, 70), slice(a, 0, 70)});
+
+    // Non power of two size, so addresses wrap around
+    hdl::Memory* memory = module.memory(70, 5);
+    memory->name = "memory";
+    memory->init(2, hdl::BitString::from_uint(uint64_t(42)).zero_extend(70));
+    memory->write(clock, address, enable, module.op(Kind::Xor, {diff, slice(b, 30, 70)}));
+
+    module.output("lt_s", module.op(Kind::LtS, {acc, b}));
+    module.output("lt_u", module.op(Kind::LtU, {a, acc}));
+    module.output("eq", module.op(Kind::Eq, {slice(a, 0, 8), shift}));
+    module.output("shr_s", module.op(Kind::ShrS, {acc, shift}));
+    module.output("shr_u", module.op(Kind::ShrU, {product, shift}));
+    module.output("shl", module.op(Kind::Shl, {a, shift}));
+    module.output("concat", module.op(Kind::Concat, {slice(acc, 37, 50), diff}));
+    module.output("select", module.op(Kind::Select, {enable, acc, module.op(Kind::Not, {b})}));
+    module.output("product", product);
+    module.output("read", memory->read(address));
+    module.output("read_acc", memory->read(slice(acc, 0, 3)));
+
+    std::vector<std::vector<hdl::BitString>> inputs;
+    bool clock_value = false;
+    for (size_t it = 0; it < 400; it++) {
+      hdl::BitString shift_value = hdl::BitString::random(8);
+      if (it % 3 != 0) {
+        shift_value = hdl::BitString::from_uint(uint8_t(shift_value.as_uint64() % 128));
+      }
+      inputs.push_back({
+        hdl::BitString::from_bool(clock_value),
+        hdl::BitString::random(100),
+        hdl::BitString::random(100),
+        shift_value,
+        hdl::BitString::random(3),
+        hdl::BitString::random(1)
+      });
+      clock_value = !clock_value;
+    }
+
+    std::vector<std::string> lines = run_generated(module, inputs);
+    assert(lines.size() == inputs.size());
+
+    hdl::sim::Simulation sim(module);
+    for (size_t it = 0; it < inputs.size(); it++) {
+      sim.update(inputs[it]);
+      std::string expected;
+      for (const hdl::BitString& output : sim.outputs()) {
+        expected += format_words(output);
+      }
+      assert(lines[it] == expected);
+    }
+  });
+
+  return 0;
+}
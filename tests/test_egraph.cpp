@@ -0,0 +1,219 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <random>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_egraph.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+// Builds a random circuit of bitwise and additive operators
+void build_random(hdl::Module& module, size_t seed) {
+  using Kind = hdl::Op::Kind;
+  
+  std::mt19937 rng(seed);
+  hdl::Value* clock = module.input("clock", 1);
+  std::vector<hdl::Value*> values = {
+    module.input("a", 8),
+    module.input("b", 8),
+    module.input("c", 8)
+  };
+  hdl::Reg* reg = module.reg(hdl::BitString(8), clock);
+  values.push_back(reg);
+  
+  Kind kinds[] = {Kind::And, Kind::Or, Kind::Xor, Kind::Add, Kind::Sub, Kind::Not};
+  for (size_t it = 0; it < 40; it++) {
+    Kind kind = kinds[rng() % 6];
+    hdl::Value* a = values[rng() % values.size()];
+    hdl::Value* b = values[rng() % values.size()];
+    if (kind == Kind::Not) {
+      values.push_back(module.op(kind, {a}));
+    } else {
+      values.push_back(module.op(kind, {a, b}));
+    }
+  }
+  
+  reg->next = values[values.size() - 2];
+  module.output("x", values.back());
+  module.output("y", values[values.size() - 3]);
+}
+
+int main() {
+  using Kind = hdl::Op::Kind;
+  using EGraph = hdl::egraph::EGraph;
+  using ENode = hdl::egraph::ENode;
+  using ClassId = hdl::egraph::ClassId;
+  
+  Test("EGraph/Congruence").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    
+    EGraph egraph(module);
+    ClassId class_a = egraph.add(ENode(a));
+    ClassId class_b = egraph.add(ENode(b));
+    ClassId not_a = egraph.add(ENode(Kind::Not, {class_a}));
+    ClassId not_b = egraph.add(ENode(Kind::Not, {class_b}));
+    assert(egraph.find(not_a) != egraph.find(not_b));
+    assert(egraph.add(ENode(Kind::Not, {class_a})) == egraph.find(not_a));
+    
+    egraph.merge(class_a, class_b);
+    egraph.rebuild();
+    assert(egraph.find(class_a) == egraph.find(class_b));
+    assert(egraph.find(not_a) == egraph.find(not_b));
+    assert(egraph.nodes(not_a).size() == 1);
+  });
+  
+  Test("EGraph/Constant Folding").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* x = module.constant(hdl::BitString::from_uint(uint8_t(3)));
+    hdl::Value* y = module.constant(hdl::BitString::from_uint(uint8_t(4)));
+    
+    EGraph egraph(module);
+    ClassId sum = egraph.add(ENode(Kind::Add, {egraph.add(ENode(x)), egraph.add(ENode(y))}));
+    egraph.rebuild();
+    assert(egraph.constant(sum) != nullptr);
+    assert(egraph.constant(sum)->value.as_uint64() == 7);
+    
+    ClassId class_a = egraph.add(ENode(a));
+    ClassId masked = egraph.add(ENode(Kind::And, {class_a, egraph.add(ENode(x))}));
+    egraph.rebuild();
+    assert(egraph.constant(masked) == nullptr);
+    
+    egraph.merge(class_a, egraph.add(ENode(y)));
+    egraph.rebuild();
+    assert(egraph.constant(masked) != nullptr);
+    assert(egraph.constant(masked)->value.as_uint64() == 0);
+  });
+  
+  Test("EGraph/Match").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    
+    EGraph egraph(module);
+    ClassId class_a = egraph.add(ENode(a));
+    ClassId class_b = egraph.add(ENode(b));
+    ClassId same = egraph.add(ENode(Kind::And, {class_a, class_a}));
+    ClassId different = egraph.add(ENode(Kind::And, {class_a, class_b}));
+    
+    using Pattern = hdl::egraph::Pattern;
+    Pattern pattern = Pattern::op(Kind::And, {Pattern::variable(0), Pattern::variable(0)});
+    
+    size_t count = 0;
+    egraph.match(pattern, same, [&](const auto& subst){
+      assert(subst[0] == egraph.find(class_a));
+      count++;
+    });
+    egraph.match(pattern, different, [&](const auto& subst){
+      count++;
+    });
+    assert(count == 1);
+  });
+  
+  Test("Optimize/Factor").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* c = module.input("c", 8);
+    module.output("x", module.op(Kind::Or, {
+      module.op(Kind::And, {a, b}),
+      module.op(Kind::And, {c, a})
+    }));
+    
+    hdl::egraph::Stats stats = hdl::egraph::optimize(module);
+    assert(stats.iterations > 0);
+    module.gc();
+    
+    hdl::Op* op = hdl::dyn_cast<hdl::Op>(module.outputs()[0].value);
+    assert(op != nullptr);
+    assert(op->kind == Kind::And);
+    assert(module.depth() == 2);
+  });
+  
+  Test("Optimize/Cancel").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    module.output("x", module.op(Kind::Xor, {
+      module.op(Kind::Sub, {module.op(Kind::Add, {a, b}), b}),
+      a
+    }));
+    
+    hdl::egraph::optimize(module);
+    hdl::Constant* constant = hdl::dyn_cast<hdl::Constant>(module.outputs()[0].value);
+    assert(constant != nullptr);
+    assert(constant->value == hdl::BitString(8));
+  });
+  
+  Test("Optimize/Limits").run([](){
+    hdl::Module module("top");
+    hdl::Value* sum = module.input("a0", 8);
+    for (size_t it = 1; it < 12; it++) {
+      sum = module.op(Kind::Add, {sum, module.input("a" + std::to_string(it), 8)});
+    }
+    module.output("sum", sum);
+    
+    hdl::egraph::Limits limits;
+    limits.max_iterations = 2;
+    hdl::egraph::Stats stats = hdl::egraph::optimize(module, hdl::egraph::default_rules(), limits);
+    assert(stats.iterations == 2);
+    assert(!stats.is_saturated);
+    
+    limits = hdl::egraph::Limits();
+    limits.max_nodes = 500;
+    EGraph egraph(module);
+    egraph.add(module);
+    stats = egraph.saturate(hdl::egraph::default_rules(), limits);
+    assert(!stats.is_saturated);
+    assert(egraph.node_count() < 1000);
+  });
+  
+  Test("Optimize/Equivalence").run([](){
+    for (size_t seed = 0; seed < 16; seed++) {
+      hdl::Module module("top");
+      hdl::Module optimized("top");
+      build_random(module, seed);
+      build_random(optimized, seed);
+      
+      hdl::egraph::Limits limits;
+      limits.max_nodes = 4000;
+      hdl::egraph::optimize(optimized, hdl::egraph::default_rules(), limits);
+      optimized.gc();
+      
+      hdl::sim::Simulation sim(module);
+      hdl::sim::Simulation sim_optimized(optimized);
+      bool clock = false;
+      for (size_t iter = 0; iter < 64; iter++) {
+        std::vector<hdl::BitString> inputs = {
+          hdl::BitString::from_bool(clock),
+          hdl::BitString::random(8),
+          hdl::BitString::random(8),
+          hdl::BitString::random(8)
+        };
+        sim.update(inputs);
+        sim_optimized.update(inputs);
+        assert(sim.outputs() == sim_optimized.outputs());
+        clock = !clock;
+      }
+    }
+  });
+  
+  return 0;
+}
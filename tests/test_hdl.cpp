@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include <inttypes.h>
+#include <set>
+#include <map>
+#include <utility>
 
 #include "../../unittest.cpp/unittest.hpp"
 #include "../hdl.hpp"
@@ -67,6 +70,484 @@ void test_module() {
     assert(module.regs().size() == 1);
   });
   
+  Test("Garbage Collection/Deep").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    
+    // Deep enough to overflow the stack of a recursive collector
+    std::vector<hdl::Value*> values;
+    hdl::Value* value = a;
+    for (size_t it = 0; it < 1000000; it++) {
+      value = module.op(it % 2 == 0 ? hdl::Op::Kind::Add : hdl::Op::Kind::Xor, {value, b});
+      values.push_back(value);
+    }
+    module.output("value", values[values.size() / 2]);
+    module.gc();
+    module.gc();
+    
+    value = a;
+    for (size_t it = 0; it <= values.size() / 2; it++) {
+      value = module.op(it % 2 == 0 ? hdl::Op::Kind::Add : hdl::Op::Kind::Xor, {value, b});
+      assert(value == values[it]);
+    }
+  });
+  
+  Test("Garbage Collection/Memory Reads").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 4);
+    hdl::Value* b = module.input("b", 4);
+    
+    hdl::Memory* memory = module.memory(8, 16);
+    module.output("live", memory->read(a));
+    memory->read(module.op(hdl::Op::Kind::Not, {a}));
+    assert(memory->reads.size() == 2);
+    
+    module.enable_fanouts();
+    module.gc();
+    assert(memory->reads.size() == 1);
+    assert(module.users(a).size() == 1);
+    
+    // May reuse the ID of the collected operator
+    hdl::Value* and_op = module.op(hdl::Op::Kind::And, {a, b});
+    assert(module.users(and_op).empty());
+  });
+  
+  Test("Arena").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 32);
+    
+    auto build = [&](){
+      hdl::Value* value = a;
+      for (size_t it = 0; it < 10000; it++) {
+        value = module.op(hdl::Op::Kind::Add, {value, a});
+      }
+      return value;
+    };
+    
+    build();
+    module.gc();
+    size_t slab_count = module.arena().slab_count();
+    
+    // Nodes freed by the garbage collector are reused
+    module.output("value", build());
+    assert(module.arena().slab_count() == slab_count);
+    
+    hdl::Module moved = std::move(module);
+    assert(moved.outputs().size() == 1);
+  });
+  
+  Test("Operator Hashcons/Rehash").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 32);
+    hdl::Value* b = module.input("b", 32);
+    
+    std::vector<hdl::Value*> values;
+    hdl::Value* value = a;
+    for (size_t it = 0; it < 1000; it++) {
+      value = module.op(hdl::Op::Kind::Xor, {value, b});
+      values.push_back(value);
+    }
+    module.output("value", values[499]);
+    
+    value = a;
+    for (size_t it = 0; it < 1000; it++) {
+      value = module.op(hdl::Op::Kind::Xor, {value, b});
+      assert(value == values[it]);
+    }
+    
+    assert(module.constant(hdl::BitString("0101")) == module.constant(hdl::BitString("0101")));
+    assert(module.constant(hdl::BitString("0101")) != module.constant(hdl::BitString("00101")));
+    
+    // Nodes surviving the garbage collection can still be found
+    module.gc();
+    value = a;
+    for (size_t it = 0; it < 500; it++) {
+      value = module.op(hdl::Op::Kind::Xor, {value, b});
+      assert(value == values[it]);
+    }
+  });
+  
+  Test("Value IDs").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, b});
+    hdl::Value* diff = module.op(hdl::Op::Kind::Sub, {a, b});
+    module.output("sum", sum);
+    
+    std::set<uint32_t> ids = {a->id(), b->id(), sum->id(), diff->id()};
+    assert(ids.size() == 4);
+    assert(module.id_count() == 4);
+    for (uint32_t id : ids) {
+      assert(id < module.id_count());
+    }
+    
+    // IDs of collected values are reused
+    module.gc();
+    hdl::Value* prod = module.op(hdl::Op::Kind::Mul, {a, b});
+    assert(module.id_count() == 4);
+    assert(prod->id() != sum->id());
+  });
+  
+  Test("NodeMap").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, b});
+    
+    hdl::NodeMap<std::string> names(module);
+    assert(names.empty());
+    assert(!names.has(a));
+    assert(names.find(a) == nullptr);
+    
+    names[a] = "a";
+    assert(names.insert(sum, "sum"));
+    assert(!names.insert(sum, "other"));
+    assert(names.size() == 2);
+    assert(names.at(a) == "a");
+    assert(names.at(sum) == "sum");
+    assert(!names.has(b));
+    
+    bool thrown = false;
+    try {
+      names.at(b);
+    } catch (const hdl::Error& error) {
+      thrown = true;
+    }
+    assert(thrown);
+    
+    names.erase(a);
+    assert(!names.has(a));
+    assert(names.size() == 1);
+    
+    // Values created later can still be inserted
+    hdl::Value* prod = module.op(hdl::Op::Kind::Mul, {a, b});
+    names[prod] = "prod";
+    assert(*names.find(prod) == "prod");
+    
+    // Ids of removed values are reused, so the map is invalidated
+    module.output("sum", sum);
+    module.gc();
+    hdl::Value* diff = module.op(hdl::Op::Kind::Sub, {a, b});
+    thrown = false;
+    try {
+      names.has(diff);
+    } catch (const hdl::Error& error) {
+      thrown = true;
+    }
+    assert(thrown);
+    
+    names.clear();
+    names[diff] = "diff";
+    assert(names.at(diff) == "diff");
+  });
+  
+  Test("NodeMap/Multiple Modules").run([&](){
+    // Values of different modules may share ids
+    hdl::Module module_a("a");
+    hdl::Module module_b("b");
+    hdl::Value* a = module_a.input("a", 1);
+    hdl::Value* b = module_b.input("b", 1);
+    assert(a->id() == b->id());
+    
+    auto fails = [](const std::function<void()>& func){
+      try {
+        func();
+      } catch (const hdl::Error& error) {
+        return true;
+      }
+      return false;
+    };
+    
+    hdl::NodeMap<int> bound(module_a);
+    bound[a] = 1;
+    assert(fails([&](){ bound[b] = 2; }));
+    assert(fails([&](){ bound.has(b); }));
+    assert(bound.at(a) == 1);
+    
+    // Default constructed maps are bound to the module of the first value
+    hdl::NodeMap<int> unbound;
+    assert(!unbound.has(b));
+    unbound[a] = 1;
+    assert(fails([&](){ unbound.insert(b, 2); }));
+    assert(fails([&](){ unbound.find(b); }));
+    assert(unbound.size() == 1);
+  });
+  
+  Test("Fanouts").run([&](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, b});
+    
+    module.enable_fanouts();
+    assert(module.users(a).size() == 1);
+    assert(module.users(a)[0].user == sum);
+    
+    // Operators using a value twice are only listed once
+    hdl::Value* twice = module.op(hdl::Op::Kind::Mul, {a, a});
+    assert(module.users(a).size() == 2);
+    module.op(hdl::Op::Kind::Mul, {a, a});
+    assert(module.users(a).size() == 2);
+    
+    hdl::Reg* reg = module.reg(hdl::BitString(8), clock);
+    module.set_next(reg, sum);
+    assert(module.users(sum).size() == 1);
+    assert(module.users(sum)[0].user == reg);
+    assert(module.users(reg).empty());
+    
+    hdl::Memory* memory = module.memory(8, 16);
+    hdl::Value* address = module.op(hdl::Op::Kind::Slice, {
+      b,
+      module.constant(hdl::BitString::from_uint(0)),
+      module.constant(hdl::BitString::from_uint(4))
+    });
+    memory->write(clock, address, module.constant(hdl::BitString("1")), reg);
+    assert(module.users(reg).size() == 1);
+    assert(module.users(reg)[0].memory == memory);
+    assert(module.users(reg)[0].write == 0);
+    
+    hdl::Value* read = memory->read(address);
+    assert(module.users(address).size() == 2);
+    
+    module.output("twice", twice);
+    module.output("read", read);
+    module.gc();
+    assert(module.users(a).size() == 2);
+    assert(module.users(clock).size() == 2);
+    
+    module.disable_fanouts();
+    assert(!module.has_fanouts());
+  });
+  
+  Test("Fanouts/Replace").run([&](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* c = module.input("c", 8);
+    module.enable_fanouts();
+    
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, b});
+    hdl::Value* prod = module.op(hdl::Op::Kind::Mul, {sum, c});
+    hdl::Reg* reg = module.reg(hdl::BitString(8), clock);
+    module.set_next(reg, module.op(hdl::Op::Kind::Xor, {sum, reg}));
+    module.output("sum", sum);
+    module.output("prod", prod);
+    module.output("reg", reg);
+    
+    module.replace(b, c);
+    hdl::Value* new_sum = module.op(hdl::Op::Kind::Add, {a, c});
+    assert(module.find_output("sum").value == new_sum);
+    assert(module.find_output("prod").value == module.op(hdl::Op::Kind::Mul, {new_sum, c}));
+    assert(reg->next == module.op(hdl::Op::Kind::Xor, {new_sum, reg}));
+    assert(module.users(b).size() == 1);
+    
+    // Replacing a value by one of its users
+    hdl::Value* inverted = module.op(hdl::Op::Kind::Not, {new_sum});
+    module.replace(new_sum, inverted);
+    assert(module.find_output("sum").value == inverted);
+    assert(hdl::dyn_cast<hdl::Op>(inverted)->args[0] == new_sum);
+    
+    // Rebuilt operators are simplified
+    module.replace(reg, module.constant(hdl::BitString(8)));
+    assert(module.find_output("reg").value == module.constant(hdl::BitString(8)));
+    assert(reg->next == inverted);
+  });
+  
+  Test("Fanouts/Direct Assignment").run([&](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* c = module.input("c", 8);
+    hdl::Reg* reg = module.reg(hdl::BitString(8), clock);
+    hdl::Memory* memory = module.memory(8, 4);
+    module.enable_fanouts();
+    
+    // The DSL and the yosys frontend assign next directly
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, b});
+    reg->next = sum;
+    assert(module.users(sum).size() == 1);
+    assert(module.users(sum)[0].user == reg);
+    
+    memory->writes.emplace_back(clock, module.constant(hdl::BitString("00")), module.constant(hdl::BitString("1")), a);
+    assert(module.users(a).size() == 2);
+    
+    module.replace(a, c);
+    assert(reg->next == module.op(hdl::Op::Kind::Add, {c, b}));
+    assert(memory->writes[0].value == c);
+    assert(module.users(a).size() == 1);
+    
+    reg->next = reg;
+    assert(module.users(module.op(hdl::Op::Kind::Add, {c, b})).empty());
+    memory->writes.clear();
+    assert(module.users(c).size() == 1);
+  });
+  
+  Test("Substitute").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 1);
+    hdl::Value* b = module.input("b", 1);
+    hdl::Value* c = module.input("c", 1);
+    hdl::Value* clock = module.op(hdl::Op::Kind::And, {a, b});
+    hdl::Reg* reg = module.reg(hdl::BitString(1), clock);
+    reg->next = module.op(hdl::Op::Kind::Not, {reg});
+    hdl::Memory* memory = module.memory(1, 2);
+    memory->write(clock, a, b, reg);
+    module.output("read", memory->read(module.op(hdl::Op::Kind::Not, {a})));
+    module.enable_fanouts();
+    
+    hdl::NodeMap<hdl::Value*> substitutes(module);
+    substitutes[a] = c;
+    module.remap_roots(module.substitute(substitutes));
+    
+    hdl::Value* new_clock = module.op(hdl::Op::Kind::And, {c, b});
+    assert(reg->clock == new_clock);
+    assert(memory->writes[0].clock == new_clock);
+    assert(memory->writes[0].address == c);
+    assert(module.outputs()[0].value == memory->read(module.op(hdl::Op::Kind::Not, {c})));
+    assert(module.users(clock).empty());
+    assert(module.users(new_clock).size() == 2);
+  });
+  
+  Test("Fanouts/Replace Reconvergent").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* c = module.input("c", 8);
+    
+    auto chain = [&](hdl::Value* value){
+      for (size_t it = 0; it < 32; it++) {
+        value = module.op(hdl::Op::Kind::Xor, {
+          module.op(hdl::Op::Kind::And, {value, b}),
+          module.op(hdl::Op::Kind::Or, {value, b})
+        });
+      }
+      return value;
+    };
+    
+    module.output("value", chain(a));
+    module.enable_fanouts();
+    size_t id_count = module.id_count();
+    module.replace(a, c);
+    
+    // Every diamond is rebuilt once
+    assert(module.id_count() == id_count + 3 * 32);
+    assert(module.find_output("value").value == chain(c));
+  });
+  
+  Test("Topological Order").run([&](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Reg* reg = module.reg(hdl::BitString(8), clock);
+    hdl::Value* sum = module.op(hdl::Op::Kind::Add, {a, reg});
+    hdl::Value* prod = module.op(hdl::Op::Kind::Xor, {sum, reg});
+    reg->next = sum;
+    module.output("prod", prod);
+    
+    const std::vector<hdl::Value*>& order = module.topo_order();
+    assert(order.size() == 5);
+    std::map<hdl::Value*, size_t> positions;
+    for (size_t it = 0; it < order.size(); it++) {
+      positions[order[it]] = it;
+    }
+    assert(positions.at(a) < positions.at(sum));
+    assert(positions.at(reg) < positions.at(sum));
+    assert(positions.at(sum) < positions.at(prod));
+    assert(positions.find(clock) != positions.end());
+    
+    assert(module.levels().at(a) == 0);
+    assert(module.levels().at(reg) == 0);
+    assert(module.levels().at(sum) == 1);
+    assert(module.levels().at(prod) == 2);
+    assert(module.depth() == 2);
+    
+    // The order is cached until a root changes
+    assert(&module.topo_order() == &order);
+    assert(module.topo_order().size() == 5);
+    module.op(hdl::Op::Kind::Sub, {a, reg});
+    assert(module.topo_order().size() == 5);
+    
+    hdl::Value* next = module.op(hdl::Op::Kind::Sub, {prod, a});
+    reg->next = next;
+    assert(module.topo_order().size() == 6);
+    assert(module.levels().at(next) == 3);
+  });
+  
+  Test("Topological Order/Deep").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* value = a;
+    for (size_t it = 0; it < 1000000; it++) {
+      value = module.op(hdl::Op::Kind::Not, {module.op(hdl::Op::Kind::Add, {value, a})});
+    }
+    module.output("value", value);
+    assert(module.topo_order().size() == 2000001);
+    assert(module.depth() == 2000000);
+  });
+  
+  Test("Verilog/Deep").run([&](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* shared = a;
+    for (size_t it = 0; it < 200000; it++) {
+      shared = module.op(hdl::Op::Kind::Add, {shared, shared});
+    }
+    hdl::Value* inline_value = module.input("b", 8);
+    for (size_t it = 0; it < 1000; it++) {
+      inline_value = module.op(hdl::Op::Kind::Sub, {inline_value, a});
+    }
+    module.output("shared", shared);
+    module.output("inline", inline_value);
+    
+    std::ostringstream stream;
+    hdl::verilog::Printer(module).print(stream);
+    std::string verilog = stream.str();
+    
+    // Values used more than once become wires, all others are inlined
+    size_t wires = 0;
+    size_t subs = 0;
+    for (size_t it = 0; it < verilog.size(); it++) {
+      if (verilog.compare(it, 7, "  wire ") == 0) {
+        wires++;
+      } else if (verilog.compare(it, 3, " - ") == 0) {
+        subs++;
+      }
+    }
+    assert(wires == 199999);
+    assert(subs == 1000);
+  });
+  
+  Test("Tags").run([&](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* constant = module.constant(hdl::BitString("1010"));
+    hdl::Reg* reg = module.reg(hdl::BitString("0000"), clock);
+    hdl::Value* op = module.op(hdl::Op::Kind::Add, {reg, module.input("a", 4)});
+    hdl::Memory* memory = module.memory(4, 16);
+    hdl::Value* read = memory->read(reg);
+    
+    assert(hdl::isa<hdl::Input>(clock));
+    assert(hdl::isa<hdl::Constant>(constant));
+    assert(hdl::isa<hdl::Comb>(constant));
+    assert(hdl::isa<hdl::Reg>(reg));
+    assert(!hdl::isa<hdl::Comb>(reg));
+    assert(hdl::isa<hdl::Op>(op));
+    assert(hdl::isa<hdl::Comb>(op));
+    assert(hdl::isa<hdl::Memory::Read>(read));
+    assert(hdl::isa<hdl::Comb>(read));
+    assert(!hdl::isa<hdl::Op>(nullptr));
+    
+    assert(hdl::dyn_cast<hdl::Op>(op) == dynamic_cast<hdl::Op*>(op));
+    assert(hdl::dyn_cast<hdl::Op>(constant) == nullptr);
+    assert(hdl::dyn_cast<hdl::Comb>(clock) == nullptr);
+    assert(hdl::cast<hdl::Constant>(constant)->value == hdl::BitString("1010"));
+  });
+  
   Test("Unknown Value").run([&](){
     hdl::Module module("top");
     hdl::Value* a = module.unknown(32);
@@ -220,6 +701,42 @@ void test_sim() {
     }
   });
   
+  Test("Simulation/Deep").run([](){
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* value = a;
+    for (size_t it = 0; it < 1000000; it++) {
+      value = module.op(hdl::Op::Kind::Not, {module.op(hdl::Op::Kind::Add, {value, a})});
+    }
+    module.output("value", value);
+    
+    uint8_t expected = 3;
+    for (size_t it = 0; it < 1000000; it++) {
+      expected = uint8_t(~uint8_t(expected + 3));
+    }
+    
+    hdl::sim::Simulation sim(module);
+    sim.update({hdl::BitString::from_uint(uint8_t(3))});
+    assert(sim.outputs()[0].as_uint64() == expected);
+  });
+  
+  Test("Simulation/Lazy Select").run([](){
+    hdl::Module module("top");
+    hdl::Value* cond = module.input("cond", 1);
+    hdl::Value* a = module.input("a", 8);
+    module.output("value", module.op(hdl::Op::Kind::Select, {
+      cond, a, module.op(hdl::Op::Kind::Not, {module.unknown(8)})
+    }));
+    
+    hdl::sim::Simulation sim(module);
+    std::vector<hdl::BitString> inputs = {
+      hdl::BitString::from_bool(true),
+      hdl::BitString::from_uint(uint8_t(42))
+    };
+    sim.update(inputs);
+    assert(sim.outputs()[0].as_uint64() == 42);
+  });
+  
   Test("Memory Simulation").run([](){
     hdl::Module module("top");
     hdl::Value* clock = module.input("clock", 1);
@@ -266,6 +783,260 @@ void test_sim() {
       }
     }
   });
+  
+  Test("Memory Storage").run([](){
+    using MemoryData = hdl::sim::Simulation::MemoryData;
+    
+    hdl::Module module("top");
+    hdl::Memory* small = module.memory(100, 64);
+    small->init(3, hdl::BitString::from_uint(uint64_t(42)).zero_extend(100));
+    hdl::Memory* large = module.memory(32, size_t(1) << 22);
+    hdl::Memory* multi_gigabyte = module.memory(64, size_t(1) << 30);
+    hdl::Memory* huge = module.memory(64, size_t(1) << 40);
+    
+    for (MemoryData::Storage storage : {MemoryData::Storage::Dense, MemoryData::Storage::Sparse}) {
+      MemoryData data(small, storage);
+      assert(data.read(3).as_uint64() == 42);
+      assert(data.read(4).is_zero());
+      
+      hdl::BitString value = hdl::BitString::random(100);
+      assert(data.write(5, value));
+      assert(!data.write(5, value));
+      assert(data.read(5) == value);
+      assert(data.read(64 + 5) == value);
+      assert(data.write(5, hdl::BitString(100)));
+      assert(data.read(5).is_zero());
+      
+      data[6] = value;
+      assert(data.read(6) == value);
+      data[7] = data[6];
+      assert(hdl::BitString(data[7]) == value);
+      assert(std::as_const(data)[64 + 7] == value);
+      
+      bool has_error = false;
+      try {
+        data[8] = hdl::BitString(101);
+      } catch (const hdl::Error& error) {
+        has_error = true;
+      }
+      assert(has_error);
+    }
+    
+    MemoryData large_data(large);
+    assert(large_data.is_dense());
+    assert(large_data.is_mapped());
+    large_data.write(123456, hdl::BitString::from_uint(uint32_t(789)));
+    MemoryData large_copy = large_data;
+    assert(large_copy.read(123456).as_uint64() == 789);
+    
+    MemoryData multi_gigabyte_data(multi_gigabyte);
+    assert(multi_gigabyte_data.is_dense());
+    assert(multi_gigabyte_data.is_mapped());
+    multi_gigabyte_data.write(uint64_t(1) << 29, hdl::BitString::from_uint(uint64_t(1)));
+    assert(multi_gigabyte_data.read(uint64_t(1) << 29).as_uint64() == 1);
+    
+    MemoryData huge_data(huge);
+    assert(!huge_data.is_dense());
+    huge_data.write(uint64_t(1) << 39, hdl::BitString::from_uint(uint64_t(1)));
+    assert(huge_data.read(uint64_t(1) << 39).as_uint64() == 1);
+  });
+  
+  Test("Compiled Simulation").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* write_enable = module.input("write_enable", 1);
+    
+    hdl::Reg* counter = module.reg(hdl::BitString(8), clock);
+    counter->next = module.op(hdl::Op::Kind::Add, {
+      counter,
+      module.constant(hdl::BitString::from_uint(uint8_t(1)))
+    });
+    
+    // Register clocked by a register
+    hdl::Reg* divided = module.reg(hdl::BitString(1), clock);
+    divided->next = module.op(hdl::Op::Kind::Not, {divided});
+    hdl::Reg* slow = module.reg(hdl::BitString(8), divided);
+    slow->next = module.op(hdl::Op::Kind::Xor, {slow, a});
+    
+    hdl::Memory* memory = module.memory(16, 8);
+    hdl::Value* address = module.op(hdl::Op::Kind::Slice, {
+      a,
+      module.constant(hdl::BitString::from_uint(0)),
+      module.constant(hdl::BitString::from_uint(3))
+    });
+    memory->write(clock, address, write_enable, module.op(hdl::Op::Kind::Mul, {a, b}));
+    
+    module.output("counter", counter);
+    module.output("slow", slow);
+    module.output("read", memory->read(address));
+    module.output("select", module.op(hdl::Op::Kind::Select, {
+      module.op(hdl::Op::Kind::LtU, {a, b}),
+      module.op(hdl::Op::Kind::Concat, {a, counter}),
+      module.op(hdl::Op::Kind::Concat, {b, slow})
+    }));
+    
+    hdl::sim::Simulation sim(module);
+    hdl::sim::CompiledSimulation compiled(module);
+    hdl::sim::CompiledSimulation event_driven(module);
+    event_driven.set_event_driven(true);
+    
+    bool clock_value = false;
+    for (size_t iter = 0; iter < 200; iter++) {
+      std::vector<hdl::BitString> inputs = {
+        hdl::BitString::from_bool(clock_value),
+        hdl::BitString::random(8),
+        hdl::BitString::random(8),
+        hdl::BitString::random(1)
+      };
+      sim.update(inputs);
+      compiled.update(inputs);
+      event_driven.update(inputs);
+      assert(sim.outputs() == compiled.outputs());
+      assert(sim.outputs() == event_driven.outputs());
+      clock_value = !clock_value;
+    }
+    
+    assert(compiled.find_output("counter").as_uint64() == 100);
+    assert(event_driven.find_output("counter").as_uint64() == 100);
+  });
+  
+  Test("Compiled Simulation/Event Driven").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* enable = module.input("enable", 1);
+    hdl::Value* a = module.input("a", 16);
+    
+    // Pipeline which only captures a new value when enabled
+    hdl::Value* value = a;
+    for (size_t it = 0; it < 8; it++) {
+      hdl::Reg* stage = module.reg(hdl::BitString(16), clock);
+      hdl::Value* computed = module.op(hdl::Op::Kind::Add, {
+        module.op(hdl::Op::Kind::Xor, {value, module.constant(hdl::BitString::from_uint(uint16_t(it)))}),
+        value
+      });
+      stage->next = module.op(hdl::Op::Kind::Select, {enable, computed, stage});
+      value = stage;
+    }
+    module.output("out", value);
+    
+    hdl::sim::Simulation sim(module);
+    hdl::sim::CompiledSimulation compiled(module);
+    compiled.set_event_driven(true);
+    
+    bool clock_value = false;
+    for (size_t iter = 0; iter < 64; iter++) {
+      std::vector<hdl::BitString> inputs = {
+        hdl::BitString::from_bool(clock_value),
+        hdl::BitString::from_bool(iter < 32),
+        hdl::BitString::from_uint(uint16_t(iter * 37))
+      };
+      sim.update(inputs);
+      compiled.update(inputs);
+      assert(sim.outputs() == compiled.outputs());
+      clock_value = !clock_value;
+    }
+    
+    // Idle pipeline with constant inputs does not require any evaluations
+    std::vector<hdl::BitString> inputs = {
+      hdl::BitString::from_bool(false),
+      hdl::BitString::from_bool(false),
+      hdl::BitString::from_uint(uint16_t(0))
+    };
+    compiled.update(inputs);
+    size_t eval_count = compiled.eval_count();
+    for (size_t iter = 0; iter < 16; iter++) {
+      compiled.update(inputs);
+    }
+    assert(compiled.eval_count() == eval_count);
+  });
+  
+  Test("Compiled Simulation/Wide").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* a = module.input("a", 200);
+    hdl::Value* b = module.input("b", 200);
+    hdl::Value* shift = module.input("shift", 8);
+    
+    auto slice = [&](hdl::Value* value, size_t offset, size_t width){
+      return module.op(Kind::Slice, {
+        value,
+        module.constant(hdl::BitString::from_uint(offset)),
+        module.constant(hdl::BitString::from_uint(width))
+      });
+    };
+    
+    hdl::Reg* acc = module.reg(hdl::BitString(200), clock);
+    acc->next = module.op(Kind::Sub, {
+      module.op(Kind::Add, {acc, module.op(Kind::And, {a, b})}),
+      module.op(Kind::Or, {a, module.op(Kind::Not, {b})})
+    });
+    
+    hdl::Memory* memory = module.memory(200, 4);
+    hdl::Value* address = slice(a, 0, 2);
+    memory->write(clock, address, slice(b, 0, 1), module.op(Kind::Xor, {acc, b}));
+    
+    module.output("mul", module.op(Kind::Mul, {acc, a}));
+    module.output("eq", module.op(Kind::Eq, {acc, a}));
+    module.output("lt_u", module.op(Kind::LtU, {acc, a}));
+    module.output("lt_s", module.op(Kind::LtS, {acc, b}));
+    module.output("concat", module.op(Kind::Concat, {slice(acc, 70, 130), b}));
+    module.output("shl", module.op(Kind::Shl, {acc, shift}));
+    module.output("shr_u", module.op(Kind::ShrU, {acc, shift}));
+    module.output("shr_s", module.op(Kind::ShrS, {acc, shift}));
+    module.output("select", module.op(Kind::Select, {slice(a, 5, 1), acc, b}));
+    module.output("read", memory->read(slice(acc, 3, 2)));
+    
+    hdl::sim::Simulation sim(module);
+    hdl::sim::CompiledSimulation compiled(module);
+    hdl::sim::CompiledSimulation event_driven(module);
+    event_driven.set_event_driven(true);
+    
+    bool clock_value = false;
+    for (size_t iter = 0; iter < 200; iter++) {
+      std::vector<hdl::BitString> inputs = {
+        hdl::BitString::from_bool(clock_value),
+        hdl::BitString::random(200),
+        iter % 4 == 0 ? hdl::BitString(200) : hdl::BitString::random(200),
+        hdl::BitString::random(8)
+      };
+      sim.update(inputs);
+      compiled.update(inputs);
+      event_driven.update(inputs);
+      assert(sim.outputs() == compiled.outputs());
+      assert(sim.outputs() == event_driven.outputs());
+      clock_value = !clock_value;
+    }
+  });
+  
+  Test("Compiled Simulation/Unknown").run([](){
+    // Simulation only evaluates the selected arm, but CompiledSimulation
+    // evaluates both and rejects unknown values when compiling
+    hdl::Module module("top");
+    hdl::Value* cond = module.input("cond", 1);
+    hdl::Value* a = module.input("a", 8);
+    module.output("value", module.op(hdl::Op::Kind::Select, {
+      cond, a, module.op(hdl::Op::Kind::Not, {module.unknown(8)})
+    }));
+    
+    hdl::sim::Simulation sim(module);
+    std::vector<hdl::BitString> inputs = {
+      hdl::BitString::from_bool(true),
+      hdl::BitString::from_uint(uint8_t(42))
+    };
+    sim.update(inputs);
+    assert(sim.outputs()[0].as_uint64() == 42);
+    
+    bool has_error = false;
+    try {
+      hdl::sim::CompiledSimulation compiled(module);
+    } catch (const hdl::Error& error) {
+      has_error = true;
+    }
+    assert(has_error);
+  });
 }
 
 int main() {
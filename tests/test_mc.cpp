@@ -0,0 +1,317 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_mc.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+// Replays a trace using hdl::sim::Simulation. The clock (input 0) is
+// toggled in every cycle. Returns the value of the property in the last cycle.
+bool replay(hdl::Module& module, const hdl::mc::Trace& trace) {
+  hdl::sim::Simulation sim(module);
+  size_t property = 0;
+  for (size_t it = 0; it < module.outputs().size(); it++) {
+    if (module.outputs()[it].name == "property") {
+      property = it;
+    }
+  }
+  
+  bool value = true;
+  for (std::vector<hdl::BitString> inputs : trace.inputs) {
+    inputs[0] = hdl::BitString::from_bool(false);
+    sim.update(inputs);
+    value = sim.outputs()[property][0];
+    inputs[0] = hdl::BitString::from_bool(true);
+    sim.update(inputs);
+  }
+  return value;
+}
+
+// Counter modulo 10. Counter values 10 and 11 are unreachable but satisfy
+// the property, so it is not 1-inductive.
+void build_decimal_counter(hdl::Module& module) {
+  using Kind = hdl::Op::Kind;
+  hdl::Value* clock = module.input("clock", 1);
+  hdl::Reg* counter = module.reg(hdl::BitString("0000"), clock);
+  counter->next = module.op(Kind::Select, {
+    module.op(Kind::Eq, {counter, module.constant(hdl::BitString("1001"))}),
+    module.constant(hdl::BitString("0000")),
+    module.op(Kind::Add, {counter, module.constant(hdl::BitString("0001"))})
+  });
+  module.output("property", module.op(Kind::Not, {
+    module.op(Kind::Eq, {counter, module.constant(hdl::BitString("1100"))})
+  }));
+  module.output("is_nine", module.op(Kind::Not, {
+    module.op(Kind::Eq, {counter, module.constant(hdl::BitString("1001"))})
+  }));
+}
+
+// State 1 is an unreachable self loop which can be left towards the bad
+// state 3. Without simple path constraints, it is not k-inductive for any k.
+void build_loop(hdl::Module& module) {
+  using Kind = hdl::Op::Kind;
+  hdl::Value* clock = module.input("clock", 1);
+  hdl::Value* leave = module.input("leave", 1);
+  hdl::Reg* state = module.reg(hdl::BitString("00"), clock);
+  state->next = module.op(Kind::Select, {
+    module.op(Kind::Eq, {state, module.constant(hdl::BitString("01"))}),
+    module.op(Kind::Select, {
+      leave,
+      module.constant(hdl::BitString("10")),
+      module.constant(hdl::BitString("01"))
+    }),
+    module.op(Kind::Select, {
+      module.op(Kind::Eq, {state, module.constant(hdl::BitString("10"))}),
+      module.constant(hdl::BitString("11")),
+      state
+    })
+  });
+  module.output("property", module.op(Kind::Not, {
+    module.op(Kind::Eq, {state, module.constant(hdl::BitString("11"))})
+  }));
+}
+
+int main() {
+  Test("Counter").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* enable = module.input("enable", 1);
+    hdl::Reg* counter = module.reg(hdl::BitString("0000"), clock);
+    counter->next = module.op(Kind::Select, {
+      enable,
+      module.op(Kind::Add, {counter, module.constant(hdl::BitString("0001"))}),
+      counter
+    });
+    module.output("property", module.op(Kind::Not, {
+      module.op(Kind::Eq, {counter, module.constant(hdl::BitString("1010"))})
+    }));
+    
+    hdl::mc::Bmc bmc(module, {"property"});
+    assert(!bmc.check(10).has_value());
+    assert(bmc.checked_depth() == 10);
+    
+    std::optional<hdl::mc::Trace> trace = bmc.check(16);
+    assert(trace.has_value());
+    assert(trace->cycle == 10);
+    assert(trace->property == 0);
+    assert(trace->inputs.size() == 11);
+    for (size_t cycle = 0; cycle < 10; cycle++) {
+      assert(trace->inputs[cycle][1] == hdl::BitString("1"));
+    }
+    assert(!replay(module, *trace));
+  });
+  
+  Test("Memory").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* address = module.input("address", 2);
+    hdl::Value* data = module.input("data", 8);
+    hdl::Value* enable = module.input("enable", 1);
+    
+    hdl::Memory* memory = module.memory(8, 4);
+    memory->init(3, hdl::BitString("00000001"));
+    memory->write(clock, address, enable, data);
+    
+    // Address 3 can only contain 10101010 after it was written
+    hdl::Value* value = memory->read(module.constant(hdl::BitString("11")));
+    module.output("property", module.op(Kind::Not, {
+      module.op(Kind::Eq, {value, module.constant(hdl::BitString("10101010"))})
+    }));
+    
+    hdl::mc::Bmc bmc(module, {"property"});
+    std::optional<hdl::mc::Trace> trace = bmc.check(4);
+    assert(trace.has_value());
+    assert(trace->cycle == 1);
+    assert(trace->inputs[0][1] == hdl::BitString("11"));
+    assert(trace->inputs[0][2] == hdl::BitString("10101010"));
+    assert(trace->inputs[0][3] == hdl::BitString("1"));
+    assert(!replay(module, *trace));
+  });
+  
+  Test("Memory/Wrapped Address").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    
+    // Address 3 wraps around to address 0, as in hdl::sim::Simulation
+    hdl::Memory* memory = module.memory(8, 3);
+    memory->write(
+      clock,
+      module.constant(hdl::BitString("11")),
+      module.constant(hdl::BitString("1")),
+      module.constant(hdl::BitString("10101010"))
+    );
+    hdl::Value* value = memory->read(module.constant(hdl::BitString("00")));
+    module.output("property", module.op(Kind::Not, {
+      module.op(Kind::Eq, {value, module.constant(hdl::BitString("10101010"))})
+    }));
+    
+    hdl::mc::Bmc bmc(module, {"property"});
+    std::optional<hdl::mc::Trace> trace = bmc.check(4);
+    assert(trace.has_value());
+    assert(trace->cycle == 1);
+    assert(!replay(module, *trace));
+  });
+  
+  Test("Memory/Wide Address").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* address = module.input("address", 4);
+    hdl::Value* data = module.input("data", 8);
+    
+    hdl::Memory* memory = module.memory(8, 5);
+    memory->init(2, hdl::BitString("00000001"));
+    // Only addresses 8 to 15 are written, 12 wraps around to 2
+    hdl::Value* upper = module.op(Kind::Or, {address, module.constant(hdl::BitString("1000"))});
+    memory->write(clock, upper, module.constant(hdl::BitString("1")), data);
+    hdl::Value* value = memory->read(module.constant(hdl::BitString("0010")));
+    module.output("property", module.op(Kind::Not, {
+      module.op(Kind::Eq, {value, module.constant(hdl::BitString("10101010"))})
+    }));
+    
+    hdl::mc::Bmc bmc(module, {"property"});
+    std::optional<hdl::mc::Trace> trace = bmc.check(4);
+    assert(trace.has_value());
+    assert(trace->cycle == 1);
+    assert((trace->inputs[0][1].as_uint64() | 8) == 12);
+    assert(!replay(module, *trace));
+  });
+  
+  Test("Errors").run([](){
+    hdl::Module module("top");
+    module.output("wide", module.input("a", 2));
+    bool has_error = false;
+    try {
+      hdl::mc::Bmc bmc(module, {"wide"});
+    } catch (const hdl::Error& error) {
+      has_error = true;
+    }
+    assert(has_error);
+  });
+  
+  Test("Errors/Multiple Clocks").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Reg* a = module.reg(hdl::BitString("0"), module.input("c1", 1));
+    hdl::Reg* b = module.reg(hdl::BitString("0"), module.input("c2", 1));
+    a->next = module.op(Kind::Not, {a});
+    b->next = module.op(Kind::Not, {b});
+    module.output("property", module.op(Kind::Eq, {a, b}));
+    
+    size_t errors = 0;
+    try {
+      hdl::mc::Bmc bmc(module, {"property"});
+    } catch (const hdl::Error& error) {
+      errors++;
+    }
+    try {
+      hdl::mc::KInduction induction(module, {"property"});
+    } catch (const hdl::Error& error) {
+      errors++;
+    }
+    try {
+      hdl::mc::Ic3 ic3(module, {"property"});
+    } catch (const hdl::Error& error) {
+      errors++;
+    }
+    assert(errors == 3);
+  });
+  
+  Test("K-Induction").run([](){
+    hdl::Module module("top");
+    build_decimal_counter(module);
+    hdl::mc::KInduction induction(module, {"property"});
+    assert(induction.check(8) == hdl::mc::Status::Proven);
+    assert(induction.depth() == 3);
+  });
+  
+  Test("K-Induction/Simple Path").run([](){
+    hdl::Module module("top");
+    build_loop(module);
+    hdl::mc::KInduction induction(module, {"property"});
+    assert(induction.check(2) == hdl::mc::Status::Unknown);
+    assert(induction.check(8) == hdl::mc::Status::Proven);
+    assert(induction.depth() == 3);
+  });
+  
+  Test("K-Induction/Violated").run([](){
+    hdl::Module module("top");
+    build_decimal_counter(module);
+    hdl::mc::KInduction induction(module, {"property", "is_nine"});
+    assert(induction.check(16) == hdl::mc::Status::Violated);
+    assert(induction.trace().cycle == 9);
+    assert(induction.trace().property == 1);
+  });
+  
+  for (bool is_loop : {false, true}) {
+    Test(is_loop ? "IC3/Loop" : "IC3/Counter").run([&](){
+      hdl::Module module("top");
+      if (is_loop) {
+        build_loop(module);
+      } else {
+        build_decimal_counter(module);
+      }
+      hdl::mc::Ic3 ic3(module, {"property"});
+      assert(ic3.check(16) == hdl::mc::Status::Proven);
+      
+      // The invariant holds in all reachable states and is 1-inductive
+      module.output("invariant", ic3.invariant().build(module));
+      hdl::mc::Bmc bmc(module, {"invariant"});
+      assert(!bmc.check(16).has_value());
+      hdl::mc::KInduction induction(module, {"invariant"});
+      assert(induction.check(1) == hdl::mc::Status::Proven);
+    });
+  }
+  
+  Test("IC3/Lockstep").run([](){
+    // Requires enough strengthened queries that retired clauses are
+    // deleted from the solver several times
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* step = module.input("step", 1);
+    hdl::Value* increment = module.op(Kind::Concat, {module.constant(hdl::BitString(4)), step});
+    hdl::Reg* a = module.reg(hdl::BitString(5), clock);
+    hdl::Reg* b = module.reg(hdl::BitString(5), clock);
+    a->next = module.op(Kind::Add, {a, increment});
+    b->next = module.op(Kind::Add, {b, increment});
+    module.output("property", module.op(Kind::Eq, {a, b}));
+    
+    hdl::mc::Ic3 ic3(module, {"property"});
+    assert(ic3.check(64) == hdl::mc::Status::Proven);
+    module.output("invariant", ic3.invariant().build(module));
+    hdl::mc::KInduction induction(module, {"invariant"});
+    assert(induction.check(1) == hdl::mc::Status::Proven);
+  });
+  
+  Test("IC3/Violated").run([](){
+    hdl::Module module("top");
+    build_decimal_counter(module);
+    hdl::mc::Ic3 ic3(module, {"property", "is_nine"});
+    assert(ic3.check(32) == hdl::mc::Status::Violated);
+    assert(ic3.trace().cycle == 9);
+    assert(ic3.trace().inputs.size() == 10);
+    assert(ic3.trace().property == 1);
+  });
+  
+  return 0;
+}
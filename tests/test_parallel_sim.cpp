@@ -0,0 +1,147 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <sstream>
+#include <random>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_flatten.hpp"
+#include "../hdl_parallel_sim.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+template <size_t WORDS>
+void test_op(hdl::Op::Kind kind, const std::vector<size_t>& arg_widths) {
+  using ParallelSimulation = hdl::sim::ParallelSimulation<WORDS>;
+
+  std::ostringstream name;
+  name << "Op::Kind::" << kind << "/" << ParallelSimulation::LANES;
+  Test(name.str()).run([&](){
+    hdl::Module module("top");
+    hdl::flatten::Flattening flattening(module);
+
+    std::vector<hdl::Value*> args;
+    std::vector<std::vector<hdl::Value*>> args_bits;
+    for (size_t width : arg_widths) {
+      hdl::Value* arg = module.input("", width);
+      args.push_back(arg);
+      args_bits.push_back(flattening.split(arg));
+      flattening.define(arg, args_bits.back());
+    }
+
+    hdl::Value* op = module.op(kind, args);
+    flattening.flatten(op);
+
+    ParallelSimulation sim(module, flattening[op]);
+    std::mt19937_64 rng(0);
+    sim.randomize(rng);
+    sim.eval();
+
+    for (size_t lane = 0; lane < ParallelSimulation::LANES; lane++) {
+      std::vector<hdl::BitString> values;
+      for (const std::vector<hdl::Value*>& bits : args_bits) {
+        hdl::BitString value(bits.size());
+        for (size_t it = 0; it < bits.size(); it++) {
+          value.set(it, sim.has(bits[it]) && sim.at(bits[it], lane));
+        }
+        values.push_back(value);
+      }
+
+      hdl::BitString expected = hdl::dyn_cast<hdl::Op>(op)->eval(values);
+
+      const std::vector<hdl::Value*>& result = flattening[op];
+      for (size_t it = 0; it < result.size(); it++) {
+        assert(sim.at(result[it], lane) == expected[it]);
+      }
+    }
+  });
+}
+
+template <size_t WORDS>
+void test_ops() {
+  test_op<WORDS>(hdl::Op::Kind::And, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::Xor, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::Add, {16, 16});
+  test_op<WORDS>(hdl::Op::Kind::Sub, {16, 16});
+  test_op<WORDS>(hdl::Op::Kind::Mul, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::Eq, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::LtU, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::LtS, {8, 8});
+  test_op<WORDS>(hdl::Op::Kind::Shl, {8, 3});
+  test_op<WORDS>(hdl::Op::Kind::ShrS, {8, 3});
+  test_op<WORDS>(hdl::Op::Kind::Select, {1, 8, 8});
+}
+
+int main() {
+  test_ops<1>();
+  test_ops<4>();
+  test_ops<8>();
+
+  Test("Lanes Size").run([](){
+    assert(sizeof(hdl::sim::ParallelSimulation<1>::Lanes) == 8);
+    assert(sizeof(hdl::sim::ParallelSimulation<2>::Lanes) == 16);
+    assert(sizeof(hdl::sim::ParallelSimulation<4>::Lanes) == 32);
+    assert(alignof(hdl::sim::ParallelSimulation<4>::Lanes) == 32);
+    assert(sizeof(hdl::sim::ParallelSimulation<8>::Lanes) == 64);
+    assert(alignof(hdl::sim::ParallelSimulation<8>::Lanes) == 64);
+  });
+
+  Test("Registers").run([](){
+    using ParallelSimulation = hdl::sim::ParallelSimulation<4>;
+
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* enable = module.input("enable", 1);
+
+    // 3 bit counter which only counts when enable is set
+    hdl::Reg* a = module.reg(hdl::BitString("0"), clock);
+    hdl::Reg* b = module.reg(hdl::BitString("0"), clock);
+    hdl::Reg* c = module.reg(hdl::BitString("1"), clock);
+    a->next = module.op(hdl::Op::Kind::Xor, {a, enable});
+    hdl::Value* carry_a = module.op(hdl::Op::Kind::And, {a, enable});
+    b->next = module.op(hdl::Op::Kind::Xor, {b, carry_a});
+    hdl::Value* carry_b = module.op(hdl::Op::Kind::And, {b, carry_a});
+    c->next = module.op(hdl::Op::Kind::Xor, {c, carry_b});
+
+    ParallelSimulation sim(module, {a, b, c});
+    assert(sim.free().size() == 1);
+    assert(sim.free()[0] == enable);
+
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> counters(ParallelSimulation::LANES, 4);
+    for (size_t cycle = 0; cycle < 32; cycle++) {
+      sim.randomize(rng);
+      for (size_t lane = 0; lane < ParallelSimulation::LANES; lane++) {
+        if (sim.at(enable, lane)) {
+          counters[lane] = (counters[lane] + 1) % 8;
+        }
+      }
+      sim.step();
+      for (size_t lane = 0; lane < ParallelSimulation::LANES; lane++) {
+        uint64_t counter = uint64_t(sim.at(a, lane)) |
+                           uint64_t(sim.at(b, lane)) << 1 |
+                           uint64_t(sim.at(c, lane)) << 2;
+        assert(counter == counters[lane]);
+      }
+    }
+
+    sim.reset();
+    assert(!sim.at(a, 0) && !sim.at(b, 0) && sim.at(c, 0));
+  });
+
+  return 0;
+}
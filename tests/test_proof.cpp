@@ -0,0 +1,377 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <random>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_flatten.hpp"
+#include "../hdl_proof.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+using Cnf = hdl::proof::Cnf;
+using Solver = hdl::proof::Solver;
+
+// Places pigeons + 1 pigeons into pigeons holes
+Cnf pigeonhole(size_t pigeons) {
+  Cnf cnf;
+  std::vector<std::vector<Cnf::Literal>> vars(pigeons + 1);
+  for (auto& holes : vars) {
+    for (size_t hole = 0; hole < pigeons; hole++) {
+      holes.push_back(cnf.var());
+    }
+    cnf.add_clause(holes);
+  }
+  for (size_t hole = 0; hole < pigeons; hole++) {
+    for (size_t a = 0; a < vars.size(); a++) {
+      for (size_t b = a + 1; b < vars.size(); b++) {
+        cnf.add_clause({!vars[a][hole], !vars[b][hole]});
+      }
+    }
+  }
+  return cnf;
+}
+
+bool is_model(const std::vector<std::vector<Cnf::Literal>>& clauses, const Solver& solver) {
+  for (const auto& clause : clauses) {
+    bool is_sat = false;
+    for (Cnf::Literal lit : clause) {
+      is_sat = is_sat || solver.value(lit);
+    }
+    if (!is_sat) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  Test("Empty").run([](){
+    Cnf cnf;
+    cnf.var();
+    assert(Solver(cnf).solve() == Solver::Result::Sat);
+    cnf.add_clause({});
+    assert(Solver(cnf).solve() == Solver::Result::Unsat);
+  });
+  
+  Test("Units").run([](){
+    Cnf cnf;
+    Cnf::Literal a = cnf.var();
+    Cnf::Literal b = cnf.var();
+    cnf.add_clause({a});
+    cnf.add_clause({!a, b});
+    Solver solver(cnf);
+    assert(solver.solve() == Solver::Result::Sat);
+    assert(solver.value(a) && solver.value(b));
+    cnf.add_clause({!b});
+    assert(Solver(cnf).solve() == Solver::Result::Unsat);
+  });
+  
+  Test("Pigeonhole").run([](){
+    for (size_t pigeons = 1; pigeons <= 6; pigeons++) {
+      Solver solver(pigeonhole(pigeons));
+      assert(solver.solve() == Solver::Result::Unsat);
+    }
+    Solver solver(pigeonhole(8));
+    assert(solver.solve(10) == Solver::Result::Unknown);
+  });
+  
+  Test("Learnt Clause Reduction").run([](){
+    Solver solver(pigeonhole(7));
+    assert(solver.solve() == Solver::Result::Unsat);
+    // Without reduction, all 5640 learnt clauses would be kept
+    assert(solver.learnt_count() < 3000);
+    
+    // Pigeonhole problem which is only enabled under an assumption
+    Cnf cnf;
+    Cnf::Literal enable = cnf.var();
+    std::vector<std::vector<Cnf::Literal>> vars(8);
+    for (auto& holes : vars) {
+      for (size_t hole = 0; hole < 7; hole++) {
+        holes.push_back(cnf.var());
+      }
+      std::vector<Cnf::Literal> clause = holes;
+      clause.push_back(!enable);
+      cnf.add_clause(clause);
+    }
+    for (size_t hole = 0; hole < 7; hole++) {
+      for (size_t a = 0; a < vars.size(); a++) {
+        for (size_t b = a + 1; b < vars.size(); b++) {
+          cnf.add_clause({!vars[a][hole], !vars[b][hole]});
+        }
+      }
+    }
+    
+    Solver incremental(cnf);
+    for (size_t iter = 0; iter < 3; iter++) {
+      assert(incremental.solve({enable}) == Solver::Result::Unsat);
+      assert(incremental.failed_assumptions().size() == 1);
+      assert(incremental.solve() == Solver::Result::Sat);
+      assert(!incremental.value(enable));
+    }
+    
+    cnf.add_clause({enable});
+    incremental.sync(cnf);
+    assert(incremental.solve() == Solver::Result::Unsat);
+  });
+  
+  Test("Retired Clauses").run([](){
+    hdl::proof::CnfBuilder builder;
+    Cnf& cnf = builder.cnf();
+    Cnf::Literal x = cnf.var();
+    Cnf::Literal y = cnf.var();
+    cnf.add_clause({x, y});
+    for (size_t it = 0; it < 10; it++) {
+      // Temporarily forbid x and y being equal
+      Cnf::Literal activation = cnf.var();
+      cnf.add_clause({!activation, !x, !y});
+      cnf.add_clause({!activation, x, y});
+      assert(builder.solve({activation, x}) == Solver::Result::Sat);
+      assert(!builder.solver().value(y));
+      cnf.add_clause({!activation});
+    }
+    builder.simplify();
+    assert(builder.solver().clause_count() == 1);
+    assert(builder.solve({x, y}) == Solver::Result::Sat);
+  });
+  
+  Test("Random 3-SAT").run([](){
+    std::mt19937_64 rng(0);
+    size_t sat_count = 0;
+    for (size_t iter = 0; iter < 50; iter++) {
+      Cnf cnf;
+      std::vector<Cnf::Literal> vars;
+      for (size_t it = 0; it < 40; it++) {
+        vars.push_back(cnf.var());
+      }
+      std::vector<std::vector<Cnf::Literal>> clauses;
+      for (size_t it = 0; it < 170; it++) {
+        std::vector<Cnf::Literal> clause;
+        for (size_t lit = 0; lit < 3; lit++) {
+          Cnf::Literal var = vars[rng() % vars.size()];
+          clause.push_back(rng() % 2 ? var : !var);
+        }
+        cnf.add_clause(clause);
+        clauses.push_back(clause);
+      }
+      Solver solver(cnf);
+      if (solver.solve() == Solver::Result::Sat) {
+        assert(is_model(clauses, solver));
+        sat_count++;
+      }
+    }
+    assert(sat_count > 0 && sat_count < 50);
+  });
+  
+  Test("Model").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* product = module.op(Kind::Mul, {a, b});
+    
+    hdl::flatten::Flattening flattening(module);
+    flattening.define(a, flattening.split(a));
+    flattening.define(b, flattening.split(b));
+    flattening.flatten(product);
+    
+    // Factorize 143 without trivial factors
+    hdl::Value* one = module.constant(hdl::BitString("00000001"));
+    hdl::Value* nontrivial = module.op(Kind::And, {
+      module.op(Kind::LtU, {one, a}),
+      module.op(Kind::LtU, {one, b})
+    });
+    flattening.flatten(nontrivial);
+    
+    hdl::proof::CnfBuilder builder;
+    builder.free(flattening[a]);
+    builder.free(flattening[b]);
+    builder.require(flattening[product], hdl::BitString("0000000010001111"));
+    builder.require(flattening[nontrivial], hdl::BitString("1"));
+    
+    Solver solver(builder.cnf());
+    assert(solver.solve() == Solver::Result::Sat);
+    uint64_t value_a = builder.model(solver, flattening[a]).as_uint64();
+    uint64_t value_b = builder.model(solver, flattening[b]).as_uint64();
+    assert(value_a * value_b == 143);
+    assert(value_a == 11 || value_a == 13);
+  });
+  
+  Test("Equivalence").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 16);
+    hdl::Value* b = module.input("b", 16);
+    hdl::Value* eq = module.op(Kind::Eq, {
+      module.op(Kind::Add, {a, b}),
+      module.op(Kind::Sub, {a, module.op(Kind::Sub, {module.constant(hdl::BitString(16)), b})})
+    });
+    
+    hdl::flatten::Flattening flattening(module);
+    flattening.define(a, flattening.split(a));
+    flattening.define(b, flattening.split(b));
+    flattening.flatten(eq);
+    
+    hdl::proof::CnfBuilder builder;
+    builder.free(flattening[a]);
+    builder.free(flattening[b]);
+    builder.require(flattening[eq], hdl::BitString("0"));
+    assert(Solver(builder.cnf()).solve() == Solver::Result::Unsat);
+  });
+  
+  Test("Multiple Modules").run([](){
+    // Values of different modules may share IDs
+    hdl::Module module_a("a");
+    hdl::Module module_b("b");
+    hdl::Value* a = module_a.input("a", 1);
+    hdl::Value* b = module_b.input("b", 1);
+    
+    hdl::proof::CnfBuilder builder;
+    builder.free(a);
+    builder.free(b);
+    assert(builder[a].id != builder[b].id);
+    assert(builder.solve({builder[a], !builder[b]}) == Solver::Result::Sat);
+  });
+  
+  Test("Assumptions").run([](){
+    Cnf cnf;
+    Cnf::Literal x = cnf.var();
+    Cnf::Literal y = cnf.var();
+    Cnf::Literal z = cnf.var();
+    Cnf::Literal unrelated = cnf.var();
+    cnf.add_clause({!x, y});
+    cnf.add_clause({!y, z});
+    
+    Solver solver(cnf);
+    assert(solver.solve({unrelated, x, !z}) == Solver::Result::Unsat);
+    const std::vector<Cnf::Literal>& failed = solver.failed_assumptions();
+    assert(failed.size() == 2);
+    for (Cnf::Literal lit : failed) {
+      assert(lit.id == x.id || lit.id == (!z).id);
+    }
+    
+    assert(solver.solve({x}) == Solver::Result::Sat);
+    assert(solver.value(y) && solver.value(z));
+    assert(solver.solve({!z}) == Solver::Result::Sat);
+    assert(!solver.value(x));
+    
+    cnf.add_clause({!z});
+    solver.sync(cnf);
+    assert(solver.solve({x}) == Solver::Result::Unsat);
+    assert(solver.solve() == Solver::Result::Sat);
+    assert(!solver.value(x) && !solver.value(y));
+  });
+  
+  Test("Incremental").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* sum = module.op(Kind::Add, {a, b});
+    
+    hdl::flatten::Flattening flattening(module);
+    flattening.define(a, flattening.split(a));
+    flattening.define(b, flattening.split(b));
+    flattening.flatten(sum);
+    
+    hdl::proof::CnfBuilder builder;
+    builder.free(flattening[a]);
+    builder.free(flattening[b]);
+    for (uint64_t value = 0; value < 256; value += 15) {
+      hdl::BitString expected = hdl::BitString::from_uint(uint8_t(value));
+      std::vector<Cnf::Literal> assumptions = builder.assumptions(flattening[sum], expected);
+      std::vector<Cnf::Literal> a_is_b = builder.assumptions(flattening[a], hdl::BitString::from_uint(uint8_t(value / 2)));
+      
+      assert(builder.solve(assumptions) == Solver::Result::Sat);
+      assert(builder.model(flattening[sum]) == expected);
+      
+      // a = b = value / 2 only sums to value if value is even
+      assumptions.insert(assumptions.end(), a_is_b.begin(), a_is_b.end());
+      std::vector<Cnf::Literal> b_is_a = builder.assumptions(flattening[b], hdl::BitString::from_uint(uint8_t(value / 2)));
+      assumptions.insert(assumptions.end(), b_is_a.begin(), b_is_a.end());
+      Solver::Result result = builder.solve(assumptions);
+      assert(result == (value % 2 == 0 ? Solver::Result::Sat : Solver::Result::Unsat));
+      if (result == Solver::Result::Unsat) {
+        assert(builder.failed_assumptions().size() > 0);
+        assert(builder.failed_assumptions().size() <= assumptions.size());
+      }
+    }
+  });
+  
+  Test("Simplify").run([](){
+    std::mt19937_64 rng(1);
+    for (size_t iter = 0; iter < 100; iter++) {
+      Cnf cnf;
+      std::vector<Cnf::Literal> vars;
+      for (size_t it = 0; it < 30; it++) {
+        vars.push_back(cnf.var());
+      }
+      std::vector<std::vector<Cnf::Literal>> clauses;
+      for (size_t it = 0; it < 120; it++) {
+        std::vector<Cnf::Literal> clause;
+        size_t size = 1 + rng() % 4;
+        for (size_t lit = 0; lit < size; lit++) {
+          Cnf::Literal var = vars[rng() % vars.size()];
+          clause.push_back(rng() % 2 ? var : !var);
+        }
+        cnf.add_clause(clause);
+        clauses.push_back(clause);
+      }
+      
+      Cnf::Reconstruction reconstruction;
+      Cnf simplified = cnf.simplify(reconstruction);
+      assert(simplified.size() <= cnf.size());
+      
+      Solver solver(simplified);
+      Solver::Result result = solver.solve();
+      assert(result == Solver(cnf).solve());
+      if (result == Solver::Result::Sat) {
+        std::vector<bool> model = reconstruction.model(solver.model());
+        for (const auto& clause : clauses) {
+          bool is_sat = false;
+          for (Cnf::Literal lit : clause) {
+            is_sat = is_sat || model[lit.var()] == lit.is_positive();
+          }
+          assert(is_sat);
+        }
+      }
+    }
+  });
+  
+  Test("Simplify Unsat").run([](){
+    Cnf cnf;
+    Cnf::Literal a = cnf.var();
+    Cnf::Literal b = cnf.var();
+    Cnf::Literal c = cnf.var();
+    Cnf::Literal d = cnf.var();
+    for (Cnf::Literal x : {a, b, c, d}) {
+      for (Cnf::Literal y : {a, b, c, d}) {
+        if (x.id < y.id) {
+          cnf.add_clause({x, y});
+          cnf.add_clause({!x, !y});
+          // Subsumed by the clause above
+          cnf.add_clause({x, y, !a});
+        }
+      }
+    }
+    Cnf simplified = cnf.simplify();
+    assert(simplified.clause_count() == 1);
+    assert(simplified.size() == 0);
+  });
+  
+  return 0;
+}
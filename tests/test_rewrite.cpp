@@ -0,0 +1,185 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_rewrite.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+int main() {
+  using Kind = hdl::Op::Kind;
+  using RuleSet = hdl::rewrite::RuleSet;
+  
+  Test("De Morgan").run([](){
+    RuleSet rules;
+    rules.read("(And (Not a) (Not b)) => (Not (Or a b))");
+    assert(rules.size() == 1);
+    
+    hdl::Module module("top");
+    module.set_rewriter(&rules);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* result = module.op(Kind::And, {
+      module.op(Kind::Not, {a}),
+      module.op(Kind::Not, {b})
+    });
+    assert(result == module.op(Kind::Not, {module.op(Kind::Or, {a, b})}));
+  });
+  
+  Test("Commutative").run([](){
+    RuleSet rules;
+    rules.read("(Add (Sub a b) b) => a");
+    
+    hdl::Module module("top");
+    module.set_rewriter(&rules);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    hdl::Value* diff = module.op(Kind::Sub, {a, b});
+    assert(module.op(Kind::Add, {diff, b}) == a);
+    assert(module.op(Kind::Add, {b, diff}) == a);
+    assert(hdl::isa<hdl::Op>(module.op(Kind::Add, {diff, a})));
+  });
+  
+  Test("Constants").run([](){
+    RuleSet rules;
+    rules.read(
+      "(Eq (Concat x y) 8'b0) => (And (Eq x 4'b0) (Eq y 4'b0))\n"
+      "(And (Match 8'b0xxxxxxx c) (ShrU a 8'h1)) => (ShrU a 8'h1)\n"
+      "(Shl (Shl a (Match 8'bxxxxxxxx m)) m) => (Shl a (Add m m))\n"
+    );
+    assert(rules.size() == 3);
+    
+    hdl::Module module("top");
+    module.set_rewriter(&rules);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* x = module.input("x", 4);
+    hdl::Value* y = module.input("y", 4);
+    
+    hdl::Value* eq = module.op(Kind::Eq, {
+      module.op(Kind::Concat, {x, y}),
+      module.constant(hdl::BitString("00000000"))
+    });
+    hdl::Op* eq_op = hdl::dyn_cast<hdl::Op>(eq);
+    assert(eq_op != nullptr && eq_op->kind == Kind::And);
+    
+    hdl::Value* shifted = module.op(Kind::ShrU, {a, module.constant(hdl::BitString("00000001"))});
+    assert(module.op(Kind::And, {module.constant(hdl::BitString("01111111")), shifted}) == shifted);
+    assert(module.op(Kind::And, {module.constant(hdl::BitString("11111110")), shifted}) != shifted);
+    
+    hdl::Value* two = module.constant(hdl::BitString("00000010"));
+    hdl::Value* three = module.constant(hdl::BitString("00000011"));
+    hdl::Value* shl = module.op(Kind::Shl, {module.op(Kind::Shl, {a, two}), two});
+    assert(shl == module.op(Kind::Shl, {a, module.constant(hdl::BitString("00000100"))}));
+    shl = module.op(Kind::Shl, {module.op(Kind::Shl, {a, two}), three});
+    assert(hdl::dyn_cast<hdl::Op>(shl)->args[1] == three);
+  });
+  
+  Test("Priority").run([](){
+    RuleSet rules;
+    rules.read(
+      "(Xor (Not a) b) => (Not (Xor a b))\n"
+      "(Xor a a) => a\n"
+      "(Xor (Not _) _) => 1'b1\n"
+    );
+    
+    hdl::Module module("top");
+    module.set_rewriter(&rules);
+    hdl::Value* a = module.input("a", 1);
+    hdl::Value* b = module.input("b", 1);
+    hdl::Value* result = module.op(Kind::Xor, {module.op(Kind::Not, {a}), b});
+    assert(result == module.op(Kind::Not, {module.op(Kind::Xor, {a, b})}));
+  });
+  
+  Test("Existing Nodes").run([](){
+    RuleSet rules;
+    rules.read("(Or a (Not a)) => 1'b1");
+    
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 1);
+    hdl::Value* before = module.op(Kind::Or, {a, module.op(Kind::Not, {a})});
+    assert(hdl::isa<hdl::Op>(before));
+    
+    module.set_rewriter(&rules);
+    assert(module.op(Kind::Or, {a, module.op(Kind::Not, {a})}) == before);
+    
+    hdl::Value* b = module.input("b", 1);
+    assert(hdl::isa<hdl::Constant>(module.op(Kind::Or, {module.op(Kind::Not, {b}), b})));
+  });
+  
+  Test("Errors").run([](){
+    auto fails = [](const std::string& source){
+      try {
+        RuleSet rules;
+        rules.read(source);
+      } catch (const hdl::Error& error) {
+        return true;
+      }
+      return false;
+    };
+    
+    assert(fails("(And a b)"));
+    assert(fails("(And a b) => c"));
+    assert(fails("(And a) => a"));
+    assert(fails("(Foo a b) => a"));
+    assert(fails("a => a"));
+    assert(fails("(And a b) => (Match 1'b1 a)"));
+    assert(fails("(And a b) => 1'bx"));
+  });
+  
+  Test("Widths").run([](){
+    RuleSet rules;
+    rules.read(
+      "(Or a (Not a)) => 1'b1\n"
+      "(Eq (Concat x y) 8'b0) => (And (Eq x 4'b0) (Eq y 4'b0))\n"
+      "(Xor a (Slice b o w)) => (Concat a a)\n"
+      "(Xor a (Slice b (Match 8'bxxxxxxxx o) (Match 8'bxxxxxxxx w))) => (Slice b o w)\n"
+      "(Not (Slice b o w)) => (Slice b (Add o w) w)\n"
+    );
+    
+    hdl::Module module("top");
+    module.set_rewriter(&rules);
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* or_op = module.op(Kind::Or, {a, module.op(Kind::Not, {a})});
+    assert(hdl::isa<hdl::Op>(or_op));
+    assert(hdl::dyn_cast<hdl::Op>(or_op)->kind == Kind::Or);
+    
+    // x is not 4 bits wide
+    hdl::Value* x = module.input("x", 2);
+    hdl::Value* y = module.input("y", 6);
+    hdl::Value* eq = module.op(Kind::Eq, {
+      module.op(Kind::Concat, {x, y}),
+      module.constant(hdl::BitString("00000000"))
+    });
+    assert(hdl::dyn_cast<hdl::Op>(eq)->kind == Kind::Eq);
+    
+    // The first rule which fits is used
+    hdl::Value* b = module.input("b", 16);
+    hdl::Value* slice = module.op(Kind::Slice, {
+      b,
+      module.constant(hdl::BitString::from_uint(uint8_t(4))),
+      module.constant(hdl::BitString::from_uint(uint8_t(8)))
+    });
+    assert(module.op(Kind::Xor, {a, slice}) == slice);
+    
+    // Slices are only built with constant bounds within the sliced value
+    hdl::Value* not_op = module.op(Kind::Not, {slice});
+    assert(hdl::dyn_cast<hdl::Op>(not_op)->kind == Kind::Not);
+  });
+  
+  return 0;
+}
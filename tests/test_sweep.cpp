@@ -0,0 +1,306 @@
+// Copyright 2023 Can Joshua Lehmann
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+
+#include "../../unittest.cpp/unittest.hpp"
+#include "../hdl.hpp"
+#include "../hdl_flatten.hpp"
+#include "../hdl_sweep.hpp"
+
+using Test = unittest::Test;
+#define assert(cond) unittest_assert(cond)
+
+// Counter which increments every cycle, together with registers which
+// only hold constants and copies of the counter.
+void build_counter(hdl::Module& module) {
+  using Kind = hdl::Op::Kind;
+  
+  hdl::Value* clock = module.input("clock", 1);
+  hdl::Value* data = module.input("data", 8);
+  hdl::Value* one = module.constant(hdl::BitString("00000001"));
+  
+  hdl::Reg* counter = module.reg(hdl::BitString("00000000"), clock);
+  counter->name = "counter";
+  counter->next = module.op(Kind::Add, {counter, one});
+  
+  hdl::Reg* copy = module.reg(hdl::BitString("00000000"), clock);
+  copy->name = "copy";
+  copy->next = module.op(Kind::Add, {copy, one});
+  
+  // Only ever reproduces its initial value
+  hdl::Reg* stuck = module.reg(hdl::BitString("0000"), clock);
+  stuck->name = "stuck";
+  stuck->next = module.op(Kind::And, {stuck, module.op(Kind::Slice, {
+    data,
+    module.constant(hdl::BitString::from_uint(0)),
+    module.constant(hdl::BitString::from_uint(4))
+  })});
+  
+  // Enable is always false, so the memory is never written
+  hdl::Memory* memory = module.memory(8, 4);
+  memory->initial[1] = hdl::BitString("10101010");
+  hdl::Reg* enable = module.reg(hdl::BitString("0"), clock);
+  enable->next = module.op(Kind::Or, {enable, module.op(Kind::Eq, {stuck, module.constant(hdl::BitString("1111"))})});
+  memory->write(clock, module.op(Kind::Slice, {
+    counter,
+    module.constant(hdl::BitString::from_uint(0)),
+    module.constant(hdl::BitString::from_uint(2))
+  }), enable, data);
+  
+  // Not observable
+  hdl::Reg* unused = module.reg(hdl::BitString("0"), clock);
+  unused->next = module.op(Kind::Not, {unused});
+  
+  module.output("sum", module.op(Kind::Add, {counter, copy}));
+  module.output("stuck", stuck);
+  module.output("read", memory->read(module.op(Kind::Slice, {
+    module.op(Kind::Concat, {stuck, stuck}),
+    module.constant(hdl::BitString::from_uint(0)),
+    module.constant(hdl::BitString::from_uint(2))
+  })));
+}
+
+int main() {
+  using Kind = hdl::Op::Kind;
+  using RegisterSweep = hdl::sweep::RegisterSweep;
+  
+  Test("Constant Registers").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* data = module.input("data", 4);
+    
+    // Toggles between two values, so it is not constant
+    hdl::Reg* toggle = module.reg(hdl::BitString("01"), clock);
+    toggle->next = module.op(Kind::Not, {toggle});
+    
+    // Bits 1 and 2 are constant, bit 0 follows data
+    hdl::Reg* partial = module.reg(hdl::BitString("0100"), clock);
+    partial->next = module.op(Kind::Concat, {
+      module.constant(hdl::BitString("010")),
+      module.op(Kind::Slice, {data, module.constant(hdl::BitString::from_uint(0)), module.constant(hdl::BitString::from_uint(1))})
+    });
+    
+    // Constant, since the condition only depends on a constant bit of partial
+    hdl::Reg* constant = module.reg(hdl::BitString("11"), clock);
+    constant->next = module.op(Kind::Select, {
+      module.op(Kind::Slice, {partial, module.constant(hdl::BitString::from_uint(2)), module.constant(hdl::BitString::from_uint(1))}),
+      constant,
+      toggle
+    });
+    
+    module.output("toggle", toggle);
+    module.output("partial", partial);
+    module.output("constant", constant);
+    
+    RegisterSweep::Stats stats = RegisterSweep(module).run();
+    assert(stats.constant_regs == 1);
+    assert(module.regs().size() == 2);
+    hdl::Constant* output = hdl::dyn_cast<hdl::Constant>(module.outputs()[2].value);
+    assert(output != nullptr);
+    assert(output->value == hdl::BitString("11"));
+  });
+  
+  Test("Constant Registers/Wide Shift").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* data = module.input("data", 4);
+    
+    // Shifting by at least the width always produces zero
+    hdl::Reg* shifted = module.reg(hdl::BitString("0000"), clock);
+    shifted->next = module.op(Kind::Shl, {
+      module.op(Kind::Xor, {shifted, data}),
+      module.constant(hdl::BitString("101"))
+    });
+    module.output("shifted", shifted);
+    
+    RegisterSweep::Stats stats = RegisterSweep(module).run();
+    assert(stats.constant_regs == 1);
+    assert(module.outputs()[0].value == module.constant(hdl::BitString("0000")));
+  });
+  
+  Test("Constant Registers/Reconvergent").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* data = module.input("data", 4);
+    
+    hdl::Reg* constant = module.reg(hdl::BitString("0101"), clock);
+    hdl::Value* value = constant;
+    for (size_t it = 0; it < 64; it++) {
+      value = module.op(Kind::Xor, {
+        module.op(Kind::And, {value, data}),
+        module.op(Kind::Or, {value, data})
+      });
+    }
+    module.output("value", value);
+    
+    size_t id_count = module.id_count();
+    RegisterSweep::Stats stats = RegisterSweep(module).run();
+    assert(stats.constant_regs == 1);
+    assert(module.id_count() <= id_count + 3 * 64 + 1);
+  });
+  
+  Test("Equivalent Registers").run([](){
+    hdl::Module module("top");
+    hdl::Value* clock = module.input("clock", 1);
+    hdl::Value* other_clock = module.input("other_clock", 1);
+    hdl::Value* data = module.input("data", 1);
+    
+    // a and b only depend on each other, c has a different clock
+    hdl::Reg* a = module.reg(hdl::BitString("0"), clock);
+    hdl::Reg* b = module.reg(hdl::BitString("0"), clock);
+    hdl::Reg* c = module.reg(hdl::BitString("0"), other_clock);
+    hdl::Reg* d = module.reg(hdl::BitString("1"), clock);
+    a->next = module.op(Kind::Xor, {b, data});
+    b->next = module.op(Kind::Xor, {a, data});
+    c->next = module.op(Kind::Xor, {a, data});
+    d->next = module.op(Kind::Xor, {a, data});
+    
+    module.output("a", a);
+    module.output("b", b);
+    module.output("c", c);
+    module.output("d", d);
+    
+    RegisterSweep::Stats stats = RegisterSweep(module).run();
+    assert(stats.merged_regs == 1);
+    assert(module.regs().size() == 3);
+    assert(module.outputs()[0].value == module.outputs()[1].value);
+  });
+  
+  Test("Simulation").run([](){
+    hdl::Module module("top");
+    hdl::Module swept("top");
+    build_counter(module);
+    build_counter(swept);
+    
+    RegisterSweep::Stats stats = RegisterSweep(swept).run();
+    assert(stats.constant_regs == 2);
+    assert(stats.merged_regs == 1);
+    assert(stats.constant_reads == 1);
+    assert(stats.removed_writes == 1);
+    assert(swept.regs().size() == 1);
+    assert(swept.memories().size() == 0);
+    
+    hdl::sim::Simulation sim(module);
+    hdl::sim::Simulation sim_swept(swept);
+    bool clock = false;
+    for (size_t iter = 0; iter < 64; iter++) {
+      std::vector<hdl::BitString> inputs = {
+        hdl::BitString::from_bool(clock),
+        hdl::BitString::random(8)
+      };
+      sim.update(inputs);
+      sim_swept.update(inputs);
+      assert(sim.outputs() == sim_swept.outputs());
+      clock = !clock;
+    }
+  });
+  
+  Test("Fraig").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 1);
+    hdl::Value* b = module.input("b", 1);
+    hdl::Value* c = module.input("c", 1);
+    
+    module.output("maj", module.op(Kind::Or, {
+      module.op(Kind::And, {a, b}),
+      module.op(Kind::And, {c, module.op(Kind::Or, {a, b})})
+    }));
+    module.output("maj2", module.op(Kind::Or, {
+      module.op(Kind::Or, {
+        module.op(Kind::And, {a, b}),
+        module.op(Kind::And, {a, c})
+      }),
+      module.op(Kind::And, {b, c})
+    }));
+    module.output("xor", module.op(Kind::Xor, {a, b}));
+    module.output("xnor", module.op(Kind::Or, {
+      module.op(Kind::And, {a, b}),
+      module.op(Kind::And, {
+        module.op(Kind::Not, {a}),
+        module.op(Kind::Not, {b})
+      })
+    }));
+    module.output("and", module.op(Kind::And, {a, c}));
+    
+    hdl::sweep::Fraig::Stats stats = hdl::sweep::Fraig(module).run();
+    assert(stats.merged >= 2);
+    
+    const std::vector<hdl::Output>& outputs = module.outputs();
+    assert(outputs[0].value == outputs[1].value);
+    assert(outputs[3].value == module.op(Kind::Not, {outputs[2].value}));
+    assert(outputs[4].value != outputs[0].value);
+  });
+  
+  Test("Fraig/Clocks").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::Value* a = module.input("a", 1);
+    hdl::Value* b = module.input("b", 1);
+    hdl::Value* data = module.input("data", 1);
+    
+    hdl::Value* both = module.op(Kind::And, {a, b});
+    hdl::Value* clock = module.op(Kind::Not, {
+      module.op(Kind::Or, {module.op(Kind::Not, {a}), module.op(Kind::Not, {b})})
+    });
+    hdl::Reg* reg = module.reg(hdl::BitString("0"), clock);
+    reg->next = data;
+    hdl::Memory* memory = module.memory(1, 2);
+    memory->write(clock, data, module.constant(hdl::BitString("1")), data);
+    module.output("both", both);
+    module.output("reg", reg);
+    module.output("read", memory->read(a));
+    
+    assert(clock != both);
+    hdl::sweep::Fraig(module).run();
+    assert(reg->clock == both);
+    assert(memory->writes[0].clock == both);
+  });
+  
+  Test("Fraig Adder").run([](){
+    using Kind = hdl::Op::Kind;
+    hdl::Module module("top");
+    hdl::flatten::Flattening flattening(module);
+    
+    hdl::Value* a = module.input("a", 8);
+    hdl::Value* b = module.input("b", 8);
+    flattening.define(a, flattening.split(a));
+    flattening.define(b, flattening.split(b));
+    
+    hdl::Value* zero = module.constant(hdl::BitString(8));
+    hdl::Value* sum = module.op(Kind::Add, {a, b});
+    hdl::Value* sum2 = module.op(Kind::Sub, {a, module.op(Kind::Sub, {zero, b})});
+    flattening.flatten(sum);
+    flattening.flatten(sum2);
+    for (hdl::Value* bit : flattening[sum]) {
+      module.output("sum", bit);
+    }
+    for (hdl::Value* bit : flattening[sum2]) {
+      module.output("sum2", bit);
+    }
+    
+    hdl::sweep::Fraig fraig(module);
+    fraig.max_conflicts = 100000;
+    hdl::sweep::Fraig::Stats stats = fraig.run();
+    assert(stats.unknown == 0);
+    
+    const std::vector<hdl::Output>& outputs = module.outputs();
+    for (size_t it = 0; it < 8; it++) {
+      assert(outputs[it].value == outputs[it + 8].value);
+    }
+  });
+  
+  return 0;
+}